@@ -0,0 +1,111 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#include "aabbbvh.h"
+#include "aabbtree.h"
+#include "unittest.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+template <typename T, typename U, typename V>
+static bool QueryEqual(const T & tree, const U & bvh, const V & shape)
+{
+	std::vector<int> a, b;
+	tree.Query(shape, a);
+	bvh.Query(shape, b);
+	std::sort(a.begin(), a.end());
+	std::sort(b.begin(), b.end());
+	return a == b;
+}
+
+// box of half extent size around center with planes tilted by tilt, facing inwards
+static Frustum TiltedBoxFrustum(const Vec3 & center, float size, float tilt)
+{
+	Frustum frustum;
+	for (int k = 0; k < 3; ++k)
+	{
+		Vec3 n0, n1;
+		n0[k] = 1;
+		n0[(k + 1) % 3] = tilt;
+		n1[k] = -1;
+		n1[(k + 2) % 3] = tilt;
+		n0 = n0.Normalize();
+		n1 = n1.Normalize();
+		for (int i = 0; i < 3; ++i)
+		{
+			frustum.frustum[2 * k][i] = n0[i];
+			frustum.frustum[2 * k + 1][i] = n1[i];
+		}
+		frustum.frustum[2 * k][3] = size - n0.dot(center);
+		frustum.frustum[2 * k + 1][3] = size - n1.dot(center);
+	}
+	return frustum;
+}
+
+QT_TEST(aabb_bvh_test)
+{
+	AabbBvh <int, 4> bvh;
+	QT_CHECK_EQUAL(bvh.size(), 0);
+	QT_CHECK(bvh.Empty());
+
+	// leaf size used by the renderer drawable containers
+	AabbBvh <int, 8> bvh8;
+
+	// compare against the reference tree on a random set of boxes
+	AabbTreeNode <int> tree;
+	srand(42);
+	for (int i = 0; i < 1000; ++i)
+	{
+		Vec3 center(rand() % 1000, rand() % 1000, rand() % 100);
+		float radius = 1 + rand() % 10;
+		Aabb <float> box;
+		box.SetFromSphere(center, radius);
+		tree.Add(i, box);
+		bvh.Add(i, box);
+		bvh8.Add(i, box);
+	}
+	tree.Optimize();
+	bvh.Optimize();
+	bvh8.Optimize();
+	QT_CHECK_EQUAL(bvh.size(), 1000);
+
+	std::vector<int> all;
+	bvh.Query(Aabb<float>::IntersectAlways(), all);
+	QT_CHECK_EQUAL(all.size(), 1000);
+
+	for (int i = 0; i < 100; ++i)
+	{
+		Vec3 orig(rand() % 1000, rand() % 1000, 200);
+		Vec3 dir(0, 0, -1);
+		QT_CHECK(QueryEqual(tree, bvh, Aabb<float>::Ray(orig, dir, 300)));
+
+		Vec3 c1(rand() % 1000, rand() % 1000, rand() % 100);
+		Vec3 c2 = c1 + Vec3(50, 50, 50);
+		QT_CHECK(QueryEqual(tree, bvh, Aabb<float>(c1, c2)));
+
+		// from thin slices partially overlapping leaf bounds to most of the set
+		Vec3 c(rand() % 1000, rand() % 1000, rand() % 100);
+		float size = 1 + rand() % 300;
+		float tilt = (rand() % 100) * 0.01f;
+		Frustum frustum = TiltedBoxFrustum(c, size, tilt);
+		QT_CHECK(QueryEqual(tree, bvh, frustum));
+		QT_CHECK(QueryEqual(tree, bvh8, frustum));
+	}
+}
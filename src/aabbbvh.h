@@ -0,0 +1,187 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef _AABBBVH_H
+#define _AABBBVH_H
+
+#include "aabb.h"
+#include "mathvector.h"
+
+#include <vector>
+#include <algorithm>
+
+/// Bounding volume hierarchy stored as a flat node array in depth first order.
+/// Every node references a contiguous range of objects covering its subtree,
+/// so a fully contained node is emitted without visiting its children.
+/// Traversal is stackless, a rejected node jumps to its skip index.
+template <typename DataType, unsigned int leaf_size = 1>
+class AabbBvh
+{
+public:
+	void Add(const DataType & object, const Aabb <float> & newaabb)
+	{
+		objects.push_back(Object(object, newaabb));
+		nodes.clear();
+	}
+
+	/// build the hierarchy, has to be called after adding objects
+	void Optimize()
+	{
+		nodes.clear();
+		if (objects.empty())
+			return;
+
+		nodes.reserve(2 * (objects.size() / leaf_size + 1));
+		Build(0, objects.size());
+	}
+
+	///run a query for objects that collide with the given shape
+	template <typename T, typename U>
+	void Query(const T & shape, U & outputlist) const
+	{
+		if (nodes.empty())
+		{
+			// not optimized, test all objects
+			for (typename objectlist_type::const_iterator i = objects.begin(); i != objects.end(); ++i)
+			{
+				if (i->box.Intersect(shape) != Aabb<float>::OUT)
+					outputlist.push_back(i->data);
+			}
+			return;
+		}
+
+		unsigned int n = 0;
+		while (n < nodes.size())
+		{
+			const Node & node = nodes[n];
+			const Aabb<float>::IntersectionEnum intersection = node.box.Intersect(shape);
+			if (intersection == Aabb<float>::OUT)
+			{
+				n = node.skip;
+				continue;
+			}
+
+			if (intersection == Aabb<float>::IN || node.skip == n + 1)
+			{
+				// fully in or leaf node, objects only need testing if partially intersecting
+				// a single object leaf has the same box as the node, no need to test it again
+				const bool test = (intersection != Aabb<float>::IN && node.count > 1);
+				const unsigned int end = node.first + node.count;
+				for (unsigned int i = node.first; i < end; ++i)
+				{
+					if (!test || objects[i].box.Intersect(shape) != Aabb<float>::OUT)
+						outputlist.push_back(objects[i].data);
+				}
+				n = node.skip;
+				continue;
+			}
+
+			// partially intersecting inner node, descend
+			++n;
+		}
+	}
+
+	unsigned int size() const {return objects.size();}
+
+	bool Empty() const {return objects.empty();}
+
+	void Clear() {objects.clear(); nodes.clear();}
+
+private:
+	struct Object
+	{
+		DataType data;
+		Aabb <float> box;
+
+		Object(const DataType & data, const Aabb <float> & box) : data(data), box(box) {}
+	};
+
+	struct Node
+	{
+		Aabb <float> box;
+		unsigned int first; ///< first object of the subtree
+		unsigned int count; ///< number of objects in the subtree
+		unsigned int skip; ///< index of the next node after the subtree
+	};
+
+	struct CenterLess
+	{
+		int axis;
+
+		CenterLess(int axis) : axis(axis) {}
+
+		bool operator()(const Object & a, const Object & b) const
+		{
+			return a.box.GetCenter()[axis] < b.box.GetCenter()[axis];
+		}
+	};
+
+	typedef std::vector <Object> objectlist_type;
+	objectlist_type objects;
+	std::vector <Node> nodes;
+
+	///recursively build the subtree for objects [first, first + count), median split along the largest center axis
+	void Build(const unsigned int first, const unsigned int count)
+	{
+		const unsigned int index = nodes.size();
+		nodes.push_back(Node());
+
+		const unsigned int end = first + count;
+		Aabb <float> box = objects[first].box;
+		Vec3 cmin = objects[first].box.GetCenter();
+		Vec3 cmax = cmin;
+		for (unsigned int i = first + 1; i < end; ++i)
+		{
+			const Vec3 & c = objects[i].box.GetCenter();
+			for (int j = 0; j < 3; ++j)
+			{
+				cmin[j] = std::min(cmin[j], c[j]);
+				cmax[j] = std::max(cmax[j], c[j]);
+			}
+			box.CombineWith(objects[i].box);
+		}
+
+		if (count > leaf_size)
+		{
+			const Vec3 extent = cmax - cmin;
+			int axis = 0;
+			if (extent[1] > extent[axis]) axis = 1;
+			if (extent[2] > extent[axis]) axis = 2;
+
+			const unsigned int mid = first + count / 2;
+			std::nth_element(
+				objects.begin() + first,
+				objects.begin() + mid,
+				objects.begin() + end,
+				CenterLess(axis));
+
+			Build(first, mid - first);
+			Build(mid, end - mid);
+		}
+
+		// nodes may have been reallocated by the children
+		Node & node = nodes[index];
+		node.box = box;
+		node.first = first;
+		node.count = count;
+		node.skip = nodes.size();
+	}
+};
+
+#endif // _AABBBVH_H
@@ -18,6 +18,7 @@
 /************************************************************************/
 
 #include "ai.h"
+#include "jobsystem.h"
 #include <cassert>
 // AI implementations:
 #include "ai_car_standard.h"
@@ -25,7 +26,11 @@
 
 const std::string Ai::default_type = "aistd";
 
-Ai::Ai() : empty_input(CarInput::INVALID, 0.0)
+Ai::Ai() :
+	empty_input(CarInput::INVALID, 0.0),
+	update_cars(0),
+	update_cars_num(0),
+	update_dt(0)
 {
 	AddFactory("aistd", new AiCarStandardFactory());
 	AddFactory("aiexp", new AiCarExperimentalFactory());
@@ -82,10 +87,19 @@ void Ai::ClearCars()
 
 void Ai::Update(float dt, const CarDynamics cars[], const int cars_num)
 {
-	int size = ai_cars.size();
-	for (int i = 0; i < size; i++)
+	// ai cars only write their own inputs, update them in parallel
+	update_cars = cars;
+	update_cars_num = cars_num;
+	update_dt = dt;
+	JobSystem::instance().Run(UpdateJob, this, 0, ai_cars.size(), 1);
+}
+
+void Ai::UpdateJob(void * ai, int begin, int end)
+{
+	Ai & a = *static_cast<Ai*>(ai);
+	for (int i = begin; i < end; i++)
 	{
-		ai_cars[i]->Update(dt, cars, cars_num);
+		a.ai_cars[i]->Update(a.update_dt, a.update_cars, a.update_cars_num);
 	}
 }
 
@@ -58,6 +58,13 @@ private:
 	std::vector <AiCar*> ai_cars;
 	std::map <std::string, AiFactory*> ai_factories;
 	std::vector <float> empty_input;
+
+	// update job parameters
+	const CarDynamics * update_cars;
+	int update_cars_num;
+	float update_dt;
+
+	static void UpdateJob(void * ai, int begin, int end);
 };
 
 #endif //_AI_H
@@ -18,9 +18,12 @@
 /************************************************************************/
 
 #include "bezier.h"
+#include "simd4.h"
 #include "unittest.h"
 
+#include <algorithm>
 #include <cmath>
+#include <sstream>
 
 std::ostream & operator << (std::ostream &os, const Bezier & b)
 {
@@ -42,6 +45,7 @@ Bezier::Bezier()
 	dist_from_start = 0.0;
 	length = 0.0;
 	have_racingline = false;
+	UpdatePoly();
 }
 
 Bezier::~Bezier()
@@ -139,6 +143,8 @@ void Bezier::SetFromCorners(const Vec3 & fl, const Vec3 & fr, const Vec3 & bl, c
 		}
 	}
 
+	UpdatePoly();
+
 	//CheckForProblems();
 }
 
@@ -375,6 +381,8 @@ void Bezier::Reverse()
 	for (int n = 0; n < 4; n++)
 		for (int i = 0; i < 4; i++)
 			points[n][i] = oldpoints[3-n][3-i];
+
+	UpdatePoly();
 }
 
 Vec3 Bezier::Bernstein(float u, const Vec3 p[]) const
@@ -437,6 +445,85 @@ Vec3 Bezier::SurfNorm(float px, float py) const
 	return n;
 }
 
+// Power basis coefficients of the Bernstein basis functions, B_k(t) = sum_n t^n * PowerBasis[k][n]
+static const float PowerBasis[4][4] =
+{
+	{0, 0, 0, 1},
+	{0, 0, 3, -3},
+	{0, 3, -6, 3},
+	{1, -3, 3, -1}
+};
+
+void Bezier::UpdatePoly()
+{
+	// SurfCoord(px, py) = sum_j B_j(py) * sum_k B_k(px) * points[j][k]
+	for (int a = 0; a < 3; a++)
+	{
+		for (int m = 0; m < 4; m++)
+		{
+			for (int n = 0; n < 4; n++)
+			{
+				float c = 0;
+				for (int j = 0; j < 4; j++)
+				{
+					for (int k = 0; k < 4; k++)
+					{
+						c += PowerBasis[j][m] * PowerBasis[k][n] * points[j][k][a];
+					}
+				}
+				poly[a][m][n] = c;
+			}
+		}
+	}
+}
+
+void Bezier::SurfCoordPoly(const float px[4], const float py[4], Vec3 out[4]) const
+{
+	const Simd4f u = Simd4f::Load(px);
+	const Simd4f v = Simd4f::Load(py);
+	for (int a = 0; a < 3; a++)
+	{
+		// horner scheme in px for each power of py, then in py
+		Simd4f r(0.0f);
+		for (int m = 3; m >= 0; m--)
+		{
+			const float * c = poly[a][m];
+			Simd4f row = ((Simd4f(c[3]) * u + Simd4f(c[2])) * u + Simd4f(c[1])) * u + Simd4f(c[0]);
+			r = r * v + row;
+		}
+
+		float result[4];
+		r.Store(result);
+		for (int i = 0; i < 4; i++)
+		{
+			out[i][a] = result[i];
+		}
+	}
+}
+
+void Bezier::SurfCoordNormPoly(float px, float py, Vec3 & pos, Vec3 & normal) const
+{
+	// position and partial derivatives along px (du) and py (dv)
+	Vec3 du, dv;
+	for (int a = 0; a < 3; a++)
+	{
+		float p = 0, pu = 0, pv = 0;
+		for (int m = 3; m >= 0; m--)
+		{
+			const float * c = poly[a][m];
+			float row = ((c[3] * px + c[2]) * px + c[1]) * px + c[0];
+			float rowu = (3 * c[3] * px + 2 * c[2]) * px + c[1];
+			pv = pv * py + p;
+			p = p * py + row;
+			pu = pu * py + rowu;
+		}
+		pos[a] = p;
+		du[a] = pu;
+		dv[a] = pv;
+	}
+	normal = -du.cross(dv).Normalize();
+}
+
 Bezier & Bezier::CopyFrom(const Bezier &other)
 {
 	for (int x = 0; x < 4; x++)
@@ -447,6 +534,17 @@ Bezier & Bezier::CopyFrom(const Bezier &other)
 		}
 	}
 
+	for (int a = 0; a < 3; a++)
+	{
+		for (int m = 0; m < 4; m++)
+		{
+			for (int n = 0; n < 4; n++)
+			{
+				poly[a][m][n] = other.poly[a][m][n];
+			}
+		}
+	}
+
 	center = other.center;
 	radius = other.radius;
 	length = other.length;
@@ -476,6 +574,7 @@ void Bezier::ReadFrom(std::istream &openfile)
 		//FitSpline(points[x]);
 		//FitMidPoint(points[x]);
 	}
+	UpdatePoly();
 }
 
 void Bezier::ReadFromYZX(std::istream &openfile)
@@ -490,6 +589,7 @@ void Bezier::ReadFromYZX(std::istream &openfile)
 			openfile >> points[x][y][0];
 		}
 	}
+	UpdatePoly();
 }
 
 void Bezier::WriteTo(std::ostream &openfile) const
@@ -507,85 +607,169 @@ void Bezier::WriteTo(std::ostream &openfile) const
 	}
 }
 
+template <typename T>
+static void ReadPod(std::istream & in, T & value)
+{
+	in.read((char *)&value, sizeof(T));
+}
+
+template <typename T>
+static void WritePod(std::ostream & out, const T & value)
+{
+	out.write((const char *)&value, sizeof(T));
+}
+
+void Bezier::ReadBinary(std::istream & in)
+{
+	char racingline = 0;
+	for (int x = 0; x < 4; x++)
+	{
+		for (int y = 0; y < 4; y++)
+		{
+			ReadPod(in, points[x][y]);
+		}
+	}
+	ReadPod(in, center);
+	ReadPod(in, radius);
+	ReadPod(in, length);
+	ReadPod(in, dist_from_start);
+	ReadPod(in, track_radius);
+	ReadPod(in, turn);
+	ReadPod(in, track_curvature);
+	ReadPod(in, racing_line);
+	ReadPod(in, racingline);
+	have_racingline = racingline;
+	UpdatePoly();
+}
+
+void Bezier::WriteBinary(std::ostream & out) const
+{
+	for (int x = 0; x < 4; x++)
+	{
+		for (int y = 0; y < 4; y++)
+		{
+			WritePod(out, points[x][y]);
+		}
+	}
+	WritePod(out, center);
+	WritePod(out, radius);
+	WritePod(out, length);
+	WritePod(out, dist_from_start);
+	WritePod(out, track_radius);
+	WritePod(out, turn);
+	WritePod(out, track_curvature);
+	WritePod(out, racing_line);
+	WritePod(out, char(have_racingline));
+}
+
 bool Bezier::CollideSubDivQuadSimple(const Vec3 & origin, const Vec3 & direction, Vec3 &outtri) const
 {
 	Vec3 normal;
 	return CollideSubDivQuadSimpleNorm(origin, direction, outtri, normal);
 }
 
-bool Bezier::CollideSubDivQuadSimpleNorm(const Vec3 & origin, const Vec3 & direction, Vec3 &outtri, Vec3 & normal) const
+template <class Corners>
+bool Bezier::CollideSubDiv(const Corners & corners, const Vec3 & origin, const Vec3 & direction, float & su, float & sv) const
 {
-	bool col = false;
 	const int COLLISION_QUAD_DIVS = 6;
 	const float areacut = 0.5;
 
 	float t, u, v;
 
-	float su = 0;
-	float sv = 0;
+	su = 0;
+	sv = 0;
 
 	float umin = 0;
 	float umax = 1;
 	float vmin = 0;
 	float vmax = 1;
 
-	Vec3 ul = points[3][3];
-	Vec3 ur = points[3][0];
-	Vec3 br = points[0][0];
-	Vec3 bl = points[0][3];
-
 	for (int i = 0; i < COLLISION_QUAD_DIVS; i++)
 	{
 		float tu[2];
 		float tv[2];
 
-		//speedup for i == 0
-		//if (i != 0)
-		{
-			tu[0] = umin;
-			if (tu[0] < 0)
-				tu[0] = 0;
-			tu[1] = umax;
-			if (tu[1] > 1)
-				tu[1] = 1;
-
-			tv[0] = vmin;
-			if (tv[0] < 0)
-				tv[0] = 0;
-			tv[1] = vmax;
-
-			if (tv[1] > 1)
-				tv[1] = 1;
-
-			ul = SurfCoord(tu[0], tv[0]);
-			ur = SurfCoord(tu[1], tv[0]);
-			br = SurfCoord(tu[1], tv[1]);
-			bl = SurfCoord(tu[0], tv[1]);
-		}
+		tu[0] = umin;
+		if (tu[0] < 0)
+			tu[0] = 0;
+		tu[1] = umax;
+		if (tu[1] > 1)
+			tu[1] = 1;
+
+		tv[0] = vmin;
+		if (tv[0] < 0)
+			tv[0] = 0;
+		tv[1] = vmax;
+		if (tv[1] > 1)
+			tv[1] = 1;
+
+		// ul, ur, br, bl
+		const float px[4] = {tu[0], tu[1], tu[1], tu[0]};
+		const float py[4] = {tv[0], tv[0], tv[1], tv[1]};
+		Vec3 quad[4];
+		corners(px, py, quad);
+
+		if (!IntersectQuadrilateralF(origin, direction, quad[0], quad[1], quad[2], quad[3], t, u, v))
+			return false;
 
-		col = IntersectQuadrilateralF(origin, direction, ul, ur, br, bl, t, u, v);
+		//expand quad UV to surface UV
+		su = u * (tu[1] - tu[0]) + tu[0];
+		sv = v * (tv[1] - tv[0]) + tv[0];
 
-		if (col)
-		{
-			//expand quad UV to surface UV
-			//su = u * (umax - umin) + umin;
-			//sv = v * (vmax - vmin) + vmin;
-
-			su = u * (tu[1] - tu[0]) + tu[0];
-			sv = v * (tv[1] - tv[0]) + tv[0];
-
-			//place max and min according to area hit
-			vmax = sv + (0.5*areacut)*(vmax - vmin);
-			vmin = sv - (0.5*areacut)*(vmax - vmin);
-			umax = su + (0.5*areacut)*(umax - umin);
-			umin = su - (0.5*areacut)*(umax - umin);
-		}
-		else
+		//place max and min according to area hit
+		vmax = sv + (0.5*areacut)*(vmax - vmin);
+		vmin = sv - (0.5*areacut)*(vmax - vmin);
+		umax = su + (0.5*areacut)*(umax - umin);
+		umin = su - (0.5*areacut)*(umax - umin);
+	}
+
+	return true;
+}
+
+struct Bezier::BernsteinCorners
+{
+	const Bezier & b;
+	BernsteinCorners(const Bezier & b) : b(b) {}
+	void operator()(const float px[4], const float py[4], Vec3 out[4]) const
+	{
+		for (int i = 0; i < 4; i++)
 		{
-			outtri = origin;
-			return false;
+			out[i] = b.SurfCoord(px[i], py[i]);
 		}
 	}
+};
+
+struct Bezier::PolyCorners
+{
+	const Bezier & b;
+	PolyCorners(const Bezier & b) : b(b) {}
+	void operator()(const float px[4], const float py[4], Vec3 out[4]) const
+	{
+		b.SurfCoordPoly(px, py, out);
+	}
+};
+
+bool Bezier::CollideSubDivQuadSimpleNorm(const Vec3 & origin, const Vec3 & direction, Vec3 &outtri, Vec3 & normal) const
+{
+	float su, sv;
+	if (!CollideSubDiv(PolyCorners(*this), origin, direction, su, sv))
+	{
+		outtri = origin;
+		return false;
+	}
+
+	SurfCoordNormPoly(su, sv, outtri, normal);
+	return true;
+}
+
+bool Bezier::CollideSubDivQuadSimpleNormBernstein(const Vec3 & origin, const Vec3 & direction, Vec3 &outtri, Vec3 & normal) const
+{
+	float su, sv;
+	if (!CollideSubDiv(BernsteinCorners(*this), origin, direction, su, sv))
+	{
+		outtri = origin;
+		return false;
+	}
 
 	outtri = SurfCoord(su, sv);
 	normal = SurfNorm(su, sv);
@@ -791,3 +975,72 @@ QT_TEST(bezier_test)
 	b.SetFromCorners(Vec3(1,0,1),Vec3(-1,0,1),Vec3(1,0,-1),Vec3(-1,0,-1));
 	QT_CHECK(!b.CheckForProblems());
 }
+
+QT_TEST(bezier_collide_test)
+{
+	// curved and twisted road patch away from the origin
+	std::stringstream patch;
+	for (int x = 0; x < 4; x++)
+	{
+		for (int y = 0; y < 4; y++)
+		{
+			patch << 100 + 4 * y + 0.3 * x * x << " ";
+			patch << 50 + 0.2 * x * y - 0.1 * y * y << " ";
+			patch << -200 + 5 * x + 0.5 * y << " ";
+		}
+	}
+	Bezier b;
+	b.ReadFrom(patch);
+	QT_CHECK(!b.CheckForProblems());
+
+	// hit points and normals match the bernstein evaluation
+	int hits = 0;
+	float max_pos_error = 0;
+	float max_norm_error = 0;
+	const Vec3 dir(0, -1, 0.1);
+	for (int i = 0; i < 400; i++)
+	{
+		Vec3 origin(98 + (i % 20) * 0.8, 60, -203 + (i / 20) * 1.2);
+		Vec3 pos, norm, pos_ref, norm_ref;
+		bool col = b.CollideSubDivQuadSimpleNorm(origin, dir, pos, norm);
+		bool col_ref = b.CollideSubDivQuadSimpleNormBernstein(origin, dir, pos_ref, norm_ref);
+		QT_CHECK_EQUAL(col, col_ref);
+		if (col && col_ref)
+		{
+			hits++;
+			max_pos_error = std::max(max_pos_error, (pos - pos_ref).Magnitude());
+			max_norm_error = std::max(max_norm_error, (norm - norm_ref).Magnitude());
+		}
+	}
+	QT_CHECK(hits > 100);
+	QT_CHECK_LESS(max_pos_error, 1E-3);
+	QT_CHECK_LESS(max_norm_error, 1E-4);
+}
+
+QT_TEST(bezier_binary_test)
+{
+	Bezier b;
+	b.SetFromCorners(Vec3(2, 0, 10), Vec3(-2, 0, 10), Vec3(2, 1, 0), Vec3(-2, 1, 0));
+
+	std::stringstream s;
+	b.WriteBinary(s);
+	Bezier c;
+	c.ReadBinary(s);
+	QT_CHECK(s.good());
+	QT_CHECK_EQUAL(s.peek(), EOF);
+	QT_CHECK_EQUAL(c.GetFL(), b.GetFL());
+	QT_CHECK_EQUAL(c.GetBR(), b.GetBR());
+	QT_CHECK_EQUAL(c.GetDistFromStart(), b.GetDistFromStart());
+	QT_CHECK_EQUAL(c.HasRacingline(), b.HasRacingline());
+
+	// same bytes when written again, collision polynomial restored
+	std::stringstream t;
+	c.WriteBinary(t);
+	QT_CHECK(t.str() == s.str());
+
+	Vec3 hitb, hitc;
+	const Vec3 origin(0.5, 5, 4), dir(0, -1, 0);
+	QT_CHECK(b.CollideSubDivQuadSimple(origin, dir, hitb));
+	QT_CHECK(c.CollideSubDivQuadSimple(origin, dir, hitc));
+	QT_CHECK_EQUAL(hitc, hitb);
+}
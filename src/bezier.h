@@ -27,11 +27,13 @@
 
 class Track;
 class RoadPatch;
+class RoadStrip;
 
 class Bezier
 {
 friend class Track;
 friend class RoadPatch;
+friend class RoadStrip;
 
 public:
 	Bezier();
@@ -65,11 +67,18 @@ public:
 	bool CollideSubDivQuadSimple(const Vec3 & origin, const Vec3 & direction, Vec3 &outtri) const;
 	bool CollideSubDivQuadSimpleNorm(const Vec3 & origin, const Vec3 & direction, Vec3 &outtri, Vec3 & normal) const;
 
+	///reference for CollideSubDivQuadSimpleNorm, evaluates the bernstein polynomials instead of the cached power basis
+	bool CollideSubDivQuadSimpleNormBernstein(const Vec3 & origin, const Vec3 & direction, Vec3 &outtri, Vec3 & normal) const;
+
 	///read/write IO operations (ascii format)
 	void ReadFrom(std::istream & openfile);
 	void ReadFromYZX(std::istream & openfile);
 	void WriteTo(std::ostream & openfile) const;
 
+	///binary IO of the patch state except the next patch link (native byte order)
+	void ReadBinary(std::istream & in);
+	void WriteBinary(std::ostream & out) const;
+
 	///flip points on both axes
 	void Reverse();
 
@@ -131,6 +140,23 @@ public:
 	}
 
 private:
+	struct BernsteinCorners;
+	struct PolyCorners;
+
+	///ray intersection by quad subdivision, corners evaluates four surface points at once
+	///output the surface coordinates of the contact point to su, sv
+	template <class Corners>
+	bool CollideSubDiv(const Corners & corners, const Vec3 & origin, const Vec3 & direction, float & su, float & sv) const;
+
+	///update the power basis coefficients from the bezier points
+	void UpdatePoly();
+
+	///evaluate the surface at four normalized coordinates px, py using the power basis (SIMD)
+	void SurfCoordPoly(const float px[4], const float py[4], Vec3 out[4]) const;
+
+	///evaluate the surface point and normal at the normalized coordinates px and py using the power basis
+	void SurfCoordNormPoly(float px, float py, Vec3 & pos, Vec3 & normal) const;
+
 	///return the bernstein given the normalized coordinate u (zero to one) and an array of four points p
 	Vec3 Bernstein(float u, const Vec3 p[]) const;
 
@@ -149,6 +175,7 @@ private:
 		float &t, float &u, float &v) const;
 
 	Vec3 points[4][4];
+	float poly[3][4][4]; ///< power basis coefficients poly[axis][m][n] of py^m * px^n
 	Vec3 center;
 	float radius;
 	float length;
@@ -383,6 +383,26 @@ void CarGraphics::Update(const CarDynamics & dynamics)
 		ni->GetTransform().SetRotation(rot);
 	}
 
+	UpdateParts(dynamics.GetTransmission().GetGear());
+}
+
+void CarGraphics::Update(const Vec3 positions[], const Quat rotations[], int gear)
+{
+	if (!bodynode.valid()) return;
+
+	unsigned i = 0;
+	SceneNode::List & childlist = topnode.GetNodeList();
+	for (SceneNode::List::iterator ni = childlist.begin(); ni != childlist.end(); ++ni, ++i)
+	{
+		ni->GetTransform().SetTranslation(positions[i]);
+		ni->GetTransform().SetRotation(rotations[i]);
+	}
+
+	UpdateParts(gear);
+}
+
+void CarGraphics::UpdateParts(int gear)
+{
 	// brake/reverse lights
 	SceneNode & bodynoderef = topnode.GetNode(bodynode);
 	for (std::list<Light>::iterator i = lights.begin(); i != lights.end(); i++)
@@ -399,7 +419,7 @@ void CarGraphics::Update(const CarDynamics & dynamics)
 	if (reverselights.valid())
 	{
 		Drawable & draw = bodynoderef.GetDrawList().lights_emissive.get(reverselights);
-		draw.SetDrawEnable(dynamics.GetTransmission().GetGear() < 0);
+		draw.SetDrawEnable(gear < 0);
 	}
 
 	// steering
@@ -66,6 +66,10 @@ public:
 	/// update graphics from car dynamics state
 	void Update(const CarDynamics & dynamics);
 
+	/// update graphics from a copy of the car state, one body transform
+	/// per dynamics body (interpolated simulation snapshots)
+	void Update(const Vec3 positions[], const Quat rotations[], int gear);
+
 	void SetColor(float r, float g, float b);
 
 	void EnableInteriorView(bool value);
@@ -118,6 +122,9 @@ private:
 		std::ostream & error_output);
 
 	void ClearCameras();
+
+	// lights and steering wheel
+	void UpdateParts(int gear);
 };
 
 #endif // _CARGRAPHICS_H
@@ -248,12 +248,41 @@ bool CarSound::Load(
 	return true;
 }
 
+void CarSound::GetInfo(const CarDynamics & dynamics, CarSoundInfo & info)
+{
+	info.position = ToMathVector<float>(dynamics.GetPosition());
+	info.engine_position = ToMathVector<float>(dynamics.GetEnginePosition());
+	for (int i = 0; i < WHEEL_POSITION_SIZE; i++)
+	{
+		const WheelPosition wp = WheelPosition(i);
+		info.wheel_position[i] = ToMathVector<float>(dynamics.GetWheelPosition(wp));
+		info.wheel_speed[i] = dynamics.GetWheelVelocity(wp).length();
+		info.squeal[i] = dynamics.GetTireSquealAmount(wp);
+		info.surface[i] = dynamics.GetWheelContact(wp).GetSurface().type;
+	}
+	info.rpm = dynamics.GetTachoRPM();
+	info.rpm_limit = dynamics.GetEngine().GetRPMLimit();
+	info.throttle = dynamics.GetEngine().GetThrottle();
+	info.velocity = dynamics.GetVelocity().length();
+	info.speed = dynamics.GetSpeed();
+	info.gear = dynamics.GetTransmission().GetGear();
+}
+
 void CarSound::Update(const CarDynamics & dynamics, float dt)
 {
 	if (!psound) return;
 
-	Vec3 pos_car = ToMathVector<float>(dynamics.GetPosition());
-	Vec3 pos_eng = ToMathVector<float>(dynamics.GetEnginePosition());
+	CarSoundInfo info;
+	GetInfo(dynamics, info);
+	Update(info, dt);
+}
+
+void CarSound::Update(const CarSoundInfo & car, float dt)
+{
+	if (!psound) return;
+
+	const Vec3 & pos_car = car.position;
+	const Vec3 & pos_eng = car.engine_position;
 
 	psound->SetSourcePosition(roadnoise, pos_car[0], pos_car[1], pos_car[2]);
 	psound->SetSourcePosition(crashsound, pos_car[0], pos_car[1], pos_car[2]);
@@ -262,8 +291,8 @@ void CarSound::Update(const CarDynamics & dynamics, float dt)
 	psound->SetSourcePosition(handbrakesound, pos_car[0], pos_car[1], pos_car[2]);
 
 	// update engine sounds
-	const float rpm = dynamics.GetTachoRPM();
-	const float throttle = dynamics.GetEngine().GetThrottle();
+	const float rpm = car.rpm;
+	const float throttle = car.throttle;
 	float total_gain = 0.0;
 
 	std::vector<std::pair<size_t, float> > gainlist;
@@ -341,33 +370,33 @@ void CarSound::Update(const CarDynamics & dynamics, float dt)
 		psound->SetSourceGain(grasssound[i], 0.0);
 		psound->SetSourceGain(tiresqueal[i], 0.0);
 
-		float squeal = dynamics.GetTireSquealAmount(WheelPosition(i));
+		float squeal = car.squeal[i];
 		float maxgain = 0.3;
 		float pitchvariation = 0.4;
 
 		unsigned sound_active = 0;
-		const TrackSurface & surface = dynamics.GetWheelContact(WheelPosition(i)).GetSurface();
-		if (surface.type == TrackSurface::ASPHALT)
+		const TrackSurface::Type surface = car.surface[i];
+		if (surface == TrackSurface::ASPHALT)
 		{
 			sound_active = tiresqueal[i];
 		}
-		else if (surface.type == TrackSurface::GRASS)
+		else if (surface == TrackSurface::GRASS)
 		{
 			sound_active = grasssound[i];
 			maxgain = 0.4; // up the grass sound volume a little
 		}
-		else if (surface.type == TrackSurface::GRAVEL)
+		else if (surface == TrackSurface::GRAVEL)
 		{
 			sound_active = gravelsound[i];
 			maxgain = 0.4;
 		}
-		else if (surface.type == TrackSurface::CONCRETE)
+		else if (surface == TrackSurface::CONCRETE)
 		{
 			sound_active = tiresqueal[i];
 			maxgain = 0.3;
 			pitchvariation = 0.25;
 		}
-		else if (surface.type == TrackSurface::SAND)
+		else if (surface == TrackSurface::SAND)
 		{
 			sound_active = grasssound[i];
 			maxgain = 0.25; // quieter for sand
@@ -379,9 +408,8 @@ void CarSound::Update(const CarDynamics & dynamics, float dt)
 			maxgain = 0.0;
 		}
 
-		btVector3 pos_wheel = dynamics.GetWheelPosition(WheelPosition(i));
-		btVector3 vel_wheel = dynamics.GetWheelVelocity(WheelPosition(i));
-		float pitch = (vel_wheel.length() - 5.0) * 0.1;
+		const Vec3 & pos_wheel = car.wheel_position[i];
+		float pitch = (car.wheel_speed[i] - 5.0) * 0.1;
 		pitch = clamp(pitch, 0.0f, 1.0f);
 		pitch = 1.0 - pitch;
 		pitch *= pitchvariation;
@@ -395,7 +423,7 @@ void CarSound::Update(const CarDynamics & dynamics, float dt)
 
 	// update road noise sound
 	{
-		float gain = dynamics.GetVelocity().length();
+		float gain = car.velocity;
 		gain *= 0.02;
 		gain *= gain;
 		if (gain > 1) gain = 1;
@@ -432,7 +460,7 @@ void CarSound::Update(const CarDynamics & dynamics, float dt)
 	}
 */
 	// update crash sound
-	crashdetection.Update(dynamics.GetSpeed(), dt);
+	crashdetection.Update(car.speed, dt);
 	float crashdecel = crashdetection.GetMaxDecel();
 	if (crashdecel > 0)
 	{
@@ -452,11 +480,11 @@ void CarSound::Update(const CarDynamics & dynamics, float dt)
 	if (!interior) return;
 
 	// update gear sound
-	if (gearsound_check != dynamics.GetTransmission().GetGear())
+	if (gearsound_check != car.gear)
 	{
 		float gain = 0.0;
 		if (rpm > 0.0)
-			gain = dynamics.GetEngine().GetRPMLimit() / rpm;
+			gain = car.rpm_limit / rpm;
 		gain = clamp(gain, 0.25f, 0.50f);
 
 		if (!psound->GetSourcePlaying(gearsound))
@@ -464,7 +492,7 @@ void CarSound::Update(const CarDynamics & dynamics, float dt)
 			psound->ResetSource(gearsound);
 			psound->SetSourceGain(gearsound, gain);
 		}
-		gearsound_check = dynamics.GetTransmission().GetGear();
+		gearsound_check = car.gear;
 	}
 /*	fixme
 	// brake sound
@@ -21,7 +21,9 @@
 #define _CARSOUND_H
 
 #include "physics/carwheelposition.h"
+#include "physics/tracksurface.h"
 #include "crashdetection.h"
+#include "mathvector.h"
 #include "enginesoundinfo.h"
 
 #include <iosfwd>
@@ -32,6 +34,23 @@ class Sound;
 class CarDynamics;
 class ContentManager;
 
+/// car state the sounds are updated from
+struct CarSoundInfo
+{
+	Vec3 position;
+	Vec3 engine_position;
+	Vec3 wheel_position[WHEEL_POSITION_SIZE];
+	float wheel_speed[WHEEL_POSITION_SIZE];
+	float squeal[WHEEL_POSITION_SIZE];
+	TrackSurface::Type surface[WHEEL_POSITION_SIZE];
+	float rpm;
+	float rpm_limit;
+	float throttle;
+	float velocity; ///< magnitude of the body velocity
+	float speed; ///< forward speed, for crash detection
+	int gear;
+};
+
 class CarSound
 {
 public:
@@ -52,6 +71,11 @@ public:
 
 	void Update(const CarDynamics & dynamics, float dt);
 
+	/// update sounds from a copy of the car state
+	void Update(const CarSoundInfo & car, float dt);
+
+	static void GetInfo(const CarDynamics & dynamics, CarSoundInfo & info);
+
 	void EnableInteriorSound(bool value);
 
 private:
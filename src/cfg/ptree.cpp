@@ -53,6 +53,10 @@ QT_TEST(ptree)
 	ptree.get("root.child.ipsum", str, err);
 	QT_CHECK_EQUAL(str, "7.89");
 
+	ptree.set("root.child.dolor", 42);
+	ptree.get("root.child.dolor", str, err);
+	QT_CHECK_EQUAL(str, "42");
+
 	int i = 0;
 	troot->get("bar", i, err);
 	QT_CHECK_EQUAL(i, 456);
@@ -266,8 +266,8 @@ template <typename T>
 inline PTree & PTree::set(const std::string & key, const T & value)
 {
 	size_t next = key.find(".");
-	iterator i = _children.insert(std::make_pair(key.substr(0, next), PTree())).first;
-	PTree & p = i->second;
+	std::pair<iterator, bool> pi = _children.insert(std::make_pair(key.substr(0, next), PTree()));
+	PTree & p = pi.first->second;
 	p._parent = this; ///< store parent pointer for error reporting
 	if (next >= key.length()-1)
 	{
@@ -276,8 +276,11 @@ inline PTree & PTree::set(const std::string & key, const T & value)
 		p._value = s.str();
 		return p;
 	}
-	p._value = i->first; ///< store node key for error reporting
-	return p.set(key.substr(next), value);
+	if (pi.second)
+	{
+		p._value = pi.first->first; ///< store node key for error reporting
+	}
+	return p.set(key.substr(next+1), value);
 }
 
 inline void PTree::set(const PTree & other)
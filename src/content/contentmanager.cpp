@@ -18,19 +18,86 @@
 /************************************************************************/
 
 #include "contentmanager.h"
+#include "graphics/texture.h"
+#include "graphics/model.h"
+#include "sound/soundbuffer.h"
+#include "unittest.h"
+#include <algorithm>
 
 ContentManager::ContentManager(std::ostream & error) :
-	error(error)
+	error(error),
+	budget(0),
+	access(0),
+	requests_mutex(SDL_CreateMutex()),
+	requests_decoded(SDL_CreateCond()),
+	requests_count(0)
 {
 	// ctor
 }
 
 ContentManager::~ContentManager()
 {
+	// job threads must not touch the requests after this
+	JobSystem::instance().Wait(requests_fence);
+	SDL_DestroyCond(requests_decoded);
+	SDL_DestroyMutex(requests_mutex);
+	budget = 0;
 	sweep();
 	_logleaks();
 }
 
+size_t ContentManager::update()
+{
+	while (true)
+	{
+		RequestBase * request = 0;
+		SDL_LockMutex(requests_mutex);
+		if (!decoded.empty())
+		{
+			request = decoded.front();
+			decoded.erase(decoded.begin());
+		}
+		SDL_UnlockMutex(requests_mutex);
+
+		if (!request)
+			break;
+
+		request->finish();
+	}
+	return requests_count;
+}
+
+void ContentManager::wait()
+{
+	while (requests_count > 0)
+	{
+		RequestBase * request = 0;
+		bool pending_request = false;
+		SDL_LockMutex(requests_mutex);
+		while (decoded.empty() && pending.empty())
+		{
+			// decoding on a job thread
+			SDL_CondWait(requests_decoded, requests_mutex);
+		}
+		if (!decoded.empty())
+		{
+			request = decoded.front();
+			decoded.erase(decoded.begin());
+		}
+		else
+		{
+			request = _takepending();
+			pending_request = true;
+		}
+		SDL_UnlockMutex(requests_mutex);
+
+		if (pending_request)
+			request->decode();
+
+		request->finish();
+	}
+}
+
 void ContentManager::addSharedPath(const std::string & path)
 {
 	sharedpaths.push_back(path);
@@ -41,14 +108,42 @@ void ContentManager::addPath(const std::string & path)
 	basepaths.push_back(path);
 }
 
+void ContentManager::setBudget(size_t bytes)
+{
+	budget = bytes;
+}
+
 void ContentManager::sweep()
 {
+	size_t bytes = 0;
+	std::vector<Unused> unused;
 	for (size_t i = 0; i < factory_cached.m_caches.size(); ++i)
 	{
-		factory_cached.m_caches[i]->sweep();
+		bytes += factory_cached.m_caches[i]->bytes;
+		factory_cached.m_caches[i]->unused(unused);
+	}
+
+	// evict least recently used content until we are within budget
+	std::sort(unused.begin(), unused.end());
+	for (size_t i = 0; i < unused.size() && (bytes > budget || budget == 0); ++i)
+	{
+		bytes -= unused[i].size;
+		unused[i].cache->evict(unused[i].name);
 	}
 }
 
+void ContentManager::logStats(std::ostream & log) const
+{
+	size_t bytes = 0;
+	for (size_t i = 0; i < factory_cached.m_caches.size(); ++i)
+	{
+		bytes += factory_cached.m_caches[i]->bytes;
+		factory_cached.m_caches[i]->stats(log);
+		log << "\n";
+	}
+	log << "Content cache " << (bytes >> 10) << " KB, budget " << (budget >> 10) << " KB" << std::endl;
+}
+
 bool ContentManager::_logleaks()
 {
 	size_t n = 0;
@@ -59,13 +154,12 @@ bool ContentManager::_logleaks()
 	if (n == 0)
 		return false;
 
-	error << "Leaked " << n << " cached objects:";
+	error << "Leaked " << n << " cached objects:\n";
 	for (size_t i = 0; i < factory_cached.m_caches.size(); ++i)
 	{
-		error << "\n";
 		factory_cached.m_caches[i]->log(error);
 	}
-	error << std::endl;
+	logStats(error);
 	return false;
 }
 
@@ -85,3 +179,253 @@ bool ContentManager::_logerror(
 	error << std::endl;
 	return false;
 }
+
+size_t ContentManager::_size(const SoundBuffer & sound)
+{
+	// samples of all channels
+	const SoundInfo & info = sound.GetInfo();
+	return size_t(info.samples) * info.bytespersample;
+}
+
+size_t ContentManager::_size(const Texture & texture)
+{
+	return texture.GetSize();
+}
+
+size_t ContentManager::_size(const Model & model)
+{
+	return model.GetVertexArray().GetSize();
+}
+
+size_t ContentManager::_size(const PTree & /*config*/)
+{
+	// small compared to the other content, not accounted
+	return 0;
+}
+
+void ContentManager::_decode(void * data, int /*begin*/, int /*end*/)
+{
+	ContentManager & content = *static_cast<ContentManager *>(data);
+
+	SDL_LockMutex(content.requests_mutex);
+	RequestBase * request = content._takepending();
+	SDL_UnlockMutex(content.requests_mutex);
+
+	// request has been taken by the main thread
+	if (!request)
+		return;
+
+	request->decode();
+
+	SDL_LockMutex(content.requests_mutex);
+	content.decoded.push_back(request);
+	SDL_CondBroadcast(content.requests_decoded);
+	SDL_UnlockMutex(content.requests_mutex);
+}
+
+ContentManager::RequestBase * ContentManager::_takepending()
+{
+	if (pending.empty())
+		return 0;
+
+	std::vector<RequestBase *>::iterator r = pending.begin();
+	for (std::vector<RequestBase *>::iterator i = pending.begin() + 1; i != pending.end(); ++i)
+	{
+		if ((*i)->priority > (*r)->priority)
+			r = i;
+	}
+	RequestBase * request = *r;
+	pending.erase(r);
+	return request;
+}
+
+void ContentManager::_wait(RequestBase & request)
+{
+	SDL_LockMutex(requests_mutex);
+	std::vector<RequestBase *>::iterator i = std::find(pending.begin(), pending.end(), &request);
+	const bool pending_request = (i != pending.end());
+	if (pending_request)
+	{
+		pending.erase(i);
+		SDL_UnlockMutex(requests_mutex);
+		request.decode();
+		return;
+	}
+
+	// decoding on a job thread
+	while ((i = std::find(decoded.begin(), decoded.end(), &request)) == decoded.end())
+	{
+		SDL_CondWait(requests_decoded, requests_mutex);
+	}
+	decoded.erase(i);
+	SDL_UnlockMutex(requests_mutex);
+}
+
+void ContentManager::RequestParam<Texture, TextureInfo>::decode()
+{
+	// texture creation needs the graphics context, decode pixels only
+	if (param.data || param.cube || content->getFactory<Texture>().isHeadless())
+		return;
+
+	const std::vector<std::string> & basepaths = content->basepaths;
+	for (size_t i = 0; i < basepaths.size(); ++i)
+	{
+		if (Texture::Decode(basepaths[i] + "/" + path + "/" + name, param, pixels))
+			return;
+	}
+	const std::vector<std::string> & sharedpaths = content->sharedpaths;
+	for (size_t i = 0; i < sharedpaths.size(); ++i)
+	{
+		if (Texture::Decode(sharedpaths[i] + "//" + name, param, pixels))
+		{
+			shared = true;
+			return;
+		}
+	}
+}
+
+void ContentManager::RequestParam<Texture, TextureInfo>::finish()
+{
+	// request might be the last reference to itself
+	CacheShared<Texture> & cache = content->factory_cached;
+	std::tr1::shared_ptr<Request<Texture> > self = cache.requests[path + name];
+	release();
+
+	// create texture from decoded pixels, load from file if decoding failed
+	content->load(sptr, shared ? std::string() : path, name, param);
+	param.data = 0;
+	std::vector<unsigned char>().swap(pixels);
+}
+
+// position of the load error of name in the log, npos if there is none
+static size_t FindLoadError(const std::string & log, const std::string & name, size_t pos = 0)
+{
+	return log.find("\"" + name + "\"", pos);
+}
+
+QT_TEST(contentmanager_async_test)
+{
+	// tests run before the job system is initialized,
+	// requests are decoded by wait() and load() in priority order
+	QT_CHECK_EQUAL(JobSystem::instance().GetThreadCount(), 1);
+
+	// requests for the same content are merged, keeping the higher priority
+	{
+		std::ostringstream log;
+		ContentManager content(log);
+		ContentManager::Handle<SoundBuffer> a0 = content.loadAsync<SoundBuffer>("", "a", 0);
+		ContentManager::Handle<SoundBuffer> b = content.loadAsync<SoundBuffer>("", "b", 1);
+		ContentManager::Handle<SoundBuffer> a1 = content.loadAsync<SoundBuffer>("", "a", 2);
+		QT_CHECK(!a0.done() && !a1.done() && !b.done());
+		QT_CHECK_EQUAL(content.update(), 2u);
+
+		content.wait();
+		QT_CHECK(a0.done() && a1.done() && b.done());
+		QT_CHECK_EQUAL(&a0.get(), &a1.get());
+		QT_CHECK(a0.get());
+
+		const std::string s = log.str();
+		const size_t a = FindLoadError(s, "a");
+		QT_CHECK(a < FindLoadError(s, "b"));
+		QT_CHECK_EQUAL(FindLoadError(s, "a", a + 1), std::string::npos);
+	}
+
+	// higher priority first, same priority in request order
+	{
+		std::ostringstream log;
+		ContentManager content(log);
+		content.loadAsync<SoundBuffer>("", "c", 0);
+		content.loadAsync<SoundBuffer>("", "d", 3);
+		content.loadAsync<SoundBuffer>("", "e", 1);
+		content.loadAsync<SoundBuffer>("", "f", 3);
+		content.wait();
+		QT_CHECK_EQUAL(content.update(), 0u);
+
+		const std::string s = log.str();
+		QT_CHECK(FindLoadError(s, "d") < FindLoadError(s, "f"));
+		QT_CHECK(FindLoadError(s, "f") < FindLoadError(s, "e"));
+		QT_CHECK(FindLoadError(s, "e") < FindLoadError(s, "c"));
+		QT_CHECK(FindLoadError(s, "c") != std::string::npos);
+	}
+
+	// load of the same content completes the pending request
+	{
+		std::ostringstream log;
+		ContentManager content(log);
+		ContentManager::Handle<SoundBuffer> g = content.loadAsync<SoundBuffer>("", "g", 0);
+		ContentManager::Handle<SoundBuffer> h = content.loadAsync<SoundBuffer>("", "h", 1);
+		std::tr1::shared_ptr<SoundBuffer> sptr;
+		content.load(sptr, "", "g");
+		QT_CHECK(g.done());
+		QT_CHECK(!h.done());
+		QT_CHECK_EQUAL(g.get(), sptr);
+		QT_CHECK_EQUAL(content.update(), 1u);
+		content.wait();
+		QT_CHECK(h.done());
+	}
+}
+
+// model of 1200 bytes
+static std::tr1::shared_ptr<Model> MakeModel()
+{
+	std::vector<unsigned int> faces(30, 0);
+	std::vector<float> vertices(270, 1.0f);
+	VertexArray varray;
+	varray.Add(&faces[0], faces.size(), &vertices[0], vertices.size());
+	std::tr1::shared_ptr<Model> model(new Model());
+	model->Load(varray, std::cerr);
+	return model;
+}
+
+QT_TEST(contentmanager_budget_test)
+{
+	std::ostringstream log;
+	ContentManager content(log);
+	content.setBudget(3000);
+
+	// cache a, b, c of 1200 bytes each, then use a again
+	std::tr1::weak_ptr<Model> a, b, c;
+	{
+		std::tr1::shared_ptr<Model> model = MakeModel();
+		QT_CHECK_EQUAL(model->GetVertexArray().GetSize(), 1200u);
+		a = model;
+		content.set(model, "", "a");
+		model = MakeModel();
+		b = model;
+		content.set(model, "", "b");
+		model = MakeModel();
+		c = model;
+		content.set(model, "", "c");
+		content.load(model, "", "a");
+		QT_CHECK_EQUAL(model, a.lock());
+	}
+
+	// over budget, the least recently used b is evicted
+	content.sweep();
+	QT_CHECK(!a.expired());
+	QT_CHECK(b.expired());
+	QT_CHECK(!c.expired());
+
+	// within budget nothing is evicted
+	content.sweep();
+	QT_CHECK(!a.expired());
+	QT_CHECK(!c.expired());
+
+	// content in use is never evicted, unused content is evicted even if that doesn't reach the budget
+	std::tr1::shared_ptr<Model> used = c.lock();
+	content.setBudget(500);
+	content.sweep();
+	QT_CHECK(a.expired());
+	QT_CHECK(!c.expired());
+
+	// empty entries are evicted too
+	content.set(std::tr1::shared_ptr<Model>(), "", "empty");
+	used.reset();
+	content.setBudget(0);
+	content.sweep();
+	QT_CHECK(c.expired());
+
+	std::ostringstream stats;
+	content.logStats(stats);
+	QT_CHECK(stats.str().find("Model: 0 cached") != std::string::npos);
+}
@@ -24,12 +24,34 @@
 #include "texturefactory.h"
 #include "modelfactory.h"
 #include "configfactory.h"
+#include "jobsystem.h"
+#include <cassert>
+#include <sstream>
 #include <vector>
 #include <map>
 
 class ContentManager
 {
+private:
+	template <class T> struct Request;
+
 public:
+	/// asynchronous load request, see loadAsync
+	template <class T>
+	class Handle
+	{
+	public:
+		/// content has been loaded or failed to load
+		bool done() const;
+
+		/// loaded content or default object, only valid once done
+		const std::tr1::shared_ptr<T> & get() const;
+
+	private:
+		friend class ContentManager;
+		std::tr1::shared_ptr<Request<T> > request;
+	};
+
 	ContentManager(std::ostream & error);
 
 	~ContentManager();
@@ -56,33 +78,146 @@ public:
 		const std::string & name,
 		const P & param);
 
+	/// load content on the job threads, requests with higher priority are decoded first
+	/// requests for the same content are merged, the handle is completed by
+	/// update(), wait() or a load() of the same content on the main thread
+	/// without job threads requests are decoded by wait() or load()
+	/// not available for PTree, config includes are loaded through the content manager
+	template <class T>
+	Handle<T> loadAsync(
+		const std::string & path,
+		const std::string & name,
+		int priority);
+
+	template <class T, class P>
+	Handle<T> loadAsync(
+		const std::string & path,
+		const std::string & name,
+		const P & param,
+		int priority);
+
+	/// complete decoded requests, textures are created here, main thread only
+	/// returns the number of requests still in flight
+	size_t update();
+
+	/// complete all requests
+	void wait();
+
+	/// add object loaded elsewhere to cache, as if loaded from path
+	template <class T>
+	void set(
+		const std::tr1::shared_ptr<T> & sptr,
+		const std::string & path,
+		const std::string & name);
+
 	/// add shared content directory path
 	void addSharedPath(const std::string & path);
 
 	/// add content directory path
 	void addPath(const std::string & path);
 
-	/// garbage collect unused content
+	/// unused content is kept cached up to a total cache size of budget bytes
+	void setBudget(size_t bytes);
+
+	/// garbage collect unused content exceeding the budget, least recently used first
 	void sweep();
 
+	/// log cache memory use per content type
+	void logStats(std::ostream & log) const;
+
 	/// factories access
 	template <class T>
 	Factory<T> & getFactory();
 
 private:
+	/// config loading re-enters the content manager, which is not thread safe
+	template <class T>
+	struct AsyncLoadable
+	{
+		enum { value = 1 };
+	};
+
+	/// async request state shared with the job threads
+	struct RequestBase
+	{
+		int priority;
+		RequestBase() : priority(0) {}
+		virtual ~RequestBase() {}
+		/// decode content, called on a job thread
+		virtual void decode() = 0;
+		/// cache decoded content, called on the main thread
+		virtual void finish() = 0;
+	};
+
+	template <class T>
+	struct Request : RequestBase
+	{
+		ContentManager * content;
+		std::string path;
+		std::string name;
+		std::tr1::shared_ptr<T> sptr;
+		std::ostringstream log;
+		bool shared;
+		bool done;
+		Request() : content(0), shared(false), done(false) {}
+		/// remove request from the in flight requests, cache decoded content
+		void release();
+	};
+
+	template <class T, class P>
+	struct RequestParam : Request<T>
+	{
+		P param;
+		void decode();
+		void finish();
+	};
+
+	/// cached object, its memory size and last access
+	template <class T>
+	struct Entry
+	{
+		std::tr1::shared_ptr<T> sptr;
+		size_t size;
+		unsigned access;
+		Entry() : size(0), access(0) {}
+	};
+
+	struct Cache;
+
+	/// sweep candidate
+	struct Unused
+	{
+		Cache * cache;
+		std::string name;
+		size_t size;
+		unsigned access;
+		bool operator<(const Unused & other) const { return access < other.access; }
+	};
+
 	struct Cache
 	{
+		const char * type;	///< content type name
+		size_t bytes;		///< memory size of cached content
+		Cache() : type(""), bytes(0) {}
 		virtual void log(std::ostream & log) const = 0;
+		virtual void stats(std::ostream & log) const = 0;
 		virtual size_t size() const = 0;
-		virtual void sweep() = 0;
+		virtual void unused(std::vector<Unused> & entries) = 0;
+		virtual void evict(const std::string & name) = 0;
 	};
 
 	template <class T>
-	class CacheShared : public Cache, public std::map<std::string, std::tr1::shared_ptr<T> >
+	class CacheShared : public Cache, public std::map<std::string, Entry<T> >
 	{
+	public:
+		typedef std::map<std::string, std::tr1::shared_ptr<Request<T> > > Requests;
+		Requests requests; ///< in flight requests
+	private:
 		void log(std::ostream & log) const;
+		void stats(std::ostream & log) const;
 		size_t size() const;
-		void sweep();
+		void unused(std::vector<Unused> & entries);
+		void evict(const std::string & name);
 	};
 
 	/// register content factories
@@ -104,7 +239,7 @@ private:
 
 		FactoryCached()
 		{
-			#define INIT(T) m_caches.push_back(&T ## _cache);
+			#define INIT(T) m_caches.push_back(&T ## _cache); T ## _cache.type = #T;
 			INIT(SoundBuffer)
 			INIT(Texture)
 			INIT(Model)
@@ -121,6 +256,33 @@ private:
 	/// error log
 	std::ostream & error;
 
+	/// unused content cache size limit
+	size_t budget;
+
+	/// cache access counter
+	unsigned access;
+
+	/// async requests, pending and decoded are shared with the job threads
+	std::vector<RequestBase *> pending;
+	std::vector<RequestBase *> decoded;
+	SDL_mutex * requests_mutex;
+	SDL_cond * requests_decoded; ///< signaled when a request has been decoded
+	JobSystem::Fence requests_fence;
+	size_t requests_count;
+
+	/// decode the pending request with the highest priority, job function
+	static void _decode(void * data, int begin, int end);
+
+	/// remove the first pending request with the highest priority, requests mutex held
+	RequestBase * _takepending();
+
+	/// decode request on this thread if it is still pending, else wait for it
+	void _wait(RequestBase & request);
+
+	/// complete in flight request for name
+	template <class T>
+	bool _complete(const std::string & name);
+
 	/// content leak logger
 	bool _logleaks();
 
@@ -129,6 +291,18 @@ private:
 		const std::string & path,
 		const std::string & name);
 
+	/// memory size of content
+	static size_t _size(const SoundBuffer & sound);
+	static size_t _size(const Texture & texture);
+	static size_t _size(const Model & model);
+	static size_t _size(const PTree & config);
+
+	/// add content to cache
+	template <class T>
+	void _insert(
+		const std::tr1::shared_ptr<T> & sptr,
+		const std::string & name);
+
 	/// get implementation
 	template <class T>
 	bool _get(
@@ -185,6 +359,78 @@ inline bool ContentManager::load(
 			_logerror(path, name);
 }
 
+template <class T>
+inline ContentManager::Handle<T> ContentManager::loadAsync(
+	const std::string & path,
+	const std::string & name,
+	int priority)
+{
+	return loadAsync<T>(path, name, typename Factory<T>::empty(), priority);
+}
+
+template <class T, class P>
+inline ContentManager::Handle<T> ContentManager::loadAsync(
+	const std::string & path,
+	const std::string & name,
+	const P & param,
+	int priority)
+{
+	typedef char content_type_can_not_be_loaded_async[AsyncLoadable<T>::value ? 1 : -1];
+	(void)sizeof(content_type_can_not_be_loaded_async);
+
+	Handle<T> handle;
+
+	// merge with in flight request
+	CacheShared<T> & cache = factory_cached;
+	typename CacheShared<T>::Requests::iterator i = cache.requests.find(path + name);
+	if (i != cache.requests.end())
+	{
+		SDL_LockMutex(requests_mutex);
+		if (i->second->priority < priority)
+			i->second->priority = priority;
+		SDL_UnlockMutex(requests_mutex);
+		handle.request = i->second;
+		return handle;
+	}
+
+	RequestParam<T, P> * request = new RequestParam<T, P>();
+	request->priority = priority;
+	request->content = this;
+	request->path = path;
+	request->name = name;
+	request->param = param;
+	handle.request.reset(request);
+
+	// check cache
+	if (get(request->sptr, path, name))
+	{
+		request->done = true;
+		return handle;
+	}
+
+	cache.requests[path + name] = handle.request;
+	requests_count++;
+
+	SDL_LockMutex(requests_mutex);
+	pending.push_back(request);
+	SDL_UnlockMutex(requests_mutex);
+
+	// decoding inline would ignore the priorities, leave it to wait()
+	if (JobSystem::instance().GetThreadCount() > 1)
+		JobSystem::instance().Add(_decode, this, 0, 1, requests_fence);
+
+	return handle;
+}
+
+template <class T>
+inline void ContentManager::set(
+	const std::tr1::shared_ptr<T> & sptr,
+	const std::string & path,
+	const std::string & name)
+{
+	_insert(sptr, path + name);
+}
+
 template <class T>
 inline bool ContentManager::_get(
 	std::tr1::shared_ptr<T> & sptr,
@@ -192,15 +438,30 @@ inline bool ContentManager::_get(
 {
 	// retrieve from cache
 	CacheShared<T> & cache = factory_cached;
-	typename CacheShared<T>::const_iterator i = cache.find(name);
+	typename CacheShared<T>::iterator i = cache.find(name);
 	if (i != cache.end())
 	{
-		sptr = i->second;
+		sptr = i->second.sptr;
+		i->second.access = ++access;
 		return true;
 	}
 	return false;
 }
 
+template <class T>
+inline void ContentManager::_insert(
+	const std::tr1::shared_ptr<T> & sptr,
+	const std::string & name)
+{
+	CacheShared<T> & cache = factory_cached;
+	Entry<T> & entry = cache[name];
+	cache.bytes -= entry.size;
+	entry.sptr = sptr;
+	entry.size = sptr ? _size(*sptr) : 0;
+	entry.access = ++access;
+	cache.bytes += entry.size;
+}
+
 template <class T, class P>
 inline bool ContentManager::_load(
 	std::tr1::shared_ptr<T> & sptr,
@@ -215,6 +476,12 @@ inline bool ContentManager::_load(
 		return true;
 	}
 
+	// complete async request
+	if (_complete<T>(relpath + name) && _get(sptr, relpath + name))
+	{
+		return true;
+	}
+
 	// load from basepaths
 	Factory<T>& factory = getFactory<T>();
 	for (size_t i = 0; i < basepaths.size(); ++i)
@@ -222,8 +489,7 @@ inline bool ContentManager::_load(
 		if (factory.create(sptr, error, basepaths[i], relpath, name, param))
 		{
 			// cache loaded content
-			CacheShared<T> & cache = factory_cached;
-			cache[relpath + name] = sptr;
+			_insert(sptr, relpath + name);
 			return true;
 		}
 	}
@@ -231,6 +497,20 @@ inline bool ContentManager::_load(
 	return false;
 }
 
+template <class T>
+inline bool ContentManager::_complete(const std::string & name)
+{
+	CacheShared<T> & cache = factory_cached;
+	typename CacheShared<T>::Requests::iterator i = cache.requests.find(name);
+	if (i == cache.requests.end())
+		return false;
+
+	std::tr1::shared_ptr<Request<T> > request = i->second;
+	_wait(*request);
+	request->finish();
+	return true;
+}
+
 template <class T>
 inline bool ContentManager::_getdefault(std::tr1::shared_ptr<T> & sptr)
 {
@@ -244,29 +524,148 @@ inline void ContentManager::CacheShared<T>::log(std::ostream & log) const
 	typename CacheShared<T>::const_iterator it = CacheShared<T>::begin();
 	while (it != CacheShared<T>::end())
 	{
-		log << it->second.use_count() << " : " << it->first;
+		log << it->second.sptr.use_count() << " : " << it->first << "\n";
+		++it;
+	}
+}
+
+template <class T>
+inline void ContentManager::CacheShared<T>::stats(std::ostream & log) const
+{
+	size_t used = 0, used_bytes = 0;
+	typename CacheShared<T>::const_iterator it = CacheShared<T>::begin();
+	while (it != CacheShared<T>::end())
+	{
+		if (!it->second.sptr.unique())
+		{
+			used++;
+			used_bytes += it->second.size;
+		}
+		++it;
 	}
+	log << type << ": " << size() << " cached " << (bytes >> 10) << " KB, "
+		<< used << " in use " << (used_bytes >> 10) << " KB";
 }
 
 template <class T>
 inline size_t ContentManager::CacheShared<T>::size() const
 {
-	return std::map<std::string, std::tr1::shared_ptr<T> >::size();
+	return std::map<std::string, Entry<T> >::size();
 }
 
 template <class T>
-inline void ContentManager::CacheShared<T>::sweep()
+inline void ContentManager::CacheShared<T>::unused(std::vector<Unused> & entries)
 {
-	typename CacheShared<T>::iterator it = CacheShared<T>::begin();
+	typename CacheShared<T>::const_iterator it = CacheShared<T>::begin();
 	while (it != CacheShared<T>::end())
 	{
-		if (it->second.unique())
-			CacheShared<T>::erase(it++);
-		else
-			++it;
+		if (!it->second.sptr || it->second.sptr.unique())
+		{
+			Unused entry;
+			entry.cache = this;
+			entry.name = it->first;
+			entry.size = it->second.size;
+			entry.access = it->second.access;
+			entries.push_back(entry);
+		}
+		++it;
+	}
+}
+
+template <class T>
+inline void ContentManager::CacheShared<T>::evict(const std::string & name)
+{
+	typename CacheShared<T>::iterator it = CacheShared<T>::find(name);
+	if (it != CacheShared<T>::end())
+	{
+		bytes -= it->second.size;
+		CacheShared<T>::erase(it);
+	}
+}
+
+template <class T>
+inline void ContentManager::Request<T>::release()
+{
+	CacheShared<T> & cache = content->factory_cached;
+	cache.requests.erase(path + name);
+	content->requests_count--;
+	if (sptr)
+	{
+		// cache as load would have
+		content->set(sptr, shared ? std::string() : path, name);
+	}
+	if (!log.str().empty())
+	{
+		content->error << log.str();
+	}
+	done = true;
+}
+
+template <class T, class P>
+inline void ContentManager::RequestParam<T, P>::decode()
+{
+	// same lookup as load, without touching the cache
+	Factory<T> & factory = this->content->template getFactory<T>();
+	const std::vector<std::string> & basepaths = this->content->basepaths;
+	for (size_t i = 0; i < basepaths.size(); ++i)
+	{
+		if (factory.create(this->sptr, this->log, basepaths[i], this->path, this->name, param))
+			return;
+	}
+	const std::vector<std::string> & sharedpaths = this->content->sharedpaths;
+	for (size_t i = 0; i < sharedpaths.size(); ++i)
+	{
+		if (factory.create(this->sptr, this->log, sharedpaths[i], "", this->name, param))
+		{
+			this->shared = true;
+			return;
+		}
 	}
 }
 
+template <class T, class P>
+inline void ContentManager::RequestParam<T, P>::finish()
+{
+	// request might be the last reference to itself
+	CacheShared<T> & cache = this->content->factory_cached;
+	std::tr1::shared_ptr<Request<T> > self = cache.requests[this->path + this->name];
+	this->release();
+	if (!this->sptr)
+	{
+		// fall back to load for the default object and error log
+		this->content->load(this->sptr, this->path, this->name, param);
+	}
+}
+
+/// textures are decoded on the job threads and created on the main thread
+template <>
+struct ContentManager::RequestParam<Texture, TextureInfo> : ContentManager::Request<Texture>
+{
+	TextureInfo param;
+	std::vector<unsigned char> pixels;
+	void decode();
+	void finish();
+};
+
+template <>
+struct ContentManager::AsyncLoadable<PTree>
+{
+	enum { value = 0 };
+};
+
+template <class T>
+inline bool ContentManager::Handle<T>::done() const
+{
+	return request && request->done;
+}
+
+template <class T>
+inline const std::tr1::shared_ptr<T> & ContentManager::Handle<T>::get() const
+{
+	assert(request);
+	return request->sptr;
+}
+
 template <class T>
 inline Factory<T> & ContentManager::getFactory()
 {
@@ -38,6 +38,12 @@ public:
 	/// limit texture size to max size
 	void init(int max_size, bool use_srgb, bool compress);
 
+	/// no graphics context, textures are not loaded
+	/// every texture request resolves to the default placeholder
+	void initHeadless();
+
+	bool isHeadless() const { return m_headless; }
+
 	template <class P>
 	bool create(
 		std::tr1::shared_ptr<Texture> & sptr,
@@ -59,6 +65,7 @@ private:
 	int m_size;
 	bool m_compress;
 	bool m_srgb;
+	bool m_headless;
 };
 
 #endif // _TEXTUREFACTORY_H
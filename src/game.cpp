@@ -25,7 +25,10 @@
 #include "physics/carwheelposition.h"
 #include "physics/tracksurface.h"
 #include "numprocessors.h"
+#include "jobsystem.h"
+#include "partition_testing.h"
 #include "performance_testing.h"
+#include "sound_testing.h"
 #include "quickprof.h"
 #include "utils.h"
 #include "graphics/graphics_gl2.h"
@@ -106,6 +109,16 @@ Game::Game(std::ostream & info_out, std::ostream & error_out) :
 	benchmode(false),
 	dumpfps(false),
 	pause(true),
+	headless(false),
+	headless_time(0),
+	headless_cars(1),
+	replay_speed(0),
+	replay_seek(0),
+	tire_tables(false),
+	substeps_min(10),
+	substeps_max(10),
+	substeps_tolerance(0.05),
+	low_detail_distance(0),
 	controlgrab_id(0),
 	controlgrab(false),
 	garage_camera("garagecam"),
@@ -127,8 +140,19 @@ Game::Game(std::ostream & info_out, std::ostream & error_out) :
 	particle_timer(0),
 	track(),
 	replay(timestep),
-	http("/tmp")
+	http("/tmp"),
+	pipelined(false),
+	simulation_thread(0),
+	simulation_start(0),
+	simulation_done(0),
+	simulation_lock(0),
+	simulation_running(false),
+	simulation_quit(false),
+	snapshots_fresh(false),
+	presented_frame(0),
+	presented_time(0)
 {
+	SDL_AtomicSet(&simulation_stop, 0);
 	carcontrols_local.first = NULL;
 	dynamics.setContactAddedCallback(&CarDynamics::WheelContactCallback);
 	RegisterActions();
@@ -136,7 +160,8 @@ Game::Game(std::ostream & info_out, std::ostream & error_out) :
 
 Game::~Game()
 {
-	// dtor
+	DeinitSimulationThread();
+	JobSystem::instance().Deinit();
 }
 
 /* Start the game with the given arguments... */
@@ -149,6 +174,23 @@ void Game::Start(std::list <std::string> & args)
 
 	info_output << "Starting VDrift: " << VERSION << ", Revision: " << REVISION << ", O/S: " << OS_NAME << std::endl;
 
+	InitThreading();
+
+	if (headless)
+	{
+		if (!InitHeadless() || !NewHeadlessGame())
+		{
+			error_output << "Error starting headless simulation" << std::endl;
+			LeaveHeadlessGame();
+			return;
+		}
+
+		HeadlessLoop();
+
+		LeaveHeadlessGame();
+		return;
+	}
+
 	if (!InitCoreSubsystems())
 	{
 		return;
@@ -261,10 +303,15 @@ void Game::End()
 	}
 
 	if (profilingmode)
+	{
 		info_output << "Profiling summary:\n" << PROFILER.getSummary(quickprof::PERCENT) << std::endl;
+		PrintSubsteps(info_output);
+	}
 
 	info_output << "Shutting down..." << std::endl;
 
+	DeinitSimulationThread();
+
 	LeaveGame();
 
 	// Save settings first incase later deinits cause crashes.
@@ -393,6 +440,11 @@ bool Game::InitCoreSubsystems()
 	// Init content factories
 	content.getFactory<Texture>().init(texture_size, using_gl3, settings.GetTextureCompress());
 	content.getFactory<PTree>().init(read_ini, write_ini, content);
+	content.setBudget(size_t(std::max(settings.GetContentBudget(), 0)) << 20);
+
+	pipelined = settings.GetPipelined();
+	if (pipelined)
+		InitSimulationThread();
 
 	// Init content paths
 	// Always add writeable data paths first so they are checked first
@@ -406,6 +458,41 @@ bool Game::InitCoreSubsystems()
 	return true;
 }
 
+/* Initialize the subsystems needed to run the simulation without window... */
+bool Game::InitHeadless()
+{
+	pathmanager.Init(info_output, error_output);
+
+	settings.Load(pathmanager.GetSettingsFile(), error_output);
+
+	// No graphics context, textures resolve to placeholders.
+	content.getFactory<Texture>().initHeadless();
+	content.getFactory<PTree>().init(read_ini, write_ini, content);
+	content.setBudget(size_t(std::max(settings.GetContentBudget(), 0)) << 20);
+
+	// Init content paths
+	// Always add writeable data paths first so they are checked first
+	content.addPath(pathmanager.GetWriteableDataPath());
+	content.addPath(pathmanager.GetDataPath());
+	content.addSharedPath(pathmanager.GetCarPartsPath());
+	content.addSharedPath(pathmanager.GetTrackPartsPath());
+
+	sound.Disable();
+
+	return true;
+}
+
+void Game::InitThreading()
+{
+	if (!multithreaded)
+		return;
+
+	// One job thread per processor, including the main thread.
+	// The pipelined simulation thread gets a queue of its own.
+	JobSystem::instance().Init(NUMPROCESSORS::GetNumProcessors(), 1);
+	info_output << "Job system threads: " << JobSystem::instance().GetThreadCount() << std::endl;
+}
+
 void Game::InitPlayerCar()
 {
 	Vec3 hsv;
@@ -559,6 +646,107 @@ bool Game::ParseArguments(std::list <std::string> & args)
 	}
 	arghelp["-cartest CAR"] = "Run car performance testing on given CAR.";
 
+	if (!argmap["-carsweep"].empty())
+	{
+		pathmanager.Init(info_output, error_output);
+		content.getFactory<PTree>().init(read_ini, write_ini, content);
+		content.addPath(pathmanager.GetWriteableDataPath());
+		content.addPath(pathmanager.GetDataPath());
+		content.addSharedPath(pathmanager.GetCarPartsPath());
+		content.addSharedPath(pathmanager.GetTrackPartsPath());
+
+		const std::string sweepfile = argmap["-carsweep"];
+		std::ifstream sweepstream(sweepfile.c_str());
+		if (sweepstream)
+		{
+			PTree sweep;
+			read_ini(sweepstream, sweep);
+			std::string output = "carsweep.csv";
+			sweep.get("output", output);
+
+			// one dynamics world per job thread
+			JobSystem::instance().Init(NUMPROCESSORS::GetNumProcessors());
+			PerformanceTesting::Sweep(sweep, pathmanager.GetCarsDir(), output, content, info_output, error_output);
+		}
+		else
+		{
+			error_output << "Error loading car sweep: " << sweepfile << std::endl;
+		}
+		continue_game = false;
+	}
+	arghelp["-carsweep FILE"] = "Run car performance testing on all car, tire and setup combinations in FILE (see performance_testing.h), results go to the FILE output key (default carsweep.csv).";
+
+	if (!argmap["-tracktest"].empty())
+	{
+		InitHeadless();
+
+		const std::string trackname = argmap["-tracktest"];
+		if (track.DeferredLoad(
+				content, dynamics,
+				info_output, error_output,
+				pathmanager.GetTracksPath(trackname),
+				pathmanager.GetTracksDir()+"/"+trackname,
+				pathmanager.GetEffectsTextureDir(),
+				pathmanager.GetTrackPartsPath(),
+				pathmanager.GetTrackCachePath()+"/"+trackname+".jpk",
+				0, false, false, false))
+		{
+			bool success = true;
+			while (!track.Loaded() && success)
+				success = track.ContinueDeferredLoad();
+
+			if (success)
+			{
+				PartitionTesting partitiontest;
+				partitiontest.Test(track, info_output, error_output);
+			}
+		}
+		else
+		{
+			error_output << "Error loading track: " << trackname << std::endl;
+		}
+		track.Clear();
+		continue_game = false;
+	}
+	arghelp["-tracktest TRACK"] = "Run space partitioning benchmark on given TRACK.";
+
+	if (argmap.find("-soundtest") != argmap.end())
+	{
+		const int samplers = argmap["-soundtest"].empty() ? 160 : std::max(1, cast<int>(argmap["-soundtest"]));
+		SoundTesting soundtest(samplers);
+		soundtest.Test(info_output);
+		continue_game = false;
+	}
+	arghelp["-soundtest [N]"] = "Run sound mixer benchmark with N samplers (default 160), no audio device is opened.";
+
+	if (!argmap["-trackcache"].empty())
+	{
+		InitHeadless();
+
+		// load both directions, the cache is written after loading
+		const std::string trackname = argmap["-trackcache"];
+		for (int reverse = 0; reverse < 2; ++reverse)
+		{
+			bool success = track.DeferredLoad(
+				content, dynamics,
+				info_output, error_output,
+				pathmanager.GetTracksPath(trackname),
+				pathmanager.GetTracksDir()+"/"+trackname,
+				pathmanager.GetEffectsTextureDir(),
+				pathmanager.GetTrackPartsPath(),
+				pathmanager.GetTrackCachePath()+"/"+trackname+".jpk",
+				0, reverse, false, false);
+			while (!track.Loaded() && success)
+				success = track.ContinueDeferredLoad();
+
+			if (!success)
+				error_output << "Error loading track: " << trackname << std::endl;
+			track.Clear();
+		}
+		continue_game = false;
+	}
+	arghelp["-trackcache TRACK"] = "Build the binary cache of the given TRACK.";
+
 	if (!argmap["-profile"].empty())
 	{
 		pathmanager.SetProfile(argmap["-profile"]);
@@ -634,6 +822,73 @@ bool Game::ParseArguments(std::list <std::string> & args)
 	}
 	arghelp["-benchmark"] = "Run in benchmark mode.";
 
+	if (argmap.find("-headless") != argmap.end())
+	{
+		headless = true;
+		headless_time = argmap["-headless"].empty() ? 0 : cast<float>(argmap["-headless"]);
+		if (headless_time <= 0 && !benchmode && argmap["-replay"].empty())
+			headless_time = 60;
+		info_output << "Entering headless mode." << std::endl;
+	}
+	arghelp["-headless [SECONDS]"] = "Run the simulation without graphics, sound or input for SECONDS of simulated time (default 60, or until the replay ends).";
+
+	if (!argmap["-cars"].empty())
+	{
+		headless_cars = std::max(1, cast<int>(argmap["-cars"]));
+	}
+	arghelp["-cars N"] = "Number of AI cars to simulate in headless mode.";
+
+	if (!argmap["-replay"].empty())
+	{
+		headless_replay = argmap["-replay"];
+	}
+	arghelp["-replay NAME"] = "Replay to play in headless mode.";
+
+	if (!argmap["-replayspeed"].empty())
+	{
+		replay_speed = std::max(0.0f, cast<float>(argmap["-replayspeed"]));
+	}
+	arghelp["-replayspeed N"] = "Play the headless replay at N times real time (default as fast as possible).";
+
+	if (!argmap["-replayseek"].empty())
+	{
+		replay_seek = std::max(0.0f, cast<float>(argmap["-replayseek"]));
+	}
+	arghelp["-replayseek SECONDS"] = "Start the headless replay at SECONDS.";
+
+	if (argmap.find("-tiretables") != argmap.end())
+	{
+		info_output << "Using tire force tables for AI cars." << std::endl;
+		tire_tables = true;
+	}
+	arghelp["-tiretables"] = "Use precomputed tire force tables for AI cars (faster, less accurate).";
+
+	if (!argmap["-substeps"].empty())
+	{
+		// MIN,MAX or N
+		std::istringstream s(argmap["-substeps"]);
+		char separator = 0;
+		s >> substeps_min >> separator >> substeps_max;
+		if (separator != ',')
+			substeps_max = substeps_min;
+		substeps_min = std::max(substeps_min, 1);
+		substeps_max = std::max(substeps_max, substeps_min);
+		info_output << "Car simulation substeps: " << substeps_min << " to " << substeps_max << std::endl;
+	}
+	arghelp["-substeps MIN,MAX"] = "Adapt car simulation substeps per physics step to the tire load changes (default fixed 10).";
+
+	if (!argmap["-substeptolerance"].empty())
+	{
+		substeps_tolerance = std::max(1E-3f, cast<float>(argmap["-substeptolerance"]));
+	}
+	arghelp["-substeptolerance X"] = "Max tire force change per substep relative to the tire load (default 0.05).";
+
+	if (!argmap["-lowdetail"].empty())
+	{
+		low_detail_distance = std::max(0.0f, cast<float>(argmap["-lowdetail"]));
+	}
+	arghelp["-lowdetail METERS"] = "Use low detail physics for AI cars further than METERS from the player car.";
+
 	arghelp["-render FILE"] = "Load the specified render configuration file instead of the default gl3/deferred.conf.";
 	if (!argmap["-render"].empty())
 	{
@@ -737,7 +992,7 @@ void Game::Draw(float dt)
 
 		Vec3 reflection_location = active_camera->GetPosition();
 		if (carcontrols_local.first)
-			reflection_location = ToMathVector<float>(carcontrols_local.first->GetCenterOfMass());
+			reflection_location = player_position;
 
 		Quat camlook;
 		camlook.Rotate(M_PI_2, 1, 0, 0);
@@ -773,7 +1028,7 @@ void Game::Draw(float dt)
 /* The main game loop... */
 void Game::MainLoop()
 {
-	while (!eventsystem.GetQuit() && (!benchmode || replay.GetPlaying()))
+	while (!eventsystem.GetQuit() && (!benchmode || ReplayPlaying()))
 	{
 		CalculateFPS();
 
@@ -781,10 +1036,20 @@ void Game::MainLoop()
 
 		eventsystem.BeginFrame();
 
-		// Do CPU intensive stuff in parallel with the GPU...
-		Tick(eventsystem.Get_dt());
+		if (pipelined)
+		{
+			// The simulation thread ticks on its own, draw its last published tick.
+			TickPipelined(eventsystem.Get_dt());
 
-		Draw(eventsystem.Get_dt());
+			Draw(eventsystem.Get_dt());
+		}
+		else
+		{
+			// Do CPU intensive stuff in parallel with the GPU...
+			Tick(eventsystem.Get_dt());
+
+			Draw(eventsystem.Get_dt());
+		}
 
 		eventsystem.EndFrame();
 
@@ -794,6 +1059,95 @@ void Game::MainLoop()
 	}
 }
 
+/* The headless loop, advances game logic as fast as possible... */
+void Game::HeadlessLoop()
+{
+	const unsigned int max_frames = headless_time / timestep;
+	const bool replaying = benchmode || !headless_replay.empty();
+	quickprof::Clock clock;
+
+	if (replay_seek > 0)
+	{
+		SeekReplay(replay_seek / timestep);
+		info_output << "Replay seek to " << replay_seek << " seconds took "
+			<< clock.getTimeMicroseconds() * 1E-6 << " seconds" << std::endl;
+	}
+
+	const unsigned long long start_time = clock.getTimeMicroseconds();
+
+	while ((!replaying || replay.GetPlaying()) && (max_frames == 0 || frame < max_frames))
+	{
+		frame++;
+
+		AdvanceGameLogic();
+
+		PROFILER.endCycle();
+
+		// Hold the simulation at replay_speed times real time.
+		if (replay_speed > 0)
+		{
+			const double ahead = frame * timestep / replay_speed - (clock.getTimeMicroseconds() - start_time) * 1E-6;
+			if (ahead > 1E-3)
+				SDL_Delay(ahead * 1000);
+		}
+	}
+
+	clocktime = (clock.getTimeMicroseconds() - start_time) * 1E-6;
+	const double simtime = frame * timestep;
+	info_output << "Simulated time: " << simtime << " seconds, " << frame << " frames, " << car_dynamics.size() << " cars\n";
+	info_output << "Elapsed time: " << clocktime << " seconds\n";
+	if (clocktime > 0)
+		info_output << "Simulation speed: " << simtime / clocktime << " simulated seconds per wall second\n";
+	info_output << std::endl;
+
+	if (profilingmode)
+	{
+		info_output << "Profiling summary:\n" << PROFILER.getSummary(quickprof::PERCENT) << std::endl;
+		PrintSubsteps(info_output);
+		PrintTrackStats(info_output);
+	}
+}
+
+bool Game::ReplayPlaying() const
+{
+	// The replay is advanced by the simulation thread while it runs.
+	if (simulation_running)
+		return interpolated.replay_playing;
+
+	return replay.GetPlaying();
+}
+
+void Game::SeekReplay(unsigned target_frame)
+{
+	if (!replay.GetPlaying())
+		return;
+
+	// Restore the keyframe, all cars are recorded with the same keyframes.
+	unsigned keyframe = target_frame;
+	for (int i = 0; i < car_dynamics.size(); ++i)
+	{
+		keyframe = replay.SeekFrame(i, target_frame, car_dynamics[i]);
+		car_dynamics[i].Update(replay.GetInputs(i));
+	}
+
+	// The lap timer isn't recorded, tick it up to the keyframe so that staging
+	// ends on the same frame as in straight playback. Laps before the keyframe
+	// are not counted.
+	for (; frame < keyframe; ++frame)
+	{
+		timer.Tick(timestep);
+	}
+	frame = keyframe;
+
+	// Re-simulate the remaining frames, skip ai and presentation.
+	while (frame < target_frame && replay.GetPlaying())
+	{
+		frame++;
+
+		AdvanceSimulation();
+	}
+}
+
 /* Deltat is in seconds... */
 void Game::Tick(float deltat)
 {
@@ -845,27 +1199,8 @@ void Game::AdvanceGameLogic()
 {
 	//PROFILER.beginBlock("input-processing");
 
-	eventsystem.ProcessEvents();
-
-	float car_speed = 0;
-	if (carcontrols_local.first)
-		car_speed = carcontrols_local.first->GetSpeed();
-
-	carcontrols_local.second.ProcessInput(
-			settings.GetJoyType(),
-			eventsystem,
-			timestep,
-			settings.GetJoy200(),
-			car_speed,
-			settings.GetSpeedSensitivity(),
-			window.GetW(),
-			window.GetH(),
-			settings.GetButtonRamp(),
-			settings.GetHGateShifter());
-
-	ProcessGUIInputs();
-
-	ProcessGameInputs();
+	if (!headless)
+		ProcessInputs(timestep);
 
 	//PROFILER.endBlock("input-processing");
 
@@ -877,48 +1212,559 @@ void Game::AdvanceGameLogic()
 		PROFILER.endBlock("ai");
 
 		PROFILER.beginBlock("physics");
-		dynamics.update(timestep);
+		AdvanceSimulation();
 		PROFILER.endBlock("physics");
 
-		PROFILER.beginBlock("car");
-		UpdateCars(timestep);
-		PROFILER.endBlock("car");
+		// Nothing left to simulate, the rest is presentation.
+		if (headless)
+			return;
+
+		PROFILER.beginBlock("car");
+		UpdateCars(timestep);
+		PROFILER.endBlock("car");
+
+		// Update dynamic track objects.
+		track.Update();
+
+		//PROFILER.beginBlock("particles");
+		UpdateParticles(timestep);
+		//PROFILER.endBlock("particles");
+
+		//PROFILER.beginBlock("trackmap-update");
+		UpdateTrackMap();
+		//PROFILER.endBlock("trackmap-update");
+	}
+
+	UpdateSound();
+
+	//PROFILER.beginBlock("force-feedback");
+	UpdateForceFeedback(timestep);
+	//PROFILER.endBlock("force-feedback");
+}
+
+/* One simulation step, shared by the game logic and replay seeking... */
+void Game::AdvanceSimulation()
+{
+	if (low_detail_distance > 0)
+		UpdateCarDetail();
+
+	dynamics.update(timestep);
+
+	for (int i = 0; i < car_dynamics.size(); ++i)
+	{
+		UpdateCarInputs(i);
+
+		UpdateDriftScore(i, timestep);
+	}
+
+	//PROFILER.beginBlock("timer");
+	UpdateTimer();
+	//PROFILER.endBlock("timer");
+}
+
+/* Pipelined tick, the simulation runs free on its own thread... */
+void Game::TickPipelined(float deltat)
+{
+	// Same minimum fps as Tick, for input ramps.
+	const float maxtime = 0.1;
+	if (deltat > maxtime)
+		deltat = maxtime;
+
+	http.Tick();
+
+	ProcessInputs(deltat);
+
+	// The simulation is stopped while paused, the game can be left or loaded safely.
+	if (pause)
+	{
+		StopSimulation();
+	}
+	else
+	{
+		PublishInputs();
+		StartSimulation();
+	}
+
+	PresentSimulation();
+
+	if (dumpfps && displayframe % 100 == 0)
+	{
+		info_output << "Current FPS: " << eventsystem.GetFPS() << std::endl;
+	}
+
+	UpdateParticleGraphics();
+
+	gui.Update(eventsystem.Get_dt());
+}
+
+/* Wall clock time in seconds, shared by the main and the simulation thread... */
+static double GetTime()
+{
+	return SDL_GetPerformanceCounter() / double(SDL_GetPerformanceFrequency());
+}
+
+void Game::PresentSimulation()
+{
+	SDL_LockMutex(simulation_lock);
+	if (snapshots_fresh)
+	{
+		snapshots.swapLast();
+		snapshots_fresh = false;
+	}
+	SDL_UnlockMutex(simulation_lock);
+
+	const Snapshot & prev = snapshots.getLast().prev;
+	const Snapshot & last = snapshots.getLast().last;
+
+	// The last tick is presented a timestep after it was due,
+	// interpolated from the previous tick up to then.
+	float alpha = 1;
+	if (simulation_running)
+		alpha = std::min(std::max(float((GetTime() - last.time) / timestep), 0.0f), 1.0f);
+
+	// Presented simulation time, it doesn't advance while paused.
+	const double time = (double(last.frame) - 1 + alpha) * timestep;
+	const float dt = std::min(std::max(float(time - presented_time), 0.0f), 0.1f);
+	presented_time = time;
+
+	if (!pause)
+	{
+		PROFILER.beginBlock("car");
+		interpolated.Interpolate(prev, last, alpha);
+
+		assert(interpolated.bodies.size() <= car_graphics.size());
+		int player = -1;
+		size_t body = 0;
+		for (size_t i = 0; i < interpolated.bodies.size(); ++i)
+		{
+			car_graphics[i].Update(interpolated.inputs[i]);
+			car_graphics[i].Update(&interpolated.positions[body], &interpolated.rotations[body], interpolated.gears[i]);
+			body += interpolated.bodies[i];
+
+			if (&car_dynamics[i] == carcontrols_local.first)
+				player = i;
+		}
+
+		// Sounds follow the ticks, crash detection needs the time between them.
+		if (interpolated.frame != presented_frame)
+		{
+			const float ticks_dt = std::min((interpolated.frame - presented_frame) * timestep, 0.1f);
+			for (size_t i = 0; i < interpolated.sounds.size(); ++i)
+			{
+				car_sounds[i].Update(interpolated.sounds[i], ticks_dt);
+			}
+			presented_frame = interpolated.frame;
+		}
+
+		if (player >= 0)
+		{
+			player_position = interpolated.centers[player];
+
+			if (settings.GetHUD() != "NoHud")
+				UpdateHUD(interpolated.hud, interpolated.inputs[player]);
+
+			UpdatePlayer(player, interpolated.camera_position, interpolated.camera_rotation, dt);
+		}
+		PROFILER.endBlock("car");
+
+		if (dt > 0 && !interpolated.emitter_rates.empty())
+		{
+			AddTireSmokeParticles(
+				&interpolated.emitter_positions[0],
+				&interpolated.emitter_rates[0],
+				interpolated.emitter_rates.size(), dt);
+			UpdateParticles(dt);
+		}
+
+		// Dynamic track objects, interpolated like the cars.
+		if (!interpolated.track_positions.empty())
+			track.Update(&interpolated.track_positions[0], &interpolated.track_rotations[0]);
+
+		UpdateTrackMap(interpolated.centers);
+	}
+
+	// Ai and physics debug drawing read the live state, only while stopped.
+	if (!simulation_running)
+	{
+		ai.Visualize();
+
+		if (dynamics_drawmode && track.Loaded())
+		{
+			dynamicsdraw.clear();
+			dynamics.debugDrawWorld();
+		}
+	}
+
+	UpdateSound();
+
+	UpdateForceFeedback(interpolated.feedback, dt);
+}
+
+int Game::SimulationMain(void * data)
+{
+	Game & game = *static_cast<Game*>(data);
+
+	// Physics and ai jobs go to the simulation's own queue, not the main thread's.
+	JobSystem::instance().RegisterThread();
+
+	while (true)
+	{
+		SDL_SemWait(game.simulation_start);
+		if (game.simulation_quit)
+			break;
+
+		game.RunSimulation();
+		SDL_SemPost(game.simulation_done);
+	}
+	return 0;
+}
+
+void Game::RunSimulation()
+{
+	// Same minimum fps as Tick, time further behind is dropped.
+	const double maxtime = 0.1;
+
+	double due = GetTime() + timestep;
+	while (!SDL_AtomicGet(&simulation_stop))
+	{
+		const double now = GetTime();
+		if (now < due)
+		{
+			SDL_Delay(Uint32((due - now) * 1000));
+			continue;
+		}
+
+		if (now - due > maxtime)
+			due = now - maxtime;
+
+		SimulateTick(due);
+
+		due += timestep;
+	}
+}
+
+/* The simulation gets its own thread rather than a job, so that threads
+ * helping with jobs while drawing can't pick it up and run it inline... */
+void Game::InitSimulationThread()
+{
+	if (simulation_thread)
+		return;
+
+	SDL_AtomicSet(&simulation_stop, 0);
+	simulation_quit = false;
+	simulation_running = false;
+	simulation_start = SDL_CreateSemaphore(0);
+	simulation_done = SDL_CreateSemaphore(0);
+	simulation_lock = SDL_CreateMutex();
+	simulation_thread = SDL_CreateThread(&Game::SimulationMain, "Simulation", this);
+}
+
+void Game::DeinitSimulationThread()
+{
+	if (!simulation_thread)
+		return;
+
+	StopSimulation();
+	simulation_quit = true;
+	SDL_SemPost(simulation_start);
+	SDL_WaitThread(simulation_thread, NULL);
+	SDL_DestroySemaphore(simulation_start);
+	SDL_DestroySemaphore(simulation_done);
+	SDL_DestroyMutex(simulation_lock);
+	simulation_thread = 0;
+	simulation_start = 0;
+	simulation_done = 0;
+	simulation_lock = 0;
+}
+
+void Game::StartSimulation()
+{
+	if (simulation_running || !simulation_thread)
+		return;
+
+	SDL_AtomicSet(&simulation_stop, 0);
+	simulation_running = true;
+	SDL_SemPost(simulation_start);
+}
+
+void Game::StopSimulation()
+{
+	if (!simulation_running)
+		return;
+
+	SDL_AtomicSet(&simulation_stop, 1);
+	SDL_SemWait(simulation_done);
+	simulation_running = false;
+}
+
+void Game::PublishInputs()
+{
+	const std::vector<float> & inputs = carcontrols_local.second.GetInputs();
+	std::vector<float> & published = simulation_inputs.car;
+	assert(inputs.size() >= published.size());
+
+	SDL_LockMutex(simulation_lock);
+
+	// Analog inputs, the last frame wins.
+	for (int i = CarInput::THROTTLE; i < CarInput::SHIFT_UP; ++i)
+	{
+		published[i] = inputs[i];
+	}
+
+	// Button presses are kept until a tick takes them, so that they are
+	// neither lost nor applied twice when frames and ticks don't line up.
+	for (int i = CarInput::SHIFT_UP; i < CarInput::NEUTRAL; ++i)
+	{
+		published[i] = std::max(published[i], inputs[i]);
+	}
+	published[CarInput::ROLLOVER] = std::max(published[CarInput::ROLLOVER], inputs[CarInput::ROLLOVER]);
+
+	// Gear selection, the last frame selecting a gear wins.
+	bool select = false;
+	for (int i = CarInput::NEUTRAL; i <= CarInput::REVERSE; ++i)
+	{
+		select = select || inputs[i];
+	}
+	if (select)
+	{
+		for (int i = CarInput::NEUTRAL; i <= CarInput::REVERSE; ++i)
+		{
+			published[i] = inputs[i];
+		}
+	}
+
+	simulation_inputs.debug_info = settings.GetDebugInfo();
+
+	SDL_UnlockMutex(simulation_lock);
+}
+
+/* Simulation part of AdvanceGameLogic, runs on the simulation thread while the main
+ * thread draws. It must not touch scene nodes, sound or the profiler... */
+void Game::SimulateTick(double time)
+{
+	// Take the published inputs, button presses and gear selections apply to one tick.
+	SDL_LockMutex(simulation_lock);
+	simulation_tick_inputs = simulation_inputs;
+	std::fill(simulation_inputs.car.begin() + CarInput::SHIFT_UP, simulation_inputs.car.end(), 0.0f);
+	SDL_UnlockMutex(simulation_lock);
+
+	simulation_car_inputs.resize(car_dynamics.size(), std::vector<float>(CarInput::INVALID, 0.0f));
+
+	frame++;
+
+	ai.Update(timestep, &car_dynamics[0], car_dynamics.size());
+
+	AdvanceSimulation();
+
+	StoreSnapshot(time);
+}
+
+void Game::StoreSnapshot(double time)
+{
+	SnapshotPair & pair = snapshots.getFirst();
+	pair.prev = snapshot_prev;
+
+	Snapshot & snapshot = pair.last;
+	snapshot.positions.clear();
+	snapshot.rotations.clear();
+	snapshot.bodies.clear();
+	snapshot.centers.clear();
+	snapshot.gears.clear();
+	snapshot.emitter_positions.clear();
+	snapshot.emitter_rates.clear();
+	snapshot.sounds.resize(car_dynamics.size());
+	snapshot.inputs = simulation_car_inputs;
+	snapshot.inputs.resize(car_dynamics.size(), std::vector<float>(CarInput::INVALID, 0.0f));
+	for (int i = 0; i < car_dynamics.size(); ++i)
+	{
+		const CarDynamics & car = car_dynamics[i];
+		for (unsigned int b = 0; b < car.GetNumBodies(); ++b)
+		{
+			snapshot.positions.push_back(ToMathVector<float>(car.GetPosition(b)));
+			snapshot.rotations.push_back(ToQuaternion<float>(car.GetOrientation(b)));
+		}
+		snapshot.bodies.push_back(car.GetNumBodies());
+		snapshot.centers.push_back(ToMathVector<float>(car.GetCenterOfMass()));
+		snapshot.gears.push_back(car.GetTransmission().GetGear());
+		CarSound::GetInfo(car, snapshot.sounds[i]);
+		for (int w = 0; w < WHEEL_POSITION_SIZE; ++w)
+		{
+			const WheelPosition wp = WheelPosition(w);
+			snapshot.emitter_positions.push_back(ToMathVector<float>(car.GetWheelContact(wp).GetPosition()));
+			snapshot.emitter_rates.push_back(car.GetTireSquealAmount(wp));
+		}
+	}
+
+	track.GetBodyTransforms(snapshot.track_positions, snapshot.track_rotations);
+
+	snapshot.camera_position = Vec3();
+	snapshot.camera_rotation = Quat();
+	snapshot.hud = HudInfo();
+	snapshot.feedback = 0;
+	snapshot.speed = 0;
+	for (int i = 0; i < car_dynamics.size(); ++i)
+	{
+		const CarDynamics & car = car_dynamics[i];
+		if (&car != carcontrols_local.first)
+			continue;
+
+		snapshot.camera_position = ToMathVector<float>(car.GetPosition());
+		snapshot.camera_rotation = ToQuaternion<float>(car.GetOrientation());
+		GetHudInfo(i, simulation_tick_inputs.debug_info, snapshot.hud);
+		snapshot.feedback = car.GetFeedback();
+		snapshot.speed = car.GetSpeed();
+	}
+
+	snapshot.replay_playing = replay.GetPlaying();
+	snapshot.frame = frame;
+	snapshot.time = time;
+
+	snapshot_prev = snapshot;
+
+	SDL_LockMutex(simulation_lock);
+	snapshots.swapFirst();
+	snapshots_fresh = true;
+	SDL_UnlockMutex(simulation_lock);
+}
+
+static void Interpolate(const std::vector<Vec3> & prev, const std::vector<Vec3> & last, float alpha, std::vector<Vec3> & out)
+{
+	if (prev.size() != last.size())
+	{
+		out = last;
+		return;
+	}
+
+	out.resize(last.size());
+	for (size_t n = 0; n < last.size(); ++n)
+	{
+		out[n] = prev[n] + (last[n] - prev[n]) * alpha;
+	}
+}
+
+static void Interpolate(const std::vector<Quat> & prev, const std::vector<Quat> & last, float alpha, std::vector<Quat> & out)
+{
+	if (prev.size() != last.size())
+	{
+		out = last;
+		return;
+	}
+
+	out.resize(last.size());
+	for (size_t n = 0; n < last.size(); ++n)
+	{
+		out[n] = prev[n].QuatSlerp(last[n], alpha);
+	}
+}
+
+Game::HudInfo::HudInfo() :
+	gear(0),
+	speed(0),
+	max_speed(0),
+	rpm(0),
+	rpm_limit(0),
+	redline(0),
+	abs_active(false),
+	tcs_active(false),
+	fuel(false),
+	nos(false),
+	place(0, 0),
+	lap(0),
+	drift_score(0),
+	staging_time_left(0),
+	drifting(false),
+	this_drift_score(0),
+	time(0),
+	last_lap(0),
+	best_lap(0)
+{
+	// ctor
+}
+
+Game::Snapshot::Snapshot() :
+	feedback(0),
+	speed(0),
+	replay_playing(false),
+	frame(0),
+	time(0)
+{
+	// ctor
+}
+
+void Game::Snapshot::Interpolate(const Snapshot & prev, const Snapshot & last, float alpha)
+{
+	::Interpolate(prev.positions, last.positions, alpha, positions);
+	::Interpolate(prev.rotations, last.rotations, alpha, rotations);
+	::Interpolate(prev.centers, last.centers, alpha, centers);
+	::Interpolate(prev.track_positions, last.track_positions, alpha, track_positions);
+	::Interpolate(prev.track_rotations, last.track_rotations, alpha, track_rotations);
+	::Interpolate(prev.emitter_positions, last.emitter_positions, alpha, emitter_positions);
+	bodies = last.bodies;
+	gears = last.gears;
+	sounds = last.sounds;
+	inputs = last.inputs;
+	emitter_rates = last.emitter_rates;
+	camera_position = prev.camera_position + (last.camera_position - prev.camera_position) * alpha;
+	camera_rotation = prev.camera_rotation.QuatSlerp(last.camera_rotation, alpha);
+	hud = last.hud;
+	feedback = last.feedback;
+	speed = last.speed;
+	replay_playing = last.replay_playing;
+	frame = last.frame;
+	time = last.time;
+}
+
+Game::PlayerInputs::PlayerInputs() :
+	car(CarInput::INVALID, 0.0f),
+	debug_info(false)
+{
+	// ctor
+}
+
+void Game::ProcessInputs(float dt)
+{
+	eventsystem.ProcessEvents();
+
+	float car_speed = 0;
+	if (pipelined)
+		car_speed = interpolated.speed;
+	else if (carcontrols_local.first)
+		car_speed = carcontrols_local.first->GetSpeed();
 
-		// Update dynamic track objects.
-		track.Update();
+	carcontrols_local.second.ProcessInput(
+			settings.GetJoyType(),
+			eventsystem,
+			dt,
+			settings.GetJoy200(),
+			car_speed,
+			settings.GetSpeedSensitivity(),
+			window.GetW(),
+			window.GetH(),
+			settings.GetButtonRamp(),
+			settings.GetHGateShifter());
 
-		//PROFILER.beginBlock("timer");
-		UpdateTimer();
-		//PROFILER.endBlock("timer");
+	ProcessGUIInputs();
 
-		//PROFILER.beginBlock("particles");
-		UpdateParticles(timestep);
-		//PROFILER.endBlock("particles");
+	ProcessGameInputs();
+}
 
-		//PROFILER.beginBlock("trackmap-update");
-		UpdateTrackMap();
-		//PROFILER.endBlock("trackmap-update");
-	}
+void Game::UpdateSound()
+{
+	if (!sound.Enabled())
+		return;
 
-	if (sound.Enabled())
+	PROFILER.beginBlock("sound");
+	Vec3 pos;
+	Quat rot;
+	if (active_camera)
 	{
-		PROFILER.beginBlock("sound");
-		Vec3 pos;
-		Quat rot;
-		if (active_camera)
-		{
-			pos = active_camera->GetPosition();
-			rot = active_camera->GetOrientation();
-		}
-		sound.SetListenerPosition(pos[0], pos[1], pos[2]);
-		sound.SetListenerRotation(rot[0], rot[1], rot[2], rot[3]);
-		sound.Update(pause);
-		PROFILER.endBlock("sound");
+		pos = active_camera->GetPosition();
+		rot = active_camera->GetOrientation();
 	}
-
-	//PROFILER.beginBlock("force-feedback");
-	UpdateForceFeedback(timestep);
-	//PROFILER.endBlock("force-feedback");
+	sound.SetListenerPosition(pos[0], pos[1], pos[2]);
+	sound.SetListenerRotation(rot[0], rot[1], rot[2], rot[3]);
+	sound.Update(pause);
+	PROFILER.endBlock("sound");
 }
 
 /* Process inputs used only for higher level game functions... */
@@ -1049,15 +1895,73 @@ void Game::UpdateTimer()
 	//timer.DebugPrint(info_output);
 }
 
+void Game::PrintSubsteps(std::ostream & out) const
+{
+	out << "Substeps:\n";
+	for (int i = 0; i < car_dynamics.size(); ++i)
+	{
+		out << "car " << i << ": " << car_dynamics[i].GetAverageSubsteps() << "\n";
+	}
+}
+
+void Game::PrintTrackStats(std::ostream & out) const
+{
+	PatchRayStats stats;
+	for (int i = 0; i < car_dynamics.size(); ++i)
+	{
+		const PatchRayStats & car = car_dynamics[i].GetRayStats();
+		stats.rays += car.rays;
+		stats.coherent_hits += car.coherent_hits;
+	}
+	track.debugPrint(out, &stats);
+}
+
+void Game::UpdateCarDetail()
+{
+	if (car_dynamics.size() == 0)
+		return;
+
+	// distance to the first (player) car, not the camera, so replays and
+	// headless runs pick the same detail as the recording
+	const btVector3 center = car_dynamics[0].GetPosition();
+
+	// switch back a bit closer to avoid toggling at the boundary
+	const btScalar far2 = low_detail_distance * low_detail_distance;
+	const btScalar near2 = far2 * 0.8;
+	for (int i = 0; i < car_dynamics.size(); ++i)
+	{
+		CarDynamics & car = car_dynamics[i];
+		if (i == 0 || &car == carcontrols_local.first)
+			continue;
+
+		btScalar dist2 = (car.GetPosition() - center).length2();
+		if (dist2 > far2)
+			car.SetLowDetail(true);
+		else if (dist2 < near2)
+			car.SetLowDetail(false);
+	}
+}
+
 void Game::UpdateTrackMap()
 {
-	std::list <std::pair<Vec3, bool> > carpositions;
+	std::vector<Vec3> centers;
+	centers.reserve(car_dynamics.size());
 	for (int i = 0; i != car_dynamics.size(); ++i)
 	{
-		const CarDynamics & car = car_dynamics[i];
-		bool player = (carcontrols_local.first == &car);
-		Vec3 carpos = ToMathVector<float>(car.GetCenterOfMass());
-		carpositions.push_back(std::make_pair(carpos, player));
+		centers.push_back(ToMathVector<float>(car_dynamics[i].GetCenterOfMass()));
+	}
+
+	UpdateTrackMap(centers);
+}
+
+void Game::UpdateTrackMap(const std::vector<Vec3> & centers)
+{
+	assert(centers.size() <= car_dynamics.size());
+	std::list <std::pair<Vec3, bool> > carpositions;
+	for (size_t i = 0; i != centers.size(); ++i)
+	{
+		bool player = (carcontrols_local.first == &car_dynamics[i]);
+		carpositions.push_back(std::make_pair(centers[i], player));
 	}
 
 	trackmap.Update(settings.GetTrackmap(), carpositions);
@@ -1230,15 +2134,11 @@ void Game::UpdateCars(float dt)
 {
 	for (int i = 0; i < car_dynamics.size(); ++i)
 	{
-		UpdateCarInputs(i);
-
 		car_graphics[i].Update(car_dynamics[i]);
 
 		car_sounds[i].Update(car_dynamics[i], dt);
 
 		AddTireSmokeParticles(car_dynamics[i], dt);
-
-		UpdateDriftScore(i, dt);
 	}
 }
 
@@ -1247,7 +2147,6 @@ void Game::UpdateCarInputs(const int carid)
 	assert(carid >= 0 && carid < car_dynamics.size());
 	CarDynamics & car = car_dynamics[carid];
 	CarGraphics & car_gfx = car_graphics[carid];
-	CarSound & car_snd = car_sounds[carid];
 
 	std::vector <float> carinputs(CarInput::INVALID, 0.0f);
 	if (replay.GetPlaying())
@@ -1261,7 +2160,8 @@ void Game::UpdateCarInputs(const int carid)
 	}
 	else if (carcontrols_local.first == &car)
 	{
-		carinputs = carcontrols_local.second.GetInputs();
+		// The main thread publishes the local controls for the simulation thread.
+		carinputs = pipelined ? simulation_tick_inputs.car : carcontrols_local.second.GetInputs();
 #ifdef VISUALIZE_AI_DEBUG
 		// It allows to activate the AI on the player car with F9 button.
 		// AI will override player inputs.
@@ -1312,19 +2212,45 @@ void Game::UpdateCarInputs(const int carid)
 	}
 
 	car.Update(carinputs);
-	car_gfx.Update(carinputs);
+
+	// Presented from the tick snapshots when pipelined.
+	if (pipelined)
+		simulation_car_inputs[carid] = carinputs;
+	else
+		car_gfx.Update(carinputs);
 
 	// Record car state.
 	if (replay.GetRecording())
 		replay.RecordFrame(carid, carinputs, car);
 
 	// Local player input processing starts here.
-	if (carcontrols_local.first != &car)
+	if (carcontrols_local.first != &car || pipelined)
 		return;
 
+	player_position = ToMathVector<float>(car.GetCenterOfMass());
+
 	// Update player HUD
 	if (settings.GetHUD() != "NoHud")
-		UpdateHUD(carid, carinputs);
+	{
+		HudInfo hud;
+		GetHudInfo(carid, settings.GetDebugInfo(), hud);
+		UpdateHUD(hud, carinputs);
+	}
+
+	Vec3 pos = ToMathVector<float>(car.GetPosition());
+	Quat rot = ToQuaternion<float>(car.GetOrientation());
+	UpdatePlayer(carid, pos, rot, timestep);
+}
+
+void Game::UpdatePlayer(
+	const int carid,
+	const Vec3 & carpos,
+	const Quat & carrot,
+	const float dt)
+{
+	assert(carid >= 0 && carid < car_graphics.size());
+	CarGraphics & car_gfx = car_graphics[carid];
+	CarSound & car_snd = car_sounds[carid];
 
 	// Handle camera mode change inputs.
 	Camera * old_camera = active_camera;
@@ -1359,8 +2285,8 @@ void Game::UpdateCarInputs(const int carid)
 	settings.SetCamera(camera_id);
 
 	// handle rear view
-	Vec3 pos = ToMathVector<float>(car.GetPosition());
-	Quat rot = ToQuaternion<float>(car.GetOrientation());
+	Vec3 pos = carpos;
+	Quat rot = carrot;
 	if (carcontrol.GetInput(GameInput::VIEW_REAR))
 		rot.Rotate(M_PI, 0, 0, 1);
 
@@ -1368,12 +2294,12 @@ void Game::UpdateCarInputs(const int carid)
 	if (old_camera != active_camera)
 		active_camera->Reset(pos, rot);
 	else
-		active_camera->Update(pos, rot, timestep);
+		active_camera->Update(pos, rot, dt);
 
 	// Handle camera inputs.
-	float left = timestep * (carcontrol.GetInput(GameInput::PAN_LEFT) - carcontrol.GetInput(GameInput::PAN_RIGHT));
-	float up = timestep * (carcontrol.GetInput(GameInput::PAN_UP) - carcontrol.GetInput(GameInput::PAN_DOWN));
-	float dy = timestep * (carcontrol.GetInput(GameInput::ZOOM_IN) - carcontrol.GetInput(GameInput::ZOOM_OUT));
+	float left = dt * (carcontrol.GetInput(GameInput::PAN_LEFT) - carcontrol.GetInput(GameInput::PAN_RIGHT));
+	float up = dt * (carcontrol.GetInput(GameInput::PAN_UP) - carcontrol.GetInput(GameInput::PAN_DOWN));
+	float dy = dt * (carcontrol.GetInput(GameInput::ZOOM_IN) - carcontrol.GetInput(GameInput::ZOOM_OUT));
 	Vec3 zoom(Direction::Forward * 4 * dy);
 	active_camera->Rotate(up, left);
 	active_camera->Move(zoom[0], zoom[1], zoom[2]);
@@ -1387,24 +2313,60 @@ void Game::UpdateCarInputs(const int carid)
 	graphics->SetCloseShadow(incar ? 1.0 : 5.0);
 }
 
-void Game::UpdateHUD(const int carid, const std::vector<float> & carinputs)
+void Game::GetHudInfo(const int carid, const bool debug_info, HudInfo & hud)
 {
 	assert(carid >= 0 && carid < car_dynamics.size());
 	const CarDynamics & car = car_dynamics[carid];
+
+	for (int i = 0; i < 4; ++i)
+	{
+		hud.debug_info[i].clear();
+	}
+	if (debug_info)
+	{
+		std::ostringstream info[4];
+		car.DebugPrint(info[0], true, false, false, false);
+		car.DebugPrint(info[1], false, true, false, false);
+		car.DebugPrint(info[2], false, false, true, false);
+		car.DebugPrint(info[3], false, false, false, true);
+		for (int i = 0; i < 4; ++i)
+		{
+			hud.debug_info[i] = info[i].str();
+		}
+	}
+
+	hud.gear = car.GetTransmission().GetGear();
+	hud.speed = car.GetSpeedMPS();
+	hud.max_speed = car.GetMaxSpeedMPS();
+	hud.rpm = car.GetTachoRPM();
+	hud.rpm_limit = car.GetEngine().GetRPMLimit();
+	hud.redline = car.GetEngine().GetRedline();
+	hud.abs_active = car.GetABSActive();
+	hud.tcs_active = car.GetTCSActive();
+	hud.fuel = car.GetFuelAmount() != 0;
+	hud.nos = car.GetNosAmount() != 0;
+
+	hud.place = timer.GetPlayerPlace();
+	hud.lap = timer.GetPlayerCurrentLap();
+	hud.drift_score = timer.GetDriftScore(carid);
+	hud.staging_time_left = timer.GetStagingTimeLeft();
+	hud.drifting = timer.GetIsDrifting(carid);
+	hud.this_drift_score = timer.GetThisDriftScore(carid);
+	hud.time = timer.GetPlayerTime();
+	hud.last_lap = timer.GetLastLap();
+	hud.best_lap = timer.GetBestLap();
+}
+
+void Game::UpdateHUD(const HudInfo & hud, const std::vector<float> & carinputs)
+{
 	const GuiLanguage & lang = gui.GetLanguageDict();
 
 	if (settings.GetDebugInfo())
 	{
-		std::ostringstream debug_info[4];
-		car.DebugPrint(debug_info[0], true, false, false, false);
-		car.DebugPrint(debug_info[1], false, true, false, false);
-		car.DebugPrint(debug_info[2], false, false, true, false);
-		car.DebugPrint(debug_info[3], false, false, false, true);
-
-		signal_debug_info[0](debug_info[0].str());
-		signal_debug_info[1](debug_info[1].str());
-		signal_debug_info[2](debug_info[2].str());
-		signal_debug_info[3](debug_info[3].str());
+		signal_debug_info[0](hud.debug_info[0]);
+		signal_debug_info[1](hud.debug_info[1]);
+		signal_debug_info[2](hud.debug_info[2]);
+		signal_debug_info[3](hud.debug_info[3]);
 	}
 
 	if (settings.GetInputGraph())
@@ -1419,38 +2381,38 @@ void Game::UpdateHUD(const int carid, const std::vector<float> & carinputs)
 		signal_brake(brakestr.str());
 	}
 
-	std::pair <int, int> curplace = timer.GetPlayerPlace();
+	const std::pair <int, int> & curplace = hud.place;
 	std::ostringstream placestr;
 	placestr << curplace.first << " / " << curplace.second;
 
-	int cur_lap = std::max(1, std::min(timer.GetPlayerCurrentLap(), race_laps));
+	int cur_lap = std::max(1, std::min(hud.lap, race_laps));
 	std::ostringstream lapstr;
 	if (race_laps > 0)
 		lapstr << cur_lap << " / " << race_laps;
 	else
 		lapstr << "0 / 0";
 
-	int score = timer.GetDriftScore(carid);
+	int score = hud.drift_score;
 	std::ostringstream scorestr;
 	scorestr << score;
 
 	std::ostringstream msgstr;
 	if (race_laps > 0)
 	{
-		float stagingtimeleft = timer.GetStagingTimeLeft();
+		float stagingtimeleft = hud.staging_time_left;
 		if (stagingtimeleft > 0.5)
 			msgstr << (int)stagingtimeleft + 1;
 		else if (stagingtimeleft > 0.0)
 			msgstr << lang("Ready");
 		else if (stagingtimeleft < 0.0 && stagingtimeleft > -1.0)
 			msgstr << lang("GO");
-		else if (timer.GetPlayerCurrentLap() > race_laps)
+		else if (hud.lap > race_laps)
 			msgstr << ((curplace.first == 1) ? lang("You won!") : lang("You lost"));
 	}
-	if (msgstr.tellp() <= 0 && timer.GetIsDrifting(carid))
-		msgstr << "+" << (int)timer.GetThisDriftScore(carid);
+	if (msgstr.tellp() <= 0 && hud.drifting)
+		msgstr << "+" << (int)hud.this_drift_score;
 
-	int gear = car.GetTransmission().GetGear();
+	int gear = hud.gear;
 	std::ostringstream gearstr;
 	if (gear == -1)
 		gearstr << "R";
@@ -1460,12 +2422,12 @@ void Game::UpdateHUD(const int carid, const std::vector<float> & carinputs)
 		gearstr << gear;
 
 	float speed_scale = (settings.GetMPH() ? 2.237 : 3.6);
-	float speed = std::fabs(car.GetSpeedMPS()) * speed_scale;
-	float speedometer = car.GetMaxSpeedMPS() * speed_scale;
+	float speed = std::fabs(hud.speed) * speed_scale;
+	float speedometer = hud.max_speed * speed_scale;
 	speedometer = std::min(320.0f, std::max(120.0f, std::ceil(speedometer / 40.0f) * 40.0f));
 
-	float rpm = car.GetTachoRPM();
-	float tachometer = car.GetEngine().GetRPMLimit();
+	float rpm = hud.rpm;
+	float tachometer = hud.rpm_limit;
 	tachometer = std::min(20000.0f, std::max(8000.0f, std::ceil(tachometer / 2000.0f) * 2000.0f));
 
 	std::ostringstream speedostr, speednstr, speedstr;
@@ -1474,20 +2436,20 @@ void Game::UpdateHUD(const int carid, const std::vector<float> & carinputs)
 	speedstr << std::setfill('0') << std::setw(3) << int(speed);
 
 	std::ostringstream shiftstr, tachostr, rpmnstr, rpmstr;
-	shiftstr << int(rpm >= car.GetEngine().GetRedline());
+	shiftstr << int(rpm >= hud.redline);
 	tachostr << int(tachometer);
 	rpmnstr << rpm / tachometer;
 	rpmstr << int(rpm);
 
 	std::ostringstream absstr, tcsstr, gasstr, nosstr;
-	absstr << (car.GetABSActive() ? 1.0 : 0.3);
-	tcsstr << (car.GetTCSActive() ? 1.0 : 0.3);
-	gasstr << (car.GetFuelAmount() ? 0.3 : 1.0);
-	nosstr << ((car.GetNosAmount() && carinputs[CarInput::NOS]) ? 1.0 : 0.3);
+	absstr << (hud.abs_active ? 1.0 : 0.3);
+	tcsstr << (hud.tcs_active ? 1.0 : 0.3);
+	gasstr << (hud.fuel ? 0.3 : 1.0);
+	nosstr << ((hud.nos && carinputs[CarInput::NOS]) ? 1.0 : 0.3);
 
-	signal_lap_time[0](GetTimeString(timer.GetPlayerTime()));
-	signal_lap_time[1](GetTimeString(timer.GetLastLap()));
-	signal_lap_time[2](GetTimeString(timer.GetBestLap()));
+	signal_lap_time[0](GetTimeString(hud.time));
+	signal_lap_time[1](GetTimeString(hud.last_lap));
+	signal_lap_time[2](GetTimeString(hud.best_lap));
 
 	signal_pos(placestr.str());
 	signal_lap(lapstr.str());
@@ -1554,15 +2516,29 @@ bool Game::NewGame(bool playreplay, bool addopponents, int num_laps)
 		return false;
 	}
 
+	// Decode car content on the job threads, player car first.
+	for (size_t i = 0; i < cars_num; ++i)
+	{
+		const int priority = (car_info[i].driver == "user") ? 1 : -int(i);
+		PrefetchCar(car_info[i], priority, sound.Enabled());
+	}
+
 	// Load cars.
 	car_dynamics.reserve(cars_num);
 	car_graphics.reserve(cars_num);
 	car_sounds.reserve(cars_num);
 	for (size_t i = 0; i < cars_num; ++i)
 	{
+		// Create the content decoded so far, textures need the main thread.
+		content.update();
+
 		if (!LoadCar(car_info[i], track.GetStart(i).first, track.GetStart(i).second, sound.Enabled()))
+		{
+			content.wait();
 			return false;
+		}
 	}
+	content.wait();
 
 	// Load timer.
 	float pretime = (num_laps > 0) ? 3.0f : 0.0f;
@@ -1622,22 +2598,131 @@ bool Game::NewGame(bool playreplay, bool addopponents, int num_laps)
 			}
 		}
 
-		replay.StartRecording(car_info, settings.GetTrack(), error_output);
+		replay.StartRecording(car_info, settings.GetTrack(), pathmanager.GetReplayPath() + "/recording.tmp", error_output);
 	}
 
 	// Clean up asset cache.
 	content.sweep();
+	if (profilingmode)
+		content.logStats(info_output);
 
 	// Set up GUI.
 	gui.SetInGame(true);
 	gui.ActivatePage("Hud", 0.25, error_output);
 
+	// Publish the initial state, presented until the first tick.
+	if (pipelined)
+		StoreSnapshot(0);
+
 	// not strictly needed, is expected to be called by Hud page onfocus event
 	ContinueGame();
 
 	return true;
 }
 
+bool Game::NewHeadlessGame()
+{
+	race_laps = 0;
+
+	std::string trackname = settings.GetTrack();
+	if (benchmode || !headless_replay.empty())
+	{
+		const std::string replayfilename = pathmanager.GetReplayPath() + "/" +
+			(benchmode ? std::string("benchmark.vdr") : headless_replay);
+		info_output << "Loading replay file: " << replayfilename << std::endl;
+
+		if (!replay.StartPlaying(replayfilename, error_output))
+			return false;
+
+		trackname = replay.GetTrack();
+		car_info = replay.GetCarInfo();
+	}
+	else
+	{
+		// All cars are driven by the ai, the player car is used as template.
+		InitPlayerCar();
+		car_info.resize(headless_cars, car_info[0]);
+		for (size_t i = 0; i < car_info.size(); ++i)
+		{
+			car_info[i].driver = Ai::default_type;
+		}
+	}
+
+	info_output << "Loading track: " << trackname << std::endl;
+	if (!track.DeferredLoad(
+		content, dynamics,
+		info_output, error_output,
+		pathmanager.GetTracksPath(trackname),
+		pathmanager.GetTracksDir()+"/"+trackname,
+		pathmanager.GetEffectsTextureDir(),
+		pathmanager.GetTrackPartsPath(),
+		pathmanager.GetTrackCachePath()+"/"+trackname+".jpk",
+		settings.GetAnisotropy(),
+		settings.GetTrackReverse(),
+		settings.GetTrackDynamic(),
+		false))
+	{
+		error_output << "Error loading track: " << trackname << std::endl;
+		return false;
+	}
+
+	bool success = true;
+	while (!track.Loaded() && success)
+	{
+		success = track.ContinueDeferredLoad();
+	}
+
+	if (!success)
+	{
+		error_output << "Error loading track (deferred): " << trackname << std::endl;
+		return false;
+	}
+
+	const size_t cars_num = car_info.size();
+	car_dynamics.reserve(cars_num);
+	car_graphics.reserve(cars_num);
+	car_sounds.reserve(cars_num);
+	for (size_t i = 0; i < cars_num; ++i)
+	{
+		if (!LoadCar(car_info[i], track.GetStart(i).first, track.GetStart(i).second, false))
+			return false;
+	}
+
+	if (!timer.Load(pathmanager.GetTrackRecordsPath()+"/"+trackname+".txt", 0.0f))
+	{
+		error_output << "Unable to load timer" << std::endl;
+		return false;
+	}
+
+	for (int i = 0; i < car_dynamics.size(); ++i)
+	{
+		timer.AddCar(car_info[i].name);
+	}
+
+	content.sweep();
+	content.logStats(info_output);
+
+	pause = false;
+
+	return true;
+}
+
+void Game::LeaveHeadlessGame()
+{
+	pause = true;
+
+	ai.ClearCars();
+
+	if (replay.GetPlaying())
+		replay.Reset();
+
+	track.Clear();
+	car_dynamics.clear();
+	car_graphics.clear();
+	car_sounds.clear();
+	timer.Unload();
+}
+
 std::string Game::GetReplayRecordingFilename()
 {
 	// Get time.
@@ -1655,6 +2740,95 @@ std::string Game::GetReplayRecordingFilename()
 	return s.str();
 }
 
+// queue textures and mesh of a drawable, see LoadDrawable
+static void PrefetchDrawable(
+	const std::string & meshname,
+	const std::vector<std::string> & texname,
+	const std::string & path,
+	const int anisotropy,
+	const int priority,
+	ContentManager & content)
+{
+	TextureInfo texinfo;
+	texinfo.mipmap = true;
+	texinfo.anisotropy = anisotropy;
+	for (size_t i = 0; i < texname.size() && i < 3; ++i)
+	{
+		// don't compress normal map
+		texinfo.compress = (i < 2);
+		content.loadAsync<Texture>(path, texname[i], texinfo, priority);
+	}
+	content.loadAsync<Model>(path, meshname, priority);
+}
+
+// queue drawables of config section and its subsections
+static void PrefetchDrawables(
+	const PTree & cfg,
+	const std::string & path,
+	const int anisotropy,
+	const int priority,
+	ContentManager & content)
+{
+	std::string meshname;
+	std::vector<std::string> texname;
+	if (cfg.get("texture", texname) && cfg.get("mesh", meshname))
+		PrefetchDrawable(meshname, texname, path, anisotropy, priority, content);
+
+	for (PTree::const_iterator i = cfg.begin(); i != cfg.end(); ++i)
+		PrefetchDrawables(i->second, path, anisotropy, priority, content);
+}
+
+void Game::PrefetchCar(const CarInfo & info, const int priority, const bool sound_enabled)
+{
+	const size_t n0 = info.name.find("/");
+	const size_t n1 = info.name.length();
+	const std::string carname = info.name.substr(n0 + 1, n1 - n0 - 1);
+	const std::string cardir = pathmanager.GetCarsDir() + "/" + info.name.substr(0, n0);
+
+	std::tr1::shared_ptr<PTree> carconf;
+	if (!info.config.empty() || !content.load(carconf, cardir, carname + ".car"))
+		return;
+
+	if (!headless)
+	{
+		// body texture is replaced by paint, selected wheel overrides the wheel config
+		const int anisotropy = settings.GetAnisotropy();
+		for (PTree::const_iterator i = carconf->begin(); i != carconf->end(); ++i)
+		{
+			if (i->first == "body")
+			{
+				std::string meshname;
+				std::vector<std::string> texname;
+				if (!i->second.get("texture", texname) || !i->second.get("mesh", meshname))
+					continue;
+				if (info.paint != "default")
+					texname[0] = info.paint;
+				PrefetchDrawable(meshname, texname, cardir, anisotropy, priority, content);
+			}
+			else if (i->first != "wheel" || info.wheel == "default")
+			{
+				PrefetchDrawables(i->second, cardir, anisotropy, priority, content);
+			}
+		}
+	}
+
+	if (sound_enabled)
+	{
+		// see CarSound::Load
+		const char * sounds[] = {
+			"tire_squeal", "gravel", "grass", "bump_rear", "bump_front",
+			"crash", "gear", "brake", "handbrake", "wind"};
+		for (size_t i = 0; i < sizeof(sounds) / sizeof(sounds[0]); ++i)
+		{
+			content.loadAsync<SoundBuffer>(cardir, sounds[i], priority);
+		}
+		if (!std::ifstream((cardir + "/" + carname + ".aud").c_str()))
+		{
+			content.loadAsync<SoundBuffer>(cardir, "engine", priority);
+		}
+	}
+}
+
 bool Game::LoadCar(
 	const CarInfo & info,
 	const Vec3 & position,
@@ -1688,7 +2862,7 @@ bool Game::LoadCar(
 
 	car_graphics.push_back(CarGraphics());
 	CarGraphics & car_gfx = car_graphics.back();
-	if (!car_gfx.Load(
+	if (!headless && !car_gfx.Load(
 		*carconf, cardir, carname, info.wheel, info.paint, color,
 		settings.GetAnisotropy(), settings.GetCameraBounce(),
 		content, error_output))
@@ -1725,15 +2899,22 @@ bool Game::LoadCar(
 	}
 
 	bool isai = (info.driver != "user");
-	if (!isai)
-		carcontrols_local.first = &car;
-	else
+	if (isai)
 		ai.AddCar(&car, info.ailevel, info.driver);
+	else if (!headless)
+	{
+		carcontrols_local.first = &car;
+		player_position = ToMathVector<float>(car.GetCenterOfMass());
+	}
 
 	car.SetAutoClutch(settings.GetAutoClutch() || isai);
 	car.SetAutoShift(settings.GetAutoShift() || isai);
 	car.SetABS(settings.GetABS() || isai);
 	car.SetTCS(settings.GetTCS() || isai);
+	car.SetTireTables(tire_tables && isai);
+	if (isai && low_detail_distance > 0)
+		car.BuildTireTables();
+	car.SetSubsteps(substeps_min, substeps_max, substeps_tolerance);
 
 	info_output << "Car loading was successful: " << info.name << std::endl;
 
@@ -1751,6 +2932,7 @@ bool Game::LoadTrack(const std::string & trackname)
 		pathmanager.GetTracksDir()+"/"+trackname,
 		pathmanager.GetEffectsTextureDir(),
 		pathmanager.GetTrackPartsPath(),
+		pathmanager.GetTrackCachePath()+"/"+trackname+".jpk",
 		settings.GetAnisotropy(),
 		settings.GetTrackReverse(),
 		settings.GetTrackDynamic(),
@@ -1761,16 +2943,20 @@ bool Game::LoadTrack(const std::string & trackname)
 	}
 
 	bool success = true;
-	int count = 0;
 	int count_max = track.ObjectsNum();
 	int displayevery = count_max / 50;
+	int displayed = -displayevery;
 	while (!track.Loaded() && success)
 	{
-		if (displayevery == 0 || count % displayevery == 0)
+		// objects are loaded in batches, show progress every few percent
+		int count = track.ObjectsNumLoaded();
+		if (count - displayed >= displayevery)
+		{
 			ShowLoadingScreen(count, count_max, "");
+			displayed = count;
+		}
 
 		success = track.ContinueDeferredLoad();
-		count++;
 	}
 
 	if (!success)
@@ -1833,6 +3019,7 @@ void Game::LoadGarage()
 		pathmanager.GetSkinsDir() + "/" + settings.GetSkin(),
 		pathmanager.GetEffectsTextureDir(),
 		pathmanager.GetTrackPartsPath(),
+		std::string(),
 		settings.GetAnisotropy(),
 		track_reverse, track_dynamic,
 		graphics->GetShadows()))
@@ -1842,16 +3029,20 @@ void Game::LoadGarage()
 	}
 
 	bool success = true;
-	int count = 0;
 	int count_max = track.ObjectsNum();
 	int displayevery = count_max / 50;
+	int displayed = -displayevery;
 	while (!track.Loaded() && success)
 	{
-		if (displayevery == 0 || count % displayevery == 0)
+		// objects are loaded in batches, show progress every few percent
+		int count = track.ObjectsNumLoaded();
+		if (count - displayed >= displayevery)
+		{
 			ShowLoadingScreen(count, count_max, "");
+			displayed = count;
+		}
 
 		success = track.ContinueDeferredLoad();
-		count++;
 	}
 
 	if (!success)
@@ -1948,7 +3139,7 @@ void Game::CalculateFPS()
 	fps_avg /= 10.0;
 
 	// Don't start looking an min/max until we've put out a few frames.
-	if (fps_min == 0 && frame > 20)
+	if (fps_min == 0 && displayframe > 20)
 	{
 		fps_max = fps_avg;
 		fps_min = fps_avg;
@@ -1969,11 +3160,18 @@ void Game::CalculateFPS()
 		signal_fps(fpsstr.str());
 	}
 
-	if (profilingmode && frame % 10 == 0)
+	if (profilingmode && displayframe % 10 == 0)
 	{
 		std::string cpuProfile = PROFILER.getAvgSummary(quickprof::MICROSECONDS);
 		std::ostringstream summary;
-		summary << "CPU:\n" << cpuProfile << "\n\nGPU:\n";
+		summary << "CPU:\n" << cpuProfile << "\n\n";
+		// Car stats are simulation state.
+		if (!simulation_running)
+		{
+			PrintSubsteps(summary);
+			PrintTrackStats(summary);
+		}
+		summary << "\nGPU:\n";
 		graphics->printProfilingInfo(summary);
 		profiling_text.Revise(summary.str());
 	}
@@ -2269,6 +3467,8 @@ void Game::PopulateValueLists(std::map<std::string, GuiOption::List> & valuelist
 void Game::ProcessNewSettings()
 {
 	// Update the game with any new setting changes that have just been made.
+	// The car settings are simulation state, the next tick restarts the simulation.
+	StopSimulation();
 
 	if (track.Loaded())
 	{
@@ -2412,6 +3612,15 @@ bool Game::Download(const std::vector <std::string> & urls)
 }
 
 void Game::UpdateForceFeedback(float dt)
+{
+	float feedback = 0;
+	if (carcontrols_local.first)
+		feedback = carcontrols_local.first->GetFeedback();
+
+	UpdateForceFeedback(feedback, dt);
+}
+
+void Game::UpdateForceFeedback(float feedback, float dt)
 {
 	const float ffdt = 0.02;
 
@@ -2422,8 +3631,6 @@ void Game::UpdateForceFeedback(float dt)
 		{
 			ff_update_time = 0.0;
 
-			float feedback = carcontrols_local.first->GetFeedback();
-
 			// scale
 			feedback = feedback * settings.GetFFGain();
 
@@ -2445,19 +3652,27 @@ void Game::UpdateForceFeedback(float dt)
 }
 
 void Game::AddTireSmokeParticles(const CarDynamics & car, float dt)
+{
+	Vec3 positions[4];
+	float rates[4];
+	for (int i = 0; i < 4; i++)
+	{
+		positions[i] = ToMathVector<float>(car.GetWheelContact(WheelPosition(i)).GetPosition());
+		rates[i] = car.GetTireSquealAmount(WheelPosition(i));
+	}
+	AddTireSmokeParticles(positions, rates, 4, dt);
+}
+
+void Game::AddTireSmokeParticles(const Vec3 positions[], const float rates[], int count, float dt)
 {
 	// Only spawn particles every so often...
-	unsigned int interval = 0.2 / dt;
+	unsigned int interval = std::max(1.0f, 0.2f / dt);
 	if (particle_timer % interval == 0)
 	{
-		for (int i = 0; i < 4; i++)
+		for (int i = 0; i < count; i++)
 		{
-			float squeal = car.GetTireSquealAmount(WheelPosition(i));
-			if (squeal > 0)
-			{
-				btVector3 p = car.GetWheelContact(WheelPosition(i)).GetPosition();
-				tire_smoke.AddParticle(ToMathVector<float>(p), 0.5);
-			}
+			if (rates[i] > 0)
+				tire_smoke.AddParticle(positions[i], 0.5);
 		}
 	}
 }
@@ -2594,6 +3809,14 @@ void Game::LeaveGame()
 	car_dynamics.clear();
 	car_graphics.clear();
 	car_sounds.clear();
+	snapshots.getFirst() = SnapshotPair();
+	snapshots.getSecond() = SnapshotPair();
+	snapshots.getLast() = SnapshotPair();
+	snapshots_fresh = false;
+	snapshot_prev = Snapshot();
+	interpolated = Snapshot();
+	presented_frame = 0;
+	simulation_car_inputs.clear();
 	sound.Update(true);
 	trackmap.Unload();
 	timer.Unload();
@@ -2614,6 +3837,9 @@ void Game::StartRace()
 
 void Game::PauseGame()
 {
+	// Leaving and loading games goes through here, nothing is simulated while paused.
+	StopSimulation();
+
 	if (settings.GetMouseGrab())
 		window.ShowMouseCursor(true);
 
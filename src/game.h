@@ -52,6 +52,8 @@
 #include "content/contentmanager.h"
 #include "updatemanager.h"
 #include "game_downloader.h"
+#include "jobsystem.h"
+#include "tripplebuffer.h"
 
 #include "BulletCollision/CollisionDispatch/btDefaultCollisionConfiguration.h"
 #include "BulletCollision/BroadphaseCollision/btDbvtBroadphase.h"
@@ -79,10 +81,15 @@ private:
 
 	void MainLoop();
 
+	/// Run the simulation without window, graphics, sound or input.
+	void HeadlessLoop();
+
 	bool ParseArguments(std::list <std::string> & args);
 
 	bool InitCoreSubsystems();
 
+	bool InitHeadless();
+
 	void InitThreading();
 
 	void InitPlayerCar();
@@ -95,18 +102,83 @@ private:
 
 	void Tick(float dt);
 
+	/// Process inputs and hand them to the simulation thread, present the
+	/// last published simulation tick. The simulation runs on its own clock
+	/// while unpaused, it is never waited for.
+	void TickPipelined(float dt);
+
+	/// Present the last published snapshots, interpolated to the current time.
+	void PresentSimulation();
+
+	/// simulation thread, runs the simulation between start and stop requests
+	static int SimulationMain(void * data);
+
+	/// Tick the simulation every timestep of wall clock time until stopped.
+	void RunSimulation();
+
+	void InitSimulationThread();
+
+	void DeinitSimulationThread();
+
+	/// Start the free running simulation if it isn't running.
+	void StartSimulation();
+
+	/// Stop the simulation and wait for it, game state is safe to touch afterwards.
+	void StopSimulation();
+
+	/// Hand the local car inputs of this frame to the simulation thread.
+	void PublishInputs();
+
+	/// Advance the simulation by one tick due at time, no presentation.
+	void SimulateTick(double time);
+
+	/// Store the state presented for the last simulation tick and publish it.
+	void StoreSnapshot(double time);
+
 	void Draw();
 
 	void AdvanceGameLogic();
 
+	/// Advance car physics, car inputs and lap timing by one timestep.
+	/// Shared by the game logic, the simulation thread and replay seeking.
+	void AdvanceSimulation();
+
+	/// Process events, car control, GUI and game inputs.
+	void ProcessInputs(float dt);
+
+	/// Update sound listener and sources.
+	void UpdateSound();
+
+	/// Update car graphics, sounds and tire smoke.
 	void UpdateCars(float dt);
 
 	void UpdateCarInputs(const int carid);
 
-	void UpdateHUD(const int carid, const std::vector<float> & carinputs);
+	/// Update camera and interior view of the local car.
+	void UpdatePlayer(
+		const int carid,
+		const Vec3 & carpos,
+		const Quat & carrot,
+		const float dt);
+
+	struct HudInfo;
+
+	/// Get the car and lap timing values shown by the HUD.
+	void GetHudInfo(const int carid, const bool debug_info, HudInfo & hud);
+
+	void UpdateHUD(const HudInfo & hud, const std::vector<float> & carinputs);
 
 	void UpdateTimer();
 
+	/// Average car simulation substeps per physics step
+	void PrintSubsteps(std::ostream & out) const;
+
+	/// Print track statistics, wheel ray counts summed over all cars.
+	void PrintTrackStats(std::ostream & out) const;
+
+	/// Switch cars far from the player car to low detail physics
+	void UpdateCarDetail();
+
 	/// Check eventsystem state and update GUI
 	void ProcessGUIInputs();
 
@@ -120,6 +192,22 @@ private:
 
 	bool NewGame(bool playreplay=false, bool opponents=false, int num_laps=0);
 
+	bool NewHeadlessGame();
+
+	void LeaveHeadlessGame();
+
+	/// Replay playback state, safe to call while the simulation runs.
+	bool ReplayPlaying() const;
+
+	/// Jump replay playback to frame. Car states are restored from the
+	/// nearest earlier keyframe, the remaining frames are re-simulated.
+	/// Lap timing is not recorded, laps before the keyframe are not counted
+	/// and the timer is not rewound when seeking backwards.
+	void SeekReplay(unsigned frame);
+
+	/// Queue car textures, meshes and sounds to be decoded on the job threads.
+	void PrefetchCar(const CarInfo & carinfo, const int priority, const bool sound_enabled);
+
 	bool LoadCar(
 		const CarInfo & carinfo,
 		const Vec3 & position,
@@ -166,6 +254,9 @@ private:
 
 	void UpdateTrackMap();
 
+	/// Update the track map from car centers of mass, in car order.
+	void UpdateTrackMap(const std::vector<Vec3> & centers);
+
 	void ShowLoadingScreen(float progress, float progress_max, const std::string & optional_text);
 
 	void ProcessNewSettings();
@@ -179,8 +270,14 @@ private:
 
 	void UpdateForceFeedback(float dt);
 
+	/// Update force feedback from the local car feedback value.
+	void UpdateForceFeedback(float feedback, float dt);
+
 	void AddTireSmokeParticles(const CarDynamics & car, float dt);
 
+	/// Spawn tire smoke at the emitters, rates are tire squeal amounts.
+	void AddTireSmokeParticles(const Vec3 positions[], const float rates[], int count, float dt);
+
 	void UpdateParticles(float dt);
 
 	void UpdateParticleGraphics();
@@ -328,6 +425,17 @@ private:
 	bool benchmode;
 	bool dumpfps;
 	bool pause;
+	bool headless;
+	float headless_time; ///< simulated seconds to run in headless mode
+	size_t headless_cars; ///< number of ai cars in headless mode
+	std::string headless_replay; ///< replay to play in headless mode
+	float replay_speed; ///< headless replay speed relative to real time, 0 is unlimited
+	float replay_seek; ///< headless replay start time in seconds
+	bool tire_tables; ///< use tire force tables for ai cars
+	int substeps_min; ///< car simulation substeps per physics step, adaptive if min < max
+	int substeps_max;
+	float substeps_tolerance; ///< max tire force change per substep relative to the tire load
+	float low_detail_distance; ///< ai cars further away from the camera use low detail physics, 0 is off
 
 	std::vector <EventSystem::Joystick> controlgrab_joystick_state;
 	std::pair <int,int> controlgrab_mouse_coords;
@@ -371,6 +479,97 @@ private:
 
 	std::auto_ptr <ForceFeedback> forcefeedback;
 	double ff_update_time;
+
+	/// local car values shown by the HUD
+	struct HudInfo
+	{
+		std::string debug_info[4]; ///< empty unless debug info is enabled
+		int gear;
+		float speed;
+		float max_speed;
+		float rpm;
+		float rpm_limit;
+		float redline;
+		bool abs_active;
+		bool tcs_active;
+		bool fuel;
+		bool nos;
+		std::pair<int, int> place;
+		int lap;
+		int drift_score;
+		float staging_time_left;
+		bool drifting;
+		float this_drift_score;
+		float time;
+		float last_lap;
+		float best_lap;
+
+		HudInfo();
+	};
+
+	/// state presented after a simulation tick
+	struct Snapshot
+	{
+		std::vector<Vec3> positions; ///< car bodies of all cars in order
+		std::vector<Quat> rotations;
+		std::vector<unsigned int> bodies; ///< number of bodies per car
+		std::vector<Vec3> centers; ///< car centers of mass
+		std::vector<int> gears;
+		std::vector<CarSoundInfo> sounds;
+		std::vector< std::vector<float> > inputs; ///< car inputs of the tick
+		std::vector<Vec3> track_positions; ///< dynamic track bodies
+		std::vector<Quat> track_rotations;
+		std::vector<Vec3> emitter_positions; ///< tire smoke emitters, wheel contacts of all cars in order
+		std::vector<float> emitter_rates; ///< tire squeal at the emitters
+		Vec3 camera_position; ///< camera target, local car body
+		Quat camera_rotation;
+		HudInfo hud; ///< local car
+		float feedback; ///< local car force feedback
+		float speed; ///< local car speed
+		bool replay_playing;
+		unsigned int frame; ///< simulation frame of the tick
+		double time; ///< wall clock time the tick was due at
+
+		Snapshot();
+
+		/// interpolate transforms from prev to last, the rest is taken from last
+		void Interpolate(const Snapshot & prev, const Snapshot & last, float alpha);
+	};
+
+	/// last two simulation ticks, published together
+	struct SnapshotPair
+	{
+		Snapshot prev;
+		Snapshot last;
+	};
+
+	/// local player inputs handed to the simulation thread
+	struct PlayerInputs
+	{
+		std::vector<float> car; ///< local car inputs
+		bool debug_info; ///< fill in the HUD debug info
+
+		PlayerInputs();
+	};
+
+	bool pipelined; ///< simulation runs on its own thread while drawing
+	SDL_Thread * simulation_thread;
+	SDL_sem * simulation_start; ///< posted to start the simulation
+	SDL_sem * simulation_done; ///< posted once the simulation has stopped
+	SDL_mutex * simulation_lock; ///< guards snapshot swaps and the published inputs
+	SDL_atomic_t simulation_stop; ///< set to stop the simulation
+	bool simulation_running; ///< started and not stopped, main thread only
+	bool simulation_quit;
+	TrippleBuffer<SnapshotPair> snapshots; ///< simulation writes first, main thread reads last
+	bool snapshots_fresh; ///< a pair has been published since the last read
+	Snapshot snapshot_prev; ///< last stored tick, simulation thread only
+	Snapshot interpolated; ///< presented state, main thread only
+	unsigned int presented_frame; ///< simulation frame of the presented sounds
+	double presented_time; ///< simulation time presented by the last frame
+	PlayerInputs simulation_inputs; ///< published by the main thread, taken by the next tick
+	PlayerInputs simulation_tick_inputs; ///< inputs of the current tick, simulation thread only
+	std::vector< std::vector<float> > simulation_car_inputs; ///< car inputs of the current tick
+	Vec3 player_position; ///< local car center of mass, reflection sample location
 };
 
 #endif
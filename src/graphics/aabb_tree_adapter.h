@@ -20,17 +20,15 @@
 #ifndef _AABB_TREE_ADAPTER_H
 #define _AABB_TREE_ADAPTER_H
 
-#include "aabbtree.h"
+#include "aabbbvh.h"
 #include <vector>
 
-#define OBJECTS_PER_NODE 64
+#define OBJECTS_PER_NODE 8
 
 template <typename T>
 class AabbTreeNodeAdapter
 {
 public:
-	AabbTreeNodeAdapter() : count(0) {}
-
 	void push_back(T * drawable)
 	{
 		Vec3 objpos(drawable->GetObjectCenter());
@@ -43,7 +41,7 @@ public:
 
 	unsigned int size() const
 	{
-		return count;
+		return spacetree.size();
 	}
 
 	void clear()
@@ -54,18 +52,17 @@ public:
 	void Optimize()
 	{
 		spacetree.Optimize();
-		count = spacetree.size();
 	}
 
-	template <typename U>
-	void Query(const U & object, std::vector <T*> & output) const
+	/// output is a std::vector <T*> or anything else with push_back(T*)
+	template <typename U, typename V>
+	void Query(const U & object, V & output) const
 	{
 		spacetree.Query(object, output);
 	}
 
 private:
-	AabbTreeNode <T*,OBJECTS_PER_NODE> spacetree;
-	unsigned int count; ///< cached from spacetree.size()
+	AabbBvh <T*,OBJECTS_PER_NODE> spacetree;
 };
 
 /// adapter helper functor
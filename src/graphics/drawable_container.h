@@ -52,6 +52,19 @@ struct SetAlpha
 		}
 	}
 };
+struct SetTransform
+{
+	SetTransform(const Mat4 & newtransform) : transform(newtransform) {}
+	const Mat4 & transform;
+	template <typename T>
+	void operator()(T & container)
+	{
+		for (typename T::iterator i = container.begin(); i != container.end(); i++)
+		{
+			i->SetTransform(transform);
+		}
+	}
+};
 struct ClearContainer
 {
 	template <typename T>
@@ -153,6 +166,15 @@ struct DrawableContainer
 		#undef X
 	}
 
+	/// appends the drawable pointers of this pointer container to the second
+	template <template <typename UU> class ContainerU>
+	void AppendPointersTo(DrawableContainer <ContainerU> & dest) const
+	{
+		#define X(Y) dest.Y.insert(dest.Y.end(), Y.begin(), Y.end());
+		DRAWABLES_LIST
+		#undef X
+	}
+
 	/// this is slow, don't do it often
 	reseatable_reference <Container <Drawable> > GetByName(const std::string & name)
 	{
@@ -197,6 +219,11 @@ struct DrawableContainer
 		ForEach(DrawableContainerHelper::SetAlpha(a));
 	}
 
+	void SetTransform(const Mat4 & transform)
+	{
+		ForEach(DrawableContainerHelper::SetTransform(transform));
+	}
+
 	#undef DRAWABLES_LIST
 };
 
@@ -0,0 +1,203 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#include "frustum_culler.h"
+#include "jobsystem.h"
+#include "simd4.h"
+#include "unittest.h"
+
+#include <cassert>
+
+FrustumCuller::FrustumCuller() :
+	count(0),
+	inclusive(false)
+{
+	// ctor
+}
+
+void FrustumCuller::Clear()
+{
+	x.clear();
+	y.clear();
+	z.clear();
+	r.clear();
+	frusta.clear();
+	visible.clear();
+	count = 0;
+}
+
+int FrustumCuller::AddSphere(const Vec3 & center, float radius)
+{
+	x.push_back(center[0]);
+	y.push_back(center[1]);
+	z.push_back(center[2]);
+	r.push_back(radius);
+	return count++;
+}
+
+int FrustumCuller::AddFrustum(const Frustum & frustum)
+{
+	assert(frusta.size() < MAX_FRUSTA);
+	frusta.push_back(frustum);
+	return frusta.size() - 1;
+}
+
+void FrustumCuller::Cull(bool inclusive)
+{
+	this->inclusive = inclusive;
+
+	// pad to full blocks
+	const int blocks = (count + 3) / 4;
+	x.resize(blocks * 4, 0.0f);
+	y.resize(blocks * 4, 0.0f);
+	z.resize(blocks * 4, 0.0f);
+	r.resize(blocks * 4, 0.0f);
+	visible.resize(count);
+
+	JobSystem::instance().Run(CullBlocks, this, 0, blocks, 16);
+}
+
+void FrustumCuller::CullBlocks(void * data, int begin, int end)
+{
+	FrustumCuller & c = *static_cast<FrustumCuller*>(data);
+	for (int b = begin; b < end; ++b)
+	{
+		const int i = b * 4;
+		const Simd4f cx = Simd4f::Load(&c.x[i]);
+		const Simd4f cy = Simd4f::Load(&c.y[i]);
+		const Simd4f cz = Simd4f::Load(&c.z[i]);
+		const Simd4f nr = -Simd4f::Load(&c.r[i]);
+
+		unsigned mask[4] = {0, 0, 0, 0};
+		for (size_t f = 0; f < c.frusta.size(); ++f)
+		{
+			// same evaluation order as the scalar plane test
+			const float (*p)[4] = c.frusta[f].frustum;
+			Simd4f culled(0.0f);
+			for (int n = 0; n < 6; ++n)
+			{
+				const Simd4f rd =
+					Simd4f(p[n][0]) * cx +
+					Simd4f(p[n][1]) * cy +
+					Simd4f(p[n][2]) * cz +
+					Simd4f(p[n][3]);
+				culled = Or(culled, c.inclusive ? CmpLe(rd, nr) : CmpLt(rd, nr));
+			}
+
+			const int in = ~MoveMask(culled);
+			for (int k = 0; k < 4; ++k)
+			{
+				mask[k] |= unsigned((in >> k) & 1) << f;
+			}
+		}
+
+		const int n = (c.count - i < 4) ? c.count - i : 4;
+		for (int k = 0; k < n; ++k)
+		{
+			c.visible[i + k] = mask[k];
+		}
+	}
+}
+
+// scalar reference, inclusive like the gl2 renderer culling
+static bool CullSphere(const Frustum & f, const Vec3 & center, float radius, bool inclusive)
+{
+	for (int i = 0; i < 6; i++)
+	{
+		const float rd =
+			f.frustum[i][0] * center[0] +
+			f.frustum[i][1] * center[1] +
+			f.frustum[i][2] * center[2] +
+			f.frustum[i][3];
+		if (inclusive ? rd <= -radius : rd < -radius)
+			return true;
+	}
+	return false;
+}
+
+// axis aligned box of half extent size as frustum, planes facing inwards
+static Frustum BoxFrustum(float size)
+{
+	Frustum frustum;
+	for (int n = 0; n < 6; ++n)
+	{
+		for (int k = 0; k < 3; ++k)
+			frustum.frustum[n][k] = 0.0f;
+		frustum.frustum[n][n / 2] = (n % 2) ? -1.0f : 1.0f;
+		frustum.frustum[n][3] = size;
+	}
+	return frustum;
+}
+
+QT_TEST(frustum_culler_test)
+{
+	FrustumCuller culler;
+	for (int f = 0; f < 3; ++f)
+	{
+		culler.AddFrustum(BoxFrustum(2.0f + f));
+	}
+
+	std::vector<Vec3> centers;
+	std::vector<float> radii;
+	for (int i = 0; i < 23; ++i)
+	{
+		centers.push_back(Vec3(i * 0.5f - 5.0f, i * 0.1f, -i * 0.2f));
+		radii.push_back((i % 4) * 0.25f);
+	}
+
+	// spheres exactly touching a plane of the first frustum from outside
+	centers.push_back(Vec3(-2.5f, 0.0f, 0.0f));
+	radii.push_back(0.5f);
+	centers.push_back(Vec3(0.0f, 3.25f, 1.0f));
+	radii.push_back(1.25f);
+	centers.push_back(Vec3(0.0f, 0.0f, -2.0f));
+	radii.push_back(0.0f);
+
+	for (size_t i = 0; i < centers.size(); ++i)
+	{
+		culler.AddSphere(centers[i], radii[i]);
+	}
+
+	for (int mode = 0; mode < 2; ++mode)
+	{
+		const bool inclusive = (mode == 1);
+		culler.Cull(inclusive);
+
+		bool match = true;
+		int visible = 0;
+		for (int i = 0; i < culler.GetSphereCount(); ++i)
+		{
+			for (int f = 0; f < culler.GetFrustumCount(); ++f)
+			{
+				const bool v = !CullSphere(BoxFrustum(2.0f + f), centers[i], radii[i], inclusive);
+				match = match && (v == culler.Visible(i, f));
+				visible += v;
+			}
+		}
+		QT_CHECK(match);
+		QT_CHECK(visible > 0 && visible < culler.GetSphereCount() * 3);
+
+		// touching spheres are culled only if inclusive
+		for (int i = 23; i < culler.GetSphereCount(); ++i)
+		{
+			QT_CHECK_EQUAL(culler.Visible(i, 0), !inclusive);
+			QT_CHECK(culler.Visible(i, 1));
+		}
+	}
+}
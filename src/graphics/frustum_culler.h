@@ -0,0 +1,83 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef _FRUSTUM_CULLER_H
+#define _FRUSTUM_CULLER_H
+
+#include "mathvector.h"
+#include "frustum.h"
+
+#include <vector>
+
+/// Tests bounding spheres against up to 32 frusta at once. The spheres are
+/// packed as structure of arrays, four spheres are tested against a frustum
+/// plane per SIMD operation. Sphere blocks are split across the job threads.
+class FrustumCuller
+{
+public:
+	enum {MAX_FRUSTA = 32};
+
+	FrustumCuller();
+
+	/// remove spheres and frusta
+	void Clear();
+
+	/// returns sphere index
+	int AddSphere(const Vec3 & center, float radius);
+
+	/// returns frustum index, at most MAX_FRUSTA frusta
+	int AddFrustum(const Frustum & frustum);
+
+	/// a sphere is culled if it is behind a frustum plane by more than its radius
+	/// or by exactly its radius if inclusive is set
+	void Cull(bool inclusive = false);
+
+	/// true if sphere has not been culled by frustum
+	bool Visible(int sphere, int frustum) const
+	{
+		return (visible[sphere] >> frustum) & 1;
+	}
+
+	/// frusta bit mask of sphere
+	unsigned GetVisible(int sphere) const
+	{
+		return visible[sphere];
+	}
+
+	int GetSphereCount() const
+	{
+		return count;
+	}
+
+	int GetFrustumCount() const
+	{
+		return frusta.size();
+	}
+
+private:
+	std::vector<float> x, y, z, r; ///< padded to four spheres
+	std::vector<Frustum> frusta;
+	std::vector<unsigned> visible;
+	int count;
+	bool inclusive;
+
+	static void CullBlocks(void * data, int begin, int end);
+};
+
+#endif // _FRUSTUM_CULLER_H
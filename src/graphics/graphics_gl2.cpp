@@ -25,6 +25,13 @@
 #include "uniforms.h"
 #include "vertexattrib.h"
 #include "sky.h"
+#include "jobsystem.h"
+#include "quickprof.h"
+
+// profiler counter handles, updated every frame
+static const quickprof::Counter drawlist_allocations = PROFILER.getCounter("draw list allocations");
+static const quickprof::Counter scenegraph_nodes = PROFILER.getCounter("scenegraph nodes");
+static const quickprof::Counter scenegraph_drawables = PROFILER.getCounter("scenegraph drawables");
 
 /// array end ptr
 template <typename T, size_t N>
@@ -215,24 +222,6 @@ static void AttachCubeSide(int i, FrameBufferObject & reflection_fbo, std::ostre
 	CheckForOpenGLErrors("cubemap generation: FBO cube side attachment", error_output);
 }
 
-static bool Cull(const Frustum & f, const Drawable & d)
-{
-	const float radius = d.GetRadius();
-	Vec3 center = d.GetObjectCenter();
-	d.GetTransform().TransformVectorOut(center[0], center[1], center[2]);
-	for (int i = 0; i < 6; i++)
-	{
-		const float rd =
-			f.frustum[i][0] * center[0] +
-			f.frustum[i][1] * center[1] +
-			f.frustum[i][2] * center[2] +
-			f.frustum[i][3];
-		if (rd <= -radius)
-			return true;
-	}
-	return false;
-}
-
 GraphicsGL2::GraphicsGL2() :
 	initialized(false),
 	max_anisotropy(0),
@@ -442,8 +431,11 @@ void GraphicsGL2::BindStaticVertexData(std::vector<SceneNode*> nodes)
 
 void GraphicsGL2::AddDynamicNode(SceneNode & node)
 {
-	Mat4 identity;
-	node.Traverse(dynamic_drawlist, identity);
+	SceneNode::Stats stats;
+	node.Update(stats);
+	node.GetDrawablePtrList().AppendPointersTo(dynamic_drawlist);
+	PROFILER.addCount(scenegraph_nodes, stats.nodes);
+	PROFILER.addCount(scenegraph_drawables, stats.drawables);
 }
 
 void GraphicsGL2::AddStaticNode(SceneNode & node)
@@ -597,10 +589,11 @@ void GraphicsGL2::SetupScene(
 
 	// do fast culling queries for static geometry per pass
 	ClearCulledDrawLists();
-	for (std::vector <GraphicsConfigPass>::const_iterator i = config.passes.begin(); i != config.passes.end(); i++)
+	for (size_t i = 0; i < config.passes.size(); i++)
 	{
-		CullScenePass(*i, error_output);
+		CullScenePass(config.passes[i], pass_drawlists[i], error_output);
 	}
+	CullDrawLists();
 
 	renderscene.SetFSAA(fsaa);
 	renderscene.SetContrast(contrast);
@@ -626,13 +619,14 @@ void GraphicsGL2::DrawScene(std::ostream & error_output)
 	glstate.ResetVertexObject();
 
 	// draw the passes
-	for (std::vector <GraphicsConfigPass>::const_iterator i = config.passes.begin(); i != config.passes.end(); i++)
+	for (size_t i = 0; i < config.passes.size(); i++)
 	{
-		assert(!i->draw.empty());
-		if (i->draw.back() != "postprocess")
-			DrawScenePass(*i, error_output);
+		const GraphicsConfigPass & pass = config.passes[i];
+		assert(!pass.draw.empty());
+		if (pass.draw.back() != "postprocess")
+			DrawScenePass(pass, pass_drawlists[i], error_output);
 		else
-			DrawScenePassPost(*i, error_output);
+			DrawScenePassPost(pass, error_output);
 	}
 
 	// reset texture and draw buffer
@@ -784,6 +778,8 @@ bool GraphicsGL2::EnableShaders(std::ostream & info_output, std::ostream & error
 	CheckForOpenGLErrors("EnableShaders: shader unload", error_output);
 
 	// unload inputs/outputs
+	pass_drawlists.clear();
+	culled_drawlists.clear();
 	render_outputs.clear();
 	texture_outputs.clear();
 	texture_inputs.clear();
@@ -792,7 +788,9 @@ bool GraphicsGL2::EnableShaders(std::ostream & info_output, std::ostream & error
 	// reload configuration
 	config = GraphicsConfig();
 	std::string rcpath = shaderpath + "/" + renderconfigfile;
-	if (!config.Load(rcpath, error_output))
+	const bool config_loaded = config.Load(rcpath, error_output);
+	pass_drawlists.resize(config.passes.size());
+	if (!config_loaded)
 	{
 		error_output << "EnableShaders: Error loading render configuration file: " << rcpath << std::endl;
 		return false;
@@ -964,150 +962,225 @@ bool GraphicsGL2::EnableShaders(std::ostream & info_output, std::ostream & error
 		}
 	}
 
+	CompileDrawLists(error_output);
+
 	return true;
 }
 
+void GraphicsGL2::CompileDrawLists(std::ostream & error_output)
+{
+	// for each pass, we have which camera and which draw layer to use
+	// we want to do culling for each unique camera and draw layer combination
+	// use camera/layer as the unique key, the drawlists are shared by pointer
+	for (size_t n = 0; n < config.passes.size(); n++)
+	{
+		const GraphicsConfigPass & pass = config.passes[n];
+		PassDrawLists & lists = pass_drawlists[n];
+		lists = PassDrawLists();
+
+		assert(!pass.draw.empty());
+		if (pass.draw.back() == "postprocess" || !pass.conditions.Satisfied(conditions))
+			continue;
+
+		RenderOutputMap::iterator oi = render_outputs.find(pass.output);
+		if (oi == render_outputs.end())
+		{
+			error_output << "Render output " << pass.output << " couldn't be found" << std::endl;
+			continue;
+		}
+
+		// determine if we're dealing with a cubemap
+		const bool cubemap = (oi->second.IsFBO() && oi->second.RenderToFBO().IsCubemap());
+		const int cubesides = cubemap ? 6 : 1;
+		std::vector <std::string> cameranames(cubesides, pass.camera);
+		if (cubemap)
+		{
+			for (int cubeside = 0; cubeside < cubesides; cubeside++)
+			{
+				// build a name for the sub camera
+				std::ostringstream s;
+				s << pass.camera << "_cubeside" << cubeside;
+				cameranames[cubeside] = s.str();
+				lists.cubecameras.push_back(&cameras[cameranames[cubeside]]);
+			}
+		}
+
+		bool valid = true;
+		for (std::vector <std::string>::const_iterator d = pass.draw.begin(); d != pass.draw.end(); d++)
+		{
+			reseatable_reference <AabbTreeNodeAdapter <Drawable> > container = static_drawlist.GetByName(*d);
+			reseatable_reference <PtrVector <Drawable> > container_dynamic = dynamic_drawlist.GetByName(*d);
+			if (!container || !container_dynamic)
+			{
+				error_output << "Drawable container " << *d << " couldn't be found" << std::endl;
+				valid = false;
+				break;
+			}
+			lists.containers.push_back(&(*container));
+			lists.containers_dynamic.push_back(&(*container_dynamic));
+		}
+		if (!valid)
+		{
+			lists = PassDrawLists();
+			continue;
+		}
+
+		for (int cubeside = 0; cubeside < cubesides; cubeside++)
+		{
+			for (std::vector <std::string>::const_iterator d = pass.draw.begin(); d != pass.draw.end(); d++)
+			{
+				lists.drawlists.push_back(&culled_drawlists[BuildKey(cameranames[cubeside], *d)]);
+			}
+		}
+		lists.output = &oi->second;
+	}
+}
+
 void GraphicsGL2::ClearCulledDrawLists()
 {
+	// drawlists keep their storage between frames, report the allocations of the last frame
+	unsigned int allocations = 0;
 	for(CulledDrawListMap::iterator i = culled_drawlists.begin(); i != culled_drawlists.end(); i++)
 	{
+		allocations += i->second.allocations;
+		i->second.allocations = 0;
 		i->second.drawables.clear();
 		i->second.valid = false;
 	}
+	PROFILER.addCount(drawlist_allocations, allocations);
 }
 
 void GraphicsGL2::CullScenePass(
 	const GraphicsConfigPass & pass,
+	const PassDrawLists & lists,
 	std::ostream & error_output)
 {
-	// for each pass, we have which camera and which draw layer to use
-	// we want to do culling for each unique camera and draw layer combination
-	// use camera/layer as the unique key
 	assert(!pass.draw.empty());
 
-	if (pass.draw.back() == "postprocess" || !pass.conditions.Satisfied(conditions))
+	if (pass.draw.back() == "postprocess" || !pass.conditions.Satisfied(conditions) || !lists.output)
 		return;
 
-	for (std::vector <std::string>::const_iterator d = pass.draw.begin(); d != pass.draw.end(); d++)
+	// get the base camera
+	CameraMap::iterator bci = cameras.find(pass.camera);
+	if (bci == cameras.end())
 	{
-		// determine if we're dealing with a cubemap
-		RenderOutputMap::iterator oi = render_outputs.find(pass.output);
-		if (oi == render_outputs.end())
-		{
-			ReportOnce(&pass, "Render output "+pass.output+" couldn't be found", error_output);
-			return;
-		}
-
-		const bool cubemap = (oi->second.IsFBO() && oi->second.RenderToFBO().IsCubemap());
-		const int cubesides = cubemap ? 6 : 1;
-		std::string cameraname = pass.camera;
-		for (int cubeside = 0; cubeside < cubesides; cubeside++)
-		{
-			if (cubemap)
-			{
-				// build a name for the sub camera
-				{
-					std::ostringstream s;
-					s << pass.camera << "_cubeside" << cubeside;
-					cameraname = s.str();
-				}
-
-				// get the base camera
-				CameraMap::iterator bci = cameras.find(pass.camera);
-				if (bci == cameras.end())
-				{
-					ReportOnce(&pass, "Camera " + pass.camera + " couldn't be found", error_output);
-					return;
-				}
+		ReportOnce(&pass, "Camera " + pass.camera + " couldn't be found", error_output);
+		return;
+	}
 
-				// create our sub-camera
-				GraphicsCamera & cam = cameras[cameraname];
-				cam = bci->second;
-
-				// set the sub-camera's properties
-				cam.rot = GetCubeSideOrientation(cubeside, cam.rot, error_output);
-				cam.fov = 90;
-				assert(oi->second.IsFBO());
-				const FrameBufferObject & fbo = oi->second.RenderToFBO();
-				cam.w = fbo.GetWidth();
-				cam.h = fbo.GetHeight();
-			}
+	// set the sub-cameras' properties
+	for (size_t cubeside = 0; cubeside < lists.cubecameras.size(); cubeside++)
+	{
+		GraphicsCamera & cam = *lists.cubecameras[cubeside];
+		cam = bci->second;
+		cam.rot = GetCubeSideOrientation(cubeside, cam.rot, error_output);
+		cam.fov = 90;
+		const FrameBufferObject & fbo = lists.output->RenderToFBO();
+		cam.w = fbo.GetWidth();
+		cam.h = fbo.GetHeight();
+	}
 
-			const std::string drawlist_name = BuildKey(cameraname, *d);
-			CulledDrawList & drawlist = culled_drawlists[drawlist_name];
+	const size_t layers = pass.draw.size();
+	const size_t cubesides = lists.drawlists.size() / layers;
+	for (size_t d = 0; d < layers; d++)
+	{
+		for (size_t cubeside = 0; cubeside < cubesides; cubeside++)
+		{
+			CulledDrawList & drawlist = *lists.drawlists[cubeside * layers + d];
 			if (drawlist.valid)
 				break;
 
 			drawlist.valid = true;
 			if (pass.cull)
 			{
-				// cull static drawlist
-				reseatable_reference <AabbTreeNodeAdapter <Drawable> > container = static_drawlist.GetByName(*d);
-				if (!container)
-				{
-					ReportOnce(&pass, "Drawable container " + *d + " couldn't be found", error_output);
-					return;
-				}
-
-				CameraMap::iterator ci = cameras.find(cameraname);
-				if (ci == cameras.end())
-				{
-					ReportOnce(&pass, "Camera " + cameraname + " couldn't be found", error_output);
-					return;
-				}
-				const GraphicsCamera & cam = ci->second;
-
-				Frustum frustum;
-				frustum.Extract(GetProjMatrix(cam).GetArray(), GetViewMatrix(cam).GetArray());
-
-				container->Query(frustum, drawlist.drawables);
-
-				// cull dynamic drawlist
-				reseatable_reference <PtrVector <Drawable> > container_dynamic = dynamic_drawlist.GetByName(*d);
-				if (!container_dynamic)
-				{
-					ReportOnce(&pass, "Drawable container " + *d + " couldn't be found", error_output);
-					return;
-				}
-				for (size_t i = 0; i < container_dynamic->size(); ++i)
-				{
-					if (!Cull(frustum, *(*container_dynamic)[i]))
-						drawlist.drawables.push_back((*container_dynamic)[i]);
-				}
+				// queue static and dynamic drawlist culling
+				const GraphicsCamera & cam = lists.cubecameras.empty() ? bci->second : *lists.cubecameras[cubeside];
+
+				CullRequest request;
+				request.drawlist = &drawlist;
+				request.container = lists.containers[d];
+				request.container_dynamic = lists.containers_dynamic[d];
+				request.frustum.Extract(GetProjMatrix(cam).GetArray(), GetViewMatrix(cam).GetArray());
+				cull_requests.push_back(request);
 			}
 			else
 			{
 				// copy static drawlist
-				reseatable_reference <AabbTreeNodeAdapter <Drawable> > container = static_drawlist.GetByName(*d);
-				if (!container)
-				{
-					ReportOnce(&pass, "Drawable container " + *d + " couldn't be found", error_output);
-					return;
-				}
-				container->Query(Aabb<float>::IntersectAlways(), drawlist.drawables);
+				lists.containers[d]->Query(Aabb<float>::IntersectAlways(), drawlist);
 
 				// copy dynamic drawlist
-				reseatable_reference <PtrVector <Drawable> > container_dynamic = dynamic_drawlist.GetByName(*d);
-				if (!container_dynamic)
-				{
-					ReportOnce(&pass, "Drawable container " + *d + " couldn't be found", error_output);
-					return;
-				}
-				drawlist.drawables.insert(
-					drawlist.drawables.end(),
-					container_dynamic->begin(),
-					container_dynamic->end());
+				drawlist.append(*lists.containers_dynamic[d]);
 			}
 		}
 	}
 }
 
+void GraphicsGL2::QueryStatic(void * data, int begin, int end)
+{
+	CullRequest * requests = static_cast<CullRequest*>(data);
+	for (int i = begin; i < end; ++i)
+	{
+		requests[i].container->Query(requests[i].frustum, *requests[i].drawlist);
+	}
+}
+
+void GraphicsGL2::CullDrawLists()
+{
+	if (cull_requests.empty())
+		return;
+
+	// static drawables go first
+	JobSystem::instance().Run(QueryStatic, &cull_requests[0], 0, cull_requests.size(), 1);
+
+	// batch requests sharing a dynamic container
+	cull_batched.assign(cull_requests.size(), false);
+	for (size_t i = 0; i < cull_requests.size(); ++i)
+	{
+		const PtrVector <Drawable> * container = cull_requests[i].container_dynamic;
+		if (cull_batched[i] || !container)
+			continue;
+
+		culler.Clear();
+		cull_batch.clear();
+		for (size_t j = i; j < cull_requests.size() && cull_batch.size() < FrustumCuller::MAX_FRUSTA; ++j)
+		{
+			if (!cull_batched[j] && cull_requests[j].container_dynamic == container)
+			{
+				culler.AddFrustum(cull_requests[j].frustum);
+				cull_batch.push_back(&cull_requests[j]);
+				cull_batched[j] = true;
+			}
+		}
+
+		for (PtrVector <Drawable>::const_iterator d = container->begin(); d != container->end(); ++d)
+		{
+			Vec3 center = (*d)->GetObjectCenter();
+			(*d)->GetTransform().TransformVectorOut(center[0], center[1], center[2]);
+			culler.AddSphere(center, (*d)->GetRadius());
+		}
+		culler.Cull(true);
+
+		// keep drawable order
+		for (int k = 0; k < culler.GetSphereCount(); ++k)
+		{
+			const unsigned visible = culler.GetVisible(k);
+			for (size_t f = 0; f < cull_batch.size(); ++f)
+			{
+				if ((visible >> f) & 1)
+					cull_batch[f]->drawlist->push_back((*container)[k]);
+			}
+		}
+	}
+	cull_requests.clear();
+}
+
 void GraphicsGL2::DrawScenePass(
 	const GraphicsConfigPass & pass,
+	const PassDrawLists & lists,
 	std::ostream & error_output)
 {
 	// log failure here?
-	if (!pass.conditions.Satisfied(conditions))
+	if (!pass.conditions.Satisfied(conditions) || !lists.output)
 		return;
 
 	// setup shader
@@ -1130,56 +1203,42 @@ void GraphicsGL2::DrawScenePass(
 	renderscene.SetBlendMode(glstate, BlendModeFromString(pass.blendmode));
 
 	// setup output
-	RenderOutputMap::iterator oi = render_outputs.find(pass.output);
-	if (oi == render_outputs.end())
+	RenderOutput & output = *lists.output;
+
+	// setup camera
+	CameraMap::iterator ci = cameras.find(pass.camera);
+	if (ci == cameras.end())
 	{
-		ReportOnce(&pass, "Render output " + pass.output + " couldn't be found", error_output);
+		ReportOnce(&pass, "Camera " + pass.camera + " couldn't be found", error_output);
 		return;
 	}
-	RenderOutput & output = oi->second;
 
 	// handle the cubemap case
-	const bool cubemap = (output.IsFBO() && output.RenderToFBO().IsCubemap());
-	const int cubesides = cubemap ? 6 : 1;
-	std::string cameraname = pass.camera;
-	for (int cubeside = 0; cubeside < cubesides; cubeside++)
+	const size_t layers = pass.draw.size();
+	const size_t cubesides = lists.drawlists.size() / layers;
+	for (size_t cubeside = 0; cubeside < cubesides; cubeside++)
 	{
-		if (cubemap)
+		if (!lists.cubecameras.empty())
 		{
-			// build a name for the sub camera
-			std::ostringstream s;
-			s << pass.camera << "_cubeside" << cubeside;
-			cameraname = s.str();
+			renderscene.SetCamera(*lists.cubecameras[cubeside]);
 
 			// attach the correct cube side on the render output
 			AttachCubeSide(cubeside, output.RenderToFBO(), error_output);
 		}
-
-		// setup camera
-		CameraMap::iterator ci = cameras.find(cameraname);
-		if (ci == cameras.end())
+		else
 		{
-			ReportOnce(&pass, "Camera " + pass.camera + " couldn't be found", error_output);
-			return;
+			renderscene.SetCamera(ci->second);
 		}
-		renderscene.SetCamera(ci->second);
 
 		// render pass draw layers
 		output.Begin(glstate, error_output);
 		renderscene.ClearOutput(glstate, pass.clear_color, pass.clear_depth);
-		for (std::vector <std::string>::const_iterator d = pass.draw.begin(); d != pass.draw.end(); d++)
+		for (size_t d = 0; d < layers; d++)
 		{
-			const std::string drawlist_name = BuildKey(cameraname, *d);
-			CulledDrawListMap::const_iterator drawlist_it = culled_drawlists.find(drawlist_name);
-			if (drawlist_it == culled_drawlists.end())
-			{
-				ReportOnce(&pass, "Couldn't find culled static drawlist for camera/draw combination: " + drawlist_name, error_output);
-				return;
-			}
-
-			if (!drawlist_it->second.drawables.empty())
+			const CulledDrawList & drawlist = *lists.drawlists[cubeside * layers + d];
+			if (!drawlist.drawables.empty())
 			{
-				renderscene.SetDrawList(drawlist_it->second.drawables);
+				renderscene.SetDrawList(drawlist.drawables);
 				renderscene.Render(glstate, error_output);
 			}
 		}
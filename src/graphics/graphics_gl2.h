@@ -25,6 +25,7 @@
 #include "graphicsstate.h"
 #include "texture.h"
 #include "aabb_tree_adapter.h"
+#include "frustum_culler.h"
 #include "drawable_container.h"
 #include "render_input_postprocess.h"
 #include "render_input_scene.h"
@@ -172,13 +173,53 @@ private:
 
 	struct CulledDrawList
 	{
-		CulledDrawList() : valid(false) {};
+		CulledDrawList() : valid(false), allocations(0) {};
 		PtrVector <Drawable> drawables;
 		bool valid;
+		unsigned int allocations; ///< drawables storage allocations since the last clear
+
+		/// append a drawable, counting storage allocations
+		void push_back(Drawable * drawable)
+		{
+			allocations += (drawables.size() == drawables.capacity());
+			drawables.push_back(drawable);
+		}
+
+		/// append drawables, counting storage allocations
+		void append(const PtrVector <Drawable> & source)
+		{
+			allocations += (drawables.size() + source.size() > drawables.capacity());
+			drawables.insert(drawables.end(), source.begin(), source.end());
+		}
 	};
 	typedef std::map <std::string, CulledDrawList> CulledDrawListMap;
 	CulledDrawListMap culled_drawlists;
 
+	// scene pass cameras and drawlists, looked up when the render configuration is loaded
+	struct PassDrawLists
+	{
+		PassDrawLists() : output(0) {};
+		RenderOutput * output; ///< null if the pass isn't drawn
+		std::vector <GraphicsCamera *> cubecameras; ///< cube side cameras, empty if not a cubemap
+		std::vector <CulledDrawList *> drawlists; ///< cube side major, draw layer minor
+		std::vector <const AabbTreeNodeAdapter <Drawable> *> containers;
+		std::vector <const PtrVector <Drawable> *> containers_dynamic;
+	};
+	std::vector <PassDrawLists> pass_drawlists; ///< indexed like config.passes
+
+	// camera and draw layer combination to be culled
+	struct CullRequest
+	{
+		CulledDrawList * drawlist;
+		const AabbTreeNodeAdapter <Drawable> * container;
+		const PtrVector <Drawable> * container_dynamic;
+		Frustum frustum;
+	};
+	std::vector <CullRequest> cull_requests;
+	std::vector <CullRequest*> cull_batch;
+	std::vector <bool> cull_batched;
+	FrustumCuller culler;
+
 	// render outputs
 	typedef std::map <std::string, RenderOutput> RenderOutputMap;
 	RenderOutputMap render_outputs;
@@ -226,14 +267,26 @@ private:
 
 	void DisableShaders(std::ostream & error_output);
 
+	/// look up scene pass cameras and drawlists
+	void CompileDrawLists(std::ostream & error_output);
+
 	void ClearCulledDrawLists();
 
+	/// queue cull requests of the pass
 	void CullScenePass(
 		const GraphicsConfigPass & pass,
+		const PassDrawLists & lists,
 		std::ostream & error_output);
 
+	/// cull queued requests, static drawables are queried per request in parallel,
+	/// dynamic drawables are tested against all frusta of their layer at once
+	void CullDrawLists();
+
+	static void QueryStatic(void * data, int begin, int end);
+
 	void DrawScenePass(
 		const GraphicsConfigPass & pass,
+		const PassDrawLists & lists,
 		std::ostream & error_output);
 
 	/// draw postprocess scene pass
@@ -22,6 +22,8 @@
 #include "joeserialize.h"
 #include "unordered_map.h"
 #include "utils.h"
+#include "jobsystem.h"
+#include "quickprof.h"
 #include <sstream>
 #include <vector>
 #include <map>
@@ -30,6 +32,11 @@
 
 #define enableContributionCull true
 
+// profiler counter handles, updated every frame
+static const quickprof::Counter drawListAllocations = PROFILER.getCounter("draw list allocations");
+static const quickprof::Counter scenegraphNodes = PROFILER.getCounter("scenegraph nodes");
+static const quickprof::Counter scenegraphDrawables = PROFILER.getCounter("scenegraph drawables");
+
 GraphicsGL3::GraphicsGL3(StringIdMap & map) :
 	stringMap(map),
 	gl(vertex_buffer),
@@ -42,6 +49,10 @@ GraphicsGL3::GraphicsGL3(StringIdMap & map) :
 	// initialize the full screen quad
 	fullscreenquadVertices.SetTo2DQuad(0,0,1,1, 0,1,1,0, 0);
 	fullscreenquad.SetVertArray(&fullscreenquadVertices);
+	fullscreenquadDrawList.push_back(&fullscreenquad);
+
+	viewMatrixId = stringMap.addStringId("viewMatrix");
+	projectionMatrixId = stringMap.addStringId("projectionMatrix");
 }
 
 GraphicsGL3::~GraphicsGL3()
@@ -147,8 +158,11 @@ void GraphicsGL3::BindStaticVertexData(std::vector<SceneNode*> nodes)
 
 void GraphicsGL3::AddDynamicNode(SceneNode & node)
 {
-	Mat4 identity;
-	node.Traverse(dynamic_drawlist, identity);
+	SceneNode::Stats stats;
+	node.Update(stats);
+	node.GetDrawablePtrList().AppendPointersTo(dynamic_drawlist);
+	PROFILER.addCount(scenegraphNodes, stats.nodes);
+	PROFILER.addCount(scenegraphDrawables, stats.drawables);
 }
 
 void GraphicsGL3::AddStaticNode(SceneNode & node)
@@ -341,10 +355,10 @@ void GraphicsGL3::SetupScene(
 	}
 
 	// send cameras to passes
-	for (std::map <std::string, std::string>::const_iterator i = passNameToCameraName.begin(); i != passNameToCameraName.end(); i++)
+	for (std::vector <PassCamera>::const_iterator i = passCameras.begin(); i != passCameras.end(); i++)
 	{
-		renderer.setPassUniform(stringMap.addStringId(i->first), RenderUniformEntry(stringMap.addStringId("viewMatrix"), cameras[i->second].viewMatrix.GetArray(),16));
-		renderer.setPassUniform(stringMap.addStringId(i->first), RenderUniformEntry(stringMap.addStringId("projectionMatrix"), cameras[i->second].projectionMatrix.GetArray(),16));
+		renderer.setPassUniform(i->pass, RenderUniformEntry(viewMatrixId, i->camera->viewMatrix.GetArray(),16));
+		renderer.setPassUniform(i->pass, RenderUniformEntry(projectionMatrixId, i->camera->projectionMatrix.GetArray(),16));
 	}
 
 	// send matrices for the default camera
@@ -394,22 +408,6 @@ void GraphicsGL3::SetupScene(
 	AssembleDrawMap(error_output);
 }
 
-// returns empty string if no camera
-std::string GraphicsGL3::getCameraForPass(StringId pass) const
-{
-	std::string passString = stringMap.getString(pass);
-	std::string cameraString;
-	std::map <std::string, std::string>::const_iterator camIter = passNameToCameraName.find(passString);
-	if (camIter != passNameToCameraName.end())
-		cameraString = camIter->second;
-	return cameraString;
-}
-
-std::string GraphicsGL3::getCameraDrawGroupKey(StringId pass, StringId group) const
-{
-	return getCameraForPass(pass)+"/"+stringMap.getString(group);
-}
-
 static bool SortDraworder(Drawable * d1, Drawable * d2)
 {
 	assert(d1 && d2);
@@ -456,14 +454,17 @@ static bool frustumCull(const Drawable * d, const Frustum & frustum)
 }
 
 // if frustum is NULL, don't do frustum or contribution culling
-void GraphicsGL3::AssembleDrawList(const std::vector <Drawable*> & drawables, std::vector <RenderModelExt*> & out, Frustum * frustum, const Vec3 & camPos)
+void GraphicsGL3::AssembleDrawList(const std::vector <Drawable*> & drawables, std::vector <RenderModelExt*> & out, Frustum * frustum, const Vec3 & camPos, unsigned int & allocations)
 {
 	if (frustum && enableContributionCull)
 	{
 		for (std::vector <Drawable*>::const_iterator i = drawables.begin(); i != drawables.end(); i++)
 		{
 			if (!frustumCull(*i, *frustum) && !contributionCull(*i, camPos))
+			{
+				allocations += (out.size() == out.capacity());
 				out.push_back(&(*i)->GenRenderModelData(stringMap));
+			}
 		}
 	}
 	else if (frustum)
@@ -471,147 +472,191 @@ void GraphicsGL3::AssembleDrawList(const std::vector <Drawable*> & drawables, st
 		for (std::vector <Drawable*>::const_iterator i = drawables.begin(); i != drawables.end(); i++)
 		{
 			if (!frustumCull(*i, *frustum))
+			{
+				allocations += (out.size() == out.capacity());
 				out.push_back(&(*i)->GenRenderModelData(stringMap));
+			}
 		}
 	}
 	else
 	{
 		for (std::vector <Drawable*>::const_iterator i = drawables.begin(); i != drawables.end(); i++)
 		{
+			allocations += (out.size() == out.capacity());
 			out.push_back(&(*i)->GenRenderModelData(stringMap));
 		}
 	}
 }
 
-// if frustum is NULL, don't do frustum or contribution culling
-void GraphicsGL3::AssembleDrawList(const AabbTreeNodeAdapter <Drawable> & adapter, std::vector <RenderModelExt*> & out, Frustum * frustum, const Vec3 & camPos)
+// query static drawables, if not cull don't do frustum or contribution culling
+void GraphicsGL3::CullStatic(void * data, int begin, int end)
 {
-	static std::vector <Drawable*> queryResults;
-	queryResults.clear();
-	if (frustum)
-		adapter.Query(*frustum, queryResults);
-	else
-		adapter.Query(Aabb<float>::IntersectAlways(), queryResults);
-
-	const std::vector <Drawable*> & drawables = queryResults;
-
-	if (frustum && enableContributionCull)
+	StaticCullRequest * requests = static_cast<StaticCullRequest*>(data);
+	for (int n = begin; n < end; ++n)
 	{
-		for (std::vector <Drawable*>::const_iterator i = drawables.begin(); i != drawables.end(); i++)
+		StaticCullRequest & request = requests[n];
+		std::vector <Drawable*> & visible = request.visible;
+		if (!request.drawables)
+			continue;
+
+		if (!request.cull)
 		{
-			if (!contributionCull(*i, camPos))
-				out.push_back(&(*i)->GenRenderModelData(stringMap));
+			request.drawables->Query(Aabb<float>::IntersectAlways(), request);
+			continue;
 		}
-	}
-	else
-	{
-		for (std::vector <Drawable*>::const_iterator i = drawables.begin(); i != drawables.end(); i++)
+
+		request.drawables->Query(request.frustum, request);
+		if (enableContributionCull)
 		{
-			out.push_back(&(*i)->GenRenderModelData(stringMap));
+			std::vector <Drawable*>::iterator o = visible.begin();
+			for (std::vector <Drawable*>::const_iterator i = visible.begin(); i != visible.end(); i++)
+			{
+				if (!contributionCull(*i, request.camPos))
+					*o++ = *i;
+			}
+			visible.erase(o, visible.end());
 		}
 	}
 }
 
-void GraphicsGL3::AssembleDrawMap(std::ostream & error_output)
+void GraphicsGL3::CompileDrawMap()
 {
-	//sort the two dimentional drawlist so we get correct ordering
-	std::sort(dynamic_drawlist.twodim.begin(),dynamic_drawlist.twodim.end(),&SortDraworder);
-
+	drawGroupCombinations.clear();
 	drawMap.clear();
+	passCameras.clear();
 
-	// for each pass, we have which camera and which draw groups to use
-	// we want to do culling for each unique camera and draw group combination
-	// use "camera/group" as a unique key string
-	// this is cached to avoid extra memory allocations each frame, so we need to clear old data
-	for (std::map <std::string, std::vector <RenderModelExt*> >::iterator i = cameraDrawGroupDrawLists.begin(); i != cameraDrawGroupDrawLists.end(); i++)
+	// resolve the pass cameras, cameras are created on first use and keep their address
+	for (std::map <std::string, std::string>::const_iterator i = passNameToCameraName.begin(); i != passNameToCameraName.end(); i++)
 	{
-		i->second.clear();
+		PassCamera passCamera;
+		passCamera.pass = stringMap.addStringId(i->first);
+		passCamera.camera = &cameras[i->second];
+		passCameras.push_back(passCamera);
 	}
 
-	// because the cameraDrawGroupDrawLists are cached, this is how we keep track of which combinations
-	// we have already generated
-	std::set <std::string> cameraDrawGroupCombinationsGenerated;
+	// for each pass, we have which camera and which draw groups to use
+	// we want to do culling for each unique camera and draw group combination
+	// use "camera/group" as a unique key string to find the combinations once
+	std::map <std::string, size_t> combinationIndices;
+	std::vector <std::pair <StringId, StringId> > passDrawGroups;
+	std::vector <size_t> passDrawGroupCombinations;
 
-	// for each pass, do culling of the dynamic and static drawlists and put the results into the cameraDrawGroupDrawLists
 	std::vector <StringId> passes = renderer.getPassNames();
 	for (std::vector <StringId>::const_iterator i = passes.begin(); i != passes.end(); i++)
 	{
-		if (renderer.getPassEnabled(*i))
+		std::string cameraString;
+		std::map <std::string, std::string>::const_iterator camIter = passNameToCameraName.find(stringMap.getString(*i));
+		if (camIter != passNameToCameraName.end())
+			cameraString = camIter->second;
+
+		const std::set <StringId> & groups = renderer.getDrawGroups(*i);
+		for (std::set <StringId>::const_iterator g = groups.begin(); g != groups.end(); g++)
 		{
-			const std::set <StringId> & passDrawGroups = renderer.getDrawGroups(*i);
-			for (std::set <StringId>::const_iterator g = passDrawGroups.begin(); g != passDrawGroups.end(); g++)
-			{
-				StringId passName = *i;
-				StringId drawGroupName = *g;
-				std::string drawGroupString = stringMap.getString(drawGroupName);
-				std::string cameraDrawGroupKey = getCameraDrawGroupKey(passName, drawGroupName);
+			const std::string drawGroupString = stringMap.getString(*g);
+			const std::string cameraDrawGroupKey = cameraString + "/" + drawGroupString;
 
-				std::vector <RenderModelExt*> & outDrawList = cameraDrawGroupDrawLists[cameraDrawGroupKey];
+			std::pair <std::map <std::string, size_t>::iterator, bool> result =
+				combinationIndices.insert(std::make_pair(cameraDrawGroupKey, drawGroupCombinations.size()));
+			if (result.second)
+			{
+				drawGroupCombinations.push_back(DrawGroupCombination());
+				DrawGroupCombination & combination = drawGroupCombinations.back();
 
-				// see if we have already generated this combination
-				if (cameraDrawGroupCombinationsGenerated.find(cameraDrawGroupKey) == cameraDrawGroupCombinationsGenerated.end())
-				{
-					// we need to generate this combination
-
-					// extract frustum information
-					RenderUniform proj, view;
-					bool doCull = true;
-					/*if (getCameraForPass(passName).empty())
-					{
-						doCull = false;
-					}
-					else*/
-					{
-						doCull = !(!doCull || !renderer.getPassUniform(passName, stringMap.addStringId("viewMatrix"), view));
-						doCull = !(!doCull || !renderer.getPassUniform(passName, stringMap.addStringId("projectionMatrix"), proj));
-					}
-					Frustum frustum;
-					Frustum * frustumPtr = NULL;
-					if (doCull)
-					{
-						frustum.Extract(&proj.data[0], &view.data[0]);
-						frustumPtr = &frustum;
-					}
-
-					// assemble dynamic entries
-					reseatable_reference <PtrVector <Drawable> > dynamicDrawablesPtr = dynamic_drawlist.GetByName(drawGroupString);
-					if (dynamicDrawablesPtr)
-					{
-						const std::vector <Drawable*> & dynamicDrawables = *dynamicDrawablesPtr;
-						//AssembleDrawList(dynamicDrawables, outDrawList, frustumPtr, lastCameraPosition);
-						AssembleDrawList(dynamicDrawables, outDrawList, NULL, lastCameraPosition); // TODO: the above line is commented out because frustum culling dynamic drawables doesen't work at the moment; is the object center in the drawable for the car in the correct space??
-					}
-
-					// assemble static entries
-					reseatable_reference <AabbTreeNodeAdapter <Drawable> > staticDrawablesPtr = static_drawlist.GetByName(drawGroupString);
-					if (staticDrawablesPtr)
-					{
-						const AabbTreeNodeAdapter <Drawable> & staticDrawables = *staticDrawablesPtr;
-						AssembleDrawList(staticDrawables, outDrawList, frustumPtr, lastCameraPosition);
-					}
-
-					// if it's requesting the full screen rect draw group, feed it our special drawable
-					if (drawGroupString == "full screen rect")
-					{
-						std::vector <Drawable*> rect;
-						rect.push_back(&fullscreenquad);
-						AssembleDrawList(rect, outDrawList, NULL, lastCameraPosition);
-					}
-				}
+				// dynamic entries
+				reseatable_reference <PtrVector <Drawable> > dynamicDrawablesPtr = dynamic_drawlist.GetByName(drawGroupString);
+				combination.dynamicDrawables = dynamicDrawablesPtr ? &(*dynamicDrawablesPtr) : NULL;
 
-				// use the generated combination in our drawMap
-				drawMap[passName][drawGroupName] = &outDrawList;
+				// static entries
+				reseatable_reference <AabbTreeNodeAdapter <Drawable> > staticDrawablesPtr = static_drawlist.GetByName(drawGroupString);
+				combination.staticDrawables = staticDrawablesPtr ? &(*staticDrawablesPtr) : NULL;
 
-				cameraDrawGroupCombinationsGenerated.insert(cameraDrawGroupKey);
+				// if it's requesting the full screen rect draw group, feed it our special drawable
+				combination.fullScreenRect = (drawGroupString == "full screen rect");
+				combination.enabled = false;
 			}
+			drawGroupCombinations[result.first->second].passes.push_back(*i);
+
+			passDrawGroups.push_back(std::make_pair(*i, *g));
+			passDrawGroupCombinations.push_back(result.first->second);
 		}
 	}
 
-	/*for (std::map <std::string, std::vector <RenderModelExternal*> >::iterator i = cameraDrawGroupDrawLists.begin(); i != cameraDrawGroupDrawLists.end(); i++)
+	// the combinations are complete, so the draw list pointers are stable now
+	for (size_t i = 0; i < passDrawGroups.size(); ++i)
+	{
+		drawMap[passDrawGroups[i].first][passDrawGroups[i].second] = &drawGroupCombinations[passDrawGroupCombinations[i]].drawList;
+	}
+
+	staticCullRequests.clear();
+	staticCullRequests.resize(drawGroupCombinations.size());
+	for (size_t i = 0; i < staticCullRequests.size(); ++i)
+	{
+		staticCullRequests[i].drawables = NULL;
+		staticCullRequests[i].cull = false;
+		staticCullRequests[i].allocations = 0;
+	}
+}
+
+void GraphicsGL3::AssembleDrawMap(std::ostream & error_output)
+{
+	//sort the two dimentional drawlist so we get correct ordering
+	std::sort(dynamic_drawlist.twodim.begin(),dynamic_drawlist.twodim.end(),&SortDraworder);
+
+	// the draw map and the camera and draw group combinations are compiled with the render config,
+	// draw lists keep their storage between frames
+	for (size_t i = 0; i < drawGroupCombinations.size(); ++i)
+	{
+		DrawGroupCombination & combination = drawGroupCombinations[i];
+		StaticCullRequest & request = staticCullRequests[i];
+		combination.drawList.clear();
+		request.visible.clear();
+		request.allocations = 0;
+		request.drawables = NULL;
+
+		// extract frustum information from the first enabled pass
+		std::vector <StringId>::const_iterator pass = combination.passes.begin();
+		while (pass != combination.passes.end() && !renderer.getPassEnabled(*pass))
+			pass++;
+
+		combination.enabled = (pass != combination.passes.end());
+		if (!combination.enabled)
+			continue;
+
+		RenderUniform proj, view;
+		request.cull = renderer.getPassUniform(*pass, viewMatrixId, view) &&
+			renderer.getPassUniform(*pass, projectionMatrixId, proj);
+		if (request.cull)
+			request.frustum.Extract(&proj.data[0], &view.data[0]);
+		request.camPos = lastCameraPosition;
+		request.drawables = combination.staticDrawables;
+	}
+
+	// cull static entries
+	if (!staticCullRequests.empty())
+		JobSystem::instance().Run(CullStatic, &staticCullRequests[0], 0, staticCullRequests.size(), 1);
+
+	// assemble draw lists, generating render model data is not thread safe
+	unsigned int allocations = 0;
+	for (size_t i = 0; i < drawGroupCombinations.size(); ++i)
 	{
-		std::cout << i->first << ": " << i->second.size() << std::endl;
+		DrawGroupCombination & combination = drawGroupCombinations[i];
+		StaticCullRequest & request = staticCullRequests[i];
+		if (!combination.enabled)
+			continue;
+
+		// dynamic entries
+		// TODO: dynamic entries are not frustum culled because frustum culling dynamic drawables doesen't work at the moment; is the object center in the drawable for the car in the correct space??
+		if (combination.dynamicDrawables)
+			AssembleDrawList(*combination.dynamicDrawables, combination.drawList, NULL, lastCameraPosition, allocations);
+
+		AssembleDrawList(request.visible, combination.drawList, NULL, lastCameraPosition, allocations);
+		allocations += request.allocations;
+
+		if (combination.fullScreenRect)
+			AssembleDrawList(fullscreenquadDrawList, combination.drawList, NULL, lastCameraPosition, allocations);
 	}
-	std::cout << "----------" << std::endl;*/
+	PROFILER.addCount(drawListAllocations, allocations);
+
 	//if (enableContributionCull) std::cout << "Contribution cull count: " << assembler.contributionCullCount << std::endl;
 	//std::cout << "normal_noblend: " << drawGroups[stringMap.addStringId("normal_noblend")].size() << "/" << static_drawlist.GetDrawList().GetByName("normal_noblend")->size() << std::endl;
 }
@@ -690,6 +735,7 @@ bool GraphicsGL3::ReloadShaders(std::ostream & info_output, std::ostream & error
 				if (field != fields.end())
 					passNameToCameraName[stringMap.getString(*i)] = field->second;
 			}
+			CompileDrawMap();
 
 			// set viewport size
 			float viewportSize[2] = {float(w), float(h)};
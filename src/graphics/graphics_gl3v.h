@@ -142,9 +142,6 @@ private:
 							   const Vec3 & orthoMin,
 							   const Vec3 & orthoMax);
 
-	std::string getCameraDrawGroupKey(StringId pass, StringId group) const;
-	std::string getCameraForPass(StringId pass) const;
-
 	// scenegraph output
 	template <typename T> class PtrVector : public std::vector<T*> {};
 	typedef DrawableContainer <PtrVector> DynamicDrawables;
@@ -157,22 +154,63 @@ private:
 	Drawable fullscreenquad;
 	VertexArray fullscreenquadVertices;
 
-	// drawlist cache
-	std::map <std::string, std::vector <RenderModelExt*> > cameraDrawGroupDrawLists;
+	// camera and draw group combination, compiled when the render config is loaded
+	struct DrawGroupCombination
+	{
+		std::vector <StringId> passes; ///< passes drawing this combination, the first enabled one provides the camera
+		const PtrVector <Drawable> * dynamicDrawables;
+		const AabbTreeNodeAdapter <Drawable> * staticDrawables;
+		bool fullScreenRect;
+		bool enabled;
+		std::vector <RenderModelExt*> drawList;
+	};
+	std::vector <DrawGroupCombination> drawGroupCombinations;
 
 	// this maps passes to maps of draw groups and draw list vector pointers
 	// so drawMap[passName][drawGroup] is a pointer to a vector of RenderModelExternal pointers
 	// this is complicated but it lets us do culling per camera position and draw group combination
 	std::map <StringId, std::map <StringId, std::vector <RenderModelExt*> *> > drawMap;
 
+	// static drawables of each combination are culled on the job threads
+	struct StaticCullRequest
+	{
+		const AabbTreeNodeAdapter <Drawable> * drawables;
+		Frustum frustum;
+		Vec3 camPos;
+		bool cull;
+		std::vector <Drawable*> visible;
+		unsigned int allocations; ///< visible storage allocations since the last assembly
+
+		/// append a visible drawable, counting storage allocations
+		void push_back(Drawable * drawable)
+		{
+			allocations += (visible.size() == visible.capacity());
+			visible.push_back(drawable);
+		}
+	};
+	std::vector <StaticCullRequest> staticCullRequests;
+
+	std::vector <Drawable*> fullscreenquadDrawList;
+	StringId viewMatrixId;
+	StringId projectionMatrixId;
+
 	// drawlist assembly functions
-	void AssembleDrawList(const std::vector <Drawable*> & drawables, std::vector <RenderModelExt*> & out, Frustum * frustum, const Vec3 & camPos);
-	void AssembleDrawList(const AabbTreeNodeAdapter <Drawable> & adapter, std::vector <RenderModelExt*> & out, Frustum * frustum, const Vec3 & camPos);
+	void AssembleDrawList(const std::vector <Drawable*> & drawables, std::vector <RenderModelExt*> & out, Frustum * frustum, const Vec3 & camPos, unsigned int & allocations);
 	void AssembleDrawMap(std::ostream & error_output);
+	void CompileDrawMap();
+	static void CullStatic(void * data, int begin, int end);
 
 	// a map that stores which camera each pass uses
 	std::map <std::string, std::string> passNameToCameraName;
 
+	// pass cameras resolved when the render config is loaded, the cameras are updated in place each frame
+	struct PassCamera
+	{
+		StringId pass;
+		const CameraMatrices * camera;
+	};
+	std::vector <PassCamera> passCameras;
+
 	// a set storing all configuration option conditions (bloom enabled, etc)
 	std::set <std::string> conditions;
 
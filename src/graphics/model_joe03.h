@@ -27,6 +27,7 @@
 
 class JoePack;
 struct JoeObject;
+struct JoeReader;
 
 // This class handles all of the loading code
 class ModelJoe03 : public Model
@@ -49,15 +50,18 @@ public:
 
 	bool Load(const std::string & strFileName, std::ostream & error_output, const JoePack * pack);
 
+	/// parse the model from a joe file in memory
+	bool LoadFromMemory(const char * data, unsigned int length, std::ostream & error_output);
+
 	static const unsigned int JOE_MAX_FACES;
 	static const unsigned int JOE_VERSION;
 	static const float MODEL_SCALE;
 
 private:
 	// This reads in the data from the MD2 file and stores it in the member variable
-	void ReadData(FILE * m_FilePointer, const JoePack * pack, JoeObject & Object);
+	void ReadData(JoeReader & reader, JoeObject & Object);
 
-	bool LoadFromHandle(FILE * f, const JoePack * pack, std::ostream & error_output);
+	bool LoadFromHandle(JoeReader & reader, std::ostream & error_output);
 };
 
 #endif
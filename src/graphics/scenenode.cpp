@@ -18,6 +18,28 @@
 /************************************************************************/
 
 #include "scenenode.h"
+#include "unittest.h"
+
+SceneNode::SceneNode(const SceneNode & other) :
+	childlist(other.childlist),
+	drawlist(other.drawlist),
+	transform(other.transform),
+	cached_transform(other.cached_transform),
+	changed(ALL_CHANGED)
+{
+	// ctor
+}
+
+SceneNode & SceneNode::operator=(const SceneNode & other)
+{
+	childlist = other.childlist;
+	drawlist = other.drawlist;
+	transform = other.transform;
+	cached_transform = other.cached_transform;
+	drawableptrlist.clear();
+	changed = ALL_CHANGED;
+	return *this;
+}
 
 Vec3 SceneNode::TransformIntoWorldSpace(const Vec3 & localspace) const
 {
@@ -35,6 +57,7 @@ Vec3 SceneNode::TransformIntoLocalSpace(const Vec3 & worldspace) const
 
 void SceneNode::SetChildVisibility(bool newvis)
 {
+	changed |= DRAWABLES_CHANGED | CHILD_CHANGED;
 	drawlist.SetVisibility(newvis);
 
 	for (List::iterator i = childlist.begin(); i != childlist.end(); ++i)
@@ -45,6 +68,7 @@ void SceneNode::SetChildVisibility(bool newvis)
 
 void SceneNode::SetChildAlpha(float a)
 {
+	changed |= DRAWABLES_CHANGED | CHILD_CHANGED;
 	drawlist.SetAlpha(a);
 
 	for (List::iterator i = childlist.begin(); i != childlist.end(); ++i)
@@ -53,6 +77,57 @@ void SceneNode::SetChildAlpha(float a)
 	}
 }
 
+bool SceneNode::Update(const Mat4 & prev_transform, bool prev_transform_changed, Stats & stats)
+{
+	stats.nodes++;
+
+	// recompute the world transform only if it might have changed
+	bool transform_changed = false;
+	if (prev_transform_changed || (changed & TRANSFORM_CHANGED))
+	{
+		Mat4 this_transform(prev_transform);
+		if (!transform.IsIdentityTransform())
+		{
+			transform.GetRotation().GetMatrix4(this_transform);
+			this_transform.Translate(transform.GetTranslation()[0], transform.GetTranslation()[1], transform.GetTranslation()[2]);
+			this_transform = this_transform.Multiply(prev_transform);
+		}
+		transform_changed = (this_transform != cached_transform);
+		cached_transform = this_transform;
+	}
+
+	// added drawables need the world transform too
+	if (transform_changed || (changed & DRAWABLES_CHANGED))
+		drawlist.SetTransform(cached_transform);
+
+	// unchanged children are skipped unless the world transform has changed
+	bool drawlist_changed = (changed & (DRAWABLES_CHANGED | CHILDREN_CHANGED));
+	if (transform_changed || (changed & (CHILDREN_CHANGED | CHILD_CHANGED)))
+	{
+		for (List::iterator i = childlist.begin(); i != childlist.end(); ++i)
+		{
+			if (i->Update(cached_transform, transform_changed, stats))
+				drawlist_changed = true;
+		}
+	}
+
+	// patch the draw list, children draw lists are appended as they are
+	if (drawlist_changed)
+	{
+		drawableptrlist.clear();
+		drawlist.AppendTo<PtrVector, false>(drawableptrlist, cached_transform);
+		stats.drawables += drawlist.size();
+
+		for (List::const_iterator i = childlist.begin(); i != childlist.end(); ++i)
+		{
+			i->drawableptrlist.AppendPointersTo(drawableptrlist);
+		}
+	}
+
+	changed = 0;
+	return drawlist_changed;
+}
+
 void SceneNode::DebugPrint(std::ostream & out, int curdepth) const
 {
 	for (int i = 0; i < curdepth; i++)
@@ -64,3 +139,58 @@ void SceneNode::DebugPrint(std::ostream & out, int curdepth) const
 		i->DebugPrint(out, curdepth+1);
 	}
 }
+
+QT_TEST(scenenode_update_test)
+{
+	// root with a child holding one drawable
+	SceneNode root;
+	SceneNode::Handle child = root.AddNode();
+	SceneNode::DrawableHandle drawable = root.GetNode(child).GetDrawList().normal_noblend.insert(Drawable());
+	SceneNode::Stats stats;
+	root.Update(stats);
+	QT_CHECK_EQUAL(root.GetDrawablePtrList().normal_noblend.size(), 1u);
+	QT_CHECK_EQUAL(stats.drawables, 1u);
+
+	// unchanged frame, only the root is visited
+	stats = SceneNode::Stats();
+	root.Update(stats);
+	QT_CHECK_EQUAL(stats.nodes, 1u);
+	QT_CHECK_EQUAL(stats.drawables, 0u);
+
+	// transform only change updates the drawable transform, the cached draw lists are kept
+	root.GetNode(child).GetTransform().SetTranslation(Vec3(1, 2, 3));
+	stats = SceneNode::Stats();
+	root.Update(stats);
+	QT_CHECK_EQUAL(stats.nodes, 2u);
+	QT_CHECK_EQUAL(stats.drawables, 0u);
+	QT_CHECK_EQUAL(root.GetDrawablePtrList().normal_noblend.size(), 1u);
+	const Mat4 & transform = root.GetDrawablePtrList().normal_noblend[0]->GetTransform();
+	QT_CHECK_EQUAL(transform[12], 1);
+	QT_CHECK_EQUAL(transform[13], 2);
+	QT_CHECK_EQUAL(transform[14], 3);
+
+	// draw enable toggles rebuild the draw lists
+	root.GetNode(child).GetDrawList().normal_noblend.get(drawable).SetDrawEnable(false);
+	root.Update(stats);
+	QT_CHECK(root.GetDrawablePtrList().normal_noblend.empty());
+	root.GetNode(child).GetDrawList().normal_noblend.get(drawable).SetDrawEnable(true);
+	root.Update(stats);
+	QT_CHECK_EQUAL(root.GetDrawablePtrList().normal_noblend.size(), 1u);
+
+	// added children and drawables rebuild the draw lists
+	SceneNode::Handle child2 = root.AddNode();
+	root.GetNode(child2).GetDrawList().normal_noblend.insert(Drawable());
+	root.GetNode(child2).GetDrawList().car_noblend.insert(Drawable());
+	root.Update(stats);
+	QT_CHECK_EQUAL(root.GetDrawablePtrList().normal_noblend.size(), 2u);
+	QT_CHECK_EQUAL(root.GetDrawablePtrList().car_noblend.size(), 1u);
+
+	// deleted children and drawables rebuild the draw lists
+	root.Delete(child2);
+	root.Update(stats);
+	QT_CHECK_EQUAL(root.GetDrawablePtrList().normal_noblend.size(), 1u);
+	QT_CHECK(root.GetDrawablePtrList().car_noblend.empty());
+	root.GetNode(child).GetDrawList().normal_noblend.erase(drawable);
+	root.Update(stats);
+	QT_CHECK(root.GetDrawablePtrList().normal_noblend.empty());
+}
@@ -24,6 +24,12 @@
 #include "keyed_container.h"
 #include "transform.h"
 
+/// Scene graph node caching world transforms and draw lists of its subtree.
+/// Non-const accessors mark a node as changed, Update only revisits changed
+/// nodes and the path to them. So every frame each mutation has to go through
+/// the non-const accessors from the root down (GetNode, GetDrawList,
+/// GetTransform, ...). Changes made through node, drawable or transform
+/// references kept from an earlier frame are missed by Update.
 class SceneNode
 {
 public:
@@ -32,23 +38,50 @@ public:
 	typedef keyed_container<SceneNode> List;
 	typedef List::handle Handle;
 
-	Handle AddNode() {return childlist.insert(SceneNode());}
+	template <typename T> class PtrVector : public std::vector<T*> {};
+	typedef DrawableContainer <PtrVector> DrawablePtrList;
 
-	SceneNode & GetNode(Handle handle) {return childlist.get(handle);}
+	/// scene graph update statistics
+	struct Stats
+	{
+		Stats() : nodes(0), drawables(0) {}
+		unsigned int nodes; ///< nodes visited
+		unsigned int drawables; ///< drawables re-emitted into node draw lists
+	};
+
+	SceneNode() : changed(ALL_CHANGED) {}
+
+	/// copies have to rebuild their draw lists, the drawables have moved
+	SceneNode(const SceneNode & other);
+
+	SceneNode & operator=(const SceneNode & other);
+
+	// non-const access marks the node as changed for Update
+
+	Handle AddNode() {changed |= CHILDREN_CHANGED; return childlist.insert(SceneNode());}
+
+	SceneNode & GetNode(Handle handle) {changed |= CHILD_CHANGED; return childlist.get(handle);}
 	const SceneNode & GetNode(Handle handle) const {return childlist.get(handle);}
 
-	List & GetNodeList() {return childlist;}
+	List & GetNodeList() {changed |= CHILDREN_CHANGED; return childlist;}
 	const List & GetNodeList() const {return childlist;}
 
-	DrawableList & GetDrawList() {return drawlist;}
+	DrawableList & GetDrawList() {changed |= DRAWABLES_CHANGED; return drawlist;}
 	const DrawableList & GetDrawList() const {return drawlist;}
 
-	Transform & GetTransform() {return transform;}
+	Transform & GetTransform() {changed |= TRANSFORM_CHANGED; return transform;}
 	const Transform & GetTransform() const {return transform;}
 
-	void Clear() {drawlist.clear();childlist.clear();}
+	void Clear() {changed |= ALL_CHANGED; drawlist.clear(); childlist.clear();}
+
+	void Delete(Handle handle) {changed |= CHILDREN_CHANGED; childlist.erase(handle);}
+
+	/// update world transforms and draw lists of changed subtrees
+	/// unchanged subtrees keep their cached world transforms and draw lists
+	void Update(Stats & stats) {Update(Mat4(), false, stats);}
 
-	void Delete(Handle handle) {childlist.erase(handle);}
+	/// enabled drawables of this node and its children, valid after Update
+	const DrawablePtrList & GetDrawablePtrList() const {return drawableptrlist;}
 
 	Vec3 TransformIntoWorldSpace(const Vec3 & localspace) const;
 	Vec3 TransformIntoLocalSpace(const Vec3 & worldspace) const;
@@ -88,6 +121,7 @@ public:
 	/// traverse all drawable containers applying the specified functor.
 	/// the functor should take a drawable container reference as an argument.
 	/// note that the functor is passed by value to this function.
+	/// the functor must not add, remove or hide drawables, the draw lists are not updated.
 	template <typename T>
 	void ApplyDrawableContainerFunctor(T functor)
 	{
@@ -101,6 +135,7 @@ public:
 	/// traverse all drawables applying the specified functor.
 	/// the functor should take any drawable typed reference as an argument.
 	/// note that the functor is passed by value to this function.
+	/// the functor must not hide drawables, the draw lists are not updated.
 	template <typename T>
 	void ApplyDrawableFunctor(T functor)
 	{
@@ -112,10 +147,24 @@ public:
 	}
 
 private:
+	enum
+	{
+		TRANSFORM_CHANGED = 1,
+		DRAWABLES_CHANGED = 2,
+		CHILDREN_CHANGED = 4, ///< children added or removed
+		CHILD_CHANGED = 8, ///< children might have changed
+		ALL_CHANGED = 15
+	};
+
 	List childlist;
 	DrawableList drawlist;
 	Transform transform;
 	Mat4 cached_transform;
+	DrawablePtrList drawableptrlist;
+	unsigned int changed;
+
+	/// returns true if the draw list has changed
+	bool Update(const Mat4 & prev_transform, bool prev_transform_changed, Stats & stats);
 };
 
 #endif // _SCENENODE_H
@@ -33,6 +33,7 @@
 #include <fstream>
 #include <vector>
 #include <cassert>
+#include <cstring>
 
 // averaging downsampler
 // bytespp is the size of a pixel (number of channels)
@@ -167,6 +168,19 @@ static void GetTextureFormat(
 	}
 }
 
+// uncompressed image size including mip levels
+static unsigned GetImageSize(unsigned w, unsigned h, unsigned bytespp, bool mipmap)
+{
+	unsigned size = w * h * bytespp;
+	while (mipmap && (w > 1 || h > 1))
+	{
+		w = std::max(1u, w / 2);
+		h = std::max(1u, h / 2);
+		size += w * h * bytespp;
+	}
+	return size;
+}
+
 static void SetSampler(const TextureInfo & info, bool hasmiplevels = false)
 {
 	if (info.repeatu)
@@ -213,7 +227,24 @@ static void SetSampler(const TextureInfo & info, bool hasmiplevels = false)
 		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, (float)info.anisotropy);
 }
 
-Texture::Texture()
+static void SetCubeSampler(const TextureInfo & info)
+{
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	if (info.mipmap)
+	{
+		glTexParameteri(GL_TEXTURE_CUBE_MAP,GL_TEXTURE_MIN_FILTER,GL_LINEAR_MIPMAP_LINEAR);
+		// automatic mipmap generation fallback
+		if (!GLC_ARB_framebuffer_object)
+			glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_GENERATE_MIPMAP, GL_TRUE);
+	}
+}
+
+Texture::Texture() :
+	size(0)
 {
 	// ctor
 }
@@ -327,6 +358,7 @@ bool Texture::Load(const std::string & path, const TextureInfo & info, std::ostr
 	// store dimensions
 	width = w;
 	height = h;
+	size = GetImageSize(w, h, bytespp, info.mipmap || GLC_ARB_framebuffer_object);
 
 	target = GL_TEXTURE_2D;
 
@@ -356,11 +388,68 @@ bool Texture::Load(const std::string & path, const TextureInfo & info, std::ostr
 	return true;
 }
 
+bool Texture::Decode(const std::string & path, TextureInfo & info, std::vector<unsigned char> & pixels)
+{
+	// dds files are uploaded compressed by Load
+	char magic[4];
+	std::ifstream file(path.c_str(), std::ifstream::in | std::ifstream::binary);
+	if (!file.read(magic, 4) || IsDDS(magic, 4))
+		return false;
+	file.close();
+
+	SDL_Surface * image = IMG_Load(path.c_str());
+	if (!image)
+		return false;
+
+	const unsigned bytespp = image->format->BytesPerPixel;
+	if (bytespp != 3 && bytespp != 4)
+	{
+		SDL_FreeSurface(image);
+		return false;
+	}
+
+	// Load recreates the surface from data with rgb(a) masks,
+	// convert bgr(a) and other channel orders to rgb(a) bytes
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+	const Uint32 rgba = SDL_PIXELFORMAT_RGBA8888;
+#else
+	const Uint32 rgba = SDL_PIXELFORMAT_ABGR8888;
+#endif
+	const Uint32 format = (bytespp == 3) ? Uint32(SDL_PIXELFORMAT_RGB24) : rgba;
+	SDL_Surface * surface = image;
+	if (image->format->format != format)
+	{
+		surface = SDL_ConvertSurfaceFormat(image, format, 0);
+		SDL_FreeSurface(image);
+		if (!surface)
+			return false;
+	}
+
+	const unsigned rowsize = surface->w * bytespp;
+	pixels.resize(rowsize * surface->h);
+	SDL_LockSurface(surface);
+	for (int y = 0; y < surface->h; ++y)
+	{
+		const unsigned char * row = (const unsigned char *)surface->pixels + y * surface->pitch;
+		memcpy(&pixels[y * rowsize], row, rowsize);
+	}
+	SDL_UnlockSurface(surface);
+
+	info.data = &pixels[0];
+	info.width = surface->w;
+	info.height = surface->h;
+	info.bytespp = bytespp;
+
+	SDL_FreeSurface(surface);
+	return true;
+}
+
 void Texture::Unload()
 {
 	if (texid)
 		glDeleteTextures(1, &texid);
 	texid = 0;
+	size = 0;
 }
 
 bool Texture::LoadCubeVerticalCross(const std::string & path, const TextureInfo & info, std::ostream & error)
@@ -381,24 +470,14 @@ bool Texture::LoadCubeVerticalCross(const std::string & path, const TextureInfo
 	glBindTexture(GL_TEXTURE_CUBE_MAP, texid);
 
 	// set sampler
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	if (info.mipmap)
-	{
-		glTexParameteri(GL_TEXTURE_CUBE_MAP,GL_TEXTURE_MIN_FILTER,GL_LINEAR_MIPMAP_LINEAR);
-		// automatic mipmap generation fallback
-		if (!GLC_ARB_framebuffer_object)
-			glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_GENERATE_MIPMAP, GL_TRUE);
-	}
+	SetCubeSampler(info);
 
 	width = surface->w / 3;
 	height = surface->h / 4;
 
 	// upload texture
 	unsigned bytespp = surface->format->BytesPerPixel;
+	size = 6 * GetImageSize(width, height, bytespp, info.mipmap);
 	std::vector<unsigned char> cubeface(width * height * bytespp);
 	for (int i = 0; i < 6; ++i)
 	{
@@ -535,6 +614,9 @@ bool Texture::LoadCube(const std::string & path, const TextureInfo & info, std::
 
 	glBindTexture(GL_TEXTURE_CUBE_MAP, texid);
 
+	// set sampler
+	SetCubeSampler(info);
+
 	for (int i = 0; i < 6; ++i)
 	{
 		SDL_Surface * surface = IMG_Load(cubefiles[i].c_str());
@@ -553,6 +635,7 @@ bool Texture::LoadCube(const std::string & path, const TextureInfo & info, std::
 		}
 		width = surface->w;
 		height = surface->h;
+		size += GetImageSize(width, height, surface->format->BytesPerPixel, info.mipmap);
 
 		// detect channels
 		int format = GL_RGB;
@@ -601,11 +684,8 @@ bool Texture::LoadCube(const std::string & path, const TextureInfo & info, std::
 		SDL_FreeSurface(surface);
 	}
 
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	if (info.mipmap && GLC_ARB_framebuffer_object)
+		glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
 
 	CheckForOpenGLErrors("Cubemap creation", error);
 
@@ -698,9 +778,14 @@ bool Texture::LoadDDS(const std::string & path, const TextureInfo & info, std::o
 		ih = std::max(1u, ih / 2);
 	}
 
+	size = idata - texdata;
+
 	// force mipmaps for GL3
 	if (levels == 1 && GLC_ARB_framebuffer_object)
+	{
 		glGenerateMipmap(GL_TEXTURE_2D);
+		size += size / 3;
+	}
 
 	return true;
 }
@@ -25,6 +25,7 @@
 
 #include <iosfwd>
 #include <string>
+#include <vector>
 
 class Texture : public TextureInterface
 {
@@ -37,7 +38,18 @@ public:
 
 	void Unload();
 
+	/// Texture memory size in bytes, including mip levels.
+	unsigned GetSize() const { return size; }
+
+	/// Decode a 24 or 32 bit image file into pixels and set info data and size,
+	/// so that the texture can be created from info later. Does not touch
+	/// the graphics context, safe to call from worker threads.
+	/// Returns false for other formats, they have to be loaded from file.
+	static bool Decode(const std::string & path, TextureInfo & info, std::vector<unsigned char> & pixels);
+
 private:
+	unsigned size;
+
 	bool LoadCubeVerticalCross(const std::string & path, const TextureInfo & info, std::ostream & error);
 
 	bool LoadCube(const std::string & path, const TextureInfo & info, std::ostream & error);
@@ -53,6 +53,14 @@ public:
 
 	unsigned int GetNumIndices() const { return faces.size(); }
 
+	/// memory used by the vertex data in bytes
+	unsigned int GetSize() const
+	{
+		return colors.size() * sizeof(unsigned char) +
+			(texcoords.size() + normals.size() + vertices.size()) * sizeof(float) +
+			faces.size() * sizeof(unsigned int);
+	}
+
 	VertexFormat::Enum GetVertexFormat() const { return format; }
 
 	void Add(
@@ -0,0 +1,436 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#include "jobsystem.h"
+#include "unittest.h"
+
+#include <algorithm>
+#include <cassert>
+
+JobSystem::Fence::Fence()
+{
+	SDL_AtomicSet(&count, 0);
+}
+
+bool JobSystem::Fence::Done() const
+{
+	return SDL_AtomicGet(&count) == 0;
+}
+
+JobSystem & JobSystem::instance()
+{
+	static JobSystem jobs;
+	return jobs;
+}
+
+JobSystem::JobSystem() :
+	started(0),
+	mutex(0),
+	changed(0)
+{
+	SDL_AtomicSet(&generation, 0);
+	SDL_AtomicSet(&quit, 0);
+	SDL_AtomicSet(&registered, 0);
+	queue_tls = SDL_TLSCreate();
+}
+
+JobSystem::~JobSystem()
+{
+	Deinit();
+}
+
+void JobSystem::Init(int threads, int external)
+{
+	Deinit();
+
+	if (threads < 2)
+		return;
+
+	started = SDL_CreateSemaphore(0);
+	mutex = SDL_CreateMutex();
+	changed = SDL_CreateCond();
+	SDL_AtomicSet(&quit, 0);
+	SDL_AtomicSet(&registered, 0);
+
+	// worker data has to stay in place once the threads are running
+	queues.resize(threads + std::max(external, 0));
+	workers.resize(threads - 1);
+	for (int i = 0; i < threads - 1; ++i)
+	{
+		Worker & w = workers[i];
+		w.jobs = this;
+		w.index = i + 1;
+		w.id = 0;
+		w.thread = 0;
+	}
+	for (int i = 0; i < threads - 1; ++i)
+	{
+		Worker & w = workers[i];
+		w.thread = SDL_CreateThread(WorkerMain, "JobSystem", &w);
+	}
+
+	// workers store their thread id before any job can be added
+	for (int i = 0; i < threads - 1; ++i)
+	{
+		SDL_SemWait(started);
+	}
+	SDL_DestroySemaphore(started);
+	started = 0;
+}
+
+void JobSystem::Deinit()
+{
+	if (workers.empty())
+		return;
+
+	SDL_AtomicSet(&quit, 1);
+	Notify();
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		SDL_WaitThread(workers[i].thread, NULL);
+	}
+	workers.clear();
+	queues.clear();
+
+	SDL_DestroyCond(changed);
+	SDL_DestroyMutex(mutex);
+	changed = 0;
+	mutex = 0;
+}
+
+int JobSystem::GetThreadCount() const
+{
+	return workers.size() + 1;
+}
+
+bool JobSystem::RegisterThread()
+{
+	if (workers.empty())
+		return false;
+
+	// registered since the last Init, or a worker
+	const int index = GetQueueIndex();
+	if (index != 0)
+		return index > int(workers.size());
+
+	const int reserved = workers.size() + 1 + SDL_AtomicAdd(&registered, 1);
+	if (reserved >= int(queues.size()))
+	{
+		SDL_AtomicAdd(&registered, -1);
+		return false;
+	}
+
+	SDL_TLSSet(queue_tls, reinterpret_cast<void*>(size_t(reserved + 1)), 0);
+	return true;
+}
+
+void JobSystem::Add(
+	Function function, void * data,
+	int begin, int end,
+	Fence & fence,
+	const Fence * dependency)
+{
+	if (workers.empty())
+	{
+		// all previous jobs have been executed, dependency is done
+		assert(!dependency || dependency->Done());
+		function(data, begin, end);
+		return;
+	}
+
+	Push(function, data, begin, end, fence, dependency);
+	Notify();
+}
+
+void JobSystem::Push(
+	Function function, void * data,
+	int begin, int end,
+	Fence & fence,
+	const Fence * dependency)
+{
+	Job job;
+	job.function = function;
+	job.data = data;
+	job.begin = begin;
+	job.end = end;
+	job.fence = &fence;
+	job.dependency = dependency;
+
+	SDL_AtomicIncRef(&fence.count);
+
+	Queue & q = queues[GetQueueIndex()];
+	SDL_AtomicLock(&q.lock);
+	q.jobs.push_back(job);
+	SDL_AtomicUnlock(&q.lock);
+}
+
+void JobSystem::ParallelFor(
+	Function function, void * data,
+	int begin, int end, int grain,
+	Fence & fence,
+	const Fence * dependency)
+{
+	assert(grain > 0);
+	if (workers.empty())
+	{
+		assert(!dependency || dependency->Done());
+		function(data, begin, end);
+		return;
+	}
+
+	// wake the workers once for all jobs
+	for (int i = begin; i < end; i += grain)
+	{
+		int n = (end - i < grain) ? end : i + grain;
+		Push(function, data, i, n, fence, dependency);
+	}
+	Notify();
+}
+
+void JobSystem::Wait(const Fence & fence)
+{
+	if (workers.empty())
+		return;
+
+	// help with the queued jobs, sleep if none of them is ready
+	int index = GetQueueIndex();
+	while (!fence.Done())
+	{
+		int seen = SDL_AtomicGet(&generation);
+		if (!RunOne(index) && !fence.Done())
+			WaitChange(seen);
+	}
+}
+
+void JobSystem::Run(Function function, void * data, int begin, int end, int grain)
+{
+	if (workers.empty() || end - begin <= grain)
+	{
+		function(data, begin, end);
+		return;
+	}
+
+	Fence fence;
+	ParallelFor(function, data, begin, end, grain, fence);
+	Wait(fence);
+}
+
+int JobSystem::WorkerMain(void * data)
+{
+	Worker & w = *static_cast<Worker*>(data);
+	JobSystem & jobs = *w.jobs;
+	w.id = SDL_ThreadID();
+	SDL_SemPost(jobs.started);
+
+	while (!SDL_AtomicGet(&jobs.quit))
+	{
+		// no job ready, queued jobs are blocked by dependencies
+		// or taken by other workers, sleep until that changes
+		int seen = SDL_AtomicGet(&jobs.generation);
+		if (!jobs.RunOne(w.index))
+			jobs.WaitChange(seen);
+	}
+	return 0;
+}
+
+void JobSystem::Notify()
+{
+	SDL_LockMutex(mutex);
+	SDL_AtomicIncRef(&generation);
+	SDL_CondBroadcast(changed);
+	SDL_UnlockMutex(mutex);
+}
+
+void JobSystem::WaitChange(int seen)
+{
+	SDL_LockMutex(mutex);
+	while (SDL_AtomicGet(&generation) == seen && !SDL_AtomicGet(&quit))
+	{
+		SDL_CondWait(changed, mutex);
+	}
+	SDL_UnlockMutex(mutex);
+}
+
+int JobSystem::GetQueueIndex() const
+{
+	SDL_threadID id = SDL_ThreadID();
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		if (workers[i].id == id)
+			return workers[i].index;
+	}
+
+	// registrations from before the last Init can be out of range
+	const size_t registered_index = reinterpret_cast<size_t>(SDL_TLSGet(queue_tls));
+	if (registered_index > workers.size() + 1 && registered_index <= queues.size())
+		return registered_index - 1;
+
+	// main thread and other threads outside of the pool share the first queue
+	return 0;
+}
+
+bool JobSystem::Take(int index, Job & job)
+{
+	// own queue lifo, good cache locality for nested jobs
+	{
+		Queue & q = queues[index];
+		SDL_AtomicLock(&q.lock);
+		for (std::deque<Job>::reverse_iterator i = q.jobs.rbegin(); i != q.jobs.rend(); ++i)
+		{
+			if (!i->dependency || i->dependency->Done())
+			{
+				job = *i;
+				q.jobs.erase((++i).base());
+				SDL_AtomicUnlock(&q.lock);
+				return true;
+			}
+		}
+		SDL_AtomicUnlock(&q.lock);
+	}
+
+	// steal oldest job from the other queues
+	const int n = queues.size();
+	for (int k = 1; k < n; ++k)
+	{
+		Queue & q = queues[(index + k) % n];
+		SDL_AtomicLock(&q.lock);
+		for (std::deque<Job>::iterator i = q.jobs.begin(); i != q.jobs.end(); ++i)
+		{
+			if (!i->dependency || i->dependency->Done())
+			{
+				job = *i;
+				q.jobs.erase(i);
+				SDL_AtomicUnlock(&q.lock);
+				return true;
+			}
+		}
+		SDL_AtomicUnlock(&q.lock);
+	}
+
+	return false;
+}
+
+bool JobSystem::RunOne(int index)
+{
+	Job job;
+	if (!Take(index, job))
+		return false;
+
+	Execute(job);
+	return true;
+}
+
+void JobSystem::Execute(const Job & job)
+{
+	job.function(job.data, job.begin, job.end);
+
+	// a done fence can unblock dependent jobs and waiting threads
+	if (SDL_AtomicDecRef(&job.fence->count))
+		Notify();
+}
+
+static void FillIndexRange(void * data, int begin, int end)
+{
+	std::vector<int> & v = *static_cast<std::vector<int>*>(data);
+	for (int i = begin; i < end; ++i)
+	{
+		v[i] = i;
+	}
+}
+
+static void IncrementRange(void * data, int begin, int end)
+{
+	std::vector<int> & v = *static_cast<std::vector<int>*>(data);
+	for (int i = begin; i < end; ++i)
+	{
+		v[i] += 1;
+	}
+}
+
+struct RegisteredThreadData
+{
+	JobSystem * jobs;
+	std::vector<int> values;
+	bool registered;
+};
+
+static int RegisteredThreadMain(void * data)
+{
+	RegisteredThreadData & d = *static_cast<RegisteredThreadData*>(data);
+	d.registered = d.jobs->RegisterThread();
+	d.jobs->Run(FillIndexRange, &d.values, 0, d.values.size(), 16);
+	return 0;
+}
+
+QT_TEST(jobsystem_test)
+{
+	for (int threads = 1; threads <= 4; threads += 3)
+	{
+		JobSystem jobs;
+		jobs.Init(threads);
+		QT_CHECK_EQUAL(jobs.GetThreadCount(), threads);
+
+		std::vector<int> v(1000, -1);
+		jobs.Run(FillIndexRange, &v, 0, v.size(), 16);
+		bool ok = true;
+		for (int i = 0; i < (int)v.size(); ++i)
+			ok = ok && (v[i] == i);
+		QT_CHECK(ok);
+
+		// second pass depends on the first one
+		JobSystem::Fence first, second;
+		jobs.ParallelFor(FillIndexRange, &v, 0, v.size(), 7, first);
+		jobs.ParallelFor(IncrementRange, &v, 0, v.size(), 13, second, &first);
+		jobs.Wait(second);
+		QT_CHECK(first.Done());
+		QT_CHECK(second.Done());
+		ok = true;
+		for (int i = 0; i < (int)v.size(); ++i)
+			ok = ok && (v[i] == i + 1);
+		QT_CHECK(ok);
+
+		jobs.Deinit();
+		QT_CHECK_EQUAL(jobs.GetThreadCount(), 1);
+	}
+
+	// threads outside of the pool register for the reserved queue
+	{
+		JobSystem jobs;
+		jobs.Init(3, 1);
+		RegisteredThreadData data[2];
+		for (int i = 0; i < 2; ++i)
+		{
+			data[i].jobs = &jobs;
+			data[i].values.resize(1000, -1);
+			data[i].registered = false;
+			SDL_WaitThread(SDL_CreateThread(RegisteredThreadMain, "JobSystemTest", &data[i]), NULL);
+		}
+		QT_CHECK(data[0].registered);
+		QT_CHECK(!data[1].registered);
+		QT_CHECK(!jobs.RegisterThread());
+		for (int i = 0; i < 2; ++i)
+		{
+			bool ok = true;
+			for (int n = 0; n < (int)data[i].values.size(); ++n)
+				ok = ok && (data[i].values[n] == n);
+			QT_CHECK(ok);
+		}
+		jobs.Deinit();
+	}
+}
@@ -0,0 +1,160 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef _JOBSYSTEM_H
+#define _JOBSYSTEM_H
+
+#include <SDL2/SDL_atomic.h>
+#include <SDL2/SDL_mutex.h>
+#include <SDL2/SDL_thread.h>
+
+#include <deque>
+#include <vector>
+
+/// Job scheduler with a fixed pool of worker threads.
+/// Every thread has its own job queue, idle threads steal from the others.
+/// Threads outside of the pool share the main thread's queue unless they
+/// register for one of the reserved queues.
+/// Without worker threads jobs are executed immediately by the caller.
+class JobSystem
+{
+public:
+	/// job function, processes the index range [begin, end)
+	typedef void (*Function)(void * data, int begin, int end);
+
+	/// Counts unfinished jobs. Jobs can depend on a fence, they are not
+	/// started before the fence is done. A fence can be reused once done.
+	class Fence
+	{
+	public:
+		Fence();
+
+		bool Done() const;
+
+	private:
+		friend class JobSystem;
+		mutable SDL_atomic_t count;
+	};
+
+	/// shared instance
+	static JobSystem & instance();
+
+	JobSystem();
+
+	~JobSystem();
+
+	/// calling thread is used as first worker, extra threads - 1 are started,
+	/// external queues are reserved for threads registered with RegisterThread
+	void Init(int threads, int external = 0);
+
+	/// wait for the workers to exit, pending jobs are not executed
+	void Deinit();
+
+	/// number of threads executing jobs, including the calling thread
+	int GetThreadCount() const;
+
+	/// Give the calling thread one of the reserved queues, the jobs it adds
+	/// don't contend with the main thread's. Threads have to register again
+	/// after Init. False without workers or if all reserved queues are taken.
+	bool RegisterThread();
+
+	/// queue job, fence is signaled once the job has been executed
+	void Add(
+		Function function, void * data,
+		int begin, int end,
+		Fence & fence,
+		const Fence * dependency = 0);
+
+	/// split range into jobs of at most grain indices
+	void ParallelFor(
+		Function function, void * data,
+		int begin, int end, int grain,
+		Fence & fence,
+		const Fence * dependency = 0);
+
+	/// execute queued jobs until fence is done
+	void Wait(const Fence & fence);
+
+	/// parallel for and wait
+	void Run(Function function, void * data, int begin, int end, int grain);
+
+private:
+	struct Job
+	{
+		Function function;
+		void * data;
+		int begin;
+		int end;
+		Fence * fence;
+		const Fence * dependency;
+	};
+
+	struct Queue
+	{
+		std::deque<Job> jobs;
+		SDL_SpinLock lock;
+		Queue() : lock(0) {}
+	};
+
+	struct Worker
+	{
+		JobSystem * jobs;
+		SDL_Thread * thread;
+		SDL_threadID id;
+		int index;
+	};
+
+	std::vector<Queue> queues;
+	std::vector<Worker> workers;
+	SDL_sem * started;		///< counts started workers during Init
+	SDL_mutex * mutex;
+	SDL_cond * changed;		///< signaled on new jobs and done fences
+	SDL_atomic_t generation;	///< incremented on every change
+	SDL_atomic_t quit;
+	SDL_atomic_t registered;	///< reserved queues taken by RegisterThread
+	SDL_TLSID queue_tls;		///< queue index + 1 of registered threads
+
+	static int WorkerMain(void * data);
+
+	/// queue job without waking the workers
+	void Push(
+		Function function, void * data,
+		int begin, int end,
+		Fence & fence,
+		const Fence * dependency);
+
+	/// wake all threads waiting for a change
+	void Notify();
+
+	/// sleep until the generation differs from seen
+	void WaitChange(int seen);
+
+	/// queue index of the calling thread
+	int GetQueueIndex() const;
+
+	/// take a job that is ready to run, own queue first
+	bool Take(int index, Job & job);
+
+	/// execute one job, false if there was none ready
+	bool RunOne(int index);
+
+	void Execute(const Job & job);
+};
+
+#endif // _JOBSYSTEM_H
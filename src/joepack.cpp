@@ -19,15 +19,25 @@
 
 #include "joepack.h"
 #include "endian_utility.h"
+#include "unordered_map.h"
 #include "unittest.h"
 
-#include <map>
-#include <fstream>
+#include <algorithm>
 #include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 using std::string;
-using std::map;
-using std::ios_base;
 
 struct JoePack::Impl
 {
@@ -37,138 +47,242 @@ struct JoePack::Impl
 		unsigned offset;
 		unsigned length;
 	};
+	typedef std::tr1::unordered_map<std::string, FatEntry> Fat;
 	const std::string versionstr;
-	std::map <std::string, FatEntry> fat;
-	std::map <std::string, FatEntry>::iterator curfa;
-	std::ifstream f;
+	Fat fat;
+	const char * data;
+	size_t size;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
 
 	Impl();
 	bool Load(const string & fn);
 	void Close();
-	void fclose();
-	bool fopen(const string & fn);
-	int fread(void * buffer, const unsigned size, const unsigned count);
+	bool Map(const string & fn);
+	void Unmap();
+	bool GetFile(const string & fn, const char * & filedata, unsigned & length) const;
+	static bool Write(const string & fn, const std::vector<std::pair<string, string> > & files);
 };
 
-JoePack::Impl::Impl() : versionstr("JPK01.00")
+static void WriteUnsigned(std::ostream & out, unsigned value)
 {
-	curfa = fat.end();
+	value = ENDIAN_SWAP_32(value);
+	out.write((const char *)&value, sizeof(unsigned));
 }
 
-bool JoePack::Impl::Load(const string & fn)
+// read little endian unsigned from the mapping, false if out of bounds
+static bool ReadUnsigned(const char * data, size_t size, size_t & pos, unsigned & value)
 {
-	Close();
-	f.clear();
-	f.open(fn.c_str(), ios_base::binary);
-	if (f)
-	{
-		//load header
-		char * versioncstr = new char[versionstr.length() + 1];
-		f.read(versioncstr, versionstr.length());
-		versioncstr[versionstr.length()] = '\0';
-		string fversionstr = versioncstr;
-		delete [] versioncstr;
-		if (fversionstr != versionstr)
-		{
-			//write out an error?
-			return false;
-		}
-
-		unsigned int numobjs = 0;
-		assert(sizeof(unsigned int) == 4);
-		f.read((char*)(&numobjs), sizeof(unsigned int));
-		numobjs = ENDIAN_SWAP_32(numobjs);
+	if (pos + sizeof(unsigned) > size)
+		return false;
 
-		//DPRINT(numobjs << " objects");
+	std::memcpy(&value, data + pos, sizeof(unsigned));
+	value = ENDIAN_SWAP_32(value);
+	pos += sizeof(unsigned);
+	return true;
+}
 
-		unsigned int maxstrlen = 0;
-		f.read((char*)(&maxstrlen), sizeof(unsigned int));
-		maxstrlen = ENDIAN_SWAP_32(maxstrlen);
+JoePack::Impl::Impl() :
+	versionstr("JPK01.00"),
+	data(0),
+	size(0)
+#ifdef _WIN32
+	, file(INVALID_HANDLE_VALUE),
+	mapping(0)
+#endif
+{
+	// ctor
+}
 
-		//DPRINT(maxstrlen << " max string length");
+bool JoePack::Impl::Map(const string & fn)
+{
+#ifdef _WIN32
+	file = CreateFileA(fn.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
 
-		char * fnch = new char[maxstrlen+1];
+	LARGE_INTEGER filesize;
+	if (!GetFileSizeEx(file, &filesize) || filesize.QuadPart == 0)
+	{
+		Unmap();
+		return false;
+	}
 
-		//load FAT
-		for (unsigned int i = 0; i < numobjs; i++)
-		{
-			FatEntry fa;
-			f.read((char*)(&(fa.offset)), sizeof(unsigned int));
-			fa.offset = ENDIAN_SWAP_32(fa.offset);
-			f.read((char*)(&(fa.length)), sizeof(unsigned int));
-			fa.length = ENDIAN_SWAP_32(fa.length);
-			f.read(fnch, maxstrlen);
-			fnch[maxstrlen] = '\0';
-			string filename = fnch;
-			fat[filename] = fa;
-
-			//DPRINT(filename << ": offest " << fa.offset << " length " << fa.length);
-		}
+	mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+	if (!mapping)
+	{
+		Unmap();
+		return false;
+	}
 
-		delete [] fnch;
-		return true;
+	data = (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!data)
+	{
+		Unmap();
+		return false;
 	}
-	else
+	size = filesize.QuadPart;
+	return true;
+#else
+	int fd = open(fn.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
 	{
-		//write an error?
+		close(fd);
 		return false;
 	}
-}
 
-void JoePack::Impl::Close()
-{
-	if (f.is_open()) f.close();
-	fat.clear();
-	curfa = fat.end();
+	void * mem = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED)
+		return false;
+
+	data = (const char *)mem;
+	size = st.st_size;
+	return true;
+#endif
 }
 
-void JoePack::Impl::fclose()
+void JoePack::Impl::Unmap()
 {
-	curfa = fat.end();
+#ifdef _WIN32
+	if (data) UnmapViewOfFile(data);
+	if (mapping) CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+	mapping = 0;
+	file = INVALID_HANDLE_VALUE;
+#else
+	if (data) munmap((void *)data, size);
+#endif
+	data = 0;
+	size = 0;
 }
 
-bool JoePack::Impl::fopen(const string & fn)
+bool JoePack::Impl::Load(const string & fn)
 {
-	curfa = fat.find(fn);
-	if (curfa == fat.end())
+	Close();
+	if (!Map(fn))
 	{
 		return false;
 	}
-	else
+
+	//load header
+	size_t pos = versionstr.length();
+	if (size < pos || versionstr.compare(0, pos, data, pos) != 0)
 	{
-		f.seekg(curfa->second.offset);
-		return true;
+		Close();
+		return false;
 	}
-}
 
-int JoePack::Impl::fread(void * buffer, const unsigned size, const unsigned count)
-{
-	if (curfa != fat.end())
+	unsigned int numobjs = 0;
+	unsigned int maxstrlen = 0;
+	if (!ReadUnsigned(data, size, pos, numobjs) ||
+		!ReadUnsigned(data, size, pos, maxstrlen))
 	{
-		unsigned int abspos = f.tellg();
-		assert(abspos >= curfa->second.offset);
-		unsigned int relpos = abspos - curfa->second.offset;
-		assert(curfa->second.length >= relpos);
-		unsigned int fileleft = curfa->second.length - relpos;
-		unsigned int requestedread = size*count;
+		Close();
+		return false;
+	}
 
-		assert(size != 0);
+	//check the FAT fits the file before allocating for it
+	const size_t entrysize = 2 * sizeof(unsigned) + size_t(maxstrlen);
+	if (maxstrlen > size || (numobjs > 0 && (size - pos) / numobjs < entrysize))
+	{
+		Close();
+		return false;
+	}
 
-		if (requestedread > fileleft)
+	//load FAT
+	fat.rehash(numobjs);
+	for (unsigned int i = 0; i < numobjs; i++)
+	{
+		FatEntry fa;
+		if (!ReadUnsigned(data, size, pos, fa.offset) ||
+			!ReadUnsigned(data, size, pos, fa.length) ||
+			pos + maxstrlen > size ||
+			fa.offset > size || fa.length > size - fa.offset)
 		{
-			//overflow
-			requestedread = fileleft/size;
+			Close();
+			return false;
 		}
 
-		//DPRINT("JOEPACK fread: " << abspos << "," << relpos << "," << fileleft << "," << requestedread);
-		f.read((char *)buffer, requestedread);
-		return f.gcount()/size;
+		const char * fnch = data + pos;
+		string filename(fnch, std::find(fnch, fnch + maxstrlen, '\0'));
+		pos += maxstrlen;
+		fat[filename] = fa;
+	}
+
+	return true;
+}
+
+void JoePack::Impl::Close()
+{
+	Unmap();
+	fat.clear();
+}
+
+bool JoePack::Impl::GetFile(const string & fn, const char * & filedata, unsigned & length) const
+{
+	Fat::const_iterator i = fat.find(fn);
+	if (i == fat.end())
+	{
+		return false;
+	}
+
+	filedata = data + i->second.offset;
+	length = i->second.length;
+	return true;
+}
+
+bool JoePack::Impl::Write(const string & fn, const std::vector<std::pair<string, string> > & files)
+{
+	const string version("JPK01.00");
+	unsigned maxstrlen = 1;
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		maxstrlen = std::max<unsigned>(maxstrlen, files[i].first.length() + 1);
+	}
+
+	// header and FAT, followed by the aligned file data
+	std::vector<unsigned> offsets(files.size());
+	size_t offset = version.length() + 2 * sizeof(unsigned) + files.size() * (2 * sizeof(unsigned) + maxstrlen);
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		offset = (offset + 15) & ~size_t(15);
+		offsets[i] = offset;
+		offset += files[i].second.length();
+		if (offset > 0xFFFFFFFFu)
+			return false;
 	}
-	else
+
+	std::ofstream out(fn.c_str(), std::ios::binary);
+	if (!out)
+		return false;
+
+	out.write(version.c_str(), version.length());
+	WriteUnsigned(out, files.size());
+	WriteUnsigned(out, maxstrlen);
+	for (size_t i = 0; i < files.size(); i++)
 	{
-		//write error?
-		return 0;
+		string name = files[i].first;
+		name.resize(maxstrlen, '\0');
+		WriteUnsigned(out, offsets[i]);
+		WriteUnsigned(out, files[i].second.length());
+		out.write(name.c_str(), maxstrlen);
 	}
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		size_t pos = out.tellp();
+		if (pos < offsets[i])
+			out.write("\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0", offsets[i] - pos);
+		out.write(files[i].second.data(), files[i].second.length());
+	}
+
+	return out.good();
 }
 
 JoePack::JoePack()
@@ -194,40 +308,60 @@ void JoePack::Close()
 	impl->Close();
 }
 
-void JoePack::fclose() const
+bool JoePack::GetFile(const std::string & fn, const char * & data, unsigned & length) const
 {
-	impl->fclose();
-}
-
-bool JoePack::fopen(const string & fn) const
-{
-	string newfn;
 	if (fn.find(packpath, 0) < fn.length())
 	{
-		newfn = fn.substr(packpath.length()+1);
+		return impl->GetFile(fn.substr(packpath.length()+1), data, length);
 	}
-	else
+	return impl->GetFile(fn, data, length);
+}
+
+void JoePack::GetFileNames(std::vector<std::string> & names) const
+{
+	names.reserve(names.size() + impl->fat.size());
+	for (Impl::Fat::const_iterator i = impl->fat.begin(); i != impl->fat.end(); ++i)
 	{
-		newfn = fn;
+		names.push_back(i->first);
 	}
-	return impl->fopen(newfn);
 }
 
-int JoePack::fread(void * buffer, const unsigned size, const unsigned count) const
+bool JoePack::Write(const std::string & fn, const std::vector<std::pair<std::string, std::string> > & files)
 {
-	return impl->fread(buffer, size, count);
+	return Impl::Write(fn, files);
 }
 
 QT_TEST(joepack_test)
 {
 	JoePack p;
 	QT_CHECK(p.Load("data/test/test1.jpk"));
-	QT_CHECK(p.fopen("testlist.txt"));
-	char buf[1000];
-	unsigned int chars = p.fread(buf, 1, 999);
-	QT_CHECK_EQUAL(chars, 16);
-	buf[chars] = '\0';
+	const char * data = 0;
+	unsigned length = 0;
+	QT_CHECK(p.GetFile("testlist.txt", data, length));
+	QT_CHECK_EQUAL(length, 16);
 	string comparisonstr = "This is\na test.\n";
-	string filestr = buf;
-	QT_CHECK_EQUAL(buf,comparisonstr);
+	string filestr(data, length);
+	QT_CHECK_EQUAL(filestr, comparisonstr);
+
+	std::vector<std::pair<string, string> > files;
+	files.push_back(std::make_pair(string("a.bin"), string("abc")));
+	files.push_back(std::make_pair(string("dir/b.bin"), string(1000, 'b')));
+	QT_CHECK(JoePack::Write("joepack_test.jpk", files));
+	QT_CHECK(p.Load("joepack_test.jpk"));
+	QT_CHECK(p.GetFile("dir/b.bin", data, length));
+	QT_CHECK_EQUAL(length, 1000);
+	QT_CHECK_EQUAL(size_t(data) % 16, 0);
+	QT_CHECK(p.GetFile("a.bin", data, length));
+	QT_CHECK_EQUAL(string(data, length), "abc");
+	p.Close();
+
+	// a FAT larger than the file is rejected before it is allocated
+	{
+		std::ofstream out("joepack_test.jpk", std::ios::binary);
+		out.write("JPK01.00", 8);
+		WriteUnsigned(out, 0x40000000u);
+		WriteUnsigned(out, 16);
+	}
+	QT_CHECK(!p.Load("joepack_test.jpk"));
+	std::remove("joepack_test.jpk");
 }
@@ -21,7 +21,11 @@
 #define _JOEPACK_H
 
 #include <string>
+#include <vector>
 
+/// Read only file archive. The archive is memory mapped, files are
+/// accessed as views into the mapping. Lookups do not modify the pack,
+/// a loaded pack can be read from multiple threads.
 class JoePack
 {
 public:
@@ -35,16 +39,24 @@ public:
 
 	void Close();
 
-	bool fopen(const std::string & fn) const;
+	/// get view of file fn, valid until the pack is closed
+	/// fn can be relative to the pack or prefixed with the pack path
+	bool GetFile(const std::string & fn, const char * & data, unsigned & length) const;
 
-	void fclose() const;
+	/// names of the files in the pack
+	void GetFileNames(std::vector<std::string> & names) const;
 
-	int fread(void * buffer, const unsigned size, const unsigned count) const;
+	/// write files (name, data) into a new archive fn
+	/// file data is aligned to 16 bytes
+	static bool Write(const std::string & fn, const std::vector<std::pair<std::string, std::string> > & files);
 
 private:
 	std::string packpath;
 	struct Impl;
 	Impl* impl;
+
+	JoePack(const JoePack & other);
+	JoePack & operator=(const JoePack & other);
 };
 
 #endif
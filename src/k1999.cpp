@@ -28,13 +28,18 @@
 
 #include "k1999.h"
 #include "roadstrip.h"
+#include "jobsystem.h"
+#include "unittest.h"
 
 #include <cassert>
+#include <cmath>
 
 #define SecurityR   100.0 // Security radius
 #define SideDistExt 2.0 // Security distance wrt outside
 #define SideDistInt 1.0 // Security distance wrt inside
 #define Iterations  100 // Number of smoothing operations
+#define Convergence 1E-6 // Lane change to stop smoothing at
+#define Grain       256 // Control points per job
 #define Mag(x,y) sqrt((x)*(x)+(y)*(y))
 #define Min(X,Y) ((X)<(Y)?(X):(Y))
 #define Max(X,Y) ((X)>(Y)?(X):(Y))
@@ -168,42 +173,69 @@ void K1999::AdjustRadius(int prev, int i, int next, double TargetRInverse, doubl
 	UpdateTxTy(i);
 }
 
+/////////////////////////////////////////////////////////////////////////////
+// Smooth control point k of the Points control points Step apart
+/////////////////////////////////////////////////////////////////////////////
+void K1999::SmoothPoint(int k, int Step, int Points)
+{
+	int i = k * Step;
+	int prevprev = ((k + Points - 2) % Points) * Step;
+	int prev = ((k + Points - 1) % Points) * Step;
+	int next = ((k + 1) % Points) * Step;
+	int nextnext = ((k + 2) % Points) * Step;
+
+	double ri0 = GetRInverse(prevprev, tx[prev], ty[prev], i);
+	double ri1 = GetRInverse(i, tx[next], ty[next], nextnext);
+	double lPrev = Mag(tx[i] - tx[prev], ty[i] - ty[prev]);
+	double lNext = Mag(tx[i] - tx[next], ty[i] - ty[next]);
+
+	double TargetRInverse = (lNext * ri0 + lPrev * ri1) / (lNext + lPrev);
+
+	double Security = lPrev * lNext / (8 * SecurityR);
+	double OldLane = tLane[i];
+	AdjustRadius(prev, i, next, TargetRInverse, Security);
+	tChange[i] = fabs(tLane[i] - OldLane);
+}
+
+void K1999::SmoothPoints(void * k1999, int begin, int end)
+{
+	K1999 & k = *static_cast<K1999*>(k1999);
+	for (int j = begin; j < end; ++j)
+		k.SmoothPoint(k.JobColor + 3 * j, k.JobStep, k.JobPoints);
+}
+
 /////////////////////////////////////////////////////////////////////////////
 // Smooth path
 /////////////////////////////////////////////////////////////////////////////
-void K1999::Smooth(int Step)
+double K1999::Smooth(int Step)
 {
-	int prev = ((Divs - Step) / Step) * Step;
-	int prevprev = prev - Step;
-	int next = Step;
-	int nextnext = next + Step;
-
-	assert(prev >= 0);
-	//std::cout << Divs << ", " << Step << ", " << prev << ", " << tx.size() << std::endl;
-	assert(prev < (int)tx.size());
-	assert(prev < (int)ty.size());
-	assert(next < (int)tx.size());
-	assert(next < (int)ty.size());
-
-	for (int i = 0; i <= Divs - Step; i += Step)
-	{
-	 	double ri0 = GetRInverse(prevprev, tx[prev], ty[prev], i);
-		double ri1 = GetRInverse(i, tx[next], ty[next], nextnext);
-		double lPrev = Mag(tx[i] - tx[prev], ty[i] - ty[prev]);
-		double lNext = Mag(tx[i] - tx[next], ty[i] - ty[next]);
-
-		double TargetRInverse = (lNext * ri0 + lPrev * ri1) / (lNext + lPrev);
-
-		double Security = lPrev * lNext / (8 * SecurityR);
-		AdjustRadius(prev, i, next, TargetRInverse, Security);
-
-		prevprev = prev;
-		prev = i;
-		next = nextnext;
-		nextnext = next + Step;
-		if (nextnext > Divs - Step)
-			nextnext = 0;
-	}
+	// A control point depends on two neighbours on each side, points three
+	// apart are independent. Update them in three parallel passes, the
+	// points left over by the ring wrap around are updated last.
+	int Points = (Divs - Step) / Step + 1;
+	int Colored = Points - Points % 3;
+
+	assert((Points - 1) * Step < (int)tx.size());
+
+	JobStep = Step;
+	JobPoints = Points;
+	for (JobColor = 0; JobColor < 3; ++JobColor)
+		JobSystem::instance().Run(SmoothPoints, this, 0, Colored / 3, Grain);
+
+	for (int k = Colored; k < Points; ++k)
+		SmoothPoint(k, Step, Points);
+
+	double Change = 0;
+	for (int k = 0; k < Points; ++k)
+		Change = Max(Change, tChange[k * Step]);
+	return Change;
+}
+
+void K1999::SmoothSerial(int Step)
+{
+	int Points = (Divs - Step) / Step + 1;
+	for (int k = 0; k < Points; ++k)
+		SmoothPoint(k, Step, Points);
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -229,21 +261,32 @@ void K1999::StepInterpolate(int iMin, int iMax, int Step)
 	}
 }
 
+void K1999::StepInterpolates(void * k1999, int begin, int end)
+{
+	K1999 & k = *static_cast<K1999*>(k1999);
+	for (int j = begin; j < end; ++j)
+	{
+		int iMin = j * k.JobStep;
+		int iMax = (j + 1 < k.JobPoints) ? iMin + k.JobStep : k.Divs;
+		k.StepInterpolate(iMin, iMax, k.JobStep);
+	}
+}
+
 /////////////////////////////////////////////////////////////////////////////
 // Calls to StepInterpolate for the full path
 /////////////////////////////////////////////////////////////////////////////
 void K1999::Interpolate(int Step)
 {
+	// segments only modify their inner points, they are independent
 	if (Step > 1)
 	{
-		int i;
-		for (i = Step; i <= Divs - Step; i += Step)
-			StepInterpolate(i - Step, i, Step);
-		StepInterpolate(i - Step, Divs, Step);
+		JobStep = Step;
+		JobPoints = (Divs - Step) / Step + 1;
+		JobSystem::instance().Run(StepInterpolates, this, 0, JobPoints, Grain / Step + 1);
 	}
 }
 
-void K1999::CalcRaceLine()
+void K1999::CalcRaceLine(bool reference)
 {
 	const unsigned int stepsize = 128;
 
@@ -257,7 +300,12 @@ void K1999::CalcRaceLine()
 	for (int Step = stepsize; (Step /= 2) > 0;)
 	{
 		for (int i = Iterations * int(sqrt(float(Step))); --i >= 0;)
-			Smooth(Step);
+		{
+			if (reference)
+				SmoothSerial(Step);
+			else if (Smooth(Step) < Convergence)
+				break;
+		}
 		Interpolate(Step);
 	}
 
@@ -294,6 +342,7 @@ bool K1999::LoadData(const RoadStrip & road)
 	txRight.clear();
 	tyRight.clear();
 	tLane.clear();
+	tChange.clear();
 
 	const std::vector<RoadPatch> & patchlist = road.GetPatches();
 	Divs = patchlist.size();
@@ -310,6 +359,7 @@ bool K1999::LoadData(const RoadStrip & road)
 		tx.push_back(0.0);
 		ty.push_back(0.0);
 		tRInverse.push_back(0.0);
+		tChange.push_back(0.0);
 		UpdateTxTy(count);
 
 		count++;
@@ -343,4 +393,61 @@ void K1999::UpdateRoadStrip(RoadStrip & road)
 	txRight.clear();
 	tyRight.clear();
 	tLane.clear();
+	tChange.clear();
+}
+
+// closed loop with varying radius in the ground plane, road width 10
+static void MakeLoop(RoadStrip & road, int divs)
+{
+	std::vector<RoadPatch> & patches = road.GetPatches();
+	patches.resize(divs);
+	Vec3 left[2], right[2];
+	for (int i = 0; i <= divs; ++i)
+	{
+		const double a = 2 * M_PI * i / divs;
+		const double r = 200 + 40 * sin(3 * a) + 20 * cos(5 * a);
+		left[i % 2].Set((r - 5) * cos(a), (r - 5) * sin(a), 0);
+		right[i % 2].Set((r + 5) * cos(a), (r + 5) * sin(a), 0);
+		if (i > 0)
+			patches[i - 1].GetPatch().SetFromCorners(left[i % 2], right[i % 2], left[1 - i % 2], right[1 - i % 2]);
+	}
+}
+
+QT_TEST(k1999_test)
+{
+	// parallel smoothing with early exit against the original serial smoothing
+	const int divs = 1500;
+	RoadStrip road, reference;
+	MakeLoop(road, divs);
+	MakeLoop(reference, divs);
+
+	K1999 k;
+	k.LoadData(road);
+	k.CalcRaceLine();
+	k.UpdateRoadStrip(road);
+
+	k.LoadData(reference);
+	k.CalcRaceLine(true);
+	k.UpdateRoadStrip(reference);
+
+	// neither smoother is fully converged, the serial one itself moves by
+	// about 2% of the peak curvature when given more iterations
+	double sum_curvature = 0, sum_error = 0;
+	double max_curvature = 0, max_error = 0, max_offset = 0;
+	for (int i = 0; i < divs; ++i)
+	{
+		const RoadPatch & p = road.GetPatches()[i];
+		const RoadPatch & r = reference.GetPatches()[i];
+		const double c = r.GetTrackCurvature();
+		const double e = p.GetTrackCurvature() - c;
+		sum_curvature += c * c;
+		sum_error += e * e;
+		max_curvature = Max(max_curvature, fabs(c));
+		max_error = Max(max_error, fabs(e));
+		max_offset = Max(max_offset, (p.GetRacingLine() - r.GetRacingLine()).Magnitude());
+	}
+	QT_CHECK_GREATER(max_curvature, 0);
+	QT_CHECK_LESS(sqrt(sum_error), 0.01 * sqrt(sum_curvature));
+	QT_CHECK_LESS(max_error, 0.02 * max_curvature);
+	QT_CHECK_LESS(max_offset, 0.2);
 }
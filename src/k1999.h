@@ -45,13 +45,23 @@ private:
 	std::vector <double> txRight;
 	std::vector <double> tyRight;
 	std::vector <double> tLane;
+	std::vector <double> tChange; // lane change of the last smooth pass
 	int Divs;
 
+	// smooth and interpolate job state
+	int JobStep;
+	int JobPoints;
+	int JobColor;
+
 	void UpdateTxTy(int i);
 	double GetRInverse(int prev, double x, double y, int next);
 	void AdjustRadius(int prev, int i, int next, double TargetRInverse, double Security = 0);
-	void Smooth(int Step);
+	void SmoothPoint(int k, int Step, int Points);
+	static void SmoothPoints(void * k1999, int begin, int end);
+	double Smooth(int Step); // returns the max lane change
+	void SmoothSerial(int Step); // original point by point smoothing
 	void StepInterpolate(int iMin, int iMax, int Step);
+	static void StepInterpolates(void * k1999, int begin, int end);
 	void Interpolate(int Step);
 
 #ifdef DRAWPATH
@@ -60,7 +70,8 @@ private:
 
 public:
 	bool LoadData(const RoadStrip & road);
-	void CalcRaceLine();
+	/// reference runs the original serial smoothing without early exit
+	void CalcRaceLine(bool reference = false);
 	void UpdateRoadStrip(RoadStrip & road);
 };
 
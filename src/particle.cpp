@@ -20,6 +20,7 @@
 #include "particle.h"
 #include "content/contentmanager.h"
 #include "graphics/texture.h"
+#include "jobsystem.h"
 #include "unittest.h"
 
 static inline float clamp(float v, float vmin, float vmax)
@@ -99,20 +100,10 @@ void ParticleSystem::UpdateGraphics(
 	node.GetTransform().SetRotation(-camdir);
 
 	// get particle position in camera space
-	distance_from_cam.clear();
-	for (unsigned i = 0; i < particles.size(); ++i)
-	{
-		Particle & p = particles[i];
-		Vec3 pos = p.start_position;
-		pos = pos + p.direction * p.time * p.speed - campos;
-		camdir.RotateVector(pos);
-
-		// signed distance along z-axis in camera space
-		distance_from_cam.push_back(-pos[2]);
-
-		// store camera space position
-		p.position = pos;
-	}
+	cam_rot = camdir;
+	cam_pos = campos;
+	distance_from_cam.resize(particles.size());
+	JobSystem::instance().Run(TransformJob, this, 0, particles.size(), 256);
 
 	// sort particles by distance to camera
 
@@ -182,6 +173,24 @@ void ParticleSystem::UpdateGraphics(
 	GetDrawList(node).get(draw).SetDrawEnable(varray.GetNumIndices() > 0);
 }
 
+void ParticleSystem::TransformJob(void * system, int begin, int end)
+{
+	ParticleSystem & ps = *static_cast<ParticleSystem*>(system);
+	for (int i = begin; i < end; ++i)
+	{
+		Particle & p = ps.particles[i];
+		Vec3 pos = p.start_position;
+		pos = pos + p.direction * p.time * p.speed - ps.cam_pos;
+		ps.cam_rot.RotateVector(pos);
+
+		// signed distance along z-axis in camera space
+		ps.distance_from_cam[i] = -pos[2];
+
+		// store camera space position
+		p.position = pos;
+	}
+}
+
 void ParticleSystem::AddParticle(
 	const Vec3 & position,
 	float newspeed)
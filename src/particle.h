@@ -109,6 +109,12 @@ private:
 	VertexArray varray;
 	SceneNode node;
 
+	// camera space transform job parameters
+	Quat cam_rot;
+	Vec3 cam_pos;
+
+	static void TransformJob(void * system, int begin, int end);
+
 	static keyed_container<Drawable> & GetDrawList(SceneNode & node)
 	{
 		return node.GetDrawList().particle;
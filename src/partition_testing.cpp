@@ -0,0 +1,223 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#include "partition_testing.h"
+#include "aabbtree.h"
+#include "aabbbvh.h"
+#include "camera.h"
+#include "frustum.h"
+#include "quickprof.h"
+#include "track.h"
+#include "graphics/drawable_container.h"
+#include "graphics/graphics_camera.h"
+
+#include <vector>
+#include <iostream>
+
+template <typename T> class PtrVector : public std::vector<T*> {};
+
+struct AppendDrawables
+{
+	AppendDrawables(std::vector<Drawable*> & output) : output(output) {}
+	std::vector<Drawable*> & output;
+	template <typename T>
+	void operator()(const T & container)
+	{
+		output.insert(output.end(), container.begin(), container.end());
+	}
+};
+
+template <typename Tree, typename Shape, typename Data>
+static unsigned long long QueryTime(
+	const std::vector<Tree> & trees,
+	const std::vector<Shape> & shapes,
+	const int repeat,
+	std::vector<Data> & candidates,
+	unsigned int & hits)
+{
+	quickprof::Clock clock;
+	hits = 0;
+	unsigned long long start = clock.getTimeMicroseconds();
+	for (int r = 0; r < repeat; ++r)
+	{
+		for (typename std::vector<Shape>::const_iterator s = shapes.begin(); s != shapes.end(); ++s)
+		{
+			for (typename std::vector<Tree>::const_iterator t = trees.begin(); t != trees.end(); ++t)
+			{
+				candidates.clear();
+				t->Query(*s, candidates);
+				hits += candidates.size();
+			}
+		}
+	}
+	return clock.getTimeMicroseconds() - start;
+}
+
+static void Report(
+	const char * name,
+	unsigned long long tree_time,
+	unsigned long long bvh_time,
+	unsigned int tree_hits,
+	unsigned int bvh_hits,
+	std::ostream & info_output)
+{
+	info_output << name << " aabb tree: " << tree_time << " us, bvh: " << bvh_time << " us";
+	if (bvh_time > 0)
+		info_output << ", speedup: " << float(tree_time) / bvh_time;
+	info_output << std::endl;
+	if (tree_hits != bvh_hits)
+		info_output << name << " result mismatch: " << tree_hits << " vs " << bvh_hits << std::endl;
+}
+
+PartitionTesting::PartitionTesting(int repeat) :
+	repeat(repeat)
+{
+	// ctor
+}
+
+void PartitionTesting::Test(
+	Track & track,
+	std::ostream & info_output,
+	std::ostream & error_output)
+{
+	if (!track.Loaded())
+	{
+		error_output << "Space partitioning test requires a loaded track" << std::endl;
+		return;
+	}
+
+	info_output << "Beginning space partitioning test" << std::endl;
+	TestRoads(track, info_output);
+	TestDrawables(track, info_output);
+	info_output << "Space partitioning test complete." << std::endl;
+}
+
+void PartitionTesting::TestRoads(const Track & track, std::ostream & info_output)
+{
+	typedef AabbTreeNode<int> TreeType;
+	typedef AabbBvh<int, 2> BvhType;
+	const std::list<RoadStrip> & roads = track.GetRoadList();
+
+	// one partition per road strip like RoadStrip::Collide,
+	// one down ray per patch center like a wheel contact query
+	std::vector<TreeType> trees(roads.size());
+	std::vector<BvhType> bvhs(roads.size());
+	std::vector<Aabb<float>::Ray> rays;
+	quickprof::Clock clock;
+	unsigned long long tree_build = 0, bvh_build = 0;
+	unsigned int n = 0;
+	for (std::list<RoadStrip>::const_iterator r = roads.begin(); r != roads.end(); ++r, ++n)
+	{
+		const std::vector<RoadPatch> & patches = r->GetPatches();
+		for (int i = 0; i < (int)patches.size(); ++i)
+		{
+			const Aabb<float> box = patches[i].GetPatch().GetAABB();
+			trees[n].Add(i, box);
+			bvhs[n].Add(i, box);
+			rays.push_back(Aabb<float>::Ray(box.GetCenter() + Direction::Up * 2, -Direction::Up, 4));
+		}
+
+		unsigned long long start = clock.getTimeMicroseconds();
+		trees[n].Optimize();
+		tree_build += clock.getTimeMicroseconds() - start;
+
+		start = clock.getTimeMicroseconds();
+		bvhs[n].Optimize();
+		bvh_build += clock.getTimeMicroseconds() - start;
+	}
+	info_output << "Road strips: " << roads.size() << ", patches: " << rays.size() << std::endl;
+	Report("Road build", tree_build, bvh_build, 0, 0, info_output);
+
+	std::vector<int> candidates;
+	unsigned int tree_hits, bvh_hits;
+	unsigned long long tree_time = QueryTime(trees, rays, repeat, candidates, tree_hits);
+	unsigned long long bvh_time = QueryTime(bvhs, rays, repeat, candidates, bvh_hits);
+	Report("Road ray query", tree_time, bvh_time, tree_hits, bvh_hits, info_output);
+}
+
+void PartitionTesting::TestDrawables(Track & track, std::ostream & info_output)
+{
+	typedef AabbTreeNode<Drawable*, 64> TreeType;
+	typedef AabbBvh<Drawable*, 8> BvhType;
+
+	// gather static drawables with their world transforms
+	DrawableContainer<PtrVector> drawlist;
+	track.GetTrackNode().Traverse(drawlist, Mat4());
+	std::vector<Drawable*> drawables;
+	drawlist.ForEach(AppendDrawables(drawables));
+
+	// bounding boxes as built by AabbTreeNodeAdapter
+	std::vector<TreeType> trees(1);
+	std::vector<BvhType> bvhs(1);
+	for (std::vector<Drawable*>::iterator i = drawables.begin(); i != drawables.end(); ++i)
+	{
+		Vec3 objpos((*i)->GetObjectCenter());
+		(*i)->GetTransform().TransformVectorOut(objpos[0], objpos[1], objpos[2]);
+		Aabb<float> box;
+		box.SetFromSphere(objpos, (*i)->GetRadius());
+		trees[0].Add(*i, box);
+		bvhs[0].Add(*i, box);
+	}
+
+	quickprof::Clock clock;
+	unsigned long long start = clock.getTimeMicroseconds();
+	trees[0].Optimize();
+	unsigned long long tree_build = clock.getTimeMicroseconds() - start;
+	start = clock.getTimeMicroseconds();
+	bvhs[0].Optimize();
+	unsigned long long bvh_build = clock.getTimeMicroseconds() - start;
+	info_output << "Static drawables: " << drawables.size() << std::endl;
+	Report("Drawable build", tree_build, bvh_build, 0, 0, info_output);
+
+	// view frustums along the road, camera above a patch looking at the next one
+	Quat camlook;
+	camlook.Rotate(M_PI_2, 1, 0, 0);
+	GraphicsCamera cam;
+	cam.fov = 45;
+	cam.view_distance = 1000;
+	cam.w = 4;
+	cam.h = 3;
+	const Mat4 proj = GetProjMatrix(cam);
+	std::vector<Frustum> frustums;
+	const std::list<RoadStrip> & roads = track.GetRoadList();
+	for (std::list<RoadStrip>::const_iterator r = roads.begin(); r != roads.end(); ++r)
+	{
+		const std::vector<RoadPatch> & patches = r->GetPatches();
+		for (int i = 0; i + 1 < (int)patches.size(); ++i)
+		{
+			const Vec3 pos = patches[i].GetPatch().GetAABB().GetCenter() + Direction::Up * 2;
+			const Vec3 next = patches[i + 1].GetPatch().GetAABB().GetCenter() + Direction::Up * 2;
+			if ((next - pos).MagnitudeSquared() < 1E-6)
+				continue;
+
+			cam.pos = pos;
+			cam.rot = -(LookAt(pos, next, Direction::Up) * camlook);
+			const Mat4 view = GetViewMatrix(cam);
+			frustums.push_back(Frustum());
+			frustums.back().Extract(proj.GetArray(), view.GetArray());
+		}
+	}
+	info_output << "View frustums: " << frustums.size() << std::endl;
+
+	std::vector<Drawable*> candidates;
+	unsigned int tree_hits, bvh_hits;
+	unsigned long long tree_time = QueryTime(trees, frustums, repeat, candidates, tree_hits);
+	unsigned long long bvh_time = QueryTime(bvhs, frustums, repeat, candidates, bvh_hits);
+	Report("Drawable frustum query", tree_time, bvh_time, tree_hits, bvh_hits, info_output);
+}
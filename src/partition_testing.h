@@ -17,10 +17,31 @@
 /*                                                                      */
 /************************************************************************/
 
-#include "parallel_task.h"
+#ifndef _PARTITION_TESTING_H
+#define _PARTITION_TESTING_H
 
-int Parallel::Dispatch(void * data)
+#include <iosfwd>
+
+class Track;
+
+/// Micro benchmark comparing the aabb tree and the flattened bvh
+/// on the road patches and static drawables of a loaded track.
+class PartitionTesting
 {
-	((Task *) data)->Run();
-	return 0;
-}
+public:
+	PartitionTesting(int repeat = 10);
+
+	void Test(
+		Track & track,
+		std::ostream & info_output,
+		std::ostream & error_output);
+
+private:
+	int repeat; ///< number of times each query set is run
+
+	void TestRoads(const Track & track, std::ostream & info_output);
+
+	void TestDrawables(Track & track, std::ostream & info_output);
+};
+
+#endif
@@ -99,6 +99,7 @@ void PathManager::Init(std::ostream & info_output, std::ostream & error_output)
 	MakeDir(GetTrackRecordsPath());
 	MakeDir(GetReplayPath());
 	MakeDir(GetScreenshotPath());
+	MakeDir(GetTrackCachePath());
 	MakeDir(GetTemporaryFolder());
 
 	// Print diagnostic info.
@@ -316,6 +317,11 @@ std::string PathManager::GetReplayPath() const
 	return settings_path+"/replays";
 }
 
+std::string PathManager::GetTrackCachePath() const
+{
+	return settings_path+"/trackcache";
+}
+
 std::string PathManager::GetScreenshotPath() const
 {
 	return settings_path+"/screenshots";
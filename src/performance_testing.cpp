@@ -23,25 +23,113 @@
 #include "physics/tracksurface.h"
 #include "content/contentmanager.h"
 #include "cfg/ptree.h"
+#include "coordinatesystem.h"
+#include "jobsystem.h"
+#include "quickprof.h"
+#include "unittest.h"
 
 #include "BulletCollision/CollisionDispatch/btCollisionObject.h"
+#include "BulletCollision/CollisionDispatch/btDefaultCollisionConfiguration.h"
+#include "BulletCollision/BroadphaseCollision/btDbvtBroadphase.h"
 #include "BulletCollision/CollisionShapes/btStaticPlaneShape.h"
+#include "BulletDynamics/ConstraintSolver/btSequentialImpulseConstraintSolver.h"
 
 #include <vector>
 #include <iostream>
+#include <fstream>
 #include <sstream>
-#include <ctime>
 
 static inline float ConvertToMPH(float ms)
 {
 	return ms * 2.23693629;
 }
 
+static inline float ConvertToKPH(float ms)
+{
+	return ms * 3.6;
+}
+
 static inline float ConvertToFeet(float meters)
 {
 	return meters * 3.2808399;
 }
 
+// copy setup values into the car config, nested keys are joined by '.'
+static void ApplySetup(const PTree & setup, const std::string & prefix, PTree & cfg)
+{
+	for (PTree::const_iterator i = setup.begin(); i != setup.end(); ++i)
+	{
+		const std::string key = prefix + i->first;
+		if (i->second.size() == 0)
+			cfg.set(key, i->second.value());
+		else
+			ApplySetup(i->second, key + ".", cfg);
+	}
+}
+
+// write str as a csv field, quoted if it contains separators, quotes or line breaks
+static void WriteCsvString(const std::string & str, std::ostream & out)
+{
+	if (str.find_first_of(",\"\r\n") == std::string::npos)
+	{
+		out << str;
+		return;
+	}
+
+	out << '"';
+	for (size_t i = 0; i < str.size(); ++i)
+	{
+		if (str[i] == '"')
+			out << '"';
+		out << str[i];
+	}
+	out << '"';
+}
+
+// write str as a quoted json string, escaping quotes, backslashes and control characters
+static void WriteJsonString(const std::string & str, std::ostream & out)
+{
+	static const char hex[] = "0123456789abcdef";
+	out << '"';
+	for (size_t i = 0; i < str.size(); ++i)
+	{
+		const unsigned char c = str[i];
+		if (c == '"' || c == '\\')
+			out << '\\' << c;
+		else if (c == '\n')
+			out << "\\n";
+		else if (c == '\t')
+			out << "\\t";
+		else if (c == '\r')
+			out << "\\r";
+		else if (c < 0x20)
+			out << "\\u00" << hex[c >> 4] << hex[c & 15];
+		else
+			out << c;
+	}
+	out << '"';
+}
+
+PerformanceTesting::Result::Result() :
+	max_speed(0),
+	max_speed_time(0),
+	max_speed_downforce(0),
+	max_speed_drag(0),
+	time_to_60mph(0),
+	time_to_100kmh(0),
+	quarter_time(0),
+	quarter_speed(0),
+	stopping_distance(0),
+	stopping_distance_noabs(0),
+	lateral_g(0),
+	speed_wall_time(0),
+	stopping_wall_time(0),
+	skidpad_wall_time(0),
+	valid(false)
+{
+	// ctor
+}
+
 PerformanceTesting::PerformanceTesting(DynamicsWorld & world) :
 	world(world), track(0), plane(0)
 {
@@ -76,6 +164,234 @@ void PerformanceTesting::Test(
 {
 	info_output << "Beginning car performance test on " << carname << std::endl;
 
+	const PTree setup;
+	if (!Load(cardir, carname, "", setup, content, error_output))
+	{
+		return;
+	}
+
+	btVector3 cm = -car.GetCenterOfMassOffset();
+	info_output << "Car dynamics loaded" << std::endl;
+	info_output << carname << " Summary:\n"
+		<< "Mass including driver and fuel: " << 1 / car.GetInvMass() << " kg\n"
+		<< "Center of mass: " << cm[0] << ", " << cm[1] << ", " << cm[2] << " m" << std::endl;
+	info_output << "Estimated maximum speed: " << ConvertToMPH(car.GetMaxSpeedMPS()) << " MPH" << std::endl;
+
+	Result r;
+	r.car = carname;
+	Run(r, error_output);
+
+	info_output << "Maximum speed: " << ConvertToMPH(r.max_speed) << " MPH at " << r.max_speed_time << " s" << std::endl;
+	info_output << "Downforce at maximum speed: " << r.max_speed_downforce << " N; L/D: " << r.max_speed_downforce / r.max_speed_drag << std::endl;
+	info_output << "0-60 MPH time: " << r.time_to_60mph << " s" << std::endl;
+	info_output << "0-100 km/h time: " << r.time_to_100kmh << " s" << std::endl;
+	info_output << "1/4 mile time: " << r.quarter_time << " s" << " at " << ConvertToMPH(r.quarter_speed) << " MPH" << std::endl;
+	info_output << "100-0 km/h stopping distance (ABS): " << r.stopping_distance << " m, " << ConvertToFeet(r.stopping_distance) << " ft" << std::endl;
+	info_output << "100-0 km/h stopping distance (no ABS): " << r.stopping_distance_noabs << " m, " << ConvertToFeet(r.stopping_distance_noabs) << " ft" << std::endl;
+	info_output << "Skidpad lateral acceleration: " << r.lateral_g << " g" << std::endl;
+	info_output << "Test wall time: " << r.speed_wall_time << " s speed, " << r.stopping_wall_time << " s stopping, " << r.skidpad_wall_time << " s skidpad" << std::endl;
+	info_output << "Car performance test complete." << std::endl;
+}
+
+struct PerformanceTesting::SweepWorld
+{
+	btDefaultCollisionConfiguration config;
+	btCollisionDispatcher dispatch;
+	btDbvtBroadphase broadphase;
+	btSequentialImpulseConstraintSolver solver;
+	DynamicsWorld world;
+
+	SweepWorld() :
+		dispatch(&config),
+		world(&dispatch, &broadphase, &solver, &config, 1 / 90.0)
+	{
+		world.setContactAddedCallback(&CarDynamics::WheelContactCallback);
+	}
+};
+
+// the world is declared first, it has to outlive the test car
+struct PerformanceTesting::SweepJob
+{
+	SweepWorld world;
+	PerformanceTesting test;
+	Result result;
+	std::ostringstream error_output;
+	bool loaded;
+
+	SweepJob() : test(world.world), loaded(false) {}
+};
+
+bool PerformanceTesting::Sweep(
+	const PTree & cfg,
+	const std::string & carsdir,
+	const std::string & output,
+	ContentManager & content,
+	std::ostream & info_output,
+	std::ostream & error_output)
+{
+	std::vector<std::string> cars, tires;
+	if (!cfg.get("cars", cars, error_output))
+	{
+		return false;
+	}
+	if (!cfg.get("tires", tires))
+	{
+		tires.push_back(std::string());
+	}
+
+	// setups are the config sections, the unmodified cars if there are none
+	std::vector<std::pair<std::string, const PTree *> > setups;
+	for (PTree::const_iterator i = cfg.begin(); i != cfg.end(); ++i)
+	{
+		if (i->second.size() > 0)
+			setups.push_back(std::make_pair(i->first, &i->second));
+	}
+	const PTree nosetup;
+	if (setups.empty())
+	{
+		setups.push_back(std::make_pair(std::string("default"), &nosetup));
+	}
+
+	// cars are loaded up front, the content manager is not thread safe
+	std::vector<SweepJob *> jobs;
+	jobs.reserve(cars.size() * tires.size() * setups.size());
+	for (size_t c = 0; c < cars.size(); ++c)
+	{
+		for (size_t t = 0; t < tires.size(); ++t)
+		{
+			for (size_t s = 0; s < setups.size(); ++s)
+			{
+				SweepJob * job = new SweepJob();
+				job->result.car = cars[c];
+				job->result.tire = tires[t].empty() ? "default" : tires[t];
+				job->result.setup = setups[s].first;
+				const std::string cardir = carsdir + "/" + cars[c];
+				job->loaded = job->test.Load(cardir, cars[c], tires[t], *setups[s].second, content, job->error_output);
+				if (!job->loaded)
+				{
+					error_output << "Failed to load " << cars[c] << ", tire " << job->result.tire
+						<< ", setup " << job->result.setup << std::endl;
+				}
+				jobs.push_back(job);
+			}
+		}
+	}
+
+	JobSystem & jobsystem = JobSystem::instance();
+	info_output << "Running " << jobs.size() << " car performance tests on "
+		<< jobsystem.GetThreadCount() << " threads" << std::endl;
+
+	quickprof::Clock clock;
+	if (!jobs.empty())
+	{
+		jobsystem.Run(&RunJobs, &jobs[0], 0, jobs.size(), 1);
+	}
+	float wall_time = clock.getTimeMicroseconds() * 1E-6;
+
+	bool tested = false;
+	std::vector<Result> results;
+	results.reserve(jobs.size());
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		error_output << jobs[i]->error_output.str();
+		results.push_back(jobs[i]->result);
+		tested = tested || jobs[i]->result.valid;
+		delete jobs[i];
+	}
+
+	info_output << "Car performance sweep complete: " << wall_time << " s" << std::endl;
+
+	std::ofstream out(output.c_str());
+	if (!out)
+	{
+		error_output << "Failed to write car performance results: " << output << std::endl;
+		return false;
+	}
+
+	const std::string json(".json");
+	if (output.size() > json.size() && output.compare(output.size() - json.size(), json.size(), json) == 0)
+		WriteJson(results, out);
+	else
+		WriteCsv(results, out);
+
+	info_output << "Car performance results written to " << output << std::endl;
+
+	return tested;
+}
+
+void PerformanceTesting::RunJobs(void * data, int begin, int end)
+{
+	SweepJob ** jobs = static_cast<SweepJob **>(data);
+	for (int i = begin; i < end; ++i)
+	{
+		if (jobs[i]->loaded)
+			jobs[i]->test.Run(jobs[i]->result, jobs[i]->error_output);
+	}
+}
+
+void PerformanceTesting::WriteCsv(const std::vector<Result> & results, std::ostream & out)
+{
+	out << "car,tire,setup,valid,"
+		"max_speed_kph,time_0_100_kph,quarter_mile_time,"
+		"stopping_100_0_kph,stopping_100_0_kph_noabs,lateral_g,"
+		"speed_wall_time,stopping_wall_time,skidpad_wall_time\n";
+
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const Result & r = results[i];
+		WriteCsvString(r.car, out);
+		out << ',';
+		WriteCsvString(r.tire, out);
+		out << ',';
+		WriteCsvString(r.setup, out);
+		out << ',' << r.valid << ','
+			<< ConvertToKPH(r.max_speed) << ','
+			<< r.time_to_100kmh << ','
+			<< r.quarter_time << ','
+			<< r.stopping_distance << ','
+			<< r.stopping_distance_noabs << ','
+			<< r.lateral_g << ','
+			<< r.speed_wall_time << ','
+			<< r.stopping_wall_time << ','
+			<< r.skidpad_wall_time << '\n';
+	}
+}
+
+void PerformanceTesting::WriteJson(const std::vector<Result> & results, std::ostream & out)
+{
+	out << "[\n";
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const Result & r = results[i];
+		out << "\t{\"car\": ";
+		WriteJsonString(r.car, out);
+		out << ", \"tire\": ";
+		WriteJsonString(r.tire, out);
+		out << ", \"setup\": ";
+		WriteJsonString(r.setup, out);
+		out << ", \"valid\": " << (r.valid ? "true" : "false") << ", "
+			<< "\"max_speed_kph\": " << ConvertToKPH(r.max_speed) << ", "
+			<< "\"time_0_100_kph\": " << r.time_to_100kmh << ", "
+			<< "\"quarter_mile_time\": " << r.quarter_time << ", "
+			<< "\"stopping_100_0_kph\": " << r.stopping_distance << ", "
+			<< "\"stopping_100_0_kph_noabs\": " << r.stopping_distance_noabs << ", "
+			<< "\"lateral_g\": " << r.lateral_g << ", "
+			<< "\"speed_wall_time\": " << r.speed_wall_time << ", "
+			<< "\"stopping_wall_time\": " << r.stopping_wall_time << ", "
+			<< "\"skidpad_wall_time\": " << r.skidpad_wall_time << "}"
+			<< (i + 1 < results.size() ? ",\n" : "\n");
+	}
+	out << "]\n";
+}
+
+bool PerformanceTesting::Load(
+	const std::string & cardir,
+	const std::string & carname,
+	const std::string & tire,
+	const PTree & setup,
+	ContentManager & content,
+	std::ostream & error_output)
+{
 	// init track
 	assert(!track);
 	assert(!plane);
@@ -94,40 +410,49 @@ void PerformanceTesting::Test(
 	content.load(cfg, cardir, carname + ".car");
 	if (!cfg->size())
 	{
-		return;
+		return false;
 	}
 
+	// the loaded config is shared, apply setup to a copy
+	PTree carcfg(*cfg);
+	ApplySetup(setup, std::string(), carcfg);
+
 	// position is the center of a 2 x 4 x 1 meter box on track surface
 	btVector3 pos(0.0, -2.0, 0.5);
 	btQuaternion rot = btQuaternion::getIdentity();
-	const std::string tire = "";
 	const bool damage = false;
-	if (!car.Load(*cfg, cardir, tire, pos, rot, damage, world, content, error_output))
+	if (!car.Load(carcfg, cardir, tire, pos, rot, damage, world, content, error_output))
 	{
-		return;
+		return false;
 	}
 
-	btVector3 cm = -car.GetCenterOfMassOffset();
-	info_output << "Car dynamics loaded" << std::endl;
-	info_output << carname << " Summary:\n"
-		<< "Mass including driver and fuel: " << 1 / car.GetInvMass() << " kg\n"
-		<< "Center of mass: " << cm[0] << ", " << cm[1] << ", " << cm[2] << " m" << std::endl;
-	info_output << "Estimated maximum speed: " << ConvertToMPH(car.GetMaxSpeedMPS()) << " MPH" << std::endl;
-
 	std::ostringstream statestream;
 	joeserialize::BinaryOutputSerializer serialize_output(statestream);
 	if (!car.Serialize(serialize_output))
 	{
 		error_output << "Serialization error" << std::endl;
 	}
-	//else info_output << "Car state: " << statestream.str();
 	carstate = statestream.str();
 
-	TestMaxSpeed(info_output, error_output);
-	TestStoppingDistance(false, info_output, error_output);
-	TestStoppingDistance(true, info_output, error_output);
+	return true;
+}
 
-	info_output << "Car performance test complete." << std::endl;
+void PerformanceTesting::Run(Result & result, std::ostream & error_output)
+{
+	quickprof::Clock clock;
+	TestMaxSpeed(result, error_output);
+	result.speed_wall_time = clock.getTimeMicroseconds() * 1E-6;
+
+	clock.reset();
+	TestStoppingDistance(false, result, error_output);
+	TestStoppingDistance(true, result, error_output);
+	result.stopping_wall_time = clock.getTimeMicroseconds() * 1E-6;
+
+	clock.reset();
+	TestSkidpad(result, error_output);
+	result.skidpad_wall_time = clock.getTimeMicroseconds() * 1E-6;
+
+	result.valid = true;
 }
 
 void PerformanceTesting::ResetCar()
@@ -147,10 +472,8 @@ void PerformanceTesting::ResetCar()
 	carinput[CarInput::BRAKE] = 1.0f;
 }
 
-void PerformanceTesting::TestMaxSpeed(std::ostream & info_output, std::ostream & error_output)
+void PerformanceTesting::TestMaxSpeed(Result & result, std::ostream & error_output)
 {
-	info_output << "Testing maximum speed" << std::endl;
-
 	float maxtime = 300.0;
 	float t = 0.;
 	float dt = 1/90.0;
@@ -166,13 +489,13 @@ void PerformanceTesting::TestMaxSpeed(std::ostream & info_output, std::ostream &
 	float timeto60startthreshold = 2.23; //threshold speed to start 0-60 clock in m/s
 	//float timeto60startthreshold = 0.01; //threshold speed to start 0-60 clock in m/s
 	float timeto60 = maxtime;
+	float timeto100 = maxtime;
 
 	float timetoquarter = maxtime;
 	float quarterspeed = 0;
 
 	ResetCar();
 
-	clock_t cpu_timer_start = clock();
 	while (t < maxtime)
 	{
 		if (car.GetTransmission().GetGear() == 1 &&
@@ -200,6 +523,9 @@ void PerformanceTesting::TestMaxSpeed(std::ostream & info_output, std::ostream &
 		if (car_speed < 26.8224)
 			timeto60 = t;
 
+		if (car_speed < 27.7778)
+			timeto100 = t;
+
 		if (car.GetCenterOfMass().length() > 402.3 && timetoquarter == maxtime)
 		{
 			//quarter mile!
@@ -209,49 +535,43 @@ void PerformanceTesting::TestMaxSpeed(std::ostream & info_output, std::ostream &
 
 		if (i % (int)(1.0/dt) == 0) //every second
 		{
-			if (1)
+			if (car_speed - lastsecondspeed < stopthreshold && car_speed > 26.0)
 			{
-				if (car_speed - lastsecondspeed < stopthreshold && car_speed > 26.0)
-				{
-					//info_output << "Maximum speed attained at " << maxspeed.first << " s" << std::endl;
-					break;
-				}
-				if (!car.GetEngine().GetCombustion())
-				{
-					error_output << "Car stalled during launch, t=" << t << std::endl;
-					break;
-				}
+				break;
+			}
+			if (!car.GetEngine().GetCombustion())
+			{
+				error_output << "Car stalled during launch, t=" << t << std::endl;
+				break;
 			}
 			lastsecondspeed = car_speed;
-			//std::cout << t << ", " << car_speed << ", " << car.GetGear() << ", " << car.GetEngineRPM() << std::endl;
 		}
 
 		t += dt;
 		i++;
 	}
-	clock_t cpu_timer_stop = clock();
 
-	info_output << "Maximum speed: " << ConvertToMPH(maxspeed.second) << " MPH at " << maxspeed.first << " s" << std::endl;
-	info_output << "Downforce at maximum speed: " << -maxlift << " N; L/D: " << -maxlift / maxdrag << std::endl;
-	info_output << "0-60 MPH time: " << timeto60 - timeto60start << " s" << std::endl;
-	info_output << "1/4 mile time: " << timetoquarter << " s" << " at " << ConvertToMPH(quarterspeed) << " MPH" << std::endl;
-	info_output << "Simulation performance: " << t / float(cpu_timer_stop - cpu_timer_start) * CLOCKS_PER_SEC << std::endl;
+	result.max_speed = maxspeed.second;
+	result.max_speed_time = maxspeed.first;
+	result.max_speed_downforce = -maxlift;
+	result.max_speed_drag = maxdrag;
+	result.time_to_60mph = timeto60 - timeto60start;
+	result.time_to_100kmh = timeto100 - timeto60start;
+	result.quarter_time = timetoquarter;
+	result.quarter_speed = quarterspeed;
 }
 
-void PerformanceTesting::TestStoppingDistance(bool abs, std::ostream & info_output, std::ostream & error_output)
+void PerformanceTesting::TestStoppingDistance(bool abs, Result & result, std::ostream & error_output)
 {
-	info_output << "Testing stopping distance" << std::endl;
-
 	float maxtime = 300.0;
 	float t = 0.;
 	float dt = 1/90.0;
-	int i = 0;
 
 	float stopthreshold = 0.1; //if the speed (in m/s) is less than this value, discontinue the testing
 	btVector3 stopstart; //where the stopping starts
-	float brakestartspeed = 26.82; //speed at which to start braking, in m/s (26.82 m/s is 60 mph)
+	float brakestartspeed = 27.7778; //speed at which to start braking, in m/s (27.78 m/s is 100 km/h)
 
-	bool accelerating = true; //switches to false once 60 mph is reached
+	bool accelerating = true; //switches to false once 100 km/h is reached
 
 	ResetCar();
 
@@ -280,7 +600,6 @@ void PerformanceTesting::TestStoppingDistance(bool abs, std::ostream & info_outp
 		{
 			accelerating = false;
 			stopstart = car.GetWheelPosition(WheelPosition(0));
-			//std::cout << "hitting the brakes at " << t << ", " << car_speed << std::endl;
 		}
 
 		if (!accelerating && car_speed < stopthreshold)
@@ -294,21 +613,130 @@ void PerformanceTesting::TestStoppingDistance(bool abs, std::ostream & info_outp
 			break;
 		}
 
-		if (i % (int)(1.0/dt) == 0) //every second
-		{
-			//std::cout << t << ", " << car.dynamics.GetSpeed() << ", " << car.GetGear() << ", " << car.GetEngineRPM() << std::endl;
-		}
-
 		t += dt;
-		i++;
 	}
 
 	btVector3 stopend = car.GetWheelPosition(WheelPosition(0));
 
-	info_output << "60-0 stopping distance ";
 	if (abs)
-		info_output << "(ABS)";
+		result.stopping_distance = (stopend - stopstart).length();
 	else
-		info_output << "(no ABS)";
-	info_output << ": " << ConvertToFeet((stopend-stopstart).length()) << " ft" << std::endl;
+		result.stopping_distance_noabs = (stopend - stopstart).length();
+}
+
+void PerformanceTesting::TestSkidpad(Result & result, std::ostream & error_output)
+{
+	float maxtime = 300.0;
+	float t = 0.;
+	float dt = 1/90.0;
+
+	const btScalar radius = 45.72; // 300 ft skidpad
+	const btScalar gravity = 9.81;
+	const btScalar steer_gain = 2.0; // steering per heading error in rad
+	const btScalar path_gain = 0.2; // heading correction per meter off the circle
+	const int window = 90; // samples of the lateral acceleration average
+
+	float target_speed = 5.0; // slowly increased until the car can't hold the circle
+	float target_accel = 0.2;
+
+	btScalar accel_sum = 0;
+	int accel_count = 0;
+	btScalar max_accel = 0;
+
+	ResetCar();
+	carinput[CarInput::BRAKE] = 0.0f;
+
+	// drive counterclockwise, circle center is left of the start position
+	const btVector3 up = Direction::up;
+	btVector3 forward = quatRotate(car.GetOrientation(), Direction::forward);
+	btVector3 center = car.GetCenterOfMass() + up.cross(forward).normalized() * radius;
+
+	while (t < maxtime)
+	{
+		btVector3 offset = car.GetCenterOfMass() - center;
+		offset -= up * offset.dot(up);
+		btScalar distance = offset.length();
+		btVector3 normal = offset / distance;
+
+		btVector3 heading = car.GetVelocity();
+		heading -= up * heading.dot(up);
+		btScalar car_speed = heading.length();
+		if (car_speed < 1)
+			heading = quatRotate(car.GetOrientation(), Direction::forward);
+
+		// steer along the circle tangent, towards the circle when off
+		btVector3 desired = up.cross(normal) - normal * (distance - radius) * path_gain;
+		btScalar error = btAtan2(heading.cross(desired).dot(up), heading.dot(desired));
+		btScalar steer = error * steer_gain;
+		btClamp(steer, btScalar(-1), btScalar(1));
+		carinput[CarInput::STEER_LEFT] = btMax(steer, btScalar(0));
+		carinput[CarInput::STEER_RIGHT] = btMax(-steer, btScalar(0));
+
+		target_speed += target_accel * dt;
+		float throttle = (target_speed - car_speed) * 0.5f;
+		btClamp(throttle, 0.0f, 1.0f);
+		carinput[CarInput::THROTTLE] = throttle;
+
+		car.Update(carinput);
+
+		world.update(dt);
+
+		// average lateral acceleration while on the circle
+		if (btFabs(distance - radius) < 2)
+		{
+			accel_sum += car_speed * car_speed / distance;
+			if (++accel_count == window)
+			{
+				max_accel = btMax(max_accel, accel_sum / window);
+				accel_sum = 0;
+				accel_count = 0;
+			}
+		}
+		else
+		{
+			accel_sum = 0;
+			accel_count = 0;
+		}
+
+		// car slides off the circle or can't keep up with the target speed
+		if (distance - radius > 5 || (t > 10 && target_speed - car_speed > 5))
+		{
+			break;
+		}
+
+		if (!car.GetEngine().GetCombustion())
+		{
+			error_output << "Car stalled on skidpad, t=" << t << std::endl;
+			break;
+		}
+
+		t += dt;
+	}
+
+	result.lateral_g = max_accel / gravity;
+}
+
+QT_TEST(performance_output_test)
+{
+	std::vector<PerformanceTesting::Result> results(2);
+	results[0].car = "XS";
+	results[0].tire = "";
+	results[0].setup = "base";
+	results[1].car = "a,b";
+	results[1].tire = "say \"hi\"";
+	results[1].setup = "line\nbreak";
+
+	std::ostringstream csv;
+	PerformanceTesting::WriteCsv(results, csv);
+	std::istringstream lines(csv.str());
+	std::string header, row;
+	std::getline(lines, header);
+	std::getline(lines, row);
+	QT_CHECK_EQUAL(row.find("XS,,base,0,"), 0);
+	std::getline(lines, row, '\0');
+	QT_CHECK_EQUAL(row.find("\"a,b\",\"say \"\"hi\"\"\",\"line\nbreak\",0,"), 0);
+
+	std::ostringstream json;
+	PerformanceTesting::WriteJson(results, json);
+	QT_CHECK(json.str().find("\"car\": \"a,b\", \"tire\": \"say \\\"hi\\\"\", \"setup\": \"line\\nbreak\"") != std::string::npos);
 }
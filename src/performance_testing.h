@@ -23,13 +23,42 @@
 #include "physics/cardynamics.h"
 
 class ContentManager;
+class PTree;
 
+/// Car performance tests on a flat plane: acceleration and top speed,
+/// braking distance with and without ABS and a constant radius skidpad.
 class PerformanceTesting
 {
+friend class performance_output_testTest;
 public:
+	/// test results in SI units, wall times in seconds
+	struct Result
+	{
+		std::string car;
+		std::string tire;
+		std::string setup;
+		float max_speed;
+		float max_speed_time;
+		float max_speed_downforce;
+		float max_speed_drag;
+		float time_to_60mph;
+		float time_to_100kmh;
+		float quarter_time;
+		float quarter_speed;
+		float stopping_distance;		///< 100-0 km/h with ABS
+		float stopping_distance_noabs;	///< 100-0 km/h without ABS
+		float lateral_g;				///< maximum steady lateral acceleration on the skidpad
+		float speed_wall_time;
+		float stopping_wall_time;
+		float skidpad_wall_time;
+		bool valid;						///< car loaded and tested
+		Result();
+	};
+
 	PerformanceTesting(DynamicsWorld & world);
 	~PerformanceTesting();
 
+	/// run all tests on a single car and print the results
 	void Test(
 		const std::string & cardir,
 		const std::string & carname,
@@ -37,6 +66,27 @@ public:
 		std::ostream & info_output,
 		std::ostream & error_output);
 
+	/// Run all tests on every car x tire x setup combination of the sweep config:
+	///
+	/// cars = car1, car2
+	/// tires = , tire1        (empty entry is the car default tire)
+	/// output = sweep.csv     (used by the -carsweep argument)
+	///
+	/// [setup1]
+	/// engine.peak-engine-rpm = 7000
+	///
+	/// Setup sections override car config values, no setup section tests
+	/// the unmodified cars. Every combination is simulated in its own
+	/// dynamics world, combinations are run in parallel on the job system.
+	/// Results are written to output as json if it ends with .json, else csv.
+	static bool Sweep(
+		const PTree & cfg,
+		const std::string & carsdir,
+		const std::string & output,
+		ContentManager & content,
+		std::ostream & info_output,
+		std::ostream & error_output);
+
 private:
 	DynamicsWorld & world;
 	TrackSurface surface;
@@ -49,11 +99,34 @@ private:
 	btCollisionObject * track;
 	btCollisionShape * plane;
 
+	struct SweepWorld;
+	struct SweepJob;
+
+	/// load car and test track, setup values override the car config
+	bool Load(
+		const std::string & cardir,
+		const std::string & carname,
+		const std::string & tire,
+		const PTree & setup,
+		ContentManager & content,
+		std::ostream & error_output);
+
+	/// run all tests on the loaded car
+	void Run(Result & result, std::ostream & error_output);
+
 	void ResetCar();
 
-	void TestMaxSpeed(std::ostream & info_output, std::ostream & error_output);
+	void TestMaxSpeed(Result & result, std::ostream & error_output);
+
+	void TestStoppingDistance(bool abs, Result & result, std::ostream & error_output);
+
+	void TestSkidpad(Result & result, std::ostream & error_output);
+
+	static void RunJobs(void * data, int begin, int end);
+
+	static void WriteCsv(const std::vector<Result> & results, std::ostream & out);
 
-	void TestStoppingDistance(bool abs, std::ostream & info_output, std::ostream & error_output);
+	static void WriteJson(const std::vector<Result> & results, std::ostream & out);
 };
 
 #endif
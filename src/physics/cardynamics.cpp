@@ -578,7 +578,7 @@ bool CarDynamics::Load(
 	body->setContactProcessingThreshold(0.0);
 	body->setCollisionFlags(body->getCollisionFlags() | btCollisionObject::CF_CUSTOM_MATERIAL_CALLBACK);
 	world.addRigidBody(body);
-	world.addAction(this);
+	world.addParallelAction(this);
 	this->world = &world;
 
 	// position is the center of a 2 x 4 x 1 meter box on track surface
@@ -671,6 +671,61 @@ void CarDynamics::SetTCS(bool value)
 	tcs = value;
 }
 
+void CarDynamics::SetTireTables(bool value)
+{
+	tire_tables = value;
+	for (int i = 0; i < tire.size(); ++i)
+	{
+		tire[i].setUseTables(tire_tables || low_detail);
+	}
+}
+
+void CarDynamics::SetSubsteps(int min, int max, btScalar tolerance)
+{
+	assert(min > 0 && min <= max && tolerance > 0);
+	substeps_min = min;
+	substeps_max = max;
+	substeps_tolerance = tolerance;
+	substeps = max;
+}
+
+btScalar CarDynamics::GetAverageSubsteps() const
+{
+	if (steps_total == 0)
+		return substeps;
+	return btScalar(substeps_total) / steps_total;
+}
+
+const PatchRayStats & CarDynamics::GetRayStats() const
+{
+	return ray_stats;
+}
+
+void CarDynamics::SetLowDetail(bool value)
+{
+	if (low_detail == value)
+		return;
+
+	// same state in both modes, switching is seamless
+	low_detail = value;
+	SetTireTables(tire_tables);
+	if (!low_detail)
+		substeps = substeps_max;
+}
+
+bool CarDynamics::GetLowDetail() const
+{
+	return low_detail;
+}
+
+void CarDynamics::BuildTireTables()
+{
+	for (int i = 0; i < tire.size(); ++i)
+	{
+		tire[i].buildTables();
+	}
+}
+
 void CarDynamics::Update(const std::vector<float> & inputs)
 {
 	assert(inputs.size() >= CarInput::INVALID);
@@ -1110,6 +1165,17 @@ bool CarDynamics::Serialize ( joeserialize::Serializer & s )
 		if (!serialize(s, wheel_position[i])) return false;
 		if (!serialize(s, wheel_orientation[i])) return false;
 	}
+
+	// adaptive substep state, missing in older replay state data
+	if (!s.Serialize("substeps", substeps) ||
+		!s.Serialize("substeps_total", substeps_total) ||
+		!s.Serialize("steps_total", steps_total))
+	{
+		substeps = substeps_max;
+		substeps_total = 0;
+		steps_total = 0;
+	}
+	btClamp(substeps, substeps_min, substeps_max);
 	return true;
 }
 
@@ -1283,14 +1349,18 @@ void CarDynamics::DoABS ( int i, btScalar suspension_force )
 
 void CarDynamics::ComputeSuspensionDisplacement ( int i, btScalar dt )
 {
-	//compute bump effect
-	const TrackSurface & surface = wheel_contact[i].GetSurface();
-	btScalar posx = wheel_contact[i].GetPosition()[0];
-	btScalar posz = wheel_contact[i].GetPosition()[2];
-	btScalar phase = 2 * M_PI * ( posx + posz ) / surface.bumpWaveLength;
-	btScalar shift = 2 * sin ( phase * M_PI_2 );
-	btScalar amplitude = 0.25 * surface.bumpAmplitude;
-	btScalar bumpoffset = amplitude * ( sin ( phase + shift ) + sin ( M_PI_2*phase ) - 2.0 );
+	//compute bump effect, skipped for low detail
+	btScalar bumpoffset = 0;
+	if ( !low_detail )
+	{
+		const TrackSurface & surface = wheel_contact[i].GetSurface();
+		btScalar posx = wheel_contact[i].GetPosition()[0];
+		btScalar posz = wheel_contact[i].GetPosition()[2];
+		btScalar phase = 2 * M_PI * ( posx + posz ) / surface.bumpWaveLength;
+		btScalar shift = 2 * sin ( phase * M_PI_2 );
+		btScalar amplitude = 0.25 * surface.bumpAmplitude;
+		bumpoffset = amplitude * ( sin ( phase + shift ) + sin ( M_PI_2*phase ) - 2.0 );
+	}
 
 	btScalar relative_displacement = wheel_contact[i].GetDepth() - 2 * wheel[i].GetRadius() - bumpoffset;
 	assert ( !isnan ( relative_displacement ) );
@@ -1353,41 +1423,48 @@ btVector3 CarDynamics::ApplySuspensionForceToBody ( int i, btScalar dt, btVector
 	return suspension_force;
 }
 
-btVector3 CarDynamics::ComputeTireFrictionForce (int i, btScalar dt, btScalar normal_force,
-        btScalar rotvel, const btVector3 & linvel, const btQuaternion & wheel_orientation)
+void CarDynamics::ComputeTireFrictionForces ( btVector3 friction_force[] )
 {
-	btMatrix3x3 wheel_mat(wheel_orientation);
-	btVector3 xw = wheel_mat.getColumn(0);
-	btVector3 yw = wheel_mat.getColumn(1);
-	btVector3 z = wheel_contact[i].GetNormal();
-
-	btScalar coszxw = z.dot(xw);
-	btScalar coszyw = z.dot(yw);
-	btVector3 x = (xw - z * coszxw).normalized();
-	btVector3 y = (yw - z * coszyw).normalized();
-
-	btScalar camber = M_PI_2 - btAcos(coszxw);
-	btScalar lonvel = y.dot(linvel);
-	btScalar latvel = -x.dot(linvel);
+	CarTire * tires[WHEEL_POSITION_SIZE];
+	btScalar normal_force[WHEEL_POSITION_SIZE];
+	btScalar friction_coeff[WHEEL_POSITION_SIZE];
+	btScalar camber[WHEEL_POSITION_SIZE];
+	btScalar rotvel[WHEEL_POSITION_SIZE];
+	btScalar lonvel[WHEEL_POSITION_SIZE];
+	btScalar latvel[WHEEL_POSITION_SIZE];
+	for ( int i = 0; i < WHEEL_POSITION_SIZE; ++i )
+	{
+		btMatrix3x3 wheel_mat(wheel_orientation[i]);
+		btVector3 xw = wheel_mat.getColumn(0);
+		btVector3 yw = wheel_mat.getColumn(1);
+		btVector3 z = wheel_contact[i].GetNormal();
 
-	btScalar friction_coeff =
-		tire[i].getTread() * wheel_contact[i].GetSurface().frictionTread +
-		(1.0 - tire[i].getTread()) * wheel_contact[i].GetSurface().frictionNonTread;
+		btScalar coszxw = z.dot(xw);
+		btScalar coszyw = z.dot(yw);
+		btVector3 x = (xw - z * coszxw).normalized();
+		btVector3 y = (yw - z * coszyw).normalized();
 
-	btVector3 friction_force = tire[i].getForce(
-		normal_force, friction_coeff, camber, rotvel, lonvel, latvel);
+		tires[i] = &tire[i];
+		normal_force[i] = suspension_force[i].length();
+		friction_coeff[i] =
+			tire[i].getTread() * wheel_contact[i].GetSurface().frictionTread +
+			(1.0 - tire[i].getTread()) * wheel_contact[i].GetSurface().frictionNonTread;
+		camber[i] = M_PI_2 - btAcos(coszxw);
+		rotvel[i] = wheel[i].GetAngularVelocity() * wheel[i].GetRadius();
+		lonvel[i] = y.dot(wheel_velocity[i]);
+		latvel[i] = -x.dot(wheel_velocity[i]);
+	}
 
-	for (int n = 0; n < 3; ++n) assert(!isnan(friction_force[n]));
+	// evaluate all tires in one batch
+	CarTire::getForces(tires, normal_force, friction_coeff, camber, rotvel, lonvel, latvel,
+		friction_force, WHEEL_POSITION_SIZE);
 
-	return friction_force;
+	for ( int i = 0; i < WHEEL_POSITION_SIZE; ++i )
+		for (int n = 0; n < 3; ++n) assert(!isnan(friction_force[i][n]));
 }
 
-void CarDynamics::ApplyWheelForces ( btScalar dt, btScalar wheel_drive_torque, int i, const btVector3 & suspension_force, btVector3 & force, btVector3 & torque )
+void CarDynamics::ApplyWheelForces ( btScalar dt, btScalar wheel_drive_torque, int i, const btVector3 & friction_force, btVector3 & force, btVector3 & torque )
 {
-	btScalar normal_force = suspension_force.length();
-	btScalar rotvel = wheel[i].GetAngularVelocity() * wheel[i].GetRadius();
-	btVector3 friction_force = ComputeTireFrictionForce ( i, dt, normal_force, rotvel, wheel_velocity[i], wheel_orientation[i] );
-
 	//calculate friction torque
 	btVector3 tire_force = Direction::forward * friction_force[0] - Direction::right * friction_force[1];
 	btScalar tire_friction_torque = friction_force[0] * wheel[i].GetRadius();
@@ -1488,10 +1565,14 @@ void CarDynamics::ApplyForces ( btScalar dt, const btVector3 & ext_force, const
 		}
 	}
 
+	//compute tire friction forces
+	btVector3 friction_force[WHEEL_POSITION_SIZE];
+	ComputeTireFrictionForces ( friction_force );
+
 	//compute wheel forces
 	for ( int i = 0; i < WHEEL_POSITION_SIZE; ++i )
 	{
-		ApplyWheelForces ( dt, wheel_drive_torque[i], i, suspension_force[i], force, torque );
+		ApplyWheelForces ( dt, wheel_drive_torque[i], i, friction_force[i], force, torque );
 	}
 
 	for ( int n = 0; n < 3; ++n ) assert ( !isnan ( force[n] ) );
@@ -1517,29 +1598,58 @@ void CarDynamics::Tick(btScalar dt, const btVector3 & force, const btVector3 & t
 
 // executed as last function(after integration) in bullet singlestepsimulation
 void CarDynamics::updateAction(btCollisionWorld * collisionWorld, btScalar dt)
+{
+	updateActionBegin(dt);
+	updateActionContacts();
+	updateActionEnd(dt);
+}
+
+void CarDynamics::updateActionBegin(btScalar dt)
 {
 	// reset transform, before processing tire/suspension constraints
 	// will break bullets collision clamping, tunneling prevention
 	body->setCenterOfMassTransform(transform);
 	btVector3 dv = body->getLinearVelocity() - linear_velocity;
 	btVector3 dw = body->getAngularVelocity() - angular_velocity;
-	btVector3 force = 1.0 / body->getInvMass() * dv / dt;
-	btVector3 torque = body->getInvInertiaTensorWorld().inverse() * dw / dt;
+	action_force = 1.0 / body->getInvMass() * dv / dt;
+	action_torque = body->getInvInertiaTensorWorld().inverse() * dw / dt;
 	body->setLinearVelocity(linear_velocity);
 	body->setAngularVelocity(angular_velocity);
+}
+
+void CarDynamics::updateActionContacts()
+{
+	// low detail cars keep the wheel contacts of the last step every second step
+	if (low_detail && steps_total % 2)
+		return;
+
 	UpdateWheelContacts();
+}
+
+void CarDynamics::updateActionEnd(btScalar dt)
+{
+	btVector3 force_begin[WHEEL_POSITION_SIZE];
+	for (int i = 0; i < WHEEL_POSITION_SIZE; ++i)
+	{
+		force_begin[i].setValue(tire[i].getFx(), tire[i].getFy(), 0);
+	}
 
 	feedback = 0;
-	int repeats = 10;
+	int repeats = low_detail ? btMin(2, substeps_max) : substeps;
 	for (int i = 0; i < repeats; ++i)
 	{
-		Tick(dt / repeats, force, torque);
+		Tick(dt / repeats, action_force, action_torque);
 
 		feedback += tire[FRONT_LEFT].getMz() + tire[FRONT_RIGHT].getMz();
 	}
 	feedback /= repeats;
 	feedback *= feedback_scale;
 
+	substeps_total += repeats;
+	steps_total++;
+	if (substeps_min < substeps_max && !low_detail)
+		UpdateSubsteps(force_begin);
+
 	//update fuel tank
 	fuel_tank.Consume ( engine.FuelRate() * dt );
 	engine.SetOutOfGas ( fuel_tank.Empty() );
@@ -1552,10 +1662,37 @@ void CarDynamics::updateAction(btCollisionWorld * collisionWorld, btScalar dt)
 	angular_velocity = body->getAngularVelocity();
 }
 
+void CarDynamics::UpdateSubsteps(const btVector3 force_begin[])
+{
+	// the integration error grows with the tire force change per substep,
+	// cars in steady state need few substeps, sliding or landing cars many
+	btScalar error = 0;
+	for (int i = 0; i < WHEEL_POSITION_SIZE; ++i)
+	{
+		btScalar load = suspension_force[i].length();
+		if (load > 0)
+		{
+			btVector3 force_delta(tire[i].getFx(), tire[i].getFy(), 0);
+			force_delta -= force_begin[i];
+			error = btMax(error, force_delta.length() / load);
+		}
+	}
+
+	int n = int(error / substeps_tolerance) + 1;
+	btClamp(n, substeps_min, substeps_max);
+
+	// increase immediately, decrease gradually to avoid oscillation
+	substeps = btMax(n, substeps - 1);
+}
+
 void CarDynamics::UpdateWheelContacts()
 {
 	btVector3 raydir = GetDownVector();
 	btScalar raylen = 4;
+	DynamicsWorld::Ray rays[WHEEL_POSITION_SIZE];
+	CollisionContact contacts[WHEEL_POSITION_SIZE];
+	int wheels[WHEEL_POSITION_SIZE];
+	int count = 0;
 	for (int i = 0; i < WHEEL_POSITION_SIZE; ++i)
 	{
 		btVector3 raystart = wheel_position[i] - raydir * wheel[i].GetRadius();
@@ -1566,9 +1703,22 @@ void CarDynamics::UpdateWheelContacts()
 		}
 		else
 		{
-			world->castRay(raystart, raydir, raylen, body, wheel_contact[i]);
+			rays[count].origin = raystart;
+			rays[count].direction = raydir;
+			rays[count].length = raylen;
+			rays[count].caster = body;
+			contacts[count] = wheel_contact[i];
+			wheels[count] = i;
+			count++;
 		}
 	}
+
+	// cast all wheel rays at once
+	world->castRays(rays, contacts, count, &ray_stats);
+	for (int i = 0; i < count; ++i)
+	{
+		wheel_contact[wheels[i]] = contacts[i];
+	}
 }
 
 void CarDynamics::InterpolateWheelContacts()
@@ -1938,7 +2088,7 @@ void CarDynamics::Clear()
 		}
 		delete child;
 	}
-	world->removeAction(this);
+	world->removeParallelAction(this);
 	world->removeRigidBody(body);
 	world = 0;
 
@@ -1990,6 +2140,14 @@ void CarDynamics::Init()
 	maxspeed = 0;
 	feedback_scale = 0;
 	feedback = 0;
+	substeps = 10;
+	substeps_min = 10;
+	substeps_max = 10;
+	substeps_tolerance = 0.05;
+	substeps_total = 0;
+	steps_total = 0;
+	tire_tables = false;
+	low_detail = false;
 
 	suspension.resize(WHEEL_POSITION_SIZE, 0);
 	wheel.resize(WHEEL_POSITION_SIZE);
@@ -34,7 +34,7 @@
 #include "collision_contact.h"
 #include "motionstate.h"
 #include "joeserialize.h"
-#include "BulletDynamics/Dynamics/btActionInterface.h"
+#include "parallelaction.h"
 
 #if (BT_BULLET_VERSION < 281)
 #define btCollisionObjectWrapper btCollisionObject
@@ -50,7 +50,7 @@ class FractureBody;
 class ContentManager;
 class PTree;
 
-class CarDynamics : public btActionInterface
+class CarDynamics : public ParallelAction
 {
 friend class joeserialize::Serializer;
 
@@ -87,6 +87,27 @@ public:
 	void SetABS(bool value);
 	void SetTCS(bool value);
 
+	// use precomputed tire force tables (faster, less accurate)
+	void SetTireTables(bool value);
+
+	// substeps per simulation step, adaptive if min < max
+	// tolerance is the max tire force change per substep relative to the tire load
+	void SetSubsteps(int min, int max, btScalar tolerance);
+
+	// average substeps per simulation step
+	btScalar GetAverageSubsteps() const;
+
+	// road patch ray statistics of the wheel contacts
+	const PatchRayStats & GetRayStats() const;
+
+	// reduced detail for distant cars: tire tables, two substeps,
+	// wheel rays every second step, no surface bumps
+	void SetLowDetail(bool value);
+	bool GetLowDetail() const;
+
+	// build the tire tables at load, switching to low detail won't stall
+	void BuildTireTables();
+
 	// update dynamics from car input vector
 	void Update(const std::vector<float> & inputs);
 
@@ -94,6 +115,11 @@ public:
 	void updateAction(btCollisionWorld * collisionWorld, btScalar dt);
 	void debugDraw(btIDebugDraw * debugDrawer);
 
+	// parallel action interface
+	void updateActionBegin(btScalar dt);
+	void updateActionContacts();
+	void updateActionEnd(btScalar dt);
+
 	// graphics interpolated
 	btVector3 GetEnginePosition() const;
 	const btVector3 & GetPosition() const;
@@ -187,6 +213,8 @@ protected:
 	btTransform transform;
 	btVector3 linear_velocity;
 	btVector3 angular_velocity;
+	btVector3 action_force;
+	btVector3 action_torque;
 	btAlignedObjectArray<MotionState> motion_state;
 
 	// driveline state
@@ -233,6 +261,19 @@ protected:
 	btScalar feedback_scale;
 	btScalar feedback;
 
+	// substepping
+	int substeps;
+	int substeps_min;
+	int substeps_max;
+	btScalar substeps_tolerance;
+	unsigned substeps_total;
+	unsigned steps_total;
+
+	PatchRayStats ray_stats;
+
+	bool tire_tables;
+	bool low_detail;
+
 	btVector3 GetDownVector() const;
 
 	btQuaternion LocalToWorld(const btQuaternion & local) const;
@@ -253,15 +294,17 @@ protected:
 
 	btVector3 ApplySuspensionForceToBody ( int i, btScalar dt, btVector3 & force, btVector3 & torque );
 
-	btVector3 ComputeTireFrictionForce ( int i, btScalar dt, btScalar normal_force,
-        btScalar rotvel, const btVector3 & linvel, const btQuaternion & wheel_orientation );
+	void ComputeTireFrictionForces ( btVector3 friction_force[] );
 
-	void ApplyWheelForces ( btScalar dt, btScalar wheel_drive_torque, int i, const btVector3 & suspension_force, btVector3 & force, btVector3 & torque );
+	void ApplyWheelForces ( btScalar dt, btScalar wheel_drive_torque, int i, const btVector3 & friction_force, btVector3 & force, btVector3 & torque );
 
 	void ApplyForces ( btScalar dt, const btVector3 & force, const btVector3 & torque);
 
 	void Tick ( btScalar dt, const btVector3 & force, const btVector3 & torque);
 
+	// pick substeps from the tire force change during the last step
+	void UpdateSubsteps(const btVector3 force_begin[]);
+
 	void UpdateWheelContacts();
 
 	void InterpolateWheelContacts();
@@ -19,6 +19,7 @@
 
 #include "cartire.h"
 #include "cfg/ptree.h"
+#include "unittest.h"
 #include <cassert>
 
 #ifndef VDRIFTN
@@ -43,7 +44,8 @@ CarTire::CarTire() :
 	fx(0),
 	fy(0),
 	fz(0),
-	mz(0)
+	mz(0),
+	use_tables(false)
 {
 	// ctor
 }
@@ -52,6 +54,72 @@ void CarTire::init(const CarTireInfo & info)
 {
 	CarTireInfo::operator=(info);
 	initSigmaHatAlphaHat();
+	if (!table_fx.empty())
+		initTables();
+}
+
+struct CarTire::TableFx
+{
+	const CarTire & tire;
+	TableFx(const CarTire & tire) : tire(tire) {}
+	btScalar operator()(btScalar sigma, btScalar Fz, btScalar /*gamma*/) const
+	{
+		btScalar max_Fx;
+		if (Fz <= 0) return 0;
+		return tire.PacejkaFx(sigma, Fz, 1, max_Fx);
+	}
+};
+
+struct CarTire::TableFy
+{
+	const CarTire & tire;
+	TableFy(const CarTire & tire) : tire(tire) {}
+	btScalar operator()(btScalar alpha, btScalar Fz, btScalar gamma) const
+	{
+		btScalar max_Fy;
+		if (Fz <= 0) return 0;
+		return tire.PacejkaFy(alpha, Fz, gamma, 1, max_Fy);
+	}
+};
+
+struct CarTire::TableMz
+{
+	const CarTire & tire;
+	TableMz(const CarTire & tire) : tire(tire) {}
+	btScalar operator()(btScalar alpha, btScalar Fz, btScalar gamma) const
+	{
+		btScalar max_Mz;
+		if (Fz <= 0) return 0;
+		return tire.PacejkaMz(alpha, Fz, gamma, 1, max_Mz);
+	}
+};
+
+void CarTire::setUseTables(bool value)
+{
+	// tables are kept when disabled, switching back is cheap
+	use_tables = value;
+	if (use_tables && table_fx.empty())
+		initTables();
+}
+
+void CarTire::buildTables()
+{
+	if (table_fx.empty())
+		initTables();
+}
+
+void CarTire::initTables()
+{
+	// slip axes centered on the ideal slip at medium load
+	// load and camber ranges match the getForce input limits
+	int n = sigma_hat.size() / 2;
+	btScalar sigma_scale = btMax(btFabs(sigma_hat[n]), btScalar(1E-2));
+	btScalar alpha_scale = btMax(btFabs(alpha_hat[n]), btScalar(0.5));
+	btScalar max_load = 30;
+	btScalar max_gamma = 0.1 * M_PI * SIMD_DEGS_PER_RAD;
+	table_fx.init(TableFx(*this), sigma_scale, max_load, 0, 64, 48, 1);
+	table_fy.init(TableFy(*this), alpha_scale, max_load, max_gamma, 64, 48, 5);
+	table_mz.init(TableMz(*this), alpha_scale, max_load, max_gamma, 64, 48, 5);
 }
 
 btVector3 CarTire::getForce(
@@ -98,9 +166,19 @@ btVector3 CarTire::getForce(
 	btScalar ap = rho * alpha_hat * alpha_sign;
 	btScalar gx = s / rho * sigma_sign;
 	btScalar gy = a / rho * alpha_sign;
-	btScalar Fx = gx * PacejkaFx(sp, Fz, friction_coeff, max_Fx);
-	btScalar Fy = gy * PacejkaFy(ap, Fz, gamma, friction_coeff, max_Fy);
-	btScalar Mz = PacejkaMz(alpha, Fz, gamma, friction_coeff, max_Mz);
+	btScalar Fx, Fy, Mz;
+	if (getUseTables())
+	{
+		Fx = gx * table_fx.lookup(sp, Fz, 0) * friction_coeff;
+		Fy = gy * table_fy.lookup(ap, Fz, gamma) * friction_coeff;
+		Mz = table_mz.lookup(alpha, Fz, gamma) * friction_coeff;
+	}
+	else
+	{
+		Fx = gx * PacejkaFx(sp, Fz, friction_coeff, max_Fx);
+		Fy = gy * PacejkaFy(ap, Fz, gamma, friction_coeff, max_Fy);
+		Mz = PacejkaMz(alpha, Fz, gamma, friction_coeff, max_Mz);
+	}
 
 	camber = inclination;
 	slide = sigma;
@@ -116,6 +194,25 @@ btVector3 CarTire::getForce(
 	return btVector3(Fx, Fy, Mz);
 }
 
+void CarTire::getForces(
+	CarTire * const tires[],
+	const btScalar normal_force[],
+	const btScalar friction_coeff[],
+	const btScalar inclination[],
+	const btScalar rot_velocity[],
+	const btScalar lon_velocity[],
+	const btScalar lat_velocity[],
+	btVector3 force[],
+	int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		force[i] = tires[i]->getForce(
+			normal_force[i], friction_coeff[i], inclination[i],
+			rot_velocity[i], lon_velocity[i], lat_velocity[i]);
+	}
+}
+
 btScalar CarTire::getRollingResistance(const btScalar velocity, const btScalar resistance_factor) const
 {
 	// surface influence on rolling resistance
@@ -344,4 +441,81 @@ void CarTire::initSigmaHatAlphaHat(int tablesize)
 	}
 }
 
+// sample tire parameters
+static void InitTestCarTireInfo(CarTireInfo & info)
+{
+	const btScalar a[] = {1.5, -40, 1600, 2600, 8.7, 0.014, -0.24, 1.0, -0.03, -0.0013, -0.15, -8.5, -0.29, 17.8, -2.4};
+	const btScalar b[] = {1.5, -80, 1950, 23.3, 390, 0.05, 0, 0.055, -0.024, 0.014, 0.26};
+	const btScalar c[] = {2.2, -3.9, -3.9, -1.26, -8.2, 0.025, 0, 0.044, -0.58, 0.18,
+		0.043, 0.048, -0.0035, -0.18, 0.14, -1.029, 0.27, -1.1};
+	info.lateral.assign(a, a + 15);
+	info.longitudinal.assign(b, b + 11);
+	info.aligning.assign(c, c + 18);
+}
+
+QT_TEST(cartire_table_test)
+{
+	CarTireInfo info;
+	InitTestCarTireInfo(info);
+
+	CarTire tire, tire_ref;
+	tire.init(info);
+	tire_ref.init(info);
+	tire.setUseTables(true);
+	QT_CHECK(tire.getUseTables());
+
+	// combined slip force error relative to the load
+	btScalar max_error = 0;
+	for (int k = 0; k < 10000; ++k)
+	{
+		btScalar load = 500 + (k * 37) % 9000;
+		btScalar mu = 0.5 + 0.1 * (k % 6);
+		btScalar camber = 0.02 * ((k % 11) - 5);
+		btScalar vx = 0.5 * ((k % 101) - 20);
+		btScalar vr = vx * (1 + 0.01 * ((k % 41) - 20));
+		btScalar vy = 0.1 * ((k % 53) - 26);
+		btVector3 f = tire.getForce(load, mu, camber, vr, vx, vy);
+		btVector3 r = tire_ref.getForce(load, mu, camber, vr, vx, vy);
+		btScalar error = btMax(btFabs(f[0] - r[0]), btFabs(f[1] - r[1])) / (load * mu);
+		max_error = btMax(max_error, error);
+	}
+	QT_CHECK_LESS(max_error, 0.01);
+
+	// pure slip table error relative to the load, Mz as pneumatic trail in mm
+	// slip ratio runs past the ends of the warped axis, slip angle up to them
+	// as it can't exceed 90 degrees, camber covers the whole table range
+	const int n = tire.sigma_hat.size() / 2;
+	const btScalar sigma_scale = btMax(btFabs(tire.sigma_hat[n]), btScalar(1E-2));
+	const btScalar alpha_scale = btMax(btFabs(tire.alpha_hat[n]), btScalar(0.5));
+	const btScalar max_gamma = 0.1 * M_PI * SIMD_DEGS_PER_RAD;
+	btScalar max_error_fx = 0, max_error_fy = 0, max_error_mz = 0;
+	for (int k = 0; k < 20000; ++k)
+	{
+		btScalar u = btScalar((k * 7919) % 2001) / 1000 - 1;
+		btScalar sigma = 0.995 * u / (1 - 0.995 * btFabs(u)) * sigma_scale;
+		btScalar alpha = 0.99 * u / (1 - 0.99 * btFabs(u)) * alpha_scale;
+		btScalar Fz = 0.5 + 0.0005 * ((k * 37) % 19001);
+		btScalar gamma = max_gamma * (btScalar(k % 13) / 6 - 1);
+		btScalar max_F;
+
+		btScalar fx = tire.table_fx.lookup(sigma, Fz, 0);
+		btScalar rx = tire.PacejkaFx(sigma, Fz, 1, max_F);
+		max_error_fx = btMax(max_error_fx, btFabs(fx - rx) / (Fz * 1000));
+
+		btScalar fy = tire.table_fy.lookup(alpha, Fz, gamma);
+		btScalar ry = tire.PacejkaFy(alpha, Fz, gamma, 1, max_F);
+		max_error_fy = btMax(max_error_fy, btFabs(fy - ry) / (Fz * 1000));
+
+		btScalar mz = tire.table_mz.lookup(alpha, Fz, gamma);
+		btScalar rz = tire.PacejkaMz(alpha, Fz, gamma, 1, max_F);
+		max_error_mz = btMax(max_error_mz, btFabs(mz - rz) / Fz);
+	}
+	QT_CHECK_LESS(max_error_fx, 0.015);
+	QT_CHECK_LESS(max_error_fy, 0.015);
+	QT_CHECK_LESS(max_error_mz, 1);
+
+	tire.setUseTables(false);
+	QT_CHECK(!tire.getUseTables());
+}
+
 #endif
@@ -28,6 +28,7 @@ typedef TireInfo CarTireInfo;
 
 #else
 
+#include "physics/tiretable.h"
 #include "LinearMath/btVector3.h"
 #include "joeserialize.h"
 #include "macros.h"
@@ -50,6 +51,7 @@ struct CarTireInfo
 class CarTire : private CarTireInfo
 {
 friend class joeserialize::Serializer;
+friend class cartire_table_testTest;
 public:
 	CarTire();
 
@@ -58,6 +60,15 @@ public:
 	/// get tire tread fraction
 	btScalar getTread() const;
 
+	/// use precomputed force tables instead of evaluating the pacejka formulas
+	/// trades some accuracy for speed, tables are built on first use
+	void setUseTables(bool value);
+
+	bool getUseTables() const;
+
+	/// build the force tables now instead of on first use
+	void buildTables();
+
 	/// normal_force: tire load in N
 	/// friction_coeff: contact surface friction coefficient
 	/// inclination: wheel inclination in degrees
@@ -72,6 +83,19 @@ public:
 		btScalar lon_velocty,
 		btScalar lat_velocity);
 
+	/// getForce for count tires, parameters are arrays of length count
+	/// evaluated one tire at a time, same interface as Tire::getForces
+	static void getForces(
+		CarTire * const tires[],
+		const btScalar normal_force[],
+		const btScalar friction_coeff[],
+		const btScalar inclination[],
+		const btScalar rot_velocity[],
+		const btScalar lon_velocity[],
+		const btScalar lat_velocity[],
+		btVector3 force[],
+		int count);
+
 	btScalar getRollingResistance(
 		const btScalar velocity,
 		const btScalar resistance_factor) const;
@@ -103,6 +127,16 @@ private:
 	btScalar ideal_slip; ///< ideal slip angle
 	btScalar fx, fy, fz, mz;
 
+	/// pure slip forces at unit friction over slip, load in kN, camber in degrees
+	TireTable table_fx, table_fy, table_mz;
+	struct TableFx;
+	struct TableFy;
+	struct TableMz;
+	bool use_tables;
+
+	/// build force tables from the current tire parameters
+	void initTables();
+
 	/// pacejka magic formula function, longitudinal
 	btScalar PacejkaFx(btScalar sigma, btScalar Fz, btScalar friction_coeff, btScalar & max_Fx) const;
 
@@ -130,6 +164,11 @@ inline btScalar CarTire::getTread() const
 	return tread;
 }
 
+inline bool CarTire::getUseTables() const
+{
+	return use_tables;
+}
+
 inline btScalar CarTire::getSlip() const
 {
 	return slide;
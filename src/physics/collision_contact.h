@@ -27,6 +27,15 @@
 class Bezier;
 class btCollisionObject;
 
+/// road patch ray cast counts, kept per caster so that rays cast on
+/// different threads don't share counters
+struct PatchRayStats
+{
+	unsigned rays;
+	unsigned coherent_hits; ///< rays hitting the hint patch or a neighbour
+	PatchRayStats() : rays(0), coherent_hits(0) {}
+};
+
 class CollisionContact
 {
 public:
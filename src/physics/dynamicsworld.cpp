@@ -20,10 +20,13 @@
 #include "dynamicsworld.h"
 #include "fracturebody.h"
 #include "collision_contact.h"
+#include "parallelaction.h"
+#include "jobsystem.h"
 #include "tobullet.h"
 #include "track.h"
 
 #include "BulletCollision/CollisionShapes/btCollisionShape.h"
+#include "LinearMath/btAabbUtil2.h"
 
 #define EXTBULLET
 
@@ -97,7 +100,9 @@ DynamicsWorld::DynamicsWorld(
 	btDiscreteDynamicsWorld(dispatcher, broadphase, constraintSolver, collisionConfig),
 	track(0),
 	timeStep(timeStep),
-	maxSubSteps(maxSubSteps)
+	maxSubSteps(maxSubSteps),
+	m_rayTestLock(SDL_CreateMutex()),
+	m_actionTimeStep(0)
 {
 	setGravity(btVector3(0.0, 0.0, -9.81));
 	setForceUpdateAllAabbs(false);
@@ -106,20 +111,36 @@ DynamicsWorld::DynamicsWorld(
 DynamicsWorld::~DynamicsWorld()
 {
 	reset();
+	SDL_DestroyMutex(m_rayTestLock);
 }
 
 const Bezier* DynamicsWorld::GetSectorPatch(int i){
 	return track->GetSectorPatch(i);
 }
 
-bool DynamicsWorld::castRay(
+// collects broadphase proxies overlapping a ray batch
+struct MyAabbCallback : public btBroadphaseAabbCallback
+{
+	btAlignedObjectArray<btCollisionObject*> m_objects;
+
+	virtual bool process(const btBroadphaseProxy* proxy)
+	{
+		m_objects.push_back(static_cast<btCollisionObject*>(proxy->m_clientObject));
+		return true;
+	}
+};
+
+// fill contact from ray test result, refine by track bezier patches
+static bool GetContact(
+	const Track * track,
 	const btVector3 & origin,
 	const btVector3 & direction,
 	const btScalar length,
-	const btCollisionObject * caster,
-	CollisionContact & contact) const
+	const MyRayResultCallback & ray,
+	CollisionContact & contact,
+	PatchRayStats * stats = 0)
 {
-	btVector3 p = origin + direction * length;
+	btVector3 p = ray.m_rayToWorld;
 	btVector3 n = -direction;
 	btScalar d = length;
 	int patch_id = -1;
@@ -127,9 +148,6 @@ bool DynamicsWorld::castRay(
 	const TrackSurface * s = TrackSurface::None();
 	const btCollisionObject * c = 0;
 
-	MyRayResultCallback ray(origin, p, caster);
-	rayTest(origin, p, ray);
-
 	// track geometry collision
 	if (ray.hasHit())
 	{
@@ -164,7 +182,7 @@ bool DynamicsWorld::castRay(
 			Vec3 colpoint;
 			Vec3 colnormal;
 			patch_id = contact.GetPatchId();
-			if (track->CastRay(org, dir, length, patch_id, colpoint, b, colnormal))
+			if (track->CastRay(org, dir, length, patch_id, colpoint, b, colnormal, stats))
 			{
 				p = ToBulletVector(colpoint);
 				n = ToBulletVector(colnormal);
@@ -181,15 +199,159 @@ bool DynamicsWorld::castRay(
 	return false;
 }
 
+bool DynamicsWorld::castRay(
+	const btVector3 & origin,
+	const btVector3 & direction,
+	const btScalar length,
+	const btCollisionObject * caster,
+	CollisionContact & contact) const
+{
+	btVector3 p = origin + direction * length;
+
+	// broadphase ray test uses a shared traversal stack
+	// rays are cast from job threads (car actions, ai)
+	MyRayResultCallback ray(origin, p, caster);
+	SDL_LockMutex(m_rayTestLock);
+	rayTest(origin, p, ray);
+	SDL_UnlockMutex(m_rayTestLock);
+
+	return GetContact(track, origin, direction, length, ray, contact);
+}
+
+int DynamicsWorld::castRays(
+	const Ray rays[],
+	CollisionContact contacts[],
+	const int count,
+	PatchRayStats * stats) const
+{
+	if (count < 1)
+		return 0;
+
+	// single broadphase query for the bounds of all rays
+	btVector3 bmin = rays[0].origin;
+	btVector3 bmax = rays[0].origin;
+	for (int i = 0; i < count; ++i)
+	{
+		btVector3 p = rays[i].origin + rays[i].direction * rays[i].length;
+		bmin.setMin(rays[i].origin);
+		bmax.setMax(rays[i].origin);
+		bmin.setMin(p);
+		bmax.setMax(p);
+	}
+	MyAabbCallback objects;
+	getBroadphase()->aabbTest(bmin, bmax, objects);
+
+	int hits = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		const Ray & r = rays[i];
+		btVector3 p = r.origin + r.direction * r.length;
+		btTransform from(btQuaternion::getIdentity(), r.origin);
+		btTransform to(btQuaternion::getIdentity(), p);
+
+		MyRayResultCallback ray(r.origin, p, r.caster);
+		for (int j = 0; j < objects.m_objects.size(); ++j)
+		{
+			btCollisionObject * obj = objects.m_objects[j];
+			const btBroadphaseProxy * proxy = obj->getBroadphaseHandle();
+			if (!ray.needsCollision(obj->getBroadphaseHandle()))
+				continue;
+
+			// ray against proxy bounds, closer than current hit
+			btScalar param = ray.m_closestHitFraction;
+			btVector3 normal;
+			if (!btRayAabb(r.origin, p, proxy->m_aabbMin, proxy->m_aabbMax, param, normal))
+				continue;
+
+			rayTestSingle(from, to, obj, obj->getCollisionShape(), obj->getWorldTransform(), ray);
+		}
+
+		if (GetContact(track, r.origin, r.direction, r.length, ray, contacts[i], stats))
+			hits++;
+	}
+	return hits;
+}
+
 void DynamicsWorld::update(btScalar dt)
 {
 	stepSimulation(dt, maxSubSteps, timeStep);
 	//CProfileManager::dumpAll();
 }
 
+void DynamicsWorld::addParallelAction(ParallelAction* action)
+{
+	addAction(action);
+	m_parallelActions.push_back(action);
+}
+
+void DynamicsWorld::removeParallelAction(ParallelAction* action)
+{
+	removeAction(action);
+	m_parallelActions.remove(action);
+}
+
+void DynamicsWorld::updateActions(btScalar timeStep)
+{
+	// serial actions first
+	if (m_actions.size() != m_parallelActions.size())
+	{
+		for (int i = 0; i < m_actions.size(); ++i)
+		{
+			btActionInterface * action = m_actions[i];
+			bool parallel = false;
+			for (int j = 0; j < m_parallelActions.size() && !parallel; ++j)
+				parallel = (m_parallelActions[j] == action);
+			if (!parallel)
+				action->updateAction(this, timeStep);
+		}
+	}
+
+	// every phase depends on the previous one, so that contacts always see
+	// all bodies in the same state independent of the thread count
+	m_actionTimeStep = timeStep;
+	const int n = m_parallelActions.size();
+	JobSystem & jobs = JobSystem::instance();
+	if (jobs.GetThreadCount() < 2 || n < 2)
+	{
+		updateActionsBegin(this, 0, n);
+		updateActionsContacts(this, 0, n);
+		updateActionsEnd(this, 0, n);
+		return;
+	}
+
+	JobSystem::Fence begin, contacts, end;
+	jobs.ParallelFor(updateActionsBegin, this, 0, n, 1, begin);
+	jobs.ParallelFor(updateActionsContacts, this, 0, n, 1, contacts, &begin);
+	jobs.ParallelFor(updateActionsEnd, this, 0, n, 1, end, &contacts);
+	jobs.Wait(end);
+}
+
+void DynamicsWorld::updateActionsBegin(void * world, int begin, int end)
+{
+	DynamicsWorld & w = *static_cast<DynamicsWorld*>(world);
+	for (int i = begin; i < end; ++i)
+		w.m_parallelActions[i]->updateActionBegin(w.m_actionTimeStep);
+}
+
+void DynamicsWorld::updateActionsContacts(void * world, int begin, int end)
+{
+	DynamicsWorld & w = *static_cast<DynamicsWorld*>(world);
+	for (int i = begin; i < end; ++i)
+		w.m_parallelActions[i]->updateActionContacts();
+}
+
+void DynamicsWorld::updateActionsEnd(void * world, int begin, int end)
+{
+	DynamicsWorld & w = *static_cast<DynamicsWorld*>(world);
+	for (int i = begin; i < end; ++i)
+		w.m_parallelActions[i]->updateActionEnd(w.m_actionTimeStep);
+}
+
 void DynamicsWorld::debugPrint(std::ostream & out) const
 {
 	out << "Collision objects: " << getNumCollisionObjects() << std::endl;
+	if (track)
+		track->debugPrint(out);
 }
 
 void DynamicsWorld::solveConstraints(btContactSolverInfo& solverInfo)
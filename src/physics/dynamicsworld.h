@@ -28,6 +28,9 @@ class Track;
 class CollisionContact;
 class FractureBody;
 class Bezier;
+class ParallelAction;
+struct PatchRayStats;
+struct SDL_mutex;
 
 class DynamicsWorld  : public btDiscreteDynamicsWorld
 {
@@ -44,6 +47,11 @@ public:
 
 	void addCollisionObject(btCollisionObject* object);
 
+	// add action which can be updated concurrently with other parallel actions
+	void addParallelAction(ParallelAction* action);
+
+	void removeParallelAction(ParallelAction* action);
+
 	// reset collision world (unloads previous track)
 	void reset(const Track & t);
 
@@ -60,6 +68,25 @@ public:
 		const btCollisionObject * caster,
 		CollisionContact & contact) const;
 
+	struct Ray
+	{
+		btVector3 origin;
+		btVector3 direction;
+		btScalar length;
+		const btCollisionObject * caster;
+	};
+
+	// cast a batch of rays, contacts are stored at the ray index
+	// patch ids of the passed in contacts are used as search hints
+	// rays share a single broadphase query, they should be close to each other
+	// road patch rays are counted in stats if given
+	// returns number of hits
+	int castRays(
+		const Ray rays[],
+		CollisionContact contacts[],
+		const int count,
+		PatchRayStats * stats = 0) const;
+
 	void update(btScalar dt);
 
 	void draw();
@@ -79,8 +106,19 @@ protected:
 	btScalar timeStep;
 	int maxSubSteps;
 
+	btAlignedObjectArray<ParallelAction*> m_parallelActions;
+	SDL_mutex * m_rayTestLock;
+	btScalar m_actionTimeStep;
+
 	void reset();
 
+	void updateActions(btScalar timeStep);
+
+	// parallel action phase jobs
+	static void updateActionsBegin(void * world, int begin, int end);
+	static void updateActionsContacts(void * world, int begin, int end);
+	static void updateActionsEnd(void * world, int begin, int end);
+
 	void solveConstraints(btContactSolverInfo& solverInfo);
 
 	void fractureCallback();
@@ -0,0 +1,42 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef _PARALLELACTION_H
+#define _PARALLELACTION_H
+
+#include "BulletDynamics/Dynamics/btActionInterface.h"
+
+/// Action which can be updated concurrently with other parallel actions.
+/// The update is split into phases, each phase is run for all actions
+/// before the next one starts. updateAction has to be equivalent to
+/// running the three phases in sequence.
+class ParallelAction : public btActionInterface
+{
+public:
+	/// prepare update, only modifies own state
+	virtual void updateActionBegin(btScalar dt) = 0;
+
+	/// query world contacts, world is read only
+	virtual void updateActionContacts() = 0;
+
+	/// integrate, only modifies own state
+	virtual void updateActionEnd(btScalar dt) = 0;
+};
+
+#endif // _PARALLELACTION_H
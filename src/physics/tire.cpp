@@ -18,11 +18,38 @@
 /************************************************************************/
 
 #include "tire.h"
+#include "simd4.h"
+#include "unittest.h"
 
-template <typename T>
-inline T sgn(T val)
+// scalar overloads of the Simd4f functions used by the templated pacejka code
+inline btScalar Sgn(btScalar val)
+{
+	return (btScalar(0) < val) - (val < btScalar(0));
+}
+
+inline btScalar Abs(btScalar val)
+{
+	return btFabs(val);
+}
+
+inline btScalar Atan(btScalar val)
+{
+	return btAtan(val);
+}
+
+inline btScalar Sin(btScalar val)
 {
-	return (T(0) < val) - (val < T(0));
+	return btSin(val);
+}
+
+inline btScalar Cos(btScalar val)
+{
+	return btCos(val);
+}
+
+inline btScalar Exp(btScalar val)
+{
+	return btExp(val);
 }
 
 #define ENTRY(x) #x,
@@ -47,7 +74,8 @@ Tire::Tire() :
 	ideal_slip_angle(0),
 	vx(0), vy(0),
 	fx(0), fy(0), fz(0),
-	mz(0)
+	mz(0),
+	use_tables(false)
 {
 	// ctor
 }
@@ -56,6 +84,77 @@ void Tire::init(const TireInfo & info)
 {
 	TireInfo::operator=(info);
 	initSigmaHatAlphaHat();
+	if (!table_fx.empty())
+		initTables();
+}
+
+struct Tire::TableFx
+{
+	const Tire & tire;
+	TableFx(const Tire & tire) : tire(tire) {}
+	btScalar operator()(btScalar sigma, btScalar Fz, btScalar /*gamma*/) const
+	{
+		if (Fz <= 0) return 0;
+		btScalar dFz = (Fz - tire.nominal_load) / tire.nominal_load;
+		return PacejkaFx(tire.coefficients, sigma, Fz, dFz, btScalar(1));
+	}
+};
+
+struct Tire::TableFy
+{
+	const Tire & tire;
+	TableFy(const Tire & tire) : tire(tire) {}
+	btScalar operator()(btScalar alpha, btScalar Fz, btScalar gamma) const
+	{
+		if (Fz <= 0) return 0;
+		btScalar Fz0 = tire.nominal_load;
+		btScalar dFz = (Fz - Fz0) / Fz0;
+		btScalar Dy, BCy, Shf;
+		return PacejkaFy(tire.coefficients, Fz0, alpha, gamma, Fz, dFz, btScalar(1), Dy, BCy, Shf);
+	}
+};
+
+struct Tire::TableMz
+{
+	const Tire & tire;
+	TableMz(const Tire & tire) : tire(tire) {}
+	btScalar operator()(btScalar alpha, btScalar Fz, btScalar gamma) const
+	{
+		if (Fz <= 0) return 0;
+		btScalar Fz0 = tire.nominal_load;
+		btScalar dFz = (Fz - Fz0) / Fz0;
+		btScalar Dy, BCy, Shf;
+		btScalar Fy = PacejkaFy(tire.coefficients, Fz0, alpha, gamma, Fz, dFz, btScalar(1), Dy, BCy, Shf);
+		return PacejkaMz(tire.coefficients, Fz0, alpha, gamma, Fz, dFz, btScalar(1), Fy, BCy, Shf);
+	}
+};
+
+void Tire::setUseTables(bool value)
+{
+	// tables are kept when disabled, switching back is cheap
+	use_tables = value;
+	if (use_tables && table_fx.empty())
+		initTables();
+}
+
+void Tire::buildTables()
+{
+	if (table_fx.empty())
+		initTables();
+}
+
+void Tire::initTables()
+{
+	// slip axes centered on the ideal slip at medium load
+	// camber range limited to 0.1 pi, larger values are clamped
+	// fy and mz vary strongly with camber, so they get more camber samples
+	int n = tablesize / 2;
+	btScalar sigma_scale = btMax(btFabs(sigma_hat[n]), btScalar(1E-2));
+	btScalar alpha_scale = btMax(btFabs(alpha_hat[n]), btScalar(1E-2));
+	btScalar max_gamma = btMin(max_camber, btScalar(0.1 * M_PI));
+	table_fx.init(TableFx(*this), sigma_scale, max_load, 0, 64, 32, 1);
+	table_fy.init(TableFy(*this), alpha_scale, max_load, max_gamma, 64, 32, 9);
+	table_mz.init(TableMz(*this), alpha_scale, max_load, max_gamma, 64, 32, 9);
 }
 
 void Tire::getSigmaHatAlphaHat(btScalar load, btScalar & sh, btScalar & ah) const
@@ -79,11 +178,9 @@ btVector3 Tire::getForce(
 {
 	if (normal_load * friction_coeff  < 1E-6)
 	{
-		slip = slip_angle = 0;
-		ideal_slip = ideal_slip_angle = 1;
-		fx = fy = fz = mz = 0;
-		vx = vy = 0;
-		return btVector3(0, 0, 0);
+		btVector3 zero(0, 0, 0);
+		setState(0, 0, 0, 0, 0, zero);
+		return zero;
 	}
 
 	// limit input
@@ -96,40 +193,168 @@ btVector3 Tire::getForce(
 	btScalar sigma = -lon_slip_velocity / denom;
 	btScalar alpha = btAtan(lat_velocity / denom);
 
-	// force parameters
-	btScalar Fz = normal_load;
-	btScalar Fz0 = nominal_load;
-	btScalar dFz = (Fz - Fz0) / Fz0;
+	btScalar Fx, Fy, Mz;
+	if (getUseTables())
+		PacejkaTables(normal_load, friction_coeff, camber, sigma, alpha, Fx, Fy, Mz);
+	else
+		Pacejka(coefficients, nominal_load, normal_load, friction_coeff, camber, sigma, alpha, Fx, Fy, Mz);
 
-	// pure slip
-	btScalar Dy, BCy, Shf;
-	btScalar Fx0 = PacejkaFx(sigma, Fz, dFz, friction_coeff);
-	btScalar Fy0 = PacejkaFy(alpha, camber, Fz, dFz, friction_coeff, Dy, BCy, Shf);
-	btScalar Mz0 = PacejkaMz(alpha, camber, Fz, dFz, friction_coeff, Fy0, BCy, Shf);
+	btVector3 force(Fx, Fy, Mz);
+	setState(normal_load, sigma, alpha, lon_slip_velocity, lat_velocity, force);
 
-	// combined slip
-	btScalar Gx = PacejkaGx(sigma, alpha);
-	btScalar Gy = PacejkaGy(sigma, alpha);
-	btScalar Svy = PacejkaSvy(sigma, alpha, camber, dFz, Dy);
-	btScalar Fx = Gx * Fx0;
-	btScalar Fy = Gy * Fy0 + Svy;
+	return force;
+}
+
+// The batched path differs from getForce only in the Simd4f atan, sin and
+// cos approximations, which are accurate to about 1E-7. The errors scale with
+// the peak force, for typical coefficients the force error stays below
+// 1E-6 * normal_load, the documented (and tested) bound is 1E-5 * normal_load.
+void Tire::getForces(
+	Tire * const tires[],
+	const btScalar normal_load[],
+	const btScalar friction_coeff[],
+	const btScalar camber[],
+	const btScalar rot_velocity[],
+	const btScalar lon_velocity[],
+	const btScalar lat_velocity[],
+	btVector3 force[],
+	int count)
+{
+	for (int i = 0; i < count; i += 4)
+	{
+		int n = btMin(count - i, 4);
+		bool tables = false;
+		for (int j = 0; j < n; ++j)
+			tables = tables || tires[i + j]->getUseTables();
+
+		if (tables)
+		{
+			for (int j = i; j < i + n; ++j)
+			{
+				force[j] = tires[j]->getForce(
+					normal_load[j], friction_coeff[j], camber[j],
+					rot_velocity[j], lon_velocity[j], lat_velocity[j]);
+			}
+			continue;
+		}
+
+		getForces4(
+			tires + i,
+			normal_load + i,
+			friction_coeff + i,
+			camber + i,
+			rot_velocity + i,
+			lon_velocity + i,
+			lat_velocity + i,
+			force + i,
+			n);
+	}
+}
+
+void Tire::getForces4(
+	Tire * const tires[],
+	const btScalar normal_load[],
+	const btScalar friction_coeff[],
+	const btScalar camber[],
+	const btScalar rot_velocity[],
+	const btScalar lon_velocity[],
+	const btScalar lat_velocity[],
+	btVector3 force[],
+	int count)
+{
+	// gather inputs, unused lanes replicate the last tire
+	// tires without load get the nominal load to keep the lanes finite
+	const Tire * t[4];
+	float p[CNUM][4];
+	float fz0[4], fzmax[4], gmax[4];
+	float fz[4], mu[4], gamma[4], vr[4], vx[4], vy[4];
+	bool loaded[4];
+	for (int j = 0; j < 4; ++j)
+	{
+		const int i = btMin(j, count - 1);
+		t[j] = tires[i];
+		for (int k = 0; k < CNUM; ++k)
+			p[k][j] = t[j]->coefficients[k];
+		loaded[j] = normal_load[i] * friction_coeff[i] >= 1E-6;
+		fz0[j] = t[j]->nominal_load;
+		fzmax[j] = t[j]->max_load;
+		gmax[j] = t[j]->max_camber;
+		fz[j] = loaded[j] ? normal_load[i] : t[j]->nominal_load;
+		mu[j] = loaded[j] ? friction_coeff[i] : 1;
+		gamma[j] = camber[i];
+		vr[j] = rot_velocity[i];
+		vx[j] = lon_velocity[i];
+		vy[j] = lat_velocity[i];
+	}
+
+	Simd4f coeff[CNUM];
+	for (int k = 0; k < CNUM; ++k)
+		coeff[k] = Simd4f::Load(p[k]);
+
+	// limit input
+	Simd4f Fz = Clamp(Simd4f::Load(fz), Simd4f(0), Simd4f::Load(fzmax));
+	Simd4f Gmax = Simd4f::Load(gmax);
+	Simd4f Gamma = Clamp(Simd4f::Load(gamma), -Gmax, Gmax);
 
-	// ideal slip and angle
-	btScalar sigma_hat(0), alpha_hat(0);
-	getSigmaHatAlphaHat(normal_load, sigma_hat, alpha_hat);
+	// sigma and alpha
+	Simd4f Vx = Simd4f::Load(vx);
+	Simd4f Vy = Simd4f::Load(vy);
+	Simd4f Vsx = Vx - Simd4f::Load(vr);
+	Simd4f denom = Max(Abs(Vx), Simd4f(1E-3f));
+	Simd4f Sigma = -Vsx / denom;
+	Simd4f Alpha = Atan(Vy / denom);
+
+	Simd4f Fx, Fy, Mz;
+	Pacejka(coeff, Simd4f::Load(fz0), Fz, Simd4f::Load(mu), Gamma, Sigma, Alpha, Fx, Fy, Mz);
+
+	// scatter results
+	float fx[4], fy[4], mz[4], sigma[4], alpha[4], vsx[4];
+	Fz.Store(fz);
+	Fx.Store(fx);
+	Fy.Store(fy);
+	Mz.Store(mz);
+	Sigma.Store(sigma);
+	Alpha.Store(alpha);
+	Vsx.Store(vsx);
+	for (int i = 0; i < count; ++i)
+	{
+		if (loaded[i])
+		{
+			force[i].setValue(fx[i], fy[i], mz[i]);
+			tires[i]->setState(fz[i], sigma[i], alpha[i], vsx[i], vy[i], force[i]);
+		}
+		else
+		{
+			force[i].setValue(0, 0, 0);
+			tires[i]->setState(0, 0, 0, 0, 0, force[i]);
+		}
+	}
+}
 
+void Tire::setState(
+	btScalar normal_load,
+	btScalar sigma,
+	btScalar alpha,
+	btScalar lon_slip_velocity,
+	btScalar lat_velocity,
+	const btVector3 & force)
+{
+	if (normal_load > 0)
+	{
+		getSigmaHatAlphaHat(normal_load, ideal_slip, ideal_slip_angle);
+	}
+	else
+	{
+		ideal_slip = ideal_slip_angle = 1;
+	}
 	slip = sigma;
 	slip_angle = alpha;
-	ideal_slip = sigma_hat;
-	ideal_slip_angle = alpha_hat;
-	fx = Fx;
-	fy = Fy;
-	fz = Fz;
-	mz = Mz0;
+	fx = force[0];
+	fy = force[1];
+	fz = normal_load;
+	mz = force[2];
 	vx = lon_slip_velocity;
 	vy = lat_velocity;
-
-	return btVector3(Fx, Fy, Mz0);
 }
 
 btScalar Tire::getSqueal() const
@@ -172,40 +397,40 @@ btScalar Tire::getMaxFy(btScalar load, btScalar camber) const
 	return D + Sv;
 }
 
-btScalar Tire::PacejkaFx(
-	btScalar sigma,
-	btScalar Fz,
-	btScalar dFz,
-	btScalar friction_coeff) const
+template <typename T>
+T Tire::PacejkaFx(
+	const T * p,
+	T sigma,
+	T Fz,
+	T dFz,
+	T friction_coeff)
 {
-	const btScalar * p = coefficients;
-
 	// vertical shift
-	btScalar Sv = Fz * (p[PVX1] + p[PVX2] * dFz);
+	T Sv = Fz * (p[PVX1] + p[PVX2] * dFz);
 
 	// horizontal shift
-	btScalar Sh = p[PHX1] + p[PHX2] * dFz;
+	T Sh = p[PHX1] + p[PHX2] * dFz;
 
 	// composite slip
-	btScalar S = sigma + Sh;
+	T S = sigma + Sh;
 
 	// slope at origin
-	btScalar K = Fz * (p[PKX1] + p[PKX2] * dFz) * btExp(-p[PKX3] * dFz);
+	T K = Fz * (p[PKX1] + p[PKX2] * dFz) * Exp(-p[PKX3] * dFz);
 
 	// curvature factor
-	btScalar E = (p[PEX1] + p[PEX2] * dFz + p[PEX3] * dFz * dFz) * (1 - p[PEX4] * sgn(S));
+	T E = (p[PEX1] + p[PEX2] * dFz + p[PEX3] * dFz * dFz) * (1 - p[PEX4] * Sgn(S));
 
 	// peak factor
-	btScalar D = Fz * (p[PDX1] + p[PDX2] * dFz);
+	T D = Fz * (p[PDX1] + p[PDX2] * dFz);
 
 	// shape factor
-	btScalar C = p[PCX1];
+	T C = p[PCX1];
 
 	// stiffness factor
-	btScalar B =  K / (C * D);
+	T B =  K / (C * D);
 
 	// force
-	btScalar F = D * btSin(C * btAtan(B * S - E * (B * S - btAtan(B * S)))) + Sv;
+	T F = D * Sin(C * Atan(B * S - E * (B * S - Atan(B * S)))) + Sv;
 
 	// scale by surface friction
 	F *= friction_coeff;
@@ -213,45 +438,45 @@ btScalar Tire::PacejkaFx(
 	return F;
 }
 
-btScalar Tire::PacejkaFy(
-	btScalar alpha,
-	btScalar gamma,
-	btScalar Fz,
-	btScalar dFz,
-	btScalar friction_coeff,
-	btScalar & Dy,
-	btScalar & BCy,
-	btScalar & Shf) const
+template <typename T>
+T Tire::PacejkaFy(
+	const T * p,
+	T Fz0,
+	T alpha,
+	T gamma,
+	T Fz,
+	T dFz,
+	T friction_coeff,
+	T & Dy,
+	T & BCy,
+	T & Shf)
 {
-	const btScalar * p = coefficients;
-	btScalar Fz0 = nominal_load;
-
 	// vertical shift
-	btScalar Sv = Fz * (p[PVY1] + p[PVY2] * dFz + (p[PVY3] + p[PVY4] * dFz) * gamma);
+	T Sv = Fz * (p[PVY1] + p[PVY2] * dFz + (p[PVY3] + p[PVY4] * dFz) * gamma);
 
 	// horizontal shift
-	btScalar Sh = p[PHY1] + p[PHY2] * dFz + p[PHY3] * gamma;
+	T Sh = p[PHY1] + p[PHY2] * dFz + p[PHY3] * gamma;
 
 	// composite slip angle
-	btScalar A = alpha + Sh;
+	T A = alpha + Sh;
 
 	// slope at origin
-	btScalar K = p[PKY1] * Fz0 * btSin(2 * btAtan(Fz / (p[PKY2] * Fz0))) * (1 - p[PKY3] * btFabs(gamma));
+	T K = p[PKY1] * Fz0 * Sin(2 * Atan(Fz / (p[PKY2] * Fz0))) * (1 - p[PKY3] * Abs(gamma));
 
 	// curvature factor
-	btScalar E = (p[PEY1] + p[PEY2] * dFz) * (1 - (p[PEY3] + p[PEY4] * gamma) * sgn(A));
+	T E = (p[PEY1] + p[PEY2] * dFz) * (1 - (p[PEY3] + p[PEY4] * gamma) * Sgn(A));
 
 	// peak factor
-	btScalar D = Fz * (p[PDY1] + p[PDY2] * dFz) * (1 - p[PDY3] * gamma * gamma);
+	T D = Fz * (p[PDY1] + p[PDY2] * dFz) * (1 - p[PDY3] * gamma * gamma);
 
 	// shape factor
-	btScalar C = p[PCY1];
+	T C = p[PCY1];
 
 	// stiffness factor
-	btScalar B = K / (C * D);
+	T B = K / (C * D);
 
 	// force
-	btScalar F = D * btSin(C * btAtan(B * A - E * (B * A - btAtan(B * A)))) + Sv;
+	T F = D * Sin(C * Atan(B * A - E * (B * A - Atan(B * A)))) + Sv;
 
 	// scale by surface friction
 	F *= friction_coeff;
@@ -264,86 +489,150 @@ btScalar Tire::PacejkaFy(
 	return F;
 }
 
-btScalar Tire::PacejkaMz(
-	btScalar alpha,
-	btScalar gamma,
-	btScalar Fz,
-	btScalar dFz,
-	btScalar friction_coeff,
-	btScalar Fy,
-	btScalar BCy,
-	btScalar Shf) const
+template <typename T>
+T Tire::PacejkaMz(
+	const T * p,
+	T Fz0,
+	T alpha,
+	T gamma,
+	T Fz,
+	T dFz,
+	T friction_coeff,
+	T Fy,
+	T BCy,
+	T Shf)
 {
-	const btScalar * p = coefficients;
-	btScalar Fz0 = nominal_load;
-	btScalar R0 = 0.3;
-	btScalar yz = gamma;
-	btScalar cos_alpha = btCos(alpha);
+	T R0 = 0.3;
+	T yz = gamma;
+	T cos_alpha = Cos(alpha);
 
-	btScalar Sht = p[QHZ1] + p[QHZ2] * dFz + (p[QHZ3] + p[QHZ4] * dFz) * yz;
+	T Sht = p[QHZ1] + p[QHZ2] * dFz + (p[QHZ3] + p[QHZ4] * dFz) * yz;
 
-	btScalar At = alpha + Sht;
+	T At = alpha + Sht;
 
-	btScalar Bt = (p[QBZ1] + p[QBZ2] * dFz + p[QBZ3] * dFz * dFz) * (1 + p[QBZ4] * yz + p[QBZ5] * btFabs(yz));
+	T Bt = (p[QBZ1] + p[QBZ2] * dFz + p[QBZ3] * dFz * dFz) * (1 + p[QBZ4] * yz + p[QBZ5] * Abs(yz));
 
-	btScalar Ct = p[QCZ1];
+	T Ct = p[QCZ1];
 
-	btScalar Dt = Fz * (p[QDZ1] + p[QDZ2] * dFz) * (1 + p[QDZ3] * yz + p[QDZ4] * yz * yz) * (R0 / Fz0);
+	T Dt = Fz * (p[QDZ1] + p[QDZ2] * dFz) * (1 + p[QDZ3] * yz + p[QDZ4] * yz * yz) * (R0 / Fz0);
 
-	btScalar Et = (p[QEZ1] + p[QEZ2] * dFz + p[QEZ3] * dFz * dFz) * (1 + (p[QEZ4] + p[QEZ5] * yz) * btAtan(Bt * Ct * At));
+	T Et = (p[QEZ1] + p[QEZ2] * dFz + p[QEZ3] * dFz * dFz) * (1 + (p[QEZ4] + p[QEZ5] * yz) * Atan(Bt * Ct * At));
 
-	btScalar Mzt = -Fy * Dt * btCos(Ct * btAtan(Bt * At - Et * (Bt * At - btAtan(Bt * At)))) * cos_alpha;
+	T Mzt = -Fy * Dt * Cos(Ct * Atan(Bt * At - Et * (Bt * At - Atan(Bt * At)))) * cos_alpha;
 
-	btScalar Ar = alpha + Shf;
+	T Ar = alpha + Shf;
 
-	btScalar Br = p[QBZ10] * BCy;
+	T Br = p[QBZ10] * BCy;
 
-	btScalar Dr = Fz * (p[QDZ6] + p[QDZ7] * dFz + (p[QDZ8] + p[QDZ9] * dFz) * yz) * R0;
+	T Dr = Fz * (p[QDZ6] + p[QDZ7] * dFz + (p[QDZ8] + p[QDZ9] * dFz) * yz) * R0;
 
-	btScalar Mzr = Dr * btCos(btAtan(Br * Ar)) * cos_alpha * friction_coeff;
+	T Mzr = Dr * Cos(Atan(Br * Ar)) * cos_alpha * friction_coeff;
 
 	return Mzt + Mzr;
 }
 
-btScalar Tire::PacejkaGx(
-	btScalar sigma,
-	btScalar alpha)
+template <typename T>
+T Tire::PacejkaGx(
+	const T * p,
+	T sigma,
+	T alpha)
 {
-	const btScalar * p = coefficients;
-	btScalar B = p[RBX1] * btCos(btAtan(p[RBX2] * sigma));
-	btScalar C = p[RCX1];
-	btScalar Sh = p[RHX1];
-	btScalar S = alpha + Sh;
-	btScalar G0 = btCos(C * btAtan(B * Sh));
-	btScalar G = btCos(C * btAtan(B * S)) / G0;
+	T B = p[RBX1] * Cos(Atan(p[RBX2] * sigma));
+	T C = p[RCX1];
+	T Sh = p[RHX1];
+	T S = alpha + Sh;
+	T G0 = Cos(C * Atan(B * Sh));
+	T G = Cos(C * Atan(B * S)) / G0;
 	return G;
 }
 
-btScalar Tire::PacejkaGy(
-	btScalar sigma,
-	btScalar alpha)
+template <typename T>
+T Tire::PacejkaGy(
+	const T * p,
+	T sigma,
+	T alpha)
 {
-	const btScalar * p = coefficients;
-	btScalar B = p[RBY1] * btCos(btAtan(p[RBY2] * (alpha - p[RBY3])));
-	btScalar C = p[RCY1];
-	btScalar Sh = p[RHY1];
-	btScalar S = sigma + Sh;
-	btScalar G0 = btCos(C * btAtan(B * Sh));
-	btScalar G = btCos(C * btAtan(B * S)) / G0;
+	T B = p[RBY1] * Cos(Atan(p[RBY2] * (alpha - p[RBY3])));
+	T C = p[RCY1];
+	T Sh = p[RHY1];
+	T S = sigma + Sh;
+	T G0 = Cos(C * Atan(B * Sh));
+	T G = Cos(C * Atan(B * S)) / G0;
 	return G;
 }
 
-btScalar Tire::PacejkaSvy(
+template <typename T>
+T Tire::PacejkaSvy(
+	const T * p,
+	T sigma,
+	T alpha,
+	T gamma,
+	T dFz,
+	T Dy)
+{
+	T Dv = Dy * (p[RVY1] + p[RVY2] * dFz + p[RVY3] * gamma) * Cos(Atan(p[RVY4] * alpha));
+	T Sv = Dv * Sin(p[RVY5] * Atan(p[RVY6] * sigma));
+	return Sv;
+}
+
+template <typename T>
+void Tire::Pacejka(
+	const T * p,
+	T Fz0,
+	T Fz,
+	T friction_coeff,
+	T gamma,
+	T sigma,
+	T alpha,
+	T & Fx,
+	T & Fy,
+	T & Mz)
+{
+	T dFz = (Fz - Fz0) / Fz0;
+
+	// pure slip
+	T Dy, BCy, Shf;
+	T Fx0 = PacejkaFx(p, sigma, Fz, dFz, friction_coeff);
+	T Fy0 = PacejkaFy(p, Fz0, alpha, gamma, Fz, dFz, friction_coeff, Dy, BCy, Shf);
+	T Mz0 = PacejkaMz(p, Fz0, alpha, gamma, Fz, dFz, friction_coeff, Fy0, BCy, Shf);
+
+	// combined slip
+	T Gx = PacejkaGx(p, sigma, alpha);
+	T Gy = PacejkaGy(p, sigma, alpha);
+	T Svy = PacejkaSvy(p, sigma, alpha, gamma, dFz, Dy);
+	Fx = Gx * Fx0;
+	Fy = Gy * Fy0 + Svy;
+	Mz = Mz0;
+}
+
+void Tire::PacejkaTables(
+	btScalar Fz,
+	btScalar friction_coeff,
+	btScalar gamma,
 	btScalar sigma,
 	btScalar alpha,
-	btScalar gamma,
-	btScalar dFz,
-	btScalar Dy)
+	btScalar & Fx,
+	btScalar & Fy,
+	btScalar & Mz) const
 {
 	const btScalar * p = coefficients;
-	btScalar Dv = Dy * (p[RVY1] + p[RVY2] * dFz + p[RVY3] * gamma) * btCos(btAtan(p[RVY4] * alpha));
-	btScalar Sv = Dv * btSin(p[RVY5] * btAtan(p[RVY6] * sigma));
-	return Sv;
+	btScalar dFz = (Fz - nominal_load) / nominal_load;
+
+	// pure slip
+	btScalar Fx0 = table_fx.lookup(sigma, Fz, 0) * friction_coeff;
+	btScalar Fy0 = table_fy.lookup(alpha, Fz, gamma) * friction_coeff;
+	btScalar Mz0 = table_mz.lookup(alpha, Fz, gamma) * friction_coeff;
+
+	// lateral peak factor, see PacejkaFy
+	btScalar Dy = Fz * (p[PDY1] + p[PDY2] * dFz) * (1 - p[PDY3] * gamma * gamma);
+
+	// combined slip
+	btScalar Gx = PacejkaGx(p, sigma, alpha);
+	btScalar Gy = PacejkaGy(p, sigma, alpha);
+	btScalar Svy = PacejkaSvy(p, sigma, alpha, gamma, dFz, Dy);
+	Fx = Gx * Fx0;
+	Fy = Gy * Fy0 + Svy;
+	Mz = Mz0;
 }
 
 void Tire::findSigmaHatAlphaHat(
@@ -363,7 +652,7 @@ void Tire::findSigmaHatAlphaHat(
 	btScalar smax = 2.0;
 	for (btScalar s = -smax; s < smax; s += 2 * smax / iterations)
 	{
-		btScalar Fx = PacejkaFx(s, Fz, dFz, mu);
+		btScalar Fx = PacejkaFx(coefficients, s, Fz, dFz, mu);
 		if (Fx > Fxmax)
 		{
 			output_sigmahat = btFabs(s);
@@ -375,7 +664,7 @@ void Tire::findSigmaHatAlphaHat(
 	btScalar amax = 30.0 * SIMD_RADS_PER_DEG;
 	for (btScalar a = -amax; a < amax; a += 2 * amax / iterations)
 	{
-		btScalar Fy = PacejkaFy(a, camber, Fz, dFz, mu, Dy, BCy, Shf);
+		btScalar Fy = PacejkaFy(coefficients, Fz0, a, camber, Fz, dFz, mu, Dy, BCy, Shf);
 		if (Fy > Fymax)
 		{
 			output_alphahat = btFabs(a);
@@ -393,3 +682,98 @@ void Tire::initSigmaHatAlphaHat()
 	}
 }
 
+
+// typical passenger car tire
+static void InitTestTireInfo(TireInfo & info)
+{
+	for (int i = 0; i < TireInfo::CNUM; ++i)
+		info.coefficients[i] = 0;
+	btScalar * p = info.coefficients;
+	p[TireInfo::PCX1] = 1.65; p[TireInfo::PDX1] = 1.2; p[TireInfo::PDX2] = -0.1;
+	p[TireInfo::PEX1] = 0.2; p[TireInfo::PEX2] = 0.2; p[TireInfo::PEX4] = 0.1;
+	p[TireInfo::PKX1] = 22; p[TireInfo::PKX2] = 13; p[TireInfo::PKX3] = -0.4;
+	p[TireInfo::PCY1] = 1.3; p[TireInfo::PDY1] = 1.1; p[TireInfo::PDY2] = -0.1; p[TireInfo::PDY3] = 0.5;
+	p[TireInfo::PEY1] = -0.8; p[TireInfo::PEY2] = -0.6; p[TireInfo::PEY3] = 0.1; p[TireInfo::PEY4] = -6;
+	p[TireInfo::PKY1] = 20; p[TireInfo::PKY2] = 1.5; p[TireInfo::PKY3] = 0.2;
+	p[TireInfo::PHY1] = 0.003; p[TireInfo::PVY1] = 0.04; p[TireInfo::PVY2] = -0.01; p[TireInfo::PVY3] = -0.1;
+	p[TireInfo::QBZ1] = 10; p[TireInfo::QBZ2] = -1.5; p[TireInfo::QCZ1] = 1.15; p[TireInfo::QDZ1] = 0.1;
+	p[TireInfo::QEZ1] = -3; p[TireInfo::QEZ4] = 0.5; p[TireInfo::QBZ10] = 0.5; p[TireInfo::QDZ8] = -0.1;
+	p[TireInfo::RBX1] = 13; p[TireInfo::RBX2] = -10; p[TireInfo::RCX1] = 1;
+	p[TireInfo::RBY1] = 10; p[TireInfo::RBY2] = 10; p[TireInfo::RCY1] = 1;
+	p[TireInfo::RVY1] = 0.05; p[TireInfo::RVY4] = 10; p[TireInfo::RVY5] = 2; p[TireInfo::RVY6] = 10;
+}
+
+QT_TEST(tire_batch_test)
+{
+	TireInfo info;
+	InitTestTireInfo(info);
+
+	const int count = 7;
+	Tire tire[count], tire_ref[count];
+	Tire * tires[count];
+	for (int i = 0; i < count; ++i)
+	{
+		tire[i].init(info);
+		tire_ref[i].init(info);
+		tires[i] = &tire[i];
+	}
+
+	btScalar load[count], mu[count], camber[count], vr[count], vx[count], vy[count];
+	btVector3 force[count];
+	for (int n = 0; n < 1000; ++n)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			int k = n * count + i;
+			load[i] = (k % 5 == 0) ? 0 : 500 + (k * 37) % 9000;
+			mu[i] = 0.5 + 0.1 * (k % 6);
+			camber[i] = 0.02 * ((k % 11) - 5);
+			vx[i] = 0.5 * ((k % 101) - 20);
+			vr[i] = vx[i] * (1 + 0.01 * ((k % 41) - 20));
+			vy[i] = 0.1 * ((k % 53) - 26);
+		}
+
+		Tire::getForces(tires, load, mu, camber, vr, vx, vy, force, count);
+
+		for (int i = 0; i < count; ++i)
+		{
+			btVector3 ref = tire_ref[i].getForce(load[i], mu[i], camber[i], vr[i], vx[i], vy[i]);
+			btScalar error = (ref - force[i]).length() / btMax(load[i], btScalar(1));
+			QT_CHECK_LESS(error, 1E-5);
+			QT_CHECK_CLOSE(tire[i].getSlip(), tire_ref[i].getSlip(), 1E-6);
+			QT_CHECK_CLOSE(tire[i].getIdealSlip(), tire_ref[i].getIdealSlip(), 1E-6);
+		}
+	}
+}
+
+QT_TEST(tire_table_test)
+{
+	TireInfo info;
+	InitTestTireInfo(info);
+
+	Tire tire, tire_ref;
+	tire.init(info);
+	tire_ref.init(info);
+	tire.setUseTables(true);
+	QT_CHECK(tire.getUseTables());
+
+	// interpolation error relative to the load, worst at low load and large camber
+	btScalar max_error = 0;
+	for (int k = 0; k < 10000; ++k)
+	{
+		btScalar load = 500 + (k * 37) % 9000;
+		btScalar mu = 0.5 + 0.1 * (k % 6);
+		btScalar camber = 0.02 * ((k % 11) - 5);
+		btScalar vx = 0.5 * ((k % 101) - 20);
+		btScalar vr = vx * (1 + 0.01 * ((k % 41) - 20));
+		btScalar vy = 0.1 * ((k % 53) - 26);
+		btVector3 f = tire.getForce(load, mu, camber, vr, vx, vy);
+		btVector3 r = tire_ref.getForce(load, mu, camber, vr, vx, vy);
+		btScalar error = btMax(btFabs(f[0] - r[0]), btFabs(f[1] - r[1])) / (load * mu);
+		max_error = btMax(max_error, error);
+	}
+	QT_CHECK_LESS(max_error, 0.01);
+
+	tire.setUseTables(false);
+	QT_CHECK(!tire.getUseTables());
+}
@@ -20,6 +20,7 @@
 #ifndef _TIRE_H
 #define _TIRE_H
 
+#include "physics/tiretable.h"
 #include "LinearMath/btVector3.h"
 
 struct TireInfo
@@ -86,6 +87,15 @@ public:
 	/// get tire tread fraction
 	btScalar getTread() const;
 
+	/// use precomputed pure slip force tables instead of evaluating
+	/// the pacejka formulas, combined slip factors are still exact
+	void setUseTables(bool value);
+
+	bool getUseTables() const;
+
+	/// build the force tables now instead of on first use
+	void buildTables();
+
 	/// normal_load: tire load in N
 	/// friction_coeff: contact surface friction coefficient
 	/// camber: wheel camber in rad, positive when tire top tilts to the right, viewed from rear
@@ -100,6 +110,21 @@ public:
 		btScalar lon_velocty,
 		btScalar lat_velocity);
 
+	/// batched getForce for count tires, parameters are arrays of length count
+	/// tires are evaluated four at a time using Simd4f, force[i] matches
+	/// tires[i]->getForce(...) within 1E-5 * normal_load[i] (see tire.cpp)
+	/// groups containing tires with tables fall back to getForce
+	static void getForces(
+		Tire * const tires[],
+		const btScalar normal_load[],
+		const btScalar friction_coeff[],
+		const btScalar camber[],
+		const btScalar rot_velocity[],
+		const btScalar lon_velocity[],
+		const btScalar lat_velocity[],
+		btVector3 force[],
+		int count);
+
 	btScalar getRollingResistance(
 		const btScalar velocity,
 		const btScalar resistance_factor) const;
@@ -131,52 +156,127 @@ private:
 	btScalar fx, fy, fz;		///< contact force in tire space
 	btScalar mz;				///< aligning torque
 
+	/// pacejka functions are templates over btScalar and Simd4f,
+	/// so the batched path evaluates exactly the same formulas
+	/// p: tire coefficients, Fz0: nominal load
+
 	/// longitudinal friction
-	btScalar PacejkaFx(
-		btScalar sigma,
-		btScalar Fz,
-		btScalar dFz,
-		btScalar friction_coeff) const;
+	template <typename T>
+	static T PacejkaFx(
+		const T * p,
+		T sigma,
+		T Fz,
+		T dFz,
+		T friction_coeff);
 
 	/// lateral friction
-	btScalar PacejkaFy(
-		btScalar alpha,
-		btScalar gamma,
-		btScalar Fz,
-		btScalar dFz,
-		btScalar friction_coeff,
-		btScalar & Dy,
-		btScalar & BCy,
-		btScalar & Shf) const;
+	template <typename T>
+	static T PacejkaFy(
+		const T * p,
+		T Fz0,
+		T alpha,
+		T gamma,
+		T Fz,
+		T dFz,
+		T friction_coeff,
+		T & Dy,
+		T & BCy,
+		T & Shf);
 
 	/// aligning torque
-	btScalar PacejkaMz(
-		btScalar alpha,
-		btScalar gamma,
-		btScalar Fz,
-		btScalar dFz,
-		btScalar friction_coeff,
-		btScalar Fy,
-		btScalar BCy,
-		btScalar Shf) const;
+	template <typename T>
+	static T PacejkaMz(
+		const T * p,
+		T Fz0,
+		T alpha,
+		T gamma,
+		T Fz,
+		T dFz,
+		T friction_coeff,
+		T Fy,
+		T BCy,
+		T Shf);
 
 	/// combined slip longitudinal factor
-	btScalar PacejkaGx(
-		btScalar sigma,
-		btScalar alpha);
+	template <typename T>
+	static T PacejkaGx(
+		const T * p,
+		T sigma,
+		T alpha);
 
 	/// combined slip lateral factor
-	btScalar PacejkaGy(
-		btScalar sigma,
-		btScalar alpha);
+	template <typename T>
+	static T PacejkaGy(
+		const T * p,
+		T sigma,
+		T alpha);
 
 	/// combined slip lateral offset
-	btScalar PacejkaSvy(
+	template <typename T>
+	static T PacejkaSvy(
+		const T * p,
+		T sigma,
+		T alpha,
+		T gamma,
+		T dFz,
+		T Dy);
+
+	/// combined slip forces Fx, Fy and torque Mz
+	template <typename T>
+	static void Pacejka(
+		const T * p,
+		T Fz0,
+		T Fz,
+		T friction_coeff,
+		T gamma,
+		T sigma,
+		T alpha,
+		T & Fx,
+		T & Fy,
+		T & Mz);
+
+	/// pure slip Fx0(sigma, Fz), Fy0(alpha, Fz, gamma), Mz0(alpha, Fz, gamma)
+	/// at unit friction, load in N, camber in rad
+	TireTable table_fx, table_fy, table_mz;
+	struct TableFx;
+	struct TableFy;
+	struct TableMz;
+	bool use_tables;
+
+	/// build force tables from the current tire parameters
+	void initTables();
+
+	/// Pacejka with pure slip forces from the tables
+	void PacejkaTables(
+		btScalar Fz,
+		btScalar friction_coeff,
+		btScalar gamma,
 		btScalar sigma,
 		btScalar alpha,
-		btScalar gamma,
-		btScalar dFz,
-		btScalar Dy);
+		btScalar & Fx,
+		btScalar & Fy,
+		btScalar & Mz) const;
+
+	/// evaluate up to four tires at once
+	static void getForces4(
+		Tire * const tires[],
+		const btScalar normal_load[],
+		const btScalar friction_coeff[],
+		const btScalar camber[],
+		const btScalar rot_velocity[],
+		const btScalar lon_velocity[],
+		const btScalar lat_velocity[],
+		btVector3 force[],
+		int count);
+
+	/// set cached state, slip_angle in rad
+	void setState(
+		btScalar normal_load,
+		btScalar sigma,
+		btScalar alpha,
+		btScalar lon_slip_velocity,
+		btScalar lat_velocity,
+		const btVector3 & force);
 
 	/// get ideal slide ratio, slip angle
 	void getSigmaHatAlphaHat(
@@ -202,6 +302,11 @@ inline btScalar Tire::getTread() const
 	return tread;
 }
 
+inline bool Tire::getUseTables() const
+{
+	return use_tables;
+}
+
 inline btScalar Tire::getSlip() const
 {
 	return slip;
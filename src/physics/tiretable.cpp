@@ -0,0 +1,106 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#include "tiretable.h"
+#include "unittest.h"
+
+TireTable::TireTable() :
+	slip_scale(1),
+	load_max(1),
+	camber_max(0),
+	slip_size(0),
+	load_size(0),
+	camber_size(0)
+{
+	// ctor
+}
+
+btScalar TireTable::lookup(btScalar slip, btScalar load, btScalar camber) const
+{
+	btAssert(!values.empty());
+
+	// grid coordinates
+	btScalar u = slip / (btFabs(slip) + slip_scale);
+	btClamp(u, -maxWarp(), maxWarp());
+	btScalar x = (u / maxWarp() + 1) * btScalar(0.5) * (slip_size - 1);
+	btScalar y = btSqrt(btMax(load, btScalar(0)) / load_max) * (load_size - 1);
+	btSetMin(y, btScalar(load_size - 1));
+	int i = btMin(int(x), slip_size - 2);
+	int j = btMin(int(y), load_size - 2);
+	btScalar tx = x - i;
+	btScalar ty = y - j;
+
+	if (camber_size == 1)
+		return bilinear(0, i, j, tx, ty);
+
+	btScalar z = (camber / camber_max + 1) * btScalar(0.5) * (camber_size - 1);
+	btClamp(z, btScalar(0), btScalar(camber_size - 1));
+	int k = btMin(int(z), camber_size - 2);
+	btScalar tz = z - k;
+	return bilinear(k, i, j, tx, ty) * (1 - tz) + bilinear(k + 1, i, j, tx, ty) * tz;
+}
+
+btScalar TireTable::bilinear(int k, int i, int j, btScalar tx, btScalar ty) const
+{
+	const btScalar * v = &values[(k * load_size + j) * slip_size + i];
+	btScalar v0 = v[0] * (1 - tx) + v[1] * tx;
+	btScalar v1 = v[slip_size] * (1 - tx) + v[slip_size + 1] * tx;
+	return v0 * (1 - ty) + v1 * ty;
+}
+
+struct TireTableLinear
+{
+	btScalar operator()(btScalar /*slip*/, btScalar load, btScalar camber) const
+	{
+		return 2 * btSqrt(load) + 3 * camber + 1;
+	}
+};
+
+struct TireTableSlip
+{
+	btScalar operator()(btScalar slip, btScalar /*load*/, btScalar /*camber*/) const
+	{
+		return slip / (btFabs(slip) + btScalar(0.1));
+	}
+};
+
+QT_TEST(tiretable_test)
+{
+	// linear in warped load and camber is reproduced exactly
+	TireTableLinear Linear;
+	TireTable table;
+	QT_CHECK(table.empty());
+	table.init(Linear, 0.1, 10, 0.2, 16, 5, 3);
+	QT_CHECK(!table.empty());
+	QT_CHECK_CLOSE(table.lookup(0.05, 3.3, 0.05), Linear(0.05, 3.3, 0.05), 1E-4);
+	QT_CHECK_CLOSE(table.lookup(-1.0, 10, -0.2), Linear(-1.0, 10, -0.2), 1E-4);
+
+	// clamped outside of the table range
+	QT_CHECK_CLOSE(table.lookup(0, 20, 1), Linear(0, 10, 0.2), 1E-4);
+
+	// linear in warped slip is reproduced exactly
+	table.init(TireTableSlip(), 0.1, 1, 0, 64, 2, 1);
+	QT_CHECK_CLOSE(table.lookup(0.1, 0.5, 0), 0.5, 1E-4);
+	QT_CHECK_CLOSE(table.lookup(-0.03, 0.5, 0), -0.03 / 0.13, 1E-4);
+	QT_CHECK_CLOSE(table.lookup(100, 0.5, 0), 0.99, 1E-4);
+
+	// zero camber range is evaluated at zero camber
+	table.init(Linear, 0.1, 10, 0, 16, 5, 3);
+	QT_CHECK_CLOSE(table.lookup(0.05, 3.3, 0.1), Linear(0.05, 3.3, 0), 1E-4);
+}
@@ -0,0 +1,130 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef _TIRETABLE_H
+#define _TIRETABLE_H
+
+#include "LinearMath/btScalar.h"
+#include "LinearMath/btMinMax.h"
+
+#include <vector>
+
+/// Precomputed tire force surface over slip, normal load and camber,
+/// looked up with bilinear (without camber) or trilinear interpolation.
+/// The slip axis is warped by slip / (|slip| + slip_scale), which covers
+/// the whole slip range and puts most samples around the force peak.
+/// The load axis is sampled at load_max * t^2, denser at low load where
+/// the force curves change fastest relative to the load.
+class TireTable
+{
+public:
+	TireTable();
+
+	/// sample func(slip, load, camber) on the grid
+	/// slip_scale should be close to the peak force slip
+	/// load in [0, load_max], camber in [-camber_max, camber_max]
+	/// camber_size 1 or camber_max 0 makes a 2D table evaluated at zero camber
+	template <class Func>
+	void init(
+		const Func & func,
+		btScalar slip_scale,
+		btScalar load_max,
+		btScalar camber_max,
+		int slip_size,
+		int load_size,
+		int camber_size);
+
+	/// interpolated value, arguments are clamped to the table range
+	btScalar lookup(btScalar slip, btScalar load, btScalar camber) const;
+
+	bool empty() const;
+
+	void clear();
+
+private:
+	std::vector<btScalar> values; ///< slip is the fastest changing index, camber the slowest
+	btScalar slip_scale;
+	btScalar load_max;
+	btScalar camber_max;
+	int slip_size;
+	int load_size;
+	int camber_size;
+
+	/// warped slip range, the ends map to about 100 * slip_scale
+	static btScalar maxWarp() { return 0.99; }
+
+	/// interpolate camber layer k at slip index i, load index j
+	btScalar bilinear(int k, int i, int j, btScalar tx, btScalar ty) const;
+};
+
+// implementation
+
+template <class Func>
+inline void TireTable::init(
+	const Func & func,
+	btScalar new_slip_scale,
+	btScalar new_load_max,
+	btScalar new_camber_max,
+	int new_slip_size,
+	int new_load_size,
+	int new_camber_size)
+{
+	btAssert(new_slip_size > 1 && new_load_size > 1 && new_camber_size > 0);
+	btAssert(new_load_max > 0 && new_camber_max >= 0);
+	slip_scale = new_slip_scale;
+	load_max = new_load_max;
+	camber_max = new_camber_max;
+	slip_size = new_slip_size;
+	load_size = new_load_size;
+	camber_size = (camber_max > 0) ? new_camber_size : 1;
+	values.resize(slip_size * load_size * camber_size);
+
+	int n = 0;
+	for (int k = 0; k < camber_size; ++k)
+	{
+		btScalar camber = 0;
+		if (camber_size > 1)
+			camber = camber_max * (btScalar(2 * k) / (camber_size - 1) - 1);
+
+		for (int j = 0; j < load_size; ++j)
+		{
+			btScalar t = btScalar(j) / (load_size - 1);
+			btScalar load = load_max * t * t;
+
+			for (int i = 0; i < slip_size; ++i)
+			{
+				btScalar u = maxWarp() * (btScalar(2 * i) / (slip_size - 1) - 1);
+				btScalar slip = slip_scale * u / (1 - btFabs(u));
+				values[n++] = func(slip, load, camber);
+			}
+		}
+	}
+}
+
+inline bool TireTable::empty() const
+{
+	return values.empty();
+}
+
+inline void TireTable::clear()
+{
+	values.clear();
+}
+
+#endif
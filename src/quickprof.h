@@ -54,6 +54,9 @@
 /// The main namespace that contains everything.
 namespace quickprof
 {
+	/// Handle to a named counter, see Profiler::getCounter.
+	typedef unsigned long long int* Counter;
+
 	/// A simple data structure representing a single timed block
 	/// of code.
 	struct ProfileBlock
@@ -341,6 +344,44 @@ namespace quickprof
 		inline std::string getSummary(TimeFormat format=PERCENT);
 		inline std::string getAvgSummary(TimeFormat format=PERCENT);
 
+		/**
+		Adds to the named counter.  Counters are accumulated since the
+		profiler was initialized and listed after the blocks in the
+		summary.
+
+		@param name  The name of the counter.
+		@param value The amount to add.
+		*/
+		inline void addCount(const std::string& name,
+			unsigned long long int value);
+
+		/**
+		Adds to a counter using its handle, without the name lookup.
+
+		@param counter The counter handle.
+		@param value   The amount to add.
+		*/
+		inline void addCount(Counter counter,
+			unsigned long long int value);
+
+		/**
+		Returns a handle to the named counter, creating it if needed.
+		Handles stay valid for the lifetime of the profiler, the counters
+		are only zeroed when it is re-initialized.
+
+		@param name The name of the counter.
+		@return     The counter handle.
+		*/
+		inline Counter getCounter(const std::string& name);
+
+		/**
+		Returns the named counter total, zero if it can't be found.
+
+		@param name The name of the counter.
+		@return     The counter total.
+		*/
+		inline unsigned long long int getCount(const std::string& name)const;
+
 	private:
 		/**
 		Returns everything to its initial state.
@@ -390,6 +431,9 @@ namespace quickprof
 		/// Internal map of named profile blocks.
 		std::map<std::string, ProfileBlock*> mProfileBlocks;
 
+		/// Internal map of named counters.
+		std::map<std::string, unsigned long long int> mCounters;
+
 		/// The data output file used if this feature is enabled in init.
 		std::ofstream mOutputFile;
 
@@ -452,6 +496,13 @@ namespace quickprof
 			delete (*mProfileBlocks.begin()).second;
 			mProfileBlocks.erase(mProfileBlocks.begin());
 		}
+		std::map<std::string, unsigned long long int>::iterator
+			counter = mCounters.begin();
+		for (; counter != mCounters.end(); ++counter)
+		{
+			// Keep the counters, their handles are still in use.
+			counter->second = 0;
+		}
 		if (mOutputFile.is_open())
 		{
 			mOutputFile.close();
@@ -820,9 +871,62 @@ namespace quickprof
 			oss << suffix;
 		}
 
+		std::map<std::string, unsigned long long int>::const_iterator
+			counter = mCounters.begin();
+		for (; counter != mCounters.end(); ++counter)
+		{
+			if (!mProfileBlocks.empty() || counter != mCounters.begin())
+			{
+				oss << "\n";
+			}
+
+			oss << counter->first;
+			oss << ": ";
+			oss << counter->second;
+		}
+
 		return oss.str();
 	}
 
+	void Profiler::addCount(const std::string& name,
+		unsigned long long int value)
+	{
+		if (!mEnabled)
+		{
+			return;
+		}
+
+		mCounters[name] += value;
+	}
+
+	void Profiler::addCount(Counter counter,
+		unsigned long long int value)
+	{
+		if (!mEnabled)
+		{
+			return;
+		}
+
+		*counter += value;
+	}
+
+	Counter Profiler::getCounter(const std::string& name)
+	{
+		return &mCounters[name];
+	}
+
+	unsigned long long int Profiler::getCount(const std::string& name)const
+	{
+		std::map<std::string, unsigned long long int>::const_iterator iter =
+			mCounters.find(name);
+		if (mCounters.end() == iter)
+		{
+			return 0;
+		}
+
+		return iter->second;
+	}
+
 	std::string Profiler::getAvgSummary(TimeFormat format)
 	{
 		if (!mEnabled)
@@ -23,12 +23,154 @@
 #include "physics/carinput.h"
 #include "physics/cardynamics.h"
 
+#include <algorithm>
 #include <sstream>
 #include <fstream>
+#include <cstdio>
+#include <cstring>
+
+static void WriteVarint(unsigned value, std::string & data)
+{
+	while (value >= 0x80)
+	{
+		data.push_back(char((value & 0x7F) | 0x80));
+		value >>= 7;
+	}
+	data.push_back(char(value));
+}
+
+static bool ReadVarint(const std::string & data, size_t & pos, unsigned & value)
+{
+	value = 0;
+	for (unsigned shift = 0; shift < 32 && pos < data.size(); shift += 7)
+	{
+		const unsigned char c = data[pos++];
+		value |= unsigned(c & 0x7F) << shift;
+		if (!(c & 0x80))
+			return true;
+	}
+	return false;
+}
+
+// little endian, independent of the host byte order
+static void WriteFloat(float value, std::string & data)
+{
+	unsigned bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	for (int i = 0; i < 4; ++i)
+	{
+		data.push_back(char(bits >> (i * 8)));
+	}
+}
+
+static bool ReadFloat(const std::string & data, size_t & pos, float & value)
+{
+	if (pos + 4 > data.size())
+		return false;
+
+	unsigned bits = 0;
+	for (int i = 0; i < 4; ++i)
+	{
+		bits |= unsigned((unsigned char)data[pos++]) << (i * 8);
+	}
+	std::memcpy(&value, &bits, sizeof(value));
+	return true;
+}
+
+// group the n-th bytes of 4 byte words, unchanged float and int bytes
+// turn into zero runs after the xor delta
+static void Shuffle(const std::string & in, std::string & out)
+{
+	const size_t words = in.size() / 4;
+	for (size_t b = 0; b < 4; ++b)
+	{
+		for (size_t w = 0; w < words; ++w)
+		{
+			out.push_back(in[w * 4 + b]);
+		}
+	}
+	out.append(in, words * 4, std::string::npos);
+}
+
+static void Unshuffle(const std::string & in, size_t pos, size_t size, std::string & out)
+{
+	const size_t words = size / 4;
+	out.resize(size);
+	for (size_t b = 0; b < 4; ++b)
+	{
+		for (size_t w = 0; w < words; ++w)
+		{
+			out[w * 4 + b] = in[pos++];
+		}
+	}
+	for (size_t i = words * 4; i < size; ++i)
+	{
+		out[i] = in[pos++];
+	}
+}
+
+// PackBits run-length encoding, header byte n followed by
+// n + 1 literal bytes for n in [0, 127] or a byte repeated 1 - n times for n in [-127, -1]
+static void PackBits(const std::string & in, std::string & out)
+{
+	size_t i = 0;
+	while (i < in.size())
+	{
+		size_t run = 1;
+		while (i + run < in.size() && run < 128 && in[i + run] == in[i])
+			run++;
+
+		if (run > 2)
+		{
+			out.push_back(char(257 - run));
+			out.push_back(in[i]);
+			i += run;
+			continue;
+		}
+
+		// literals up to the next run of three bytes
+		size_t count = 0;
+		while (i + count < in.size() && count < 128)
+		{
+			const size_t j = i + count;
+			if (j + 2 < in.size() && in[j] == in[j + 1] && in[j] == in[j + 2])
+				break;
+			count++;
+		}
+		out.push_back(char(count - 1));
+		out.append(in, i, count);
+		i += count;
+	}
+}
+
+static bool UnpackBits(const std::string & in, std::string & out)
+{
+	size_t i = 0;
+	while (i < in.size())
+	{
+		const int n = (signed char)in[i++];
+		if (n >= 0)
+		{
+			if (i + n + 1 > in.size())
+				return false;
+			out.append(in, i, n + 1);
+			i += n + 1;
+		}
+		else if (n > -128)
+		{
+			if (i >= in.size())
+				return false;
+			out.append(1 - n, in[i++]);
+		}
+	}
+	return true;
+}
 
 Replay::Replay(float framerate) :
-	version_info("VDRIFTREPLAYV16", CarInput::INVALID, framerate),
-	replaymode(IDLE)
+	version_info("VDRIFTREPLAYV17", CarInput::INVALID, framerate),
+	replaymode(IDLE),
+	record_block_frame(0),
+	play_block(0)
 {
 	// ctor
 }
@@ -37,21 +179,68 @@ bool Replay::StartPlaying(const std::string & replayfilename, std::ostream & err
 {
 	Reset();
 
-	std::ifstream replaystream(replayfilename.c_str(), std::ios::binary);
-	if (!replaystream)
+	playstream.open(replayfilename.c_str(), std::ios::binary);
+	if (!playstream)
 	{
 		error_output << "Error loading replay file: " << replayfilename << std::endl;
+		Reset();
 		return false;
 	}
 
-	if (!Load(replaystream, error_output))
+	Version stream_version;
+	stream_version.Load(playstream);
+
+	const Version legacy_version("VDRIFTREPLAYV16", CarInput::INVALID, version_info.framerate);
+	if (stream_version == legacy_version)
+	{
+		// legacy replays are loaded completely
+		bool loaded = LoadV16(playstream, error_output);
+		playstream.close();
+		playstream.clear();
+		if (!loaded)
+		{
+			Reset();
+			return false;
+		}
+	}
+	else if (stream_version == version_info)
+	{
+		joeserialize::BinaryInputSerializer serialize_input(playstream);
+		if (!SerializeHeader(serialize_input))
+		{
+			error_output << "Error loading replay." << std::endl;
+			Reset();
+			return false;
+		}
+		carstate.resize(carinfo.size());
+		LoadBlockIndex();
+	}
+	else
+	{
+		error_output << "Stream version " <<
+			stream_version.format_version << "/" <<
+			stream_version.inputs_supported << "/" <<
+			stream_version.framerate <<
+			" does not match expected version " <<
+			version_info.format_version << "/" <<
+			version_info.inputs_supported << "/" <<
+			version_info.framerate << std::endl;
+		Reset();
 		return false;
+	}
 
 	for (size_t i = 0; i < carstate.size(); ++i)
 	{
 		carstate[i].Reset();
 	}
 
+	if (!blocks.empty() && !LoadBlock(0))
+	{
+		error_output << "Error loading replay." << std::endl;
+		Reset();
+		return false;
+	}
+
 	replaymode = PLAYING;
 
 	return true;
@@ -63,16 +252,41 @@ void Replay::Reset()
 	track.clear();
 	carinfo.clear();
 	carstate.clear();
+
+	// discard unfinished recording
+	if (recordstream.is_open())
+	{
+		recordstream.close();
+		std::remove(recordfilename.c_str());
+	}
+	recordstream.clear();
+	recordfilename.clear();
+	record_block_frame = 0;
+
+	playstream.close();
+	playstream.clear();
+	blocks.clear();
+	play_block = 0;
 }
 
 void Replay::StartRecording(
 	const std::vector<CarInfo> & ncarinfo,
 	const std::string & trackname,
+	const std::string & nrecordfilename,
 	std::ostream & error_log)
 {
 	Reset();
 
+	recordstream.open(nrecordfilename.c_str(), std::ios::binary | std::ios::trunc);
+	if (!recordstream)
+	{
+		error_log << "Error opening replay recording file: " << nrecordfilename << std::endl;
+		recordstream.clear();
+		return;
+	}
+
 	replaymode = RECORDING;
+	recordfilename = nrecordfilename;
 	carinfo = ncarinfo;
 	track = trackname;
 
@@ -81,19 +295,31 @@ void Replay::StartRecording(
 	{
 		carstate[i].Reset();
 	}
+
+	// the file format version is written manually, see Version::Save
+	version_info.Save(recordstream);
+	joeserialize::BinaryOutputSerializer serialize_output(recordstream);
+	SerializeHeader(serialize_output);
+	recordstream.flush();
 }
 
 void Replay::StopRecording(const std::string & replayfilename)
 {
-	replaymode = IDLE;
-	if (!replayfilename.empty())
+	if (recordstream.is_open())
 	{
-		std::ofstream f(replayfilename.c_str(), std::ios::binary);
-		if (f)
+		WriteBlock();
+		recordstream.close();
+		if (!replayfilename.empty())
 		{
-			Save(f);
+			std::remove(replayfilename.c_str());
+			std::rename(recordfilename.c_str(), replayfilename.c_str());
+		}
+		else
+		{
+			std::remove(recordfilename.c_str());
 		}
 	}
+	Reset();
 }
 
 const std::vector<float> & Replay::PlayFrame(unsigned carid, CarDynamics & car)
@@ -101,7 +327,20 @@ const std::vector<float> & Replay::PlayFrame(unsigned carid, CarDynamics & car)
 	assert(carid < carstate.size());
 	assert(unsigned(version_info.inputs_supported) == CarInput::INVALID);
 
-	if (GetPlaying() && !carstate[carid].PlayFrame(car))
+	if (!GetPlaying())
+		return carstate[carid].inputbuffer;
+
+	// load the next block when reaching its first frame
+	const unsigned next_block = play_block + 1;
+	if (carid == 0 && next_block < blocks.size() &&
+		carstate[0].frame + 1 >= blocks[next_block].frame &&
+		!LoadBlock(next_block))
+	{
+		replaymode = IDLE;
+		return carstate[carid].inputbuffer;
+	}
+
+	if (!carstate[carid].PlayFrame(car) && play_block + 1 >= blocks.size())
 	{
 		replaymode = IDLE;
 	}
@@ -119,10 +358,153 @@ void Replay::RecordFrame(unsigned carid, const std::vector <float> & inputs, Car
 		if (carstate[carid].frame > 2000000000)
 			replaymode = IDLE;
 
+		// all cars have recorded the frames up to the current one
+		if (carid == 0 && carstate[0].frame >= record_block_frame + block_frames)
+			WriteBlock();
+
 		carstate[carid].RecordFrame(inputs, car);
 	}
 }
 
+// upper_bound predicate, frames are stored in increasing order
+struct FrameBefore
+{
+	template <class Frame>
+	bool operator()(unsigned frame, const Frame & f) const
+	{
+		return frame < f.GetFrame();
+	}
+};
+
+unsigned Replay::SeekFrame(unsigned carid, unsigned frame, CarDynamics & car)
+{
+	assert(carid < carstate.size());
+
+	if (!GetPlaying())
+		return carstate[carid].frame;
+
+	if (!blocks.empty())
+	{
+		size_t index = std::upper_bound(blocks.begin(), blocks.end(), frame, FrameBefore()) - blocks.begin();
+		index = (index > 0) ? index - 1 : 0;
+		if (index != play_block && !LoadBlock(index))
+		{
+			replaymode = IDLE;
+			return carstate[carid].frame;
+		}
+	}
+
+	return carstate[carid].Seek(frame, car);
+}
+
+unsigned Replay::GetFrameCount() const
+{
+	if (!blocks.empty())
+		return blocks.back().frame + blocks.back().count;
+
+	unsigned count = 0;
+	for (size_t i = 0; i < carstate.size(); ++i)
+	{
+		count = std::max(count, carstate[i].GetLastFrame() + 1);
+	}
+	return count;
+}
+
+bool Replay::LoadV16(std::istream & instream, std::ostream & error_output)
+{
+	joeserialize::BinaryInputSerializer serialize_input(instream);
+	if (!Serialize(serialize_input))
+	{
+		error_output << "Error loading replay." << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void Replay::LoadBlockIndex()
+{
+	const std::streamoff start = playstream.tellg();
+	playstream.seekg(0, std::ios::end);
+	const std::streamoff end = playstream.tellg();
+	playstream.seekg(start);
+
+	// a recording that has not been stopped ends with a partial block, skip it
+	joeserialize::BinaryInputSerializer serialize_input(playstream);
+	Block block;
+	while (block.Serialize(serialize_input))
+	{
+		block.offset = playstream.tellg();
+		if (block.offset + std::streamoff(block.size) > end)
+			break;
+
+		blocks.push_back(block);
+		playstream.seekg(block.size, std::ios::cur);
+	}
+	playstream.clear();
+}
+
+bool Replay::LoadBlock(unsigned index)
+{
+	assert(index < blocks.size());
+	const Block & block = blocks[index];
+
+	std::string data(block.size, 0);
+	playstream.clear();
+	playstream.seekg(block.offset);
+	if (block.size > 0)
+		playstream.read(&data[0], block.size);
+	if (!playstream)
+		return false;
+
+	if (block.raw_size != block.size)
+	{
+		std::string raw;
+		if (!UnpackBits(data, raw) || raw.size() != block.raw_size)
+			return false;
+		data.swap(raw);
+	}
+
+	size_t pos = 0;
+	for (size_t i = 0; i < carstate.size(); ++i)
+	{
+		if (!carstate[i].DecodeBlock(block.frame, data, pos))
+			return false;
+	}
+
+	play_block = index;
+	return true;
+}
+
+void Replay::WriteBlock()
+{
+	if (carstate.empty() || carstate[0].frame <= record_block_frame)
+		return;
+
+	Block block;
+	block.frame = record_block_frame;
+	block.count = carstate[0].frame - record_block_frame;
+
+	std::string raw;
+	for (size_t i = 0; i < carstate.size(); ++i)
+	{
+		carstate[i].EncodeBlock(record_block_frame, raw);
+	}
+
+	// store compressed block only if it is smaller
+	std::string packed;
+	PackBits(raw, packed);
+	const std::string & data = (packed.size() < raw.size()) ? packed : raw;
+	block.raw_size = raw.size();
+	block.size = data.size();
+
+	joeserialize::BinaryOutputSerializer serialize_output(recordstream);
+	block.Serialize(serialize_output);
+	recordstream.write(data.data(), data.size());
+	recordstream.flush();
+
+	record_block_frame += block.count;
+}
+
 void Replay::CarState::RecordFrame(const std::vector <float> & inputs, CarDynamics & car)
 {
 	assert(inputbuffer.size() == CarInput::INVALID);
@@ -180,6 +562,36 @@ bool Replay::CarState::PlayFrame(CarDynamics & car)
 	return (cur_stateframe != stateframes.size() || cur_inputframe != inputframes.size());
 }
 
+unsigned Replay::CarState::Seek(unsigned target, CarDynamics & car)
+{
+	assert(inputbuffer.size() == CarInput::INVALID);
+
+	// the first state frame is recorded at frame 0, so there is always a keyframe
+	std::vector<StateFrame>::const_iterator key =
+		std::upper_bound(stateframes.begin(), stateframes.end(), target, FrameBefore());
+	if (key == stateframes.begin())
+		return frame;
+	--key;
+
+	// the input snapshot replaces all input frames up to the keyframe
+	ProcessPlayStateFrame(*key, car);
+	frame = key->GetFrame();
+	cur_stateframe = key - stateframes.begin() + 1;
+	cur_inputframe = std::upper_bound(inputframes.begin(), inputframes.end(), frame, FrameBefore()) - inputframes.begin();
+
+	return frame;
+}
+
+unsigned Replay::CarState::GetLastFrame() const
+{
+	unsigned last = 0;
+	if (!stateframes.empty())
+		last = stateframes.back().GetFrame();
+	if (!inputframes.empty())
+		last = std::max(last, inputframes.back().GetFrame());
+	return last;
+}
+
 void Replay::CarState::ProcessPlayInputFrame(const InputFrame & frame)
 {
 	for (unsigned i = 0; i < frame.GetNumInputs(); i++)
@@ -203,56 +615,192 @@ void Replay::CarState::ProcessPlayStateFrame(const StateFrame & frame, CarDynami
 	car.Serialize(serialize_input);
 }
 
-bool Replay::Serialize(joeserialize::Serializer & s)
+void Replay::CarState::EncodeBlock(unsigned block_frame, std::string & data)
 {
-	_SERIALIZE_(s, track);
-	_SERIALIZE_(s, carinfo);
-	_SERIALIZE_(s, carstate);
-	return true;
-}
+	// input frames as run lengths per input
+	for (unsigned n = 0; n < CarInput::INVALID; ++n)
+	{
+		std::vector<std::pair<unsigned, float> > changes;
+		for (size_t i = 0; i < inputframes.size(); ++i)
+		{
+			for (unsigned j = 0; j < inputframes[i].GetNumInputs(); ++j)
+			{
+				const std::pair<int, float> & input = inputframes[i].GetInput(j);
+				if (unsigned(input.first) == n)
+					changes.push_back(std::make_pair(inputframes[i].GetFrame(), input.second));
+			}
+		}
 
-void Replay::Save(std::ostream & outstream)
-{
-	// write the file format version data manually
-	// if the serialization functions were used,
-	// a variable length string would be written instead,
-	// which isn't exactly what we want
-	version_info.Save(outstream);
+		WriteVarint(changes.size(), data);
+		unsigned last_frame = block_frame;
+		for (size_t i = 0; i < changes.size(); ++i)
+		{
+			WriteVarint(changes[i].first - last_frame, data);
+			WriteFloat(changes[i].second, data);
+			last_frame = changes[i].first;
+		}
+	}
 
-	joeserialize::BinaryOutputSerializer serialize_output(outstream);
-	Serialize(serialize_output);
+	// state frames as xor delta to the previous state frame
+	WriteVarint(stateframes.size(), data);
+	unsigned last_frame = block_frame;
+	std::string last_state, state, delta;
+	for (size_t i = 0; i < stateframes.size(); ++i)
+	{
+		const StateFrame & stateframe = stateframes[i];
+		const std::vector<float> & snapshot = stateframe.GetInputSnapshot();
+		const std::string & binary_state = stateframe.GetBinaryStateData();
 
-	Reset();
+		state.clear();
+		for (size_t j = 0; j < snapshot.size(); ++j)
+		{
+			WriteFloat(snapshot[j], state);
+		}
+		state.append(binary_state);
+
+		const bool xor_delta = (state.size() == last_state.size());
+		WriteVarint(stateframe.GetFrame() - last_frame, data);
+		WriteVarint(snapshot.size(), data);
+		WriteVarint(binary_state.size(), data);
+		data.push_back(xor_delta);
+
+		delta = state;
+		if (xor_delta)
+		{
+			for (size_t j = 0; j < delta.size(); ++j)
+			{
+				delta[j] ^= last_state[j];
+			}
+		}
+		Shuffle(delta, data);
+
+		last_state.swap(state);
+		last_frame = stateframe.GetFrame();
+	}
+
+	inputframes.clear();
+	stateframes.clear();
 }
 
-bool Replay::Load(std::istream & instream, std::ostream & error_output)
+// sort input changes by frame
+struct ChangeBefore
 {
-	Version stream_version;
-	stream_version.Load(instream);
+	template <class Change>
+	bool operator()(const Change & a, const Change & b) const
+	{
+		return a.first < b.first;
+	}
+};
 
-	if (!(stream_version == version_info))
+bool Replay::CarState::DecodeBlock(unsigned block_frame, const std::string & data, size_t & pos)
+{
+	inputframes.clear();
+	stateframes.clear();
+	cur_inputframe = 0;
+	cur_stateframe = 0;
+
+	// merge input run lengths into input frames
+	std::vector<std::pair<unsigned, std::pair<int, float> > > changes;
+	for (unsigned n = 0; n < CarInput::INVALID; ++n)
 	{
-		error_output << "Stream version " <<
-			stream_version.format_version << "/" <<
-			stream_version.inputs_supported << "/" <<
-			stream_version.framerate <<
-			" does not match expected version " <<
-			version_info.format_version << "/" <<
-			version_info.inputs_supported << "/" <<
-			version_info.framerate << std::endl;
-		return false;
+		unsigned count;
+		if (!ReadVarint(data, pos, count))
+			return false;
+
+		unsigned last_frame = block_frame;
+		for (unsigned i = 0; i < count; ++i)
+		{
+			unsigned frame_delta;
+			float value;
+			if (!ReadVarint(data, pos, frame_delta) || !ReadFloat(data, pos, value))
+				return false;
+
+			last_frame += frame_delta;
+			changes.push_back(std::make_pair(last_frame, std::make_pair(int(n), value)));
+		}
 	}
 
-	joeserialize::BinaryInputSerializer serialize_input(instream);
-	if (!Serialize(serialize_input))
+	// stable sort keeps the inputs of a frame in increasing order
+	std::stable_sort(changes.begin(), changes.end(), ChangeBefore());
+	for (size_t i = 0; i < changes.size(); ++i)
 	{
-		error_output << "Error loading replay." << std::endl;
+		if (inputframes.empty() || inputframes.back().GetFrame() != changes[i].first)
+			inputframes.push_back(InputFrame(changes[i].first));
+		inputframes.back().AddInput(changes[i].second.first, changes[i].second.second);
+	}
+
+	unsigned count;
+	if (!ReadVarint(data, pos, count))
 		return false;
+
+	unsigned last_frame = block_frame;
+	std::string last_state, state;
+	std::vector<float> snapshot;
+	for (unsigned i = 0; i < count; ++i)
+	{
+		unsigned frame_delta, snapshot_size, binary_state_size;
+		if (!ReadVarint(data, pos, frame_delta) ||
+			!ReadVarint(data, pos, snapshot_size) ||
+			!ReadVarint(data, pos, binary_state_size) ||
+			pos >= data.size())
+			return false;
+
+		const bool xor_delta = data[pos++];
+		const size_t state_size = size_t(snapshot_size) * 4 + binary_state_size;
+		if (state_size > data.size() - pos || (xor_delta && state_size != last_state.size()))
+			return false;
+
+		Unshuffle(data, pos, state_size, state);
+		pos += state_size;
+		if (xor_delta)
+		{
+			for (size_t j = 0; j < state.size(); ++j)
+			{
+				state[j] ^= last_state[j];
+			}
+		}
+
+		size_t state_pos = 0;
+		snapshot.resize(snapshot_size);
+		for (unsigned j = 0; j < snapshot_size; ++j)
+		{
+			ReadFloat(state, state_pos, snapshot[j]);
+		}
+
+		last_frame += frame_delta;
+		stateframes.push_back(StateFrame(last_frame));
+		stateframes.back().SetBinaryStateData(state.substr(state_pos));
+		stateframes.back().SetInputSnapshot(snapshot);
+
+		last_state.swap(state);
 	}
 
 	return true;
 }
 
+bool Replay::Serialize(joeserialize::Serializer & s)
+{
+	if (!SerializeHeader(s)) return false;
+	_SERIALIZE_(s, carstate);
+	return true;
+}
+
+bool Replay::SerializeHeader(joeserialize::Serializer & s)
+{
+	_SERIALIZE_(s, track);
+	_SERIALIZE_(s, carinfo);
+	return true;
+}
+
+bool Replay::Block::Serialize(joeserialize::Serializer & s)
+{
+	_SERIALIZE_(s, frame);
+	_SERIALIZE_(s, count);
+	_SERIALIZE_(s, raw_size);
+	_SERIALIZE_(s, size);
+	return true;
+}
+
 Replay::Version::Version() :
 	format_version("VDRIFTREPLAYV??"),
 	inputs_supported(0),
@@ -426,4 +974,224 @@ QT_TEST(replay_test)
 		replay.Save(teststream);
 		QT_CHECK(replay.Load(teststream, std::cerr));
 	}*/
+
+	// block codec round trips
+	{
+		std::string data;
+		WriteVarint(0, data);
+		WriteVarint(300, data);
+		WriteVarint(4000000000u, data);
+		WriteFloat(-1.5f, data);
+		size_t pos = 0;
+		unsigned value = 1;
+		float fvalue = 0;
+		QT_CHECK(ReadVarint(data, pos, value) && value == 0);
+		QT_CHECK(ReadVarint(data, pos, value) && value == 300);
+		QT_CHECK(ReadVarint(data, pos, value) && value == 4000000000u);
+		QT_CHECK(ReadFloat(data, pos, fvalue) && fvalue == -1.5f);
+		QT_CHECK(pos == data.size() && !ReadVarint(data, pos, value));
+	}
+	{
+		std::string data("abcdefghij");
+		data.append(300, '\0');
+		data.append("xxyyy");
+		std::string shuffled, unshuffled, packed, unpacked;
+		Shuffle(data, shuffled);
+		Unshuffle(shuffled, 0, shuffled.size(), unshuffled);
+		QT_CHECK_EQUAL(unshuffled, data);
+		PackBits(data, packed);
+		QT_CHECK(packed.size() < data.size());
+		QT_CHECK(UnpackBits(packed, unpacked));
+		QT_CHECK_EQUAL(unpacked, data);
+	}
+
+	// car state block round trip, inputs and state of two cars
+	{
+		typedef Replay::CarState CarState;
+		typedef Replay::InputFrame InputFrame;
+		typedef Replay::StateFrame StateFrame;
+		const unsigned block_frames = Replay::block_frames;
+		const unsigned block_frame = 600;
+		std::vector<CarState> cars(2);
+		for (unsigned c = 0; c < cars.size(); ++c)
+		{
+			CarState & car = cars[c];
+			for (unsigned f = block_frame; f < block_frame + block_frames; f += 7 + c)
+			{
+				// inputs in increasing order per frame, varying counts and values
+				InputFrame inputframe(f);
+				for (unsigned n = (f + c) % 3; n < CarInput::INVALID; n += 1 + (f % 4))
+				{
+					inputframe.AddInput(n, (f % 2 ? -1.0f : 1.0f) * (n + 1) / float(f - block_frame + 1));
+				}
+				car.inputframes.push_back(inputframe);
+			}
+			for (unsigned f = block_frame; f < block_frame + block_frames; f += 90)
+			{
+				// same state sizes are xor delta coded, the last frame changes size
+				std::vector<float> snapshot(CarInput::INVALID);
+				for (unsigned n = 0; n < snapshot.size(); ++n)
+				{
+					snapshot[n] = (f % 2 ? 0.0f : 0.25f) * n - c;
+				}
+				std::string binary_state(f < block_frame + 270 ? 64 : 80, '\0');
+				for (unsigned n = 0; n < binary_state.size(); n += 3)
+				{
+					binary_state[n] = char(f * 31 + n * 7 + c);
+				}
+				car.stateframes.push_back(StateFrame(f));
+				car.stateframes.back().SetInputSnapshot(snapshot);
+				car.stateframes.back().SetBinaryStateData(binary_state);
+			}
+		}
+
+		std::vector<CarState> recorded(cars);
+		std::string raw, packed, data;
+		for (unsigned c = 0; c < cars.size(); ++c)
+		{
+			cars[c].EncodeBlock(block_frame, raw);
+			QT_CHECK(cars[c].Empty());
+		}
+		PackBits(raw, packed);
+		QT_CHECK(UnpackBits(packed, data));
+		QT_CHECK_EQUAL(data, raw);
+
+		size_t pos = 0;
+		for (unsigned c = 0; c < cars.size(); ++c)
+		{
+			const CarState & expected = recorded[c];
+			CarState & car = cars[c];
+			QT_CHECK(car.DecodeBlock(block_frame, data, pos));
+
+			QT_CHECK_EQUAL(car.inputframes.size(), expected.inputframes.size());
+			for (unsigned i = 0; i < car.inputframes.size() && i < expected.inputframes.size(); ++i)
+			{
+				const InputFrame & a = car.inputframes[i];
+				const InputFrame & b = expected.inputframes[i];
+				QT_CHECK_EQUAL(a.GetFrame(), b.GetFrame());
+				QT_CHECK_EQUAL(a.GetNumInputs(), b.GetNumInputs());
+				for (unsigned j = 0; j < a.GetNumInputs() && j < b.GetNumInputs(); ++j)
+				{
+					QT_CHECK_EQUAL(a.GetInput(j).first, b.GetInput(j).first);
+					QT_CHECK_EQUAL(a.GetInput(j).second, b.GetInput(j).second);
+				}
+			}
+
+			QT_CHECK_EQUAL(car.stateframes.size(), expected.stateframes.size());
+			for (unsigned i = 0; i < car.stateframes.size() && i < expected.stateframes.size(); ++i)
+			{
+				const StateFrame & a = car.stateframes[i];
+				const StateFrame & b = expected.stateframes[i];
+				QT_CHECK_EQUAL(a.GetFrame(), b.GetFrame());
+				QT_CHECK(a.GetInputSnapshot() == b.GetInputSnapshot());
+				QT_CHECK(a.GetBinaryStateData() == b.GetBinaryStateData());
+			}
+		}
+		QT_CHECK_EQUAL(pos, data.size());
+
+		// truncated blocks fail to decode
+		size_t truncated_pos = 0;
+		QT_CHECK(!cars[0].DecodeBlock(block_frame, data.substr(0, data.size() / 4), truncated_pos));
+	}
+}
+
+QT_TEST(replay_seek_test)
+{
+	typedef Replay::CarState CarState;
+	typedef Replay::InputFrame InputFrame;
+	typedef Replay::StateFrame StateFrame;
+	const std::string filename("replay_seek_test.vdr");
+	const unsigned frame_count = 2 * Replay::block_frames + 140;
+	const unsigned car_count = 2;
+
+	// record three blocks of two cars, car state is not serialized
+	Replay recorder(90);
+	recorder.StartRecording(std::vector<CarInfo>(car_count), "track", filename + ".rec", std::cerr);
+	QT_CHECK(recorder.GetRecording());
+	for (unsigned f = 0; f < frame_count; ++f)
+	{
+		if (recorder.carstate[0].frame >= recorder.record_block_frame + Replay::block_frames)
+			recorder.WriteBlock();
+
+		for (unsigned c = 0; c < car_count; ++c)
+		{
+			CarState & car = recorder.carstate[c];
+			std::vector<float> inputs(CarInput::INVALID);
+			InputFrame inputframe(f);
+			for (unsigned n = 0; n < inputs.size(); ++n)
+			{
+				inputs[n] = ((f + c) / (n + 3) % 5) * 0.25f;
+				if (inputs[n] != car.inputbuffer[n])
+				{
+					car.inputbuffer[n] = inputs[n];
+					inputframe.AddInput(n, inputs[n]);
+				}
+			}
+			if (inputframe.GetNumInputs() > 0)
+				car.inputframes.push_back(inputframe);
+			if (f % 30 == 0)
+			{
+				car.stateframes.push_back(StateFrame(f));
+				car.stateframes.back().SetInputSnapshot(inputs);
+			}
+			car.frame++;
+		}
+	}
+	recorder.StopRecording(filename);
+
+	// play straight through, keep the playback state of every frame
+	std::vector<CarState> played[car_count];
+	Replay replay(90);
+	CarDynamics car[car_count];
+	QT_CHECK(replay.StartPlaying(filename, std::cerr));
+	QT_CHECK_EQUAL(replay.blocks.size(), 3);
+	for (unsigned c = 0; c < car_count; ++c)
+	{
+		played[c].push_back(replay.carstate[c]);
+	}
+	while (replay.GetPlaying())
+	{
+		for (unsigned c = 0; c < car_count; ++c)
+		{
+			replay.PlayFrame(c, car[c]);
+			played[c].push_back(replay.carstate[c]);
+		}
+	}
+
+	// seek forward across blocks, backward within a block and across blocks,
+	// then play to the target frame, all targets are between keyframes
+	const unsigned targets[] = {615, 605, 320, 457, 700};
+	QT_CHECK(replay.StartPlaying(filename, std::cerr));
+	for (unsigned t = 0; t < sizeof(targets) / sizeof(targets[0]); ++t)
+	{
+		const unsigned target = targets[t];
+		QT_CHECK(target < played[0].size());
+		for (unsigned c = 0; c < car_count; ++c)
+		{
+			const unsigned keyframe = replay.SeekFrame(c, target, car[c]);
+			QT_CHECK(keyframe <= target && target - keyframe < 30);
+			QT_CHECK_EQUAL(replay.carstate[c].frame, keyframe);
+		}
+		while (replay.GetPlaying() && replay.carstate[0].frame < target)
+		{
+			for (unsigned c = 0; c < car_count; ++c)
+			{
+				replay.PlayFrame(c, car[c]);
+			}
+		}
+		QT_CHECK(replay.GetPlaying());
+		for (unsigned c = 0; c < car_count; ++c)
+		{
+			const CarState & expected = played[c][std::min<size_t>(target, played[c].size() - 1)];
+			const CarState & actual = replay.carstate[c];
+			QT_CHECK_EQUAL(actual.frame, target);
+			QT_CHECK_EQUAL(actual.frame, expected.frame);
+			QT_CHECK_EQUAL(actual.cur_inputframe, expected.cur_inputframe);
+			QT_CHECK_EQUAL(actual.cur_stateframe, expected.cur_stateframe);
+			QT_CHECK(actual.inputbuffer == expected.inputbuffer);
+		}
+	}
+	replay.Reset();
+
+	std::remove(filename.c_str());
 }
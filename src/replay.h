@@ -24,13 +24,23 @@
 #include "joeserialize.h"
 #include "macros.h"
 
-#include <iosfwd>
+#include <fstream>
 #include <string>
 
 class CarDynamics;
 
+/// Replay file format (VDRIFTREPLAYV17): version, track and car info
+/// followed by blocks of block_frames frames for all cars. Blocks start
+/// with a state frame, so they can be decoded independently. Input frames
+/// are stored as run lengths per input, state frames as byte-shuffled
+/// xor deltas to the previous state, and blocks are run-length compressed
+/// if that makes them smaller. Blocks are written while recording and
+/// loaded one at a time while playing. VDRIFTREPLAYV16 files are loaded
+/// completely as before.
 class Replay
 {
+friend class replay_testTest;
+friend class replay_seek_testTest;
 public:
 	Replay(float framerate);
 
@@ -45,12 +55,14 @@ public:
 	/// true if the replay system is currently playing
 	bool GetPlaying() const;
 
+	/// recorded blocks are written to recordfilename as they are completed
 	void StartRecording(
 		const std::vector<CarInfo> & carinfo,
 		const std::string & trackname,
+		const std::string & recordfilename,
 		std::ostream & error_log);
 
-	/// if replayfilename is empty, do not save the data
+	/// recording file is moved to replayfilename, removed if replayfilename is empty
 	void StopRecording(const std::string & replayfilename);
 
 	/// true if the replay system is currently recording
@@ -62,6 +74,20 @@ public:
 	/// record car inputs and state
 	void RecordFrame(unsigned carid, const std::vector <float> & inputs, CarDynamics & car);
 
+	/// restore car state from the last keyframe at or before frame while playing
+	/// returns the keyframe, frames from there to frame have to be re-simulated
+	unsigned SeekFrame(unsigned carid, unsigned frame, CarDynamics & car);
+
+	/// current car inputs while playing
+	const std::vector<float> & GetInputs(unsigned carid) const;
+
+	/// current playback frame
+	unsigned GetFrame() const;
+
+	/// number of recorded frames
+	unsigned GetFrameCount() const;
+
+	/// VDRIFTREPLAYV16 layout: track, car info and all car states
 	bool Serialize(joeserialize::Serializer & s);
 
 	const std::vector<CarInfo> & GetCarInfo() const;
@@ -166,14 +192,45 @@ private:
 		/// set car, update inputbuffer, false if we are out of frames
 		bool PlayFrame(CarDynamics & car);
 
+		/// binary search the last state frame at or before frame, restore it
+		/// returns the restored frame
+		unsigned Seek(unsigned frame, CarDynamics & car);
+
+		/// last recorded frame
+		unsigned GetLastFrame() const;
+
 		/// get car state, save input delta frame
 		void RecordFrame(const std::vector<float> & inputs, CarDynamics & car);
 
 		void ProcessPlayInputFrame(const InputFrame & frame);
 
 		void ProcessPlayStateFrame(const StateFrame & frame, CarDynamics & car);
+
+		/// append frames since block_frame to data and clear them
+		void EncodeBlock(unsigned block_frame, std::string & data);
+
+		/// replace frames with the block frames read from data at pos
+		bool DecodeBlock(unsigned block_frame, const std::string & data, size_t & pos);
+	};
+
+	/// block of frames [frame, frame + count) in the replay file
+	struct Block
+	{
+		std::streampos offset;	///< data offset in file
+		unsigned frame;			///< first frame
+		unsigned count;			///< number of frames
+		unsigned size;			///< stored data size
+		unsigned raw_size;		///< decoded data size, compressed if different from size
+
+		/// block header, precedes the block data
+		bool Serialize(joeserialize::Serializer & s);
+
+		unsigned GetFrame() const {return frame;}
 	};
 
+	/// frames per block, multiple of the state frame interval
+	static const unsigned block_frames = 300;
+
 	/// serialized
 	Version version_info;
 	std::string track;
@@ -182,12 +239,27 @@ private:
 
 	/// not serialized
 	enum {IDLE, RECORDING, PLAYING} replaymode;
+	std::ofstream recordstream;
+	std::string recordfilename;
+	unsigned record_block_frame;	///< first frame of the block being recorded
+	std::ifstream playstream;
+	std::vector<Block> blocks;		///< block index of the file being played
+	unsigned play_block;			///< loaded block
+
+	/// track and car info
+	bool SerializeHeader(joeserialize::Serializer & s);
+
+	/// load all input and state frames from a VDRIFTREPLAYV16 stream
+	bool LoadV16(std::istream & instream, std::ostream & error_output);
+
+	/// read block index from playstream, positioned after the header
+	void LoadBlockIndex();
 
-	/// load all input and state frames to the stream
-	bool Load(std::istream & instream, std::ostream & error_output);
+	/// load block frames of all cars
+	bool LoadBlock(unsigned index);
 
-	/// save all input and state frames to the stream and then clear them
-	void Save(std::ostream & outstream);
+	/// write recorded frames of all cars as block
+	void WriteBlock();
 };
 
 // implementation
@@ -202,6 +274,17 @@ inline bool Replay::GetRecording() const
 	return (replaymode == RECORDING);
 }
 
+inline const std::vector<float> & Replay::GetInputs(unsigned carid) const
+{
+	assert(carid < carstate.size());
+	return carstate[carid].inputbuffer;
+}
+
+inline unsigned Replay::GetFrame() const
+{
+	return carstate.empty() ? 0 : carstate[0].frame;
+}
+
 inline const std::vector<CarInfo> & Replay::GetCarInfo() const
 {
 	return carinfo;
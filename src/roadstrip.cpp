@@ -18,7 +18,11 @@
 /************************************************************************/
 
 #include "roadstrip.h"
+#include "unittest.h"
 #include <algorithm>
+#include <istream>
+#include <ostream>
+#include <sstream>
 
 RoadStrip::RoadStrip() :
 	closed(false)
@@ -87,60 +91,129 @@ bool RoadStrip::ReadFrom(
 		patches.back().GetPatch().Attach(patches.front().GetPatch());
 	}
 
-	GenerateSpacePartitioning();
-
 	return true;
 }
 
-void RoadStrip::GenerateSpacePartitioning()
+bool RoadStrip::ReadBinary(std::istream & in)
 {
-	aabb_part.Clear();
-	for (unsigned i = 0; i < patches.size(); ++i)
+	unsigned num = 0;
+	char isclosed = 0;
+	in.read((char *)&num, sizeof(num));
+	in.read(&isclosed, sizeof(isclosed));
+	if (!in || num > (1 << 24))
 	{
-		aabb_part.Add(i, patches[i].GetPatch().GetAABB());
+		return false;
 	}
-	aabb_part.Optimize();
-}
 
-bool RoadStrip::Collide(
-	const Vec3 & origin,
-	const Vec3 & direction,
-	const float seglen,
-	int & patch_id,
-	Vec3 & outtri,
-	const Bezier * & colpatch,
-	Vec3 & normal) const
-{
-	if (patch_id >= 0 && patch_id < (int)patches.size())
+	patches.clear();
+	patches.resize(num);
+	closed = isclosed;
+
+	std::vector<int> next(num, -1);
+	for (unsigned i = 0; i < num; ++i)
 	{
-		Vec3 coltri, colnorm;
-		if (patches[patch_id].Collide(origin, direction, seglen, coltri, colnorm))
+		float curvature = 0;
+		Vec3 racing_line;
+		Bezier & patch = patches[i].GetPatch();
+		patch.ReadBinary(in);
+		in.read((char *)&curvature, sizeof(curvature));
+		in.read((char *)&racing_line, sizeof(racing_line));
+		in.read((char *)&next[i], sizeof(next[i]));
+		patches[i].SetTrackCurvature(curvature);
+		if (patch.HasRacingline())
 		{
-			outtri = coltri;
-			normal = colnorm;
-			colpatch = &patches[patch_id].GetPatch();
-			return true;
+			patches[i].SetRacingLine(racing_line);
 		}
 	}
+	if (!in)
+	{
+		patches.clear();
+		return false;
+	}
 
-	bool col = false;
-	std::vector<int> candidates;
-	aabb_part.Query(Aabb<float>::Ray(origin, direction, seglen), candidates);
-	for (std::vector<int>::iterator i = candidates.begin(); i != candidates.end(); ++i)
+	// restore patch links
+	for (unsigned i = 0; i < num; ++i)
 	{
-		Vec3 coltri, colnorm;
-		if (patches[*i].Collide(origin, direction, seglen, coltri, colnorm))
+		Bezier & patch = patches[i].GetPatch();
+		patch.next_patch = (next[i] >= 0 && next[i] < (int)num) ? &patches[next[i]].GetPatch() : 0;
+	}
+
+	return true;
+}
+
+void RoadStrip::WriteBinary(std::ostream & out) const
+{
+	const unsigned num = patches.size();
+	const char isclosed = closed;
+	out.write((const char *)&num, sizeof(num));
+	out.write(&isclosed, sizeof(isclosed));
+	for (unsigned i = 0; i < num; ++i)
+	{
+		// store the next patch as index into the strip, usually i + 1
+		const Bezier * next_patch = patches[i].GetPatch().GetNextPatch();
+		int next = -1;
+		for (unsigned j = 0; next_patch && j < num; ++j)
 		{
-			if (!col || (coltri-origin).MagnitudeSquared() < (outtri-origin).MagnitudeSquared())
+			unsigned k = (i + 1 + j) % num;
+			if (&patches[k].GetPatch() == next_patch)
 			{
-				outtri = coltri;
-				normal = colnorm;
-				colpatch = &patches[*i].GetPatch();
-				patch_id = *i;
+				next = k;
+				break;
 			}
-			col = true;
 		}
+
+		const float curvature = patches[i].GetTrackCurvature();
+		const Vec3 racing_line = patches[i].GetRacingLine();
+		patches[i].GetPatch().WriteBinary(out);
+		out.write((const char *)&curvature, sizeof(curvature));
+		out.write((const char *)&racing_line, sizeof(racing_line));
+		out.write((const char *)&next, sizeof(next));
 	}
+}
+
+QT_TEST(roadstrip_binary_test)
+{
+	// three patches along z, links 0 -> 1, 2 -> 0, patch 1 unlinked
+	RoadStrip strip;
+	std::vector<RoadPatch> & patches = strip.GetPatches();
+	patches.resize(3);
+	for (int i = 0; i < 3; ++i)
+	{
+		const float z0 = i * 10, z1 = z0 + 10;
+		patches[i].GetPatch().SetFromCorners(Vec3(2, 0, z1), Vec3(-2, 0, z1), Vec3(2, 0, z0), Vec3(-2, 0, z0));
+		patches[i].SetTrackCurvature(0.1f * i);
+	}
+	patches[0].GetPatch().Attach(patches[1].GetPatch());
+	patches[2].GetPatch().Attach(patches[0].GetPatch());
+	patches[1].SetRacingLine(Vec3(0.5, 0, 15));
+
+	std::stringstream s;
+	strip.WriteBinary(s);
+	RoadStrip read;
+	QT_CHECK(read.ReadBinary(s));
+
+	const std::vector<RoadPatch> & p = read.GetPatches();
+	QT_CHECK_EQUAL(p.size(), 3u);
+	if (p.size() == 3)
+	{
+		QT_CHECK_EQUAL(p[0].GetPatch().GetNextPatch(), &p[1].GetPatch());
+		QT_CHECK(!p[1].GetPatch().GetNextPatch());
+		QT_CHECK_EQUAL(p[2].GetPatch().GetNextPatch(), &p[0].GetPatch());
+		QT_CHECK(!p[0].GetPatch().HasRacingline());
+		QT_CHECK(p[1].GetPatch().HasRacingline());
+		QT_CHECK_EQUAL(p[1].GetRacingLine(), Vec3(0.5, 0, 15));
+		QT_CHECK_EQUAL(p[1].GetPatch().GetRacingLine(), Vec3(0.5, 0, 15));
+		QT_CHECK_EQUAL(p[2].GetTrackCurvature(), 0.2f);
+		QT_CHECK_EQUAL(p[2].GetPatch().GetBL(), Vec3(2, 0, 20));
+	}
+	QT_CHECK_EQUAL(read.GetClosed(), strip.GetClosed());
+
+	std::stringstream t;
+	read.WriteBinary(t);
+	QT_CHECK(t.str() == s.str());
 
-	return col;
+	// truncated data is rejected
+	std::stringstream u(s.str().substr(0, s.str().size() - 1));
+	QT_CHECK(!read.ReadBinary(u));
+	QT_CHECK(read.GetPatches().empty());
 }
@@ -21,7 +21,6 @@
 #define _ROADSTRIP_H
 
 #include "roadpatch.h"
-#include "aabbtree.h"
 
 #include <iosfwd>
 #include <vector>
@@ -36,14 +35,10 @@ public:
 		bool reverse,
 		std::ostream & error_output);
 
-	bool Collide(
-		const Vec3 & origin,
-		const Vec3 & direction,
-		const float seglen,
-		int & patch_id,
-		Vec3 & outtri,
-		const Bezier * & colpatch,
-		Vec3 & normal) const;
+	/// binary IO of the preprocessed strip including racing line (native byte order)
+	bool ReadBinary(std::istream & in);
+
+	void WriteBinary(std::ostream & out) const;
 
 	const std::vector<RoadPatch> & GetPatches() const
 	{
@@ -62,10 +57,7 @@ public:
 
 private:
 	std::vector<RoadPatch> patches;
-	AabbTreeNode <unsigned> aabb_part;
 	bool closed;
-
-	void GenerateSpacePartitioning();
 };
 
 #endif // _ROADSTRIP_H
@@ -107,7 +107,9 @@ Settings::Settings() :
 	particles(512),
 	sky_dynamic(false),
 	sky_time(17),
-	sky_time_speed(1)
+	sky_time_speed(1),
+	content_budget(0),
+	pipelined(false)
 {
 	resolution[0] = 800;
 	resolution[1] = 600;
@@ -137,6 +139,8 @@ void Settings::Serialize(bool write, Config & config)
 	Param(config, write, section, "traction_control", tcs);
 	Param(config, write, section, "record", recordreplay);
 	Param(config, write, section, "selected_replay", selected_replay);
+	Param(config, write, section, "content_budget", content_budget);
+	Param(config, write, section, "pipelined", pipelined);
 	Param(config, write, section, "car", car);
 	Param(config, write, section, "car_paint", car_paint);
 	Param(config, write, section, "car_tire", car_tire);
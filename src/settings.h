@@ -377,6 +377,18 @@ public:
 		return vehicle_damage;
 	}
 
+	/// unreferenced content is kept cached up to this size in MB
+	int GetContentBudget() const
+	{
+		return content_budget;
+	}
+
+	/// simulate the next frame on a simulation thread while drawing
+	bool GetPipelined() const
+	{
+		return pipelined;
+	}
+
 	void SetResolution(unsigned w, unsigned h)
 	{
 		resolution[0] = w;
@@ -469,6 +481,8 @@ private:
 	bool sky_dynamic;
 	int sky_time;
 	int sky_time_speed;
+	int content_budget;
+	bool pipelined;
 };
 
 #endif
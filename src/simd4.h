@@ -0,0 +1,240 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef _SIMD4_H
+#define _SIMD4_H
+
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VDRIFT_SSE
+#include <emmintrin.h>
+#endif
+
+/// Four wide float vector. Maps to SSE2 when available, otherwise to a
+/// plain array evaluated lane by lane with the standard math functions.
+/// The SSE transcendentals are cephes polynomial approximations with a
+/// maximum error of a few ulp over the argument range used in the physics.
+#ifdef VDRIFT_SSE
+
+struct Simd4f
+{
+	__m128 v;
+
+	Simd4f() {}
+	Simd4f(__m128 v) : v(v) {}
+	Simd4f(float f) : v(_mm_set1_ps(f)) {}
+	Simd4f(float x, float y, float z, float w) : v(_mm_setr_ps(x, y, z, w)) {}
+
+	static Simd4f Load(const float * p) {return _mm_loadu_ps(p);}
+	void Store(float * p) const {_mm_storeu_ps(p, v);}
+};
+
+inline Simd4f operator+(const Simd4f & a, const Simd4f & b) {return _mm_add_ps(a.v, b.v);}
+inline Simd4f operator-(const Simd4f & a, const Simd4f & b) {return _mm_sub_ps(a.v, b.v);}
+inline Simd4f operator*(const Simd4f & a, const Simd4f & b) {return _mm_mul_ps(a.v, b.v);}
+inline Simd4f operator/(const Simd4f & a, const Simd4f & b) {return _mm_div_ps(a.v, b.v);}
+inline Simd4f operator-(const Simd4f & a) {return _mm_xor_ps(a.v, _mm_set1_ps(-0.0f));}
+inline Simd4f Min(const Simd4f & a, const Simd4f & b) {return _mm_min_ps(a.v, b.v);}
+inline Simd4f Max(const Simd4f & a, const Simd4f & b) {return _mm_max_ps(a.v, b.v);}
+inline Simd4f Abs(const Simd4f & a) {return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v);}
+
+/// comparison masks, lanes are all bits set if true, zero otherwise
+inline Simd4f CmpLt(const Simd4f & a, const Simd4f & b) {return _mm_cmplt_ps(a.v, b.v);}
+inline Simd4f CmpLe(const Simd4f & a, const Simd4f & b) {return _mm_cmple_ps(a.v, b.v);}
+inline Simd4f Or(const Simd4f & a, const Simd4f & b) {return _mm_or_ps(a.v, b.v);}
+
+/// bit i is set if mask lane i is true
+inline int MoveMask(const Simd4f & a) {return _mm_movemask_ps(a.v);}
+
+/// -1, 0 or 1
+inline Simd4f Sgn(const Simd4f & a)
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	__m128 pos = _mm_and_ps(_mm_cmpgt_ps(a.v, zero), one);
+	__m128 neg = _mm_and_ps(_mm_cmplt_ps(a.v, zero), one);
+	return _mm_sub_ps(pos, neg);
+}
+
+inline Simd4f Atan(const Simd4f & a)
+{
+	const __m128 sign_mask = _mm_set1_ps(-0.0f);
+	const __m128 one = _mm_set1_ps(1.0f);
+	__m128 sign = _mm_and_ps(a.v, sign_mask);
+	__m128 x = _mm_andnot_ps(sign_mask, a.v);
+
+	// range reduction, x > tan(3pi/8) and x > tan(pi/8)
+	__m128 m1 = _mm_cmpgt_ps(x, _mm_set1_ps(2.414213562373095f));
+	__m128 m2 = _mm_andnot_ps(m1, _mm_cmpgt_ps(x, _mm_set1_ps(0.4142135623730950f)));
+	__m128 x1 = _mm_div_ps(_mm_xor_ps(one, sign_mask), x);
+	__m128 x2 = _mm_div_ps(_mm_sub_ps(x, one), _mm_add_ps(x, one));
+	x = _mm_or_ps(_mm_andnot_ps(_mm_or_ps(m1, m2), x), _mm_or_ps(_mm_and_ps(m1, x1), _mm_and_ps(m2, x2)));
+	__m128 y = _mm_or_ps(
+		_mm_and_ps(m1, _mm_set1_ps(1.5707963267948966f)),
+		_mm_and_ps(m2, _mm_set1_ps(0.7853981633974483f)));
+
+	__m128 z = _mm_mul_ps(x, x);
+	__m128 p = _mm_set1_ps(8.05374449538e-2f);
+	p = _mm_sub_ps(_mm_mul_ps(p, z), _mm_set1_ps(1.38776856032e-1f));
+	p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(1.99777106478e-1f));
+	p = _mm_sub_ps(_mm_mul_ps(p, z), _mm_set1_ps(3.33329491539e-1f));
+	p = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(p, z), x), x);
+	y = _mm_add_ps(y, p);
+
+	return _mm_xor_ps(y, sign);
+}
+
+/// shared sin/cos evaluation, x is the absolute argument, j the even octant,
+/// poly selects the sin or cos polynomial
+inline __m128 SinCosPoly(__m128 x, __m128i j, __m128i poly, __m128 sign)
+{
+	// extended precision modular arithmetic, x - j * pi/4
+	__m128 y = _mm_cvtepi32_ps(j);
+	x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(0.78515625f)));
+	x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(2.4187564849853515625e-4f)));
+	x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(3.77489497744594108e-8f)));
+	__m128 z = _mm_mul_ps(x, x);
+
+	// cos polynomial for octants 1, 2, 5, 6
+	__m128 c = _mm_set1_ps(2.443315711809948e-5f);
+	c = _mm_sub_ps(_mm_mul_ps(c, z), _mm_set1_ps(1.388731625493765e-3f));
+	c = _mm_add_ps(_mm_mul_ps(c, z), _mm_set1_ps(4.166664568298827e-2f));
+	c = _mm_mul_ps(_mm_mul_ps(c, z), z);
+	c = _mm_sub_ps(c, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+	c = _mm_add_ps(c, _mm_set1_ps(1.0f));
+
+	// sin polynomial for octants 0, 3, 4, 7
+	__m128 s = _mm_set1_ps(-1.9515295891e-4f);
+	s = _mm_add_ps(_mm_mul_ps(s, z), _mm_set1_ps(8.3321608736e-3f));
+	s = _mm_sub_ps(_mm_mul_ps(s, z), _mm_set1_ps(1.6666654611e-1f));
+	s = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(s, z), x), x);
+
+	__m128 poly_mask = _mm_castsi128_ps(_mm_cmpeq_epi32(
+		_mm_and_si128(poly, _mm_set1_epi32(2)), _mm_setzero_si128()));
+	y = _mm_or_ps(_mm_and_ps(poly_mask, s), _mm_andnot_ps(poly_mask, c));
+	return _mm_xor_ps(y, sign);
+}
+
+inline Simd4f Sin(const Simd4f & a)
+{
+	const __m128 sign_mask = _mm_set1_ps(-0.0f);
+	__m128 sign = _mm_and_ps(a.v, sign_mask);
+	__m128 x = _mm_andnot_ps(sign_mask, a.v);
+
+	// octant j, rounded up to even
+	__m128i j = _mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(1.27323954473516f)));
+	j = _mm_and_si128(_mm_add_epi32(j, _mm_set1_epi32(1)), _mm_set1_epi32(~1));
+
+	// swap sign for octants 4 to 7
+	__m128i swap = _mm_slli_epi32(_mm_and_si128(j, _mm_set1_epi32(4)), 29);
+	sign = _mm_xor_ps(sign, _mm_castsi128_ps(swap));
+
+	return SinCosPoly(x, j, j, sign);
+}
+
+inline Simd4f Cos(const Simd4f & a)
+{
+	__m128 x = _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v);
+
+	// octant j, rounded up to even
+	__m128i j = _mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(1.27323954473516f)));
+	j = _mm_and_si128(_mm_add_epi32(j, _mm_set1_epi32(1)), _mm_set1_epi32(~1));
+
+	// cos(x) = sin(x + pi/2), shift by two octants
+	__m128i k = _mm_sub_epi32(j, _mm_set1_epi32(2));
+	__m128i swap = _mm_slli_epi32(_mm_andnot_si128(k, _mm_set1_epi32(4)), 29);
+	__m128 sign = _mm_castsi128_ps(swap);
+
+	return SinCosPoly(x, j, k, sign);
+}
+
+#else // VDRIFT_SSE
+
+struct Simd4f
+{
+	float v[4];
+
+	Simd4f() {}
+	Simd4f(float f) {v[0] = v[1] = v[2] = v[3] = f;}
+	Simd4f(float x, float y, float z, float w) {v[0] = x; v[1] = y; v[2] = z; v[3] = w;}
+
+	static Simd4f Load(const float * p) {return Simd4f(p[0], p[1], p[2], p[3]);}
+	void Store(float * p) const {p[0] = v[0]; p[1] = v[1]; p[2] = v[2]; p[3] = v[3];}
+};
+
+#define SIMD4F_BINARY(name, expr) \
+inline Simd4f name(const Simd4f & a, const Simd4f & b) \
+{ \
+	Simd4f r; \
+	for (int i = 0; i < 4; ++i) { const float x = a.v[i]; const float y = b.v[i]; r.v[i] = expr; } \
+	return r; \
+}
+#define SIMD4F_UNARY(name, expr) \
+inline Simd4f name(const Simd4f & a) \
+{ \
+	Simd4f r; \
+	for (int i = 0; i < 4; ++i) { const float x = a.v[i]; r.v[i] = expr; } \
+	return r; \
+}
+SIMD4F_BINARY(operator+, x + y)
+SIMD4F_BINARY(operator-, x - y)
+SIMD4F_BINARY(operator*, x * y)
+SIMD4F_BINARY(operator/, x / y)
+SIMD4F_BINARY(Min, y < x ? y : x)
+SIMD4F_BINARY(Max, y > x ? y : x)
+SIMD4F_BINARY(CmpLt, x < y ? 1.0f : 0.0f)
+SIMD4F_BINARY(CmpLe, x <= y ? 1.0f : 0.0f)
+SIMD4F_BINARY(Or, (x != 0 || y != 0) ? 1.0f : 0.0f)
+SIMD4F_UNARY(operator-, -x)
+SIMD4F_UNARY(Abs, std::fabs(x))
+SIMD4F_UNARY(Sgn, float((0 < x) - (x < 0)))
+SIMD4F_UNARY(Atan, std::atan(x))
+SIMD4F_UNARY(Sin, std::sin(x))
+SIMD4F_UNARY(Cos, std::cos(x))
+#undef SIMD4F_BINARY
+#undef SIMD4F_UNARY
+
+/// masks are one if true, zero otherwise
+inline int MoveMask(const Simd4f & a)
+{
+	return (a.v[0] != 0) | (a.v[1] != 0) << 1 | (a.v[2] != 0) << 2 | (a.v[3] != 0) << 3;
+}
+
+#endif // VDRIFT_SSE
+
+inline Simd4f & operator+=(Simd4f & a, const Simd4f & b) {return a = a + b;}
+inline Simd4f & operator-=(Simd4f & a, const Simd4f & b) {return a = a - b;}
+inline Simd4f & operator*=(Simd4f & a, const Simd4f & b) {return a = a * b;}
+inline Simd4f & operator/=(Simd4f & a, const Simd4f & b) {return a = a / b;}
+
+inline Simd4f Clamp(const Simd4f & a, const Simd4f & lo, const Simd4f & hi)
+{
+	return Min(Max(a, lo), hi);
+}
+
+/// evaluated lane by lane, there is no vector implementation yet
+inline Simd4f Exp(const Simd4f & a)
+{
+	float v[4];
+	a.Store(v);
+	return Simd4f(std::exp(v[0]), std::exp(v[1]), std::exp(v[2]), std::exp(v[3]));
+}
+
+#endif // _SIMD4_H
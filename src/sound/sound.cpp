@@ -19,9 +19,13 @@
 
 #include "sound.h"
 #include "coordinatesystem.h"
+#include "jobsystem.h"
+#include "simd4.h"
 #include <SDL2/SDL.h>
 #include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstdlib>
 
 //static std::ofstream logso("logso.txt");
 //static std::ofstream logsa("logsa.txt");
@@ -438,11 +442,35 @@ void Sound::ProcessSources()
 {
 	std::vector<SamplerSet> & supdate = samplers_update.getFirst().sset;
 	supdate.resize(sources_num);
+	sources_gain.resize(sources_num);
+
+	// sources are independent, calculate gains in parallel
+	JobSystem::instance().Run(ProcessSourcesJob, this, 0, sources_num, 64);
 
 	sources_active.clear();
 	for (size_t i = 0; i < sources_num; ++i)
 	{
-		Source & src = sources[i];
+		if (sources_gain[i] > 0)
+		{
+			SourceActive sa;
+			sa.gain = sources_gain[i];
+			sa.id = i;
+			sources_active.push_back(sa);
+		}
+	}
+
+	LimitActiveSources();
+}
+
+void Sound::ProcessSourcesJob(void * sound, int begin, int end)
+{
+	Sound & snd = *static_cast<Sound*>(sound);
+	std::vector<SamplerSet> & supdate = snd.samplers_update.getFirst().sset;
+	for (int i = begin; i < end; ++i)
+	{
+		snd.sources_gain[i] = 0;
+
+		Source & src = snd.sources[i];
 		if (!src.playing) continue;
 
 		float gain1 = 0.0, gain2 = 0.0;
@@ -450,19 +478,20 @@ void Sound::ProcessSources()
 		{
 			if (src.is3d)
 			{
-				Vec3 relvec = src.position - listener_pos;
+				Vec3 relvec = src.position - snd.listener_pos;
 				float len = relvec.Magnitude();
 				if (len < 0.1f) len = 0.1f;
 
 				// distance attenuation
 				// y = a * (x - b)^c + d
+				const float * attenuation = snd.attenuation;
 				float cgain = attenuation[0] * powf(len - attenuation[1], attenuation[2]) + attenuation[3];
 				cgain = clamp(cgain, 0.0f, 1.0f);
 
 				// directional attenuation
 				// maximum at 0.75 (source on opposite side)
 				relvec = relvec * (1.0f / len);
-				(-listener_rot).RotateVector(relvec);
+				(-snd.listener_rot).RotateVector(relvec);
 				float xcoord = relvec.dot(Direction::Right) * 0.75f;
 				float pgain1 = xcoord;			// left attenuation
 				float pgain2 = -xcoord;			// right attenuation
@@ -477,25 +506,16 @@ void Sound::ProcessSources()
 				gain1 = gain2 = src.gain;
 			}
 
-			int maxgain = std::max(gain1, gain2) * Sampler::denom;
-			if (maxgain > 0)
-			{
-				SourceActive sa;
-				sa.gain = maxgain;
-				sa.id = i;
-				sources_active.push_back(sa);
-			}
+			snd.sources_gain[i] = std::max(gain1, gain2) * Sampler::denom;
 		}
 
 		// fade sound volume
-		float volume = set_pause ? 0 : sound_volume;
+		float volume = snd.set_pause ? 0 : snd.sound_volume;
 
 		supdate[i].gain1 = volume * gain1 * Sampler::denom;
 		supdate[i].gain2 = volume * gain2 * Sampler::denom;
 		supdate[i].pitch = src.pitch * Sampler::denom;
 	}
-
-	LimitActiveSources();
 }
 
 void Sound::LimitActiveSources()
@@ -571,13 +591,17 @@ void Sound::ProcessSamplers(unsigned char *stream, int len)
 	if (samplers_pause && !samplers_fade)
 		return;
 
-	// init sampling buffers
+	// init mixing bus, only allocates if the device buffer size changes
 	int len4 = len / 4;
+	if (len4 == 0)
+		return;
 	buffer1.resize(len4);
 	buffer2.resize(len4);
+	std::fill(buffer1.begin(), buffer1.end(), 0.0f);
+	std::fill(buffer2.begin(), buffer2.end(), 0.0f);
 
 	// run samplers
-	short * sstream = (short*)stream;
+	bool mixed = false;
 	for (size_t i = 0; i < samplers_num; ++i)
 	{
 		Sampler & smp = samplers[i];
@@ -587,29 +611,20 @@ void Sound::ProcessSamplers(unsigned char *stream, int len)
 
 		if (smp.gain1 | smp.gain2 | smp.last_gain1 | smp.last_gain2)
 		{
-			SampleAndAdvanceWithPitch16bit(smp, &buffer1[0], &buffer2[0], len4);
-
-			for (int n = 0; n < len4; ++n)
-			{
-				int pos = n * 2;
-				int val1 = sstream[pos] + buffer1[n];
-				int val2 = sstream[pos + 1] + buffer2[n];
-
-				val1 = clamp(val1, -32768, 32767);
-				val2 = clamp(val2, -32768, 32767);
-
-				sstream[pos] = val1;
-				sstream[pos + 1] = val2;
-			}
+			MixSampler(smp, &buffer1[0], &buffer2[0], len4);
+			mixed = true;
 		}
 		else
 		{
-			AdvanceWithPitch(smp, len);
+			AdvanceWithPitch(smp, len4);
 		}
 
 		if (!smp.playing)
 			sources_stop.getLast().push_back(smp.id);
 	}
+
+	if (mixed)
+		PackStereo16(&buffer1[0], &buffer2[0], (short*)stream, len4);
 }
 
 void Sound::ProcessSamplerRemove()
@@ -695,90 +710,171 @@ void Sound::CallbackWrapper(void *sound, unsigned char *stream, int len)
 	static_cast<Sound*>(sound)->Callback16bitStereo(sound, stream, len);
 }
 
-void Sound::SampleAndAdvanceWithPitch16bit(
-	Sampler & sampler, int * chan1, int * chan2, int len)
+void Sound::MixSampler(
+	Sampler & sampler, float * chan1, float * chan2, int len)
 {
 	assert(len > 0);
 	assert(sampler.buffer);
+	assert(sampler.playing);
+	assert(sampler.pitch >= 0);
 
-	// if not playing, fill output buffers with silence
-	if (!sampler.playing)
-	{
-		// should be dealt with before getting here
-		assert(0);
-		for (int i = 0; i < len; ++i)
-		{
-			chan1[i] = chan2[i] = 0;
-		}
-		return;
-	}
-
-	// start samlping
-	int chan = sampler.buffer->GetInfo().channels;
-	int samples = sampler.samples_per_channel * chan;
-	int chaninc = chan - 1;
+	const int chan = sampler.buffer->GetInfo().channels;
+	const int chaninc = chan - 1;
+	const int count = sampler.samples_per_channel;
+	const int pitch = sampler.pitch;
+	const int16_t * buf = (const int16_t *)sampler.buffer->GetRawBuffer();
 	int nr = sampler.sample_pos_remainder;
 	int ni = sampler.sample_pos;
-	const int16_t * buf = (const int16_t *)sampler.buffer->GetRawBuffer();
 
-	for (int i = 0; i < len; ++i)
+	// gains ramp linearly by max_gain_delta per frame towards the target,
+	// frame i gain: last + sgn(delta) * min((i + 1) * max_gain_delta, |delta|)
+	const int gain_delta1 = sampler.gain1 - sampler.last_gain1;
+	const int gain_delta2 = sampler.gain2 - sampler.last_gain2;
+	const Simd4f gain_last1(float(sampler.last_gain1));
+	const Simd4f gain_last2(float(sampler.last_gain2));
+	const Simd4f gain_range1(float(std::abs(gain_delta1)));
+	const Simd4f gain_range2(float(std::abs(gain_delta2)));
+	const Simd4f gain_sign1(gain_delta1 < 0 ? -1.0f : 1.0f);
+	const Simd4f gain_sign2(gain_delta2 < 0 ? -1.0f : 1.0f);
+	const Simd4f gain_step(float(Sampler::max_gain_delta));
+	const Simd4f scale(1.0f / Sampler::denom);
+
+	int i = 0;
+	while (i < len)
 	{
-		// limit gain change rate
-		int gain_delta1 = sampler.gain1 - sampler.last_gain1;
-		int gain_delta2 = sampler.gain2 - sampler.last_gain2;
-		gain_delta1 = clamp(gain_delta1, -sampler.max_gain_delta, sampler.max_gain_delta);
-		gain_delta2 = clamp(gain_delta2, -sampler.max_gain_delta, sampler.max_gain_delta);
-		sampler.last_gain1 += gain_delta1;
-		sampler.last_gain2 += gain_delta2;
-
-		if (ni >= sampler.samples_per_channel && !sampler.loop)
+		if (ni >= count)
 		{
 			// finish playing the buffer if looping is not enabled
-			chan1[i] = chan2[i] = 0;
-			sampler.playing = false;
+			if (!sampler.loop)
+			{
+				sampler.playing = false;
+				break;
+			}
+			ni = ni % count;
 		}
-		else
+
+		// frames whose right sample ni + 1 is inside the buffer,
+		// if there are none the next frame wraps around to the first sample
+		int frames = len - i;
+		bool wrap = false;
+		if (pitch > 0)
+		{
+			int64_t remaining = int64_t(count - 1 - ni) * Sampler::denom - nr;
+			if (remaining < int64_t(frames) * pitch)
+				frames = remaining > 0 ? int((remaining + pitch - 1) / pitch) : 0;
+		}
+		else if (ni == count - 1)
+		{
+			frames = 0;
+		}
+		if (frames == 0)
 		{
-			// the sample to the left of the playback position, channel 0 and 1
-			int id1 = (ni * chan) % samples;
-			int samp10 = buf[id1];
-			int samp11 = buf[id1 + chaninc];
-
-			// the sample to the right of the playback position, channel 0 and 1
-			int id2 = (id1 + chan) % samples;
-			int samp20 = buf[id2];
-			int samp21 = buf[id2 + chaninc];
-
-			// interpolated sample at playback position
-			int val1 = (nr * samp20 + (sampler.denom - nr) * samp10) / sampler.denom;
-			int val2 = (nr * samp21 + (sampler.denom - nr) * samp11) / sampler.denom;
-			val1 = (val1 * sampler.last_gain1) / sampler.denom;
-			val2 = (val2 * sampler.last_gain2) / sampler.denom;
-
-			// fill output buffers
-			chan1[i] = val1;
-			chan2[i] = val2;
-
-			// advance playback position
-			nr += sampler.pitch;
-			int ninc = nr / sampler.denom;
-			nr -= ninc * sampler.denom;
-			ni += ninc;
+			frames = 1;
+			wrap = true;
+		}
+
+		// sample blocks of four frames
+		const int end = i + frames;
+		while (i < end)
+		{
+			const int n = std::min(end - i, 4);
+			float s10[4] = {0}, s11[4] = {0}, s20[4] = {0}, s21[4] = {0}, frac[4] = {0};
+			for (int k = 0; k < n; ++k)
+			{
+				// the samples to the left and right of the playback position
+				const int id1 = ni * chan;
+				const int id2 = wrap ? 0 : id1 + chan;
+				s10[k] = buf[id1];
+				s11[k] = buf[id1 + chaninc];
+				s20[k] = buf[id2];
+				s21[k] = buf[id2 + chaninc];
+				frac[k] = nr;
+
+				// advance playback position
+				nr += pitch;
+				ni += nr >> Sampler::denom_bits;
+				nr &= Sampler::denom - 1;
+			}
+
+			// interpolated sample at playback position times ramped gain
+			const Simd4f f = Simd4f::Load(frac) * scale;
+			const Simd4f samp10 = Simd4f::Load(s10);
+			const Simd4f samp11 = Simd4f::Load(s11);
+			const Simd4f val1 = samp10 + (Simd4f::Load(s20) - samp10) * f;
+			const Simd4f val2 = samp11 + (Simd4f::Load(s21) - samp11) * f;
+			const Simd4f frame = Simd4f(float(i + 1), float(i + 2), float(i + 3), float(i + 4));
+			const Simd4f ramp = frame * gain_step;
+			const Simd4f gain1 = gain_last1 + gain_sign1 * Min(ramp, gain_range1);
+			const Simd4f gain2 = gain_last2 + gain_sign2 * Min(ramp, gain_range2);
+			const Simd4f out1 = val1 * gain1 * scale;
+			const Simd4f out2 = val2 * gain2 * scale;
+
+			// accumulate into the bus
+			if (n == 4)
+			{
+				(Simd4f::Load(chan1 + i) + out1).Store(chan1 + i);
+				(Simd4f::Load(chan2 + i) + out2).Store(chan2 + i);
+			}
+			else
+			{
+				float o1[4], o2[4];
+				out1.Store(o1);
+				out2.Store(o2);
+				for (int k = 0; k < n; ++k)
+				{
+					chan1[i + k] += o1[k];
+					chan2[i + k] += o2[k];
+				}
+			}
+			i += n;
 		}
 	}
 
+	// gains at the end of the block, frames after the end of a non looping
+	// buffer are silent but still advance the ramp
+	const int gain_ramp = len * Sampler::max_gain_delta;
+	sampler.last_gain1 += (gain_delta1 < 0 ? -1 : 1) * std::min(gain_ramp, std::abs(gain_delta1));
+	sampler.last_gain2 += (gain_delta2 < 0 ? -1 : 1) * std::min(gain_ramp, std::abs(gain_delta2));
+
 	sampler.sample_pos = ni;
 	sampler.sample_pos_remainder = nr;
 	if (!sampler.loop)
 	{
-		sampler.playing = (sampler.sample_pos < sampler.samples_per_channel);
+		sampler.playing = sampler.playing && (sampler.sample_pos < sampler.samples_per_channel);
 	}
-	else
+	else if (sampler.sample_pos >= sampler.samples_per_channel)
 	{
 		sampler.sample_pos = sampler.sample_pos % sampler.samples_per_channel;
 	}
 }
 
+void Sound::PackStereo16(
+	const float * chan1, const float * chan2, short * stream, int len)
+{
+	const Simd4f lo(-32768.0f);
+	const Simd4f hi(32767.0f);
+	int n = 0;
+#ifdef VDRIFT_SSE
+	// convert rounding to nearest even like lrintf, saturation is done by the clamp already
+	for (; n + 4 <= len; n += 4)
+	{
+		const Simd4f val1 = Clamp(Simd4f::Load(chan1 + n), lo, hi);
+		const Simd4f val2 = Clamp(Simd4f::Load(chan2 + n), lo, hi);
+		const __m128i i1 = _mm_cvtps_epi32(val1.v);
+		const __m128i i2 = _mm_cvtps_epi32(val2.v);
+		const __m128i s12 = _mm_packs_epi32(_mm_unpacklo_epi32(i1, i2), _mm_unpackhi_epi32(i1, i2));
+		_mm_storeu_si128((__m128i *)(stream + n * 2), s12);
+	}
+#endif
+	for (; n < len; ++n)
+	{
+		const float val1 = clamp(chan1[n], -32768.0f, 32767.0f);
+		const float val2 = clamp(chan2[n], -32768.0f, 32767.0f);
+		stream[n * 2] = short(lrintf(val1));
+		stream[n * 2 + 1] = short(lrintf(val2));
+	}
+}
+
 void Sound::AdvanceWithPitch(Sampler & sampler, int len)
 {
 	// advance playback position
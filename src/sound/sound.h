@@ -34,6 +34,7 @@ struct SDL_mutex;
 
 class Sound
 {
+friend class SoundTesting;
 public:
 	Sound();
 
@@ -119,7 +120,8 @@ private:
 
 	struct Sampler
 	{
-		static const int denom = 32768;
+		static const int denom_bits = 15;
+		static const int denom = 1 << denom_bits;
 		static const int max_gain_delta = (denom * 173) / 44100; // 256 samples from min to max gain
 		const SoundBuffer * buffer;
 		int samples_per_channel;
@@ -166,6 +168,7 @@ private:
 
 	// sound sources state
 	std::vector<SourceActive> sources_active;
+	std::vector<int> sources_gain;
 	std::vector<size_t> sources_remove;
 	std::vector<Source> sources;
 	size_t max_active_sources;
@@ -174,7 +177,7 @@ private:
 	bool sources_pause;
 
 	// sound thread state
-	std::vector<int> buffer1, buffer2;
+	std::vector<float> buffer1, buffer2; // 32 bit mixing bus per channel
 	std::vector<Sampler> samplers;
 	size_t samplers_num;
 	bool samplers_pause;
@@ -189,6 +192,8 @@ private:
 
 	void ProcessSources();
 
+	static void ProcessSourcesJob(void * sound, int begin, int end);
+
 	void LimitActiveSources();
 
 	void SetSamplerChanges();
@@ -210,8 +215,13 @@ private:
 
 	static void CallbackWrapper(void *sound, unsigned char *stream, int len);
 
-	static void SampleAndAdvanceWithPitch16bit(
-		Sampler & sampler, int * chan1, int * chan2, int len);
+	// add sampler output to the mixing bus, len is the number of frames
+	static void MixSampler(
+		Sampler & sampler, float * chan1, float * chan2, int len);
+
+	// saturate and interleave the mixing bus into a 16 bit stereo stream
+	static void PackStereo16(
+		const float * chan1, const float * chan2, short * stream, int len);
 
 	static void AdvanceWithPitch(Sampler & sampler, int len);
 };
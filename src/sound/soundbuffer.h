@@ -27,6 +27,7 @@
 
 class SoundBuffer
 {
+friend class SoundTesting;
 public:
 	SoundBuffer();
 
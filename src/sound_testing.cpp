@@ -0,0 +1,279 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+
+#include "sound_testing.h"
+#include "sound/sound.h"
+#include "quickprof.h"
+#include "unittest.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+#include <iostream>
+
+static const int frequency = 44100;
+
+SoundTesting::SoundTesting(int samplers, int frames, int repeat) :
+	samplers(samplers),
+	frames(frames),
+	repeat(repeat)
+{
+	// ctor
+}
+
+void SoundTesting::Test(std::ostream & info_output)
+{
+	info_output << "Beginning sound mixer test" << std::endl;
+
+	// odd buffer lengths, wrap positions differ from the callback blocks
+	SoundBuffer buffers[2];
+	GenerateTone(buffers[0], 1, frequency / 3 + 1);
+	GenerateTone(buffers[1], 2, frequency / 2 + 7);
+
+	// looping samplers with pitch 0.5 to 2 and ramping gains, quiet
+	// enough to not saturate, saturation order differs from the reference
+	typedef Sound::Sampler Sampler;
+	Sound sound;
+	sound.samplers_pause = false;
+	sound.samplers_fade = false;
+	for (int i = 0; i < samplers; ++i)
+	{
+		Sampler smp;
+		smp.buffer = &buffers[i % 2];
+		smp.samples_per_channel = smp.buffer->GetInfo().samples / smp.buffer->GetInfo().channels;
+		smp.sample_pos = (i * 7919) % smp.samples_per_channel;
+		smp.sample_pos_remainder = 0;
+		smp.pitch = Sampler::denom / 2 + (i * 1031) % (Sampler::denom * 3 / 2);
+		smp.gain1 = (i * 433) % (Sampler::denom / 64);
+		smp.gain2 = (i * 211) % (Sampler::denom / 64);
+		smp.last_gain1 = 0;
+		smp.last_gain2 = 0;
+		smp.playing = true;
+		smp.loop = true;
+		smp.id = i;
+		sound.samplers.push_back(smp);
+	}
+	sound.samplers_num = samplers;
+
+	Sound reference;
+	reference.samplers = sound.samplers;
+	reference.samplers_num = sound.samplers_num;
+
+	// compare a few seconds of output
+	const int len = frames * 4;
+	std::vector<unsigned char> stream(len), reference_stream(len);
+	int max_error = 0;
+	for (int r = 0; r < 4 * frequency / frames; ++r)
+	{
+		sound.ProcessSamplers(&stream[0], len);
+		MixReference(reference, (short *)&reference_stream[0], frames);
+
+		const short * s = (const short *)&stream[0];
+		const short * rs = (const short *)&reference_stream[0];
+		for (int n = 0; n < frames * 2; ++n)
+		{
+			max_error = std::max(max_error, std::abs(s[n] - rs[n]));
+		}
+	}
+
+	quickprof::Clock clock;
+	unsigned long long start = clock.getTimeMicroseconds();
+	for (int r = 0; r < repeat; ++r)
+	{
+		sound.ProcessSamplers(&stream[0], len);
+	}
+	const unsigned long long mix_time = clock.getTimeMicroseconds() - start;
+
+	start = clock.getTimeMicroseconds();
+	for (int r = 0; r < repeat; ++r)
+	{
+		MixReference(reference, (short *)&reference_stream[0], frames);
+	}
+	const unsigned long long reference_time = clock.getTimeMicroseconds() - start;
+
+	const float callback_time = 1E6f * frames / frequency;
+	info_output << samplers << " samplers, " << frames << " frames per callback (" << callback_time << " us)" << std::endl;
+	info_output << "Mixer: " << float(mix_time) / repeat << " us per callback, reference: " << float(reference_time) / repeat << " us";
+	if (mix_time > 0)
+		info_output << ", speedup: " << float(reference_time) / mix_time;
+	info_output << std::endl;
+	info_output << "Maximum deviation from the reference: " << max_error << std::endl;
+	info_output << "Sound mixer test complete." << std::endl;
+}
+
+void SoundTesting::GenerateTone(SoundBuffer & buffer, int channels, int samples)
+{
+	buffer.Unload();
+	buffer.info = SoundInfo(samples * channels, frequency, channels, 2);
+	buffer.size = samples * channels * 2;
+	buffer.sound_buffer = new char[buffer.size];
+	buffer.loaded = true;
+
+	short * data = (short *)buffer.sound_buffer;
+	for (int i = 0; i < samples; ++i)
+	{
+		const float phase = 2 * M_PI * 440 * i / frequency;
+		for (int c = 0; c < channels; ++c)
+		{
+			data[i * channels + c] = short(16000 * std::sin(phase + c));
+		}
+	}
+}
+
+void SoundTesting::MixReference(Sound & sound, short * stream, int len)
+{
+	typedef Sound::Sampler Sampler;
+	const int max_gain_delta = Sampler::max_gain_delta;
+	std::fill(stream, stream + len * 2, 0);
+	for (size_t s = 0; s < sound.samplers_num; ++s)
+	{
+		Sampler & sampler = sound.samplers[s];
+		const int chan = sampler.buffer->GetInfo().channels;
+		const int samples = sampler.samples_per_channel * chan;
+		const int chaninc = chan - 1;
+		const short * buf = (const short *)sampler.buffer->GetRawBuffer();
+		int nr = sampler.sample_pos_remainder;
+		int ni = sampler.sample_pos;
+		if (!sampler.playing)
+			continue;
+
+		for (int i = 0; i < len; ++i)
+		{
+			// stop at the end of a non looping buffer
+			if (!sampler.loop && ni >= sampler.samples_per_channel)
+			{
+				sampler.playing = false;
+				break;
+			}
+
+			int gain_delta1 = sampler.gain1 - sampler.last_gain1;
+			int gain_delta2 = sampler.gain2 - sampler.last_gain2;
+			gain_delta1 = std::max(-max_gain_delta, std::min(gain_delta1, max_gain_delta));
+			gain_delta2 = std::max(-max_gain_delta, std::min(gain_delta2, max_gain_delta));
+			sampler.last_gain1 += gain_delta1;
+			sampler.last_gain2 += gain_delta2;
+
+			const int id1 = (ni * chan) % samples;
+			const int id2 = (id1 + chan) % samples;
+			int val1 = (nr * buf[id2] + (Sampler::denom - nr) * buf[id1]) / Sampler::denom;
+			int val2 = (nr * buf[id2 + chaninc] + (Sampler::denom - nr) * buf[id1 + chaninc]) / Sampler::denom;
+			val1 = (val1 * sampler.last_gain1) / Sampler::denom;
+			val2 = (val2 * sampler.last_gain2) / Sampler::denom;
+
+			val1 += stream[i * 2];
+			val2 += stream[i * 2 + 1];
+			stream[i * 2] = std::max(-32768, std::min(val1, 32767));
+			stream[i * 2 + 1] = std::max(-32768, std::min(val2, 32767));
+
+			nr += sampler.pitch;
+			const int ninc = nr / Sampler::denom;
+			nr -= ninc * Sampler::denom;
+			ni += ninc;
+		}
+		sampler.sample_pos = sampler.loop ? ni % sampler.samples_per_channel : ni;
+		sampler.sample_pos_remainder = nr;
+	}
+}
+
+int SoundTesting::Compare(const Setup & setup, int frames, int callbacks, bool & playing)
+{
+	SoundBuffer buffer;
+	GenerateTone(buffer, setup.channels, setup.samples);
+
+	typedef Sound::Sampler Sampler;
+	Sampler smp;
+	smp.buffer = &buffer;
+	smp.samples_per_channel = setup.samples;
+	smp.sample_pos = setup.position;
+	smp.sample_pos_remainder = 0;
+	smp.pitch = setup.pitch;
+	smp.gain1 = setup.gain;
+	smp.gain2 = setup.gain;
+	smp.last_gain1 = 0;
+	smp.last_gain2 = 0;
+	smp.playing = true;
+	smp.loop = setup.loop;
+
+	Sound sound, reference;
+	sound.samplers_pause = false;
+	sound.samplers_fade = false;
+	for (int i = 0; i < setup.samplers; ++i)
+	{
+		smp.id = i;
+		sound.samplers.push_back(smp);
+	}
+	sound.samplers_num = setup.samplers;
+	reference.samplers = sound.samplers;
+	reference.samplers_num = sound.samplers_num;
+
+	const int len = frames * 4;
+	std::vector<unsigned char> stream(len), reference_stream(len);
+	int max_error = 0;
+	for (int r = 0; r < callbacks; ++r)
+	{
+		sound.ProcessSamplers(&stream[0], len);
+		MixReference(reference, (short *)&reference_stream[0], frames);
+
+		const short * s = (const short *)&stream[0];
+		const short * rs = (const short *)&reference_stream[0];
+		for (int n = 0; n < frames * 2; ++n)
+		{
+			max_error = std::max(max_error, std::abs(s[n] - rs[n]));
+		}
+	}
+
+	playing = sound.samplers[0].playing;
+	if (playing != reference.samplers[0].playing)
+		max_error = 65536;
+	return max_error;
+}
+
+QT_TEST(sound_mixer_test)
+{
+	typedef SoundTesting::Setup Setup;
+	const int denom = 1 << 15;
+	// the reference truncates the interpolation and the gain of each sampler
+	const int tolerance = 2;
+	bool playing;
+
+	// end of a non looping buffer
+	const Setup end = {1, 1000, 900, denom * 3 / 2, denom, false, 1};
+	QT_CHECK_LESS_OR_EQUAL(SoundTesting::Compare(end, 64, 4, playing), tolerance);
+	QT_CHECK(!playing);
+
+	// pitch 0 holds the sample
+	const Setup hold = {2, 1000, 500, 0, denom / 2, true, 1};
+	QT_CHECK_LESS_OR_EQUAL(SoundTesting::Compare(hold, 64, 4, playing), tolerance);
+	QT_CHECK(playing);
+
+	// pitch above 2 wraps a looping buffer several times per callback
+	const Setup fast = {2, 101, 0, denom * 5 / 2 + 123, denom / 2, true, 2};
+	QT_CHECK_LESS_OR_EQUAL(SoundTesting::Compare(fast, 64, 8, playing), tolerance * fast.samplers);
+	QT_CHECK(playing);
+
+	// samplers in phase saturate the same way in both mixers
+	const Setup loud = {1, 1003, 17, denom - 77, denom, true, 3};
+	QT_CHECK_LESS_OR_EQUAL(SoundTesting::Compare(loud, 64, 8, playing), tolerance * loud.samplers);
+
+	// gains ramp over 4 callbacks
+	const Setup ramp = {2, 5000, 0, denom, denom, true, 1};
+	QT_CHECK_LESS_OR_EQUAL(SoundTesting::Compare(ramp, 64, 8, playing), tolerance);
+}
@@ -0,0 +1,68 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+
+#ifndef _SOUND_TESTING_H
+#define _SOUND_TESTING_H
+
+#include <iosfwd>
+
+class Sound;
+class SoundBuffer;
+
+/// Micro benchmark of the sound mixer, mixes looping samplers of generated
+/// tones into a stream like the audio callback, without an audio device.
+class SoundTesting
+{
+public:
+	/// default is 20 cars with 8 sources each and a small device buffer
+	SoundTesting(int samplers = 160, int frames = 256, int repeat = 1000);
+
+	void Test(std::ostream & info_output);
+
+	/// identical samplers of a generated tone, gains ramp up from zero
+	struct Setup
+	{
+		int channels; ///< tone channels
+		int samples; ///< tone frames
+		int position; ///< start frame
+		int pitch; ///< playback rate in Sampler::denom units
+		int gain; ///< target gain in Sampler::denom units
+		bool loop;
+		int samplers; ///< number of samplers mixed
+	};
+
+	/// mix setup with the mixer and the reference for callbacks of frames,
+	/// returns the maximum deviation, playing is false if the samplers stopped
+	static int Compare(const Setup & setup, int frames, int callbacks, bool & playing);
+
+private:
+	int samplers; ///< number of mixed samplers
+	int frames; ///< stereo frames per callback
+	int repeat; ///< number of mixed callbacks
+
+	/// sine tone of samples frames
+	static void GenerateTone(SoundBuffer & buffer, int channels, int samples);
+
+	/// per sample integer mixer with per sampler clamping, reference output
+	/// saturation order differs from the mixer if samplers differ in sign
+	static void MixReference(Sound & sound, short * stream, int len);
+};
+
+#endif
@@ -22,13 +22,17 @@
 #include "physics/dynamicsworld.h"
 #include "coordinatesystem.h"
 #include "tobullet.h"
+#include "physics/collision_contact.h"
 
 #include "BulletCollision/CollisionShapes/btCollisionShape.h"
 #include "BulletCollision/CollisionShapes/btStridingMeshInterface.h"
+#include "LinearMath/btAlignedAllocator.h"
+
+#include <cmath>
 
 Track::Track() : racingline_visible(false)
 {
-	// Constructor.
+	// ctor
 }
 
 Track::~Track()
@@ -45,6 +49,7 @@ bool Track::DeferredLoad(
 	const std::string & trackdir,
 	const std::string & texturedir,
 	const std::string & sharedobjectpath,
+	const std::string & cachefile,
 	const int anisotropy,
 	const bool reverse,
 	const bool dynamicobjects,
@@ -61,7 +66,7 @@ bool Track::DeferredLoad(
 			info_output, error_output,
 			trackpath, trackdir,
 			texturedir,	sharedobjectpath,
-			anisotropy, reverse,
+			cachefile, anisotropy, reverse,
 			dynamicobjects,
 			dynamicshadows));
 
@@ -112,6 +117,12 @@ void Track::Clear()
 	}
 	data.meshes.clear();
 
+	for (int i = 0, n = data.bvhs.size(); i < n; ++i)
+	{
+		btAlignedFree(data.bvhs[i]);
+	}
+	data.bvhs.clear();
+
 	data.static_node.Clear();
 	data.surfaces.clear();
 	data.models.clear();
@@ -120,11 +131,64 @@ void Track::Clear()
 	data.body_transforms.clear();
 	data.lap.clear();
 	data.roads.clear();
+	data.patches.clear();
+	data.patch_bvh.Clear();
 	data.start_positions.clear();
 	data.racingline_node.Clear();
 	data.loaded = false;
 }
 
+struct Track::RayHit
+{
+	const Track & track;
+	const Vec3 & origin;
+	const Vec3 & direction;
+	float seglen;
+	int skip[3]; ///< patches that have been tested already
+	int patch_id;
+	Vec3 pos;
+	Vec3 normal;
+	const Bezier * patch;
+	float dist2;
+
+	RayHit(const Track & track, const Vec3 & origin, const Vec3 & direction, float seglen) :
+		track(track), origin(origin), direction(direction), seglen(seglen),
+		patch_id(-1), patch(0), dist2(0)
+	{
+		skip[0] = skip[1] = skip[2] = -1;
+	}
+
+	bool Hit() const
+	{
+		return patch_id >= 0;
+	}
+
+	void Test(int id)
+	{
+		Vec3 p, n;
+		const Bezier * b = 0;
+		if (!track.CastRayPatch(id, origin, direction, seglen, p, b, n))
+			return;
+
+		const float d2 = (p - origin).MagnitudeSquared();
+		if (!Hit() || d2 < dist2)
+		{
+			patch_id = id;
+			pos = p;
+			normal = n;
+			patch = b;
+			dist2 = d2;
+		}
+	}
+
+	/// called by the patch index query for each candidate
+	void push_back(unsigned id)
+	{
+		if (int(id) != skip[0] && int(id) != skip[1] && int(id) != skip[2])
+			Test(id);
+	}
+};
+
 bool Track::CastRay(
 	const Vec3 & origin,
 	const Vec3 & direction,
@@ -132,25 +196,75 @@ bool Track::CastRay(
 	int & patch_id,
 	Vec3 & outtri,
 	const Bezier * & colpatch,
-	Vec3 & normal) const
+	Vec3 & normal,
+	PatchRayStats * stats) const
 {
-	bool col = false;
-	for (std::list <RoadStrip>::const_iterator i = data.roads.begin(); i != data.roads.end(); ++i)
+	RayHit hit(*this, origin, direction, seglen);
+
+	// wheels tend to stay on the same patch or move on to a neighbour
+	if (patch_id >= 0 && patch_id < (int)data.patches.size())
 	{
-		Vec3 coltri, colnorm;
-		const Bezier * colbez = NULL;
-		if (i->Collide(origin, direction, seglen, patch_id, coltri, colbez, colnorm))
+		const Data::PatchRef & ref = data.patches[patch_id];
+		hit.skip[0] = patch_id;
+		hit.skip[1] = ref.next;
+		hit.skip[2] = ref.prev;
+		for (int i = 0; i < 3; ++i)
 		{
-			if (!col || (coltri - origin).MagnitudeSquared() < (outtri - origin).MagnitudeSquared())
-			{
-				outtri = coltri;
-				normal = colnorm;
-				colpatch = colbez;
-			}
-			col = true;
+			if (hit.skip[i] >= 0)
+				hit.Test(hit.skip[i]);
 		}
 	}
-	return col;
+
+	if (stats)
+	{
+		stats->rays++;
+		stats->coherent_hits += hit.Hit();
+	}
+
+	// only patches closer than a hint patch hit can change the result
+	float len = seglen;
+	if (hit.Hit())
+		len = std::sqrt(hit.dist2) * 1.001f + 1E-3f;
+
+	data.patch_bvh.Query(Aabb<float>::Ray(origin, direction, len), hit);
+	if (!hit.Hit())
+		return false;
+
+	patch_id = hit.patch_id;
+	outtri = hit.pos;
+	normal = hit.normal;
+	colpatch = hit.patch;
+	return true;
+}
+
+bool Track::CastRayPatch(
+	int id,
+	const Vec3 & origin,
+	const Vec3 & direction,
+	const float seglen,
+	Vec3 & outtri,
+	const Bezier * & colpatch,
+	Vec3 & normal) const
+{
+	const RoadPatch & patch = *data.patches[id].patch;
+	if (!patch.Collide(origin, direction, seglen, outtri, normal))
+		return false;
+
+	colpatch = &patch.GetPatch();
+	return true;
+}
+
+void Track::debugPrint(std::ostream & out, const PatchRayStats * stats) const
+{
+	out << "Road patches: " << data.patches.size() << "\n";
+	if (stats)
+	{
+		out << "Road patch rays: " << stats->rays;
+		if (stats->rays > 0)
+			out << ", " << int(100.0f * stats->coherent_hits / stats->rays) << "% hit the previous patch";
+		out << "\n";
+	}
+	out << std::flush;
 }
 
 void Track::Update()
@@ -166,6 +280,31 @@ void Track::Update()
 	}
 }
 
+void Track::Update(const Vec3 positions[], const Quat rotations[])
+{
+	if (!data.loaded) return;
+
+	for (int i = 0, e = data.body_nodes.size(); i < e; ++i)
+	{
+		Transform & vt = data.dynamic_node.GetNode(data.body_nodes[i]).GetTransform();
+		vt.SetRotation(rotations[i]);
+		vt.SetTranslation(positions[i]);
+	}
+}
+
+void Track::GetBodyTransforms(std::vector<Vec3> & positions, std::vector<Quat> & rotations) const
+{
+	positions.clear();
+	rotations.clear();
+	if (!data.loaded) return;
+
+	for (std::list<MotionState>::const_iterator t = data.body_transforms.begin(); t != data.body_transforms.end(); ++t)
+	{
+		positions.push_back(ToMathVector<float>(t->position));
+		rotations.push_back(ToQuaternion<float>(t->rotation));
+	}
+}
+
 std::pair <Vec3, Quat > Track::GetStart(unsigned int index) const
 {
 	assert(!data.start_positions.empty());
@@ -21,6 +21,7 @@
 #define _TRACK_H
 
 #include "roadstrip.h"
+#include "aabbbvh.h"
 #include "mathvector.h"
 #include "quaternion.h"
 #include "graphics/scenenode.h"
@@ -42,6 +43,7 @@ class ContentManager;
 class btStridingMeshInterface;
 class btCollisionShape;
 class btCollisionObject;
+struct PatchRayStats;
 
 class Track
 {
@@ -52,6 +54,9 @@ public:
 	/// Only begins loading the track.
     /// The track won't be loaded until more calls to ContinueDeferredLoad().
     /// Use Loaded() to see if loading is complete yet.
+    /// Preprocessed roads, surfaces, models and collision trees are read
+    /// from cachefile if up to date and written to it after loading.
+    /// An empty cachefile disables caching.
     /// Returns true if successful.
 	bool DeferredLoad(
 		ContentManager & content,
@@ -62,6 +67,7 @@ public:
 		const std::string & trackdir,
 		const std::string & effects_texturepath,
 		const std::string & sharedobjectpath,
+		const std::string & cachefile,
 		const int anisotropy,
 		const bool reverse,
 		const bool dynamicobjects,
@@ -83,6 +89,10 @@ public:
 
 	void Clear();
 
+	/// Cast ray against the road patches of all strips.
+	/// patch_id is the track wide id of the last patch hit, -1 if unknown.
+	/// It and its neighbours are tested first, the patch index otherwise.
+	/// The nearest hit is returned, rays are counted in stats if given.
 	bool CastRay(
 		const Vec3 & origin,
 		const Vec3 & direction,
@@ -90,11 +100,21 @@ public:
 		int & patch_id,
 		Vec3 & outtri,
 		const Bezier * & colpatch,
-		Vec3 & normal) const;
+		Vec3 & normal,
+		PatchRayStats * stats = 0) const;
+
+	/// Print road patch statistics, ray cast counts summed over the casters.
+	void debugPrint(std::ostream & out, const PatchRayStats * stats = 0) const;
 
 	/// Synchronize graphics and physics.
 	void Update();
 
+	/// Synchronize graphics with the given dynamic body transforms, see GetBodyTransforms.
+	void Update(const Vec3 positions[], const Quat rotations[]);
+
+	/// Dynamic body transforms of the last physics step, one per body.
+	void GetBodyTransforms(std::vector<Vec3> & positions, std::vector<Quat> & rotations) const;
+
 	std::pair <Vec3, Quat > GetStart(unsigned int index) const;
 
 	int GetNumStartPositions() const
@@ -171,6 +191,7 @@ private:
 		std::vector<btStridingMeshInterface*> meshes;
 		std::vector<btCollisionShape*> shapes;
 		std::vector<btCollisionObject*> objects;
+		std::vector<void*> bvhs; ///< shape bvh buffers restored from the track cache
 
 		// dynamic track objects
 		SceneNode dynamic_node;
@@ -180,6 +201,17 @@ private:
 		// road information
 		std::vector<const Bezier*> lap;
 		std::list<RoadStrip> roads;
+
+		// track wide road patch index, patch ids refer to it
+		struct PatchRef
+		{
+			const RoadPatch * patch;
+			int prev; ///< previous patch in the strip, -1 if none
+			int next; ///< next patch in the strip, -1 if none
+		};
+		std::vector<PatchRef> patches;
+		AabbBvh<unsigned, 2> patch_bvh;
+
 		std::vector<std::pair<Vec3, Quat > > start_positions;
 
 		SceneNode racingline_node;
@@ -197,6 +229,19 @@ private:
 	bool racingline_visible;
 	SceneNode empty_node;
 
+	// nearest patch hit by a ray, patches are tested as the index reports them
+	struct RayHit;
+	friend struct RayHit;
+
+	bool CastRayPatch(
+		int id,
+		const Vec3 & origin,
+		const Vec3 & direction,
+		const float seglen,
+		Vec3 & outtri,
+		const Bezier * & colpatch,
+		Vec3 & normal) const;
+
 	// temporary loading data
 	class Loader;
 	std::auto_ptr<Loader> loader;
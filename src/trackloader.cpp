@@ -25,14 +25,20 @@
 #include "k1999.h"
 #include "content/contentmanager.h"
 #include "graphics/texture.h"
-#include "graphics/model.h"
+#include "graphics/model_joe03.h"
+#include "jobsystem.h"
+#include "unittest.h"
 
 #include "BulletCollision/CollisionShapes/btBoxShape.h"
 #include "BulletCollision/CollisionShapes/btBvhTriangleMeshShape.h"
 #include "BulletCollision/CollisionShapes/btCompoundShape.h"
+#include "BulletCollision/CollisionShapes/btOptimizedBvh.h"
 #include "BulletCollision/CollisionShapes/btTriangleIndexVertexArray.h"
 #include "BulletDynamics/Dynamics/btRigidBody.h"
 
+#include <cstdio>
+#include <cstring>
+
 #define EXTBULLET
 
 static inline std::istream & operator >> (std::istream & lhs, btVector3 & rhs)
@@ -81,6 +87,165 @@ static btIndexedMesh GetIndexedMesh(const Model & model)
 	return mesh;
 }
 
+// FNV-1a
+static uint64_t Hash(const char * data, size_t size)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash = (hash ^ (unsigned char)data[i]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+static bool ReadFile(const std::string & path, std::string & data)
+{
+	std::ifstream file(path.c_str(), std::ios::binary);
+	if (!file)
+		return false;
+
+	file.seekg(0, std::ios::end);
+	const std::streamoff size = file.tellg();
+	if (size < 0)
+		return false;
+
+	data.resize(size);
+	file.seekg(0, std::ios::beg);
+	if (!data.empty())
+		file.read(&data[0], data.size());
+	return file.good();
+}
+
+// cache entries are stored in native byte order, bvhs as bullet in place
+// serialization, so they are only valid for the same platform and bullet version
+// bump the tag when an entry format or the algorithms producing cached data change
+static std::string GetCacheVersion()
+{
+	const unsigned endian = 1;
+	std::ostringstream s;
+	s << "VDRIFTTRACKCACHE03 " << int(*(const char *)&endian) << " " << sizeof(void *) << " " << BT_BULLET_VERSION;
+	return s.str();
+}
+
+// surfaces entry: surface count, type and parameters of each surface
+static void WriteSurfaces(const std::vector<TrackSurface> & surfaces, std::string & out)
+{
+	std::ostringstream s;
+	const unsigned count = surfaces.size();
+	s.write((const char *)&count, sizeof(count));
+	for (unsigned i = 0; i < count; ++i)
+	{
+		const TrackSurface & surface = surfaces[i];
+		const int type = surface.type;
+		const float params[6] = {
+			surface.bumpWaveLength, surface.bumpAmplitude,
+			surface.frictionNonTread, surface.frictionTread,
+			surface.rollResistanceCoefficient, surface.rollingDrag};
+		s.write((const char *)&type, sizeof(type));
+		s.write((const char *)params, sizeof(params));
+	}
+	out = s.str();
+}
+
+static bool ReadSurfaces(const char * data, unsigned length, std::vector<TrackSurface> & surfaces)
+{
+	std::istringstream s(std::string(data, length));
+	unsigned count = 0;
+	s.read((char *)&count, sizeof(count));
+	if (!s || count > length)
+		return false;
+
+	surfaces.resize(count);
+	for (unsigned i = 0; i < count; ++i)
+	{
+		TrackSurface & surface = surfaces[i];
+		int type = 0;
+		float params[6] = {0};
+		s.read((char *)&type, sizeof(type));
+		s.read((char *)params, sizeof(params));
+		surface.type = (type > 0 && type < TrackSurface::NumTypes) ? TrackSurface::Type(type) : TrackSurface::NONE;
+		surface.bumpWaveLength = params[0];
+		surface.bumpAmplitude = params[1];
+		surface.frictionNonTread = params[2];
+		surface.frictionTread = params[3];
+		surface.rollResistanceCoefficient = params[4];
+		surface.rollingDrag = params[5];
+	}
+	return !s.fail();
+}
+
+// model entry: face, vertex, texcoord and normal counts followed by the arrays
+static void WriteModel(const Model & model, std::string & out)
+{
+	const VertexArray & va = model.GetVertexArray();
+	const unsigned int * faces;
+	const float * vertices, * texcoords, * normals;
+	int counts[4];
+	va.GetFaces(faces, counts[0]);
+	va.GetVertices(vertices, counts[1]);
+	va.GetTexCoords(texcoords, counts[2]);
+	va.GetNormals(normals, counts[3]);
+
+	out.reserve(sizeof(counts) + (counts[0] + counts[1] + counts[2] + counts[3]) * 4);
+	out.append((const char *)counts, sizeof(counts));
+	out.append((const char *)faces, counts[0] * sizeof(unsigned int));
+	out.append((const char *)vertices, counts[1] * sizeof(float));
+	out.append((const char *)texcoords, counts[2] * sizeof(float));
+	out.append((const char *)normals, counts[3] * sizeof(float));
+}
+
+static bool ReadModel(const char * data, unsigned length, Model & model, std::ostream & error_output)
+{
+	int counts[4];
+	if (length < sizeof(counts))
+		return false;
+
+	std::memcpy(counts, data, sizeof(counts));
+	size_t size = sizeof(counts);
+	for (int i = 0; i < 4; ++i)
+	{
+		if (counts[i] < 0 || counts[i] > int(length / 4))
+			return false;
+		size += counts[i] * 4;
+	}
+	if (size != length || counts[1] == 0)
+		return false;
+
+	const unsigned int * faces = (const unsigned int *)(data + sizeof(counts));
+	const float * vertices = (const float *)(faces + counts[0]);
+	const float * texcoords = vertices + counts[1];
+	const float * normals = texcoords + counts[2];
+
+	VertexArray va;
+	va.Add(faces, counts[0], vertices, counts[1], texcoords, counts[2], normals, counts[3]);
+	return model.Load(va, error_output);
+}
+
+static void WriteBvh(btOptimizedBvh & bvh, std::string & out)
+{
+	const unsigned size = bvh.calculateSerializeBufferSize();
+	void * buffer = btAlignedAlloc(size, 16);
+	if (bvh.serializeInPlace(buffer, size, false))
+	{
+		out.assign((const char *)buffer, size);
+	}
+	btAlignedFree(buffer);
+}
+
+// buffer holds the bvh, it has to be freed after the shape using it
+static btOptimizedBvh * ReadBvh(const char * data, unsigned length, void * & buffer)
+{
+	buffer = btAlignedAlloc(length, 16);
+	std::memcpy(buffer, data, length);
+	btOptimizedBvh * bvh = btOptimizedBvh::deSerializeInPlace(buffer, length, false);
+	if (!bvh)
+	{
+		btAlignedFree(buffer);
+		buffer = 0;
+	}
+	return bvh;
+}
+
 struct Track::Loader::Object
 {
 	std::tr1::shared_ptr<Model> model;
@@ -95,6 +260,32 @@ struct Track::Loader::Object
 	bool cached;
 };
 
+struct Track::Loader::BodyLoad
+{
+	const PTree * cfg;
+	std::string name;
+	std::string model_name;
+	std::string texture_names[3];
+	TextureInfo texinfo[3];
+	std::vector<unsigned char> pixels[3];	///< decoded texture data
+	std::tr1::shared_ptr<Texture> textures[3];
+	std::tr1::shared_ptr<Model> model;
+	bool model_decoded;						///< model is not cached yet
+	bool alphablend;
+	bool doublesided;
+	Body body;
+	uint64_t model_hash;					///< model source hash, 0 if not cached
+	std::string model_cache;				///< new model cache entry
+	std::string bvh_cache;					///< new bvh cache entry
+	void * bvh_buffer;						///< bvh restored from the cache
+
+	BodyLoad() : cfg(0), model_decoded(false), alphablend(false), doublesided(false),
+		model_hash(0), bvh_buffer(0)
+	{
+		// ctor
+	}
+};
+
 Track::Loader::Loader(
 	ContentManager & content,
 	DynamicsWorld & world,
@@ -105,6 +296,7 @@ Track::Loader::Loader(
 	const std::string & trackdir,
 	const std::string & texturedir,
 	const std::string & sharedobjectpath,
+	const std::string & cachefile,
 	const int anisotropy,
 	const bool reverse,
 	const bool dynamic_objects,
@@ -121,6 +313,9 @@ Track::Loader::Loader(
 	anisotropy(anisotropy),
 	dynamic_objects(dynamic_objects),
 	dynamic_shadows(dynamic_shadows),
+	cachefile(cachefile),
+	roads_hash(0),
+	roads_cached(false),
 	packload(false),
 	numobjects(0),
 	numloaded(0),
@@ -129,6 +324,7 @@ Track::Loader::Loader(
 	min_params(14),
 	error(false),
 	list(false),
+	decode_loads(0),
 	track_shape(0)
 {
 	objectpath = trackpath + "/objects";
@@ -146,6 +342,8 @@ void Track::Loader::Clear()
 	bodies.clear();
 	objectfile.close();
 	pack.Close();
+	cache.Close();
+	cache_bake.clear();
 }
 
 bool Track::Loader::BeginLoad()
@@ -154,6 +352,8 @@ bool Track::Loader::BeginLoad()
 
 	info_output << "Loading track from path: " << trackpath << std::endl;
 
+	BeginCache();
+
 	if (!LoadSurfaces())
 	{
 		info_output << "No Surfaces File. Continuing with standard surfaces" << std::endl;
@@ -165,6 +365,8 @@ bool Track::Loader::BeginLoad()
 		data.roads.clear();
 	}
 
+	CreatePatchIndex();
+
 	if (!CreateRacingLines())
 	{
 		return false;
@@ -227,6 +429,7 @@ bool Track::Loader::ContinueLoad()
 		data.shapes.push_back(track_shape);
 		track_shape = 0;
 #endif
+		WriteCache();
 		data.loaded = true;
 		Clear();
 	}
@@ -234,6 +437,105 @@ bool Track::Loader::ContinueLoad()
 	return true;
 }
 
+bool Track::Loader::BeginCache()
+{
+	if (cachefile.empty() || !cache.Load(cachefile))
+	{
+		return false;
+	}
+
+	const char * version;
+	unsigned length;
+	if (!cache.GetFile("version", version, length) || std::string(version, length) != GetCacheVersion())
+	{
+		cache.Close();
+		return false;
+	}
+
+	info_output << "Loading track cache: " << cachefile << std::endl;
+	return true;
+}
+
+void Track::Loader::WriteCache()
+{
+	if (cache_bake.empty())
+	{
+		return;
+	}
+
+	// keep the old entries, other track directions or objects may use them
+	std::vector<std::string> names;
+	cache.GetFileNames(names);
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		const char * entry;
+		unsigned length;
+		if (names[i] != "version" && cache_bake.find(names[i]) == cache_bake.end() &&
+			cache.GetFile(names[i], entry, length))
+		{
+			cache_bake[names[i]].assign(entry, length);
+		}
+	}
+	cache.Close();
+
+	std::vector<std::pair<std::string, std::string> > files(1);
+	files.reserve(cache_bake.size() + 1);
+	files[0].first = "version";
+	files[0].second = GetCacheVersion();
+	for (std::map<std::string, std::string>::iterator i = cache_bake.begin(); i != cache_bake.end(); ++i)
+	{
+		files.push_back(std::make_pair(i->first, std::string()));
+		files.back().second.swap(i->second);
+	}
+	cache_bake.clear();
+
+	// replace the cache file only if writing succeeded
+	const std::string tempfile = cachefile + ".tmp";
+	if (JoePack::Write(tempfile, files))
+	{
+		std::remove(cachefile.c_str());
+		if (std::rename(tempfile.c_str(), cachefile.c_str()) == 0)
+		{
+			info_output << "Wrote track cache: " << cachefile << std::endl;
+			return;
+		}
+	}
+	std::remove(tempfile.c_str());
+	error_output << "Failed to write track cache: " << cachefile << std::endl;
+}
+
+bool Track::Loader::GetCacheEntry(const std::string & name, uint64_t hash, const char * & data, unsigned & length) const
+{
+	uint64_t entry_hash;
+	if (!cache.GetFile(name, data, length) || length < sizeof(entry_hash))
+	{
+		return false;
+	}
+
+	std::memcpy(&entry_hash, data, sizeof(entry_hash));
+	if (entry_hash != hash)
+	{
+		return false;
+	}
+
+	data += sizeof(entry_hash);
+	length -= sizeof(entry_hash);
+	return true;
+}
+
+void Track::Loader::AddCacheEntry(const std::string & name, uint64_t hash, const std::string & data)
+{
+	if (cachefile.empty())
+	{
+		return;
+	}
+
+	std::string & entry = cache_bake[name];
+	entry.reserve(sizeof(hash) + data.length());
+	entry.assign((const char *)&hash, sizeof(hash));
+	entry.append(data);
+}
+
 bool Track::Loader::BeginObjectLoad()
 {
 #ifndef EXTBULLET
@@ -299,23 +601,52 @@ std::pair<bool, bool> Track::Loader::Continue()
 		return std::make_pair(false, false);
 	}
 
-	if (!LoadNode(node_it->second))
+	// load a batch of nodes per call, new bodies are decoded in parallel
+	const int batch_size = 8 * JobSystem::instance().GetThreadCount();
+	std::vector<std::pair<const PTree *, std::string> > batch;
+	std::vector<BodyLoad> loads;
+	std::set<std::string> names;
+	for (int i = 0; i < batch_size && node_it != nodes->end(); ++i, ++node_it, ++numloaded)
 	{
-		return std::make_pair(true, false);
+		const PTree * sec_body;
+		if (!node_it->second.get("body", sec_body, error_output))
+		{
+			return std::make_pair(true, false);
+		}
+
+		BodyLoad load;
+		if (!ParseBody(*sec_body, load))
+		{
+			continue;
+		}
+
+		batch.push_back(std::make_pair(&node_it->second, load.name));
+		if (bodies.find(load.name) == bodies.end() && names.insert(load.name).second)
+		{
+			loads.push_back(load);
+		}
 	}
 
-	node_it++;
+	LoadBodies(loads);
+
+	for (size_t i = 0; i < batch.size(); ++i)
+	{
+		body_iterator ib = bodies.find(batch[i].second);
+		if (ib != bodies.end())
+		{
+			LoadNode(*batch[i].first, ib->second);
+		}
+	}
 
 	return std::make_pair(false, true);
 }
 
-bool Track::Loader::LoadShape(const PTree & cfg, const Model & model, Body & body)
+bool Track::Loader::LoadShape(const PTree & cfg, const Model & model, Body & body, btOptimizedBvh * bvh)
 {
 	if (body.mass < 1E-3)
 	{
 		btTriangleIndexVertexArray * mesh = new btTriangleIndexVertexArray();
 		mesh->addIndexedMesh(GetIndexedMesh(model));
-		data.meshes.push_back(mesh);
 		body.mesh = mesh;
 
 		int surface = 0;
@@ -325,9 +656,17 @@ bool Track::Loader::LoadShape(const PTree & cfg, const Model & model, Body & bod
 			surface = 0;
 		}
 
-		btBvhTriangleMeshShape * shape = new btBvhTriangleMeshShape(mesh, true);
+		btBvhTriangleMeshShape * shape;
+		if (bvh)
+		{
+			shape = new btBvhTriangleMeshShape(mesh, true, false);
+			shape->setOptimizedBvh(bvh);
+		}
+		else
+		{
+			shape = new btBvhTriangleMeshShape(mesh, true);
+		}
 		shape->setUserPointer((void*)&data.surfaces[surface]);
-		data.shapes.push_back(shape);
 		body.shape = shape;
 	}
 	else
@@ -352,7 +691,6 @@ bool Track::Loader::LoadShape(const PTree & cfg, const Model & model, Body & bod
 		{
 			shape = compound;
 		}
-		data.shapes.push_back(shape);
 
 		shape->calculateLocalInertia(body.mass, body.inertia);
 		body.shape = shape;
@@ -362,26 +700,24 @@ bool Track::Loader::LoadShape(const PTree & cfg, const Model & model, Body & bod
 	return true;
 }
 
-Track::Loader::body_iterator Track::Loader::LoadBody(const PTree & cfg)
+bool Track::Loader::ParseBody(const PTree & cfg, BodyLoad & load) const
 {
-	Body body;
 	std::string texture_str;
-	std::string model_name;
 	int clampuv = 0;
 	bool mipmap = true;
-	bool alphablend = false;
-	bool doublesided = false;
 	bool isashadow = false;
 
+	load.cfg = &cfg;
 	cfg.get("texture", texture_str, error_output);
-	cfg.get("model", model_name, error_output);
+	cfg.get("model", load.model_name, error_output);
 	cfg.get("clampuv", clampuv);
 	cfg.get("mipmap", mipmap);
-	cfg.get("alphablend", alphablend);
-	cfg.get("doublesided", doublesided);
+	cfg.get("alphablend", load.alphablend);
+	cfg.get("doublesided", load.doublesided);
 	cfg.get("isashadow", isashadow);
-	cfg.get("skybox", body.skybox);
-	cfg.get("nolighting", body.nolighting);
+	cfg.get("skybox", load.body.skybox);
+	cfg.get("nolighting", load.body.nolighting);
+	load.body.collidable = cfg.get("mass", load.body.mass);
 
 	std::vector<std::string> texture_names(3);
 	std::istringstream s(texture_str);
@@ -389,19 +725,18 @@ Track::Loader::body_iterator Track::Loader::LoadBody(const PTree & cfg)
 
 	// set relative path for models and textures, ugly hack
 	// need to identify body references
-	std::string name;
 	if (cfg.value() == "body" && cfg.parent())
 	{
-		name = cfg.parent()->value();
+		load.name = cfg.parent()->value();
 	}
 	else
 	{
-		name = cfg.value();
-		size_t npos = name.rfind("/");
-		if (npos < name.length())
+		load.name = cfg.value();
+		size_t npos = load.name.rfind("/");
+		if (npos < load.name.length())
 		{
-			std::string rel_path = name.substr(0, npos+1);
-			model_name = rel_path + model_name;
+			std::string rel_path = load.name.substr(0, npos+1);
+			load.model_name = rel_path + load.model_name;
 			texture_names[0] = rel_path + texture_names[0];
 			if (!texture_names[1].empty())
 				texture_names[1] = rel_path + texture_names[1];
@@ -410,65 +745,211 @@ Track::Loader::body_iterator Track::Loader::LoadBody(const PTree & cfg)
 		}
 	}
 
-	if (dynamic_shadows && isashadow)
+	TextureInfo texinfo;
+	texinfo.mipmap = mipmap || anisotropy; //always mipmap if anisotropy is on
+	texinfo.anisotropy = anisotropy;
+	texinfo.repeatu = clampuv != 1 && clampuv != 2;
+	texinfo.repeatv = clampuv != 1 && clampuv != 3;
+	for (int i = 0; i < 3; ++i)
 	{
-		return bodies.end();
+		load.texture_names[i] = texture_names[i];
+		load.texinfo[i] = texinfo;
 	}
+	load.texinfo[2].compress = false;
 
-	std::tr1::shared_ptr<Model> model;
-	if ((packload && content.load(model, objectdir, model_name, pack)) ||
-		content.load(model, objectdir, model_name))
+	return !(dynamic_shadows && isashadow);
+}
+
+void Track::Loader::LoadBodies(std::vector<BodyLoad> & loads)
+{
+	// look up cached content first, decode the rest on the job threads
+	const Factory<Texture> & texture_factory = content.getFactory<Texture>();
+	for (size_t i = 0; i < loads.size(); ++i)
 	{
-		data.models.insert(model);
+		BodyLoad & load = loads[i];
+		content.get(load.model, objectdir, load.model_name);
+		for (int j = 0; j < 3; ++j)
+		{
+			if (load.texture_names[j].empty())
+				continue;
+
+			if (texture_factory.isHeadless())
+				load.textures[j] = texture_factory.getDefault();
+			else
+				content.get(load.textures[j], objectdir, load.texture_names[j]);
+		}
 	}
-	else
+
+	decode_loads = &loads;
+	JobSystem::instance().Run(DecodeBodies, this, 0, loads.size(), 1);
+	decode_loads = 0;
+
+	for (size_t i = 0; i < loads.size(); ++i)
 	{
-		info_output << "Failed to load body " << cfg.value() << " model " << model_name << std::endl;
-		return bodies.end();
+		InsertBody(loads[i]);
 	}
+}
 
-	body.collidable = cfg.get("mass", body.mass);
-	if (body.collidable)
+void Track::Loader::DecodeBodies(void * loader, int begin, int end)
+{
+	Loader & l = *static_cast<Loader*>(loader);
+	for (int i = begin; i < end; ++i)
 	{
-		LoadShape(cfg, *model, body);
+		l.DecodeBody((*l.decode_loads)[i]);
 	}
+}
 
-	// load textures
-	std::tr1::shared_ptr<Texture> tex[3];
-	TextureInfo texinfo;
-	texinfo.mipmap = mipmap || anisotropy; //always mipmap if anisotropy is on
-	texinfo.anisotropy = anisotropy;
-	texinfo.repeatu = clampuv != 1 && clampuv != 2;
-	texinfo.repeatv = clampuv != 1 && clampuv != 3;
-	content.load(tex[0], objectdir, texture_names[0], texinfo);
-	if (!texture_names[1].empty())
+void Track::Loader::DecodeBody(BodyLoad & load)
+{
+	// model source, a view into the pack or the file data
+	const bool static_shape = load.body.collidable && load.body.mass < 1E-3;
+	const char * source = 0;
+	unsigned source_length = 0;
+	std::string source_file;
+	if (!load.model || (static_shape && !cachefile.empty()))
+	{
+		if (!(packload && pack.GetFile(load.model_name, source, source_length)) &&
+			ReadFile(objectpath + "/" + load.model_name, source_file))
+		{
+			source = source_file.data();
+			source_length = source_file.length();
+		}
+		if (source && !cachefile.empty())
+		{
+			load.model_hash = Hash(source, source_length);
+		}
+	}
+
+	const char * cached;
+	unsigned cached_length;
+	if (!load.model && source)
 	{
-		content.load(tex[1], objectdir, texture_names[1], texinfo);
-		data.textures.insert(tex[1]);
+		// failures are reported by the content manager fallback in InsertBody
+		std::ostringstream error;
+		std::tr1::shared_ptr<Model> model;
+		if (load.model_hash && GetCacheEntry("model/" + load.model_name, load.model_hash, cached, cached_length))
+		{
+			model.reset(new Model());
+			if (!ReadModel(cached, cached_length, *model, error))
+			{
+				model.reset();
+			}
+		}
+		if (!model)
+		{
+			std::tr1::shared_ptr<ModelJoe03> joe(new ModelJoe03());
+			if (joe->LoadFromMemory(source, source_length, error))
+			{
+				model = joe;
+				if (load.model_hash)
+				{
+					WriteModel(*model, load.model_cache);
+				}
+			}
+		}
+		if (model)
+		{
+			load.model = model;
+			load.model_decoded = true;
+		}
 	}
-	else
+
+	for (int i = 0; i < 3; ++i)
 	{
-		tex[1] = content.getFactory<Texture>().getZero();
+		if (!load.textures[i] && !load.texture_names[i].empty())
+		{
+			Texture::Decode(objectpath + "/" + load.texture_names[i], load.texinfo[i], load.pixels[i]);
+		}
 	}
-	if (!texture_names[2].empty())
+
+	// static mesh bvh construction, dynamic shapes are created in InsertBody
+	if (load.model && static_shape)
 	{
-		texinfo.compress = false;
-		content.load(tex[2], objectdir, texture_names[2], texinfo);
-		data.textures.insert(tex[2]);
+		btOptimizedBvh * bvh = 0;
+		if (load.model_hash && GetCacheEntry("bvh/" + load.model_name, load.model_hash, cached, cached_length))
+		{
+			bvh = ReadBvh(cached, cached_length, load.bvh_buffer);
+		}
+
+		LoadShape(*load.cfg, *load.model, load.body, bvh);
+
+		if (!bvh && load.model_hash)
+		{
+			btBvhTriangleMeshShape * shape = static_cast<btBvhTriangleMeshShape *>(load.body.shape);
+			WriteBvh(*shape->getOptimizedBvh(), load.bvh_cache);
+		}
 	}
-	else
+}
+
+void Track::Loader::InsertBody(BodyLoad & load)
+{
+	if (load.bvh_buffer)
+	{
+		data.bvhs.push_back(load.bvh_buffer);
+	}
+	if (!load.model_cache.empty())
+	{
+		AddCacheEntry("model/" + load.model_name, load.model_hash, load.model_cache);
+	}
+	if (!load.bvh_cache.empty())
+	{
+		AddCacheEntry("bvh/" + load.model_name, load.model_hash, load.bvh_cache);
+	}
+
+	if (load.model_decoded)
+	{
+		content.set(load.model, objectdir, load.model_name);
+	}
+	else if (!load.model && !(
+		(packload && content.load(load.model, objectdir, load.model_name, pack)) ||
+		content.load(load.model, objectdir, load.model_name)))
+	{
+		info_output << "Failed to load body " << load.cfg->value() << " model " << load.model_name << std::endl;
+		return;
+	}
+	data.models.insert(load.model);
+
+	Body & body = load.body;
+	if (body.collidable)
 	{
-		tex[2] = content.getFactory<Texture>().getZero();
+		if (!body.shape)
+		{
+			LoadShape(*load.cfg, *load.model, body);
+		}
+		if (body.mesh)
+		{
+			data.meshes.push_back(body.mesh);
+		}
+		data.shapes.push_back(body.shape);
+	}
+
+	// create textures, decoded data is uploaded from texinfo
+	for (int i = 0; i < 3; ++i)
+	{
+		if (load.textures[i])
+		{
+			continue;
+		}
+		if (i > 0 && load.texture_names[i].empty())
+		{
+			load.textures[i] = content.getFactory<Texture>().getZero();
+			continue;
+		}
+		content.load(load.textures[i], objectdir, load.texture_names[i], load.texinfo[i]);
+		if (i > 0)
+		{
+			data.textures.insert(load.textures[i]);
+		}
 	}
 
 	// setup drawable
 	Drawable & drawable = body.drawable;
-	drawable.SetModel(*model);
-	drawable.SetTextures(tex[0]->GetId(), tex[1]->GetId(), tex[2]->GetId());
-	drawable.SetDecal(alphablend);
-	drawable.SetCull(data.cull && !doublesided);
+	drawable.SetModel(*load.model);
+	drawable.SetTextures(load.textures[0]->GetId(), load.textures[1]->GetId(), load.textures[2]->GetId());
+	drawable.SetDecal(load.alphablend);
+	drawable.SetCull(data.cull && !load.doublesided);
 
-	return bodies.insert(std::make_pair(name, body)).first;
+	bodies.insert(std::make_pair(load.name, body));
 }
 
 void Track::Loader::AddBody(SceneNode & scene, const Body & body)
@@ -501,26 +982,12 @@ void Track::Loader::AddBody(SceneNode & scene, const Body & body)
 	dlist->insert(body.drawable);
 }
 
-bool Track::Loader::LoadNode(const PTree & sec)
+void Track::Loader::LoadNode(const PTree & sec, const Body & body)
 {
-	const PTree * sec_body;
-	if (!sec.get("body", sec_body, error_output))
-	{
-		return false;
-	}
-
-	body_iterator ib = LoadBody(*sec_body);
-	if (ib == bodies.end())
-	{
-		//info_output << "Object " << sec.value() << " failed to load body" << std::endl;
-		return true;
-	}
-
 	Vec3 position, angle;
 	bool has_transform = sec.get("position",  position) | sec.get("rotation", angle);
 	Quat rotation(angle[0]/180*M_PI, angle[1]/180*M_PI, angle[2]/180*M_PI);
 
-	const Body & body = ib->second;
 	if (body.mass < 1E-3)
 	{
 		// static geometry
@@ -611,8 +1078,6 @@ bool Track::Loader::LoadNode(const PTree & sec)
 			AddBody(node, body);
 		}
 	}
-
-	return true;
 }
 
 /// read from the file stream and put it in "output".
@@ -782,6 +1247,7 @@ std::pair<bool, bool> Track::Loader::ContinueOld()
 	{
 		return std::make_pair(false, false);
 	}
+	numloaded++;
 
 	Object object;
 	bool isashadow;
@@ -842,13 +1308,25 @@ std::pair<bool, bool> Track::Loader::ContinueOld()
 bool Track::Loader::LoadSurfaces()
 {
 	std::string path = trackpath + "/surfaces.txt";
-	std::ifstream file(path.c_str());
-	if (!file.good())
+	std::string surfaces;
+	if (!ReadFile(path, surfaces))
 	{
 		info_output << "Can't find surfaces configfile: " << path << std::endl;
 		return false;
 	}
 
+	const uint64_t hash = Hash(surfaces.data(), surfaces.length());
+	const char * cached;
+	unsigned cached_length;
+	if (GetCacheEntry("surfaces", hash, cached, cached_length) &&
+		ReadSurfaces(cached, cached_length, data.surfaces))
+	{
+		info_output << "Loaded surfaces from cache, " << data.surfaces.size() << " surfaces." << std::endl;
+		return true;
+	}
+	data.surfaces.clear();
+
+	std::istringstream file(surfaces);
 	PTree param;
 	read_ini(file, param);
 	for (PTree::const_iterator is = param.begin(); is != param.end(); ++is)
@@ -890,6 +1368,11 @@ bool Track::Loader::LoadSurfaces()
 		surf_cfg.get("RollingDrag", temp, error_output);
 		surface.rollingDrag = temp;
 	}
+
+	std::string entry;
+	WriteSurfaces(data.surfaces, entry);
+	AddCacheEntry("surfaces", hash, entry);
+
 	info_output << "Loaded surfaces file, " << data.surfaces.size() << " surfaces." << std::endl;
 
 	return true;
@@ -900,13 +1383,36 @@ bool Track::Loader::LoadRoads()
 	data.roads.clear();
 
 	std::string roadpath = trackpath + "/roads.trk";
-	std::ifstream trackfile(roadpath.c_str());
-	if (!trackfile.good())
+	std::string roads;
+	if (!ReadFile(roadpath, roads))
 	{
 		error_output << "Error opening roads file: " << trackpath + "/roads.trk" << std::endl;
 		return false;
 	}
 
+	// cached roads include the racing lines, see CreateRacingLines
+	roads_hash = Hash(roads.data(), roads.length());
+	const char * cached;
+	unsigned cached_length;
+	if (GetCacheEntry(data.reverse ? "roads-reverse" : "roads", roads_hash, cached, cached_length))
+	{
+		std::istringstream s(std::string(cached, cached_length));
+		unsigned numroads = 0;
+		s.read((char *)&numroads, sizeof(numroads));
+		roads_cached = !s.fail();
+		for (unsigned i = 0; i < numroads && roads_cached; ++i)
+		{
+			data.roads.push_back(RoadStrip());
+			roads_cached = data.roads.back().ReadBinary(s);
+		}
+		if (roads_cached)
+		{
+			return true;
+		}
+		data.roads.clear();
+	}
+
+	std::istringstream trackfile(roads);
 	int numroads = 0;
 	trackfile >> numroads;
 	for (int i = 0; i < numroads && trackfile; ++i)
@@ -918,16 +1424,81 @@ bool Track::Loader::LoadRoads()
 	return true;
 }
 
+void Track::Loader::CreatePatchIndex()
+{
+	data.patches.clear();
+	data.patch_bvh.Clear();
+
+	for (std::list <RoadStrip>::const_iterator i = data.roads.begin(); i != data.roads.end(); ++i)
+	{
+		const std::vector<RoadPatch> & patches = i->GetPatches();
+		const int first = data.patches.size();
+		const int n = patches.size();
+		for (int j = 0; j < n; ++j)
+		{
+			Data::PatchRef ref;
+			ref.patch = &patches[j];
+			ref.prev = (j > 0) ? first + j - 1 : -1;
+			ref.next = (j + 1 < n) ? first + j + 1 : -1;
+			if (i->GetClosed() && n > 1)
+			{
+				if (j == 0) ref.prev = first + n - 1;
+				if (j == n - 1) ref.next = first;
+			}
+			data.patch_bvh.Add(data.patches.size(), patches[j].GetPatch().GetAABB());
+			data.patches.push_back(ref);
+		}
+	}
+	data.patch_bvh.Optimize();
+}
+
+static void CalcRacingLines(void * strips, int begin, int end)
+{
+	std::vector<std::pair<RoadStrip *, bool> > & s = *static_cast<std::vector<std::pair<RoadStrip *, bool> > *>(strips);
+	for (int i = begin; i < end; ++i)
+	{
+		K1999 k1999data;
+		s[i].second = k1999data.LoadData(*s[i].first);
+		if (s[i].second)
+		{
+			k1999data.CalcRaceLine();
+			k1999data.UpdateRoadStrip(*s[i].first);
+		}
+	}
+}
+
 bool Track::Loader::CreateRacingLines()
 {
-	K1999 k1999data;
+	// strips are independent, racing line drawables are created on the main thread
+	std::vector<std::pair<RoadStrip *, bool> > strips;
 	for (std::list <RoadStrip>::iterator i = data.roads.begin(); i != data.roads.end(); ++i)
 	{
-		if (k1999data.LoadData(*i))
+		bool cached = roads_cached && !i->GetPatches().empty() && i->GetPatches()[0].GetPatch().HasRacingline();
+		strips.push_back(std::make_pair(&*i, cached));
+	}
+
+	if (!roads_cached)
+	{
+		JobSystem::instance().Run(CalcRacingLines, &strips, 0, strips.size(), 1);
+
+		if (roads_hash)
 		{
-			k1999data.CalcRaceLine();
-			k1999data.UpdateRoadStrip(*i);
-			CreateRacingLine(*i);
+			std::ostringstream s;
+			const unsigned numroads = strips.size();
+			s.write((const char *)&numroads, sizeof(numroads));
+			for (size_t i = 0; i < strips.size(); ++i)
+			{
+				strips[i].first->WriteBinary(s);
+			}
+			AddCacheEntry(data.reverse ? "roads-reverse" : "roads", roads_hash, s.str());
+		}
+	}
+
+	for (size_t i = 0; i < strips.size(); ++i)
+	{
+		if (strips[i].second)
+		{
+			CreateRacingLine(*strips[i].first);
 		}
 	}
 	return true;
@@ -1179,3 +1750,95 @@ bool Track::Loader::LoadLapSections(const PTree & info)
 	info_output << "Track timing sectors: " << lapmarkers << std::endl;
 	return true;
 }
+
+// counts the triangles of the bvh leaves overlapping a ray
+struct TriangleCount : public btNodeOverlapCallback
+{
+	int count;
+	TriangleCount() : count(0) {}
+	void processNode(int /*subpart*/, int /*triangle*/) { ++count; }
+};
+
+QT_TEST(trackloader_cache_test)
+{
+	// surfaces
+	{
+		std::vector<TrackSurface> surfaces(2);
+		surfaces[0].type = TrackSurface::ASPHALT;
+		surfaces[0].frictionTread = 0.9f;
+		surfaces[1].type = TrackSurface::GRAVEL;
+		surfaces[1].bumpWaveLength = 2.5f;
+		surfaces[1].bumpAmplitude = 0.1f;
+		surfaces[1].frictionNonTread = 0.6f;
+		surfaces[1].frictionTread = 0.7f;
+		surfaces[1].rollResistanceCoefficient = 0.01f;
+		surfaces[1].rollingDrag = 40.0f;
+
+		std::string data;
+		WriteSurfaces(surfaces, data);
+		std::vector<TrackSurface> read;
+		QT_CHECK(ReadSurfaces(data.data(), data.size(), read));
+		QT_CHECK_EQUAL(read.size(), surfaces.size());
+		for (size_t i = 0; i < read.size() && i < surfaces.size(); ++i)
+		{
+			QT_CHECK_EQUAL(read[i].type, surfaces[i].type);
+			QT_CHECK_EQUAL(read[i].bumpWaveLength, surfaces[i].bumpWaveLength);
+			QT_CHECK_EQUAL(read[i].bumpAmplitude, surfaces[i].bumpAmplitude);
+			QT_CHECK_EQUAL(read[i].frictionNonTread, surfaces[i].frictionNonTread);
+			QT_CHECK_EQUAL(read[i].frictionTread, surfaces[i].frictionTread);
+			QT_CHECK_EQUAL(read[i].rollResistanceCoefficient, surfaces[i].rollResistanceCoefficient);
+			QT_CHECK_EQUAL(read[i].rollingDrag, surfaces[i].rollingDrag);
+		}
+		QT_CHECK(!ReadSurfaces(data.data(), data.size() - 1, read));
+	}
+
+	// model
+	{
+		std::ostringstream error;
+		VertexArray va;
+		va.SetToUnitCube();
+		Model model;
+		model.Load(va, error);
+
+		std::string data;
+		WriteModel(model, data);
+		Model read;
+		QT_CHECK(ReadModel(data.data(), data.size(), read, error));
+
+		std::string reread;
+		WriteModel(read, reread);
+		QT_CHECK(reread == data);
+		QT_CHECK(!ReadModel(data.data(), data.size() - 4, read, error));
+	}
+
+	// bvh, two triangles of a unit quad in the xy plane
+	{
+		int indices[] = {0, 1, 2, 0, 2, 3};
+		btScalar vertices[] = {0, 0, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0};
+		btTriangleIndexVertexArray mesh(2, indices, 3 * sizeof(int), 4, vertices, 3 * sizeof(btScalar));
+		btBvhTriangleMeshShape shape(&mesh, true);
+
+		std::string data;
+		WriteBvh(*shape.getOptimizedBvh(), data);
+		QT_CHECK(!data.empty());
+
+		void * buffer = 0;
+		btOptimizedBvh * bvh = ReadBvh(data.data(), data.size(), buffer);
+		QT_CHECK(bvh);
+		if (bvh)
+		{
+			// rays through one, both and no triangle hit the same leaves
+			const btVector3 from[] = {btVector3(0.9, 0.1, 1), btVector3(0.5, 0.5, 1), btVector3(2, 2, 1)};
+			for (int i = 0; i < 3; ++i)
+			{
+				const btVector3 to = from[i] - btVector3(0, 0, 2);
+				TriangleCount expected, restored;
+				shape.getOptimizedBvh()->reportRayOverlappingNodex(&expected, from[i], to);
+				bvh->reportRayOverlappingNodex(&restored, from[i], to);
+				QT_CHECK_EQUAL(restored.count, expected.count);
+			}
+			QT_CHECK_EQUAL(bvh->isQuantized(), shape.getOptimizedBvh()->isQuantized());
+			btAlignedFree(buffer);
+		}
+	}
+}
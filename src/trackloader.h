@@ -24,6 +24,8 @@
 #include "cfg/ptree.h"
 #include "joepack.h"
 
+#include <stdint.h>
+
 /*
 [object.foo]
 #position = 0, 0, 0
@@ -50,6 +52,7 @@ class ContentManager;
 class btStridingMeshInterface;
 class btCompoundShape;
 class btCollisionShape;
+class btOptimizedBvh;
 class PTree;
 
 class Track::Loader
@@ -65,6 +68,7 @@ public:
 		const std::string & trackdir,
 		const std::string & texturedir,
 		const std::string & sharedobjectpath,
+		const std::string & cachefile,
 		const int anisotropy,
 		const bool reverse,
 		const bool dynamic_shadows,
@@ -94,6 +98,13 @@ private:
 	const int anisotropy;
 	const bool dynamic_objects;
 	const bool dynamic_shadows;
+	const std::string cachefile;
+
+	// binary track cache, entries start with the hash of their source data
+	JoePack cache;
+	std::map<std::string, std::string> cache_bake; ///< new entries, written after loading
+	uint64_t roads_hash;
+	bool roads_cached;
 
 	std::string objectpath;
 	std::string objectdir;
@@ -130,6 +141,10 @@ private:
 	typedef std::map<std::string, Body>::const_iterator body_iterator;
 	std::map<std::string, Body> bodies;
 
+	// body model and textures, decoded by the job threads
+	struct BodyLoad;
+	std::vector<BodyLoad> * decode_loads;
+
 	// compound track shape
 	btCompoundShape * track_shape;
 
@@ -138,10 +153,24 @@ private:
 	const PTree * nodes;
 	PTree::const_iterator node_it;
 
+	/// open the track cache, false if missing or from another version
+	bool BeginCache();
+
+	/// write new entries and the old ones not replaced by them
+	void WriteCache();
+
+	/// view of the entry data past the hash, false if missing or outdated
+	bool GetCacheEntry(const std::string & name, uint64_t hash, const char * & data, unsigned & length) const;
+
+	void AddCacheEntry(const std::string & name, uint64_t hash, const std::string & data);
+
 	bool LoadSurfaces();
 
 	bool LoadRoads();
 
+	/// Build the track wide road patch index used by Track::CastRay.
+	void CreatePatchIndex();
+
 	bool CreateRacingLines();
 
 	void CreateRacingLine(const RoadStrip & strip);
@@ -164,11 +193,24 @@ private:
 
 	void CalculateNumOld();
 
-	bool LoadNode(const PTree & sec);
+	void LoadNode(const PTree & sec, const Body & body);
+
+	/// static shapes use bvh if not null, it is built otherwise
+	bool LoadShape(const PTree & body_cfg, const Model & body_model, Body & body, btOptimizedBvh * bvh = 0);
+
+	/// false if the body is not used
+	bool ParseBody(const PTree & cfg, BodyLoad & load) const;
+
+	/// decode uncached content and build static shapes in parallel
+	void LoadBodies(std::vector<BodyLoad> & loads);
+
+	/// job thread part, no graphics or content manager access
+	void DecodeBody(BodyLoad & load);
 
-	bool LoadShape(const PTree & body_cfg, const Model & body_model, Body & body);
+	static void DecodeBodies(void * loader, int begin, int end);
 
-	body_iterator LoadBody(const PTree & cfg);
+	/// main thread part, create textures and insert the body
+	void InsertBody(BodyLoad & load);
 
 	void AddBody(SceneNode & scene, const Body & body);
 